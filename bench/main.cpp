@@ -0,0 +1,888 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "Accelerator.h"
+#include "Bvh.h"
+#include "CpuRenderer.h"
+#include "Denoiser.h"
+#include "EnvironmentMap.h"
+#include "InstanceBvh.h"
+#include "Lights.h"
+#include "PagedBvh.h"
+#include "ProceduralScenes.h"
+#include "Random.h"
+#include "SceneCache.h"
+#include "Shading.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+#include "WavefrontRenderer.h"
+
+// Render benchmark over procedurally generated canonical scenes. Measures BVH construction, ray
+// throughput for primary, incoherent and shadow rays, path samples per second and peak memory per
+// scene, and writes the results as JSON for tracking regressions across commits.
+
+struct BenchOptions
+{
+	std::string output = "ptgpu_bench.json";
+	std::vector<std::string> scenes;
+	uint32_t threads = 0;
+	// Smaller scenes for quick local runs; CI should use the default sizes.
+	bool quick = false;
+	uint32_t width = 640;
+	uint32_t height = 360;
+	// Ray batches are traced this many times and the fastest run is reported.
+	uint32_t repeats = 3;
+	uint32_t passes = 4;
+	// Animation frames followed through BVH updates.
+	uint32_t frames = 8;
+};
+
+struct SceneCase
+{
+	const char* name;
+	std::function<Scene(bool quick)> make;
+};
+
+const SceneCase SceneCases[] = {
+	{"cornell", [](bool) { return makeCornellBox(); }},
+	{"sphereflake", [](bool quick) { return makeSphereFlake(quick ? 3 : 4); }},
+	{"forest", [](bool quick) { return makeForest(quick ? 1000 : 10000); }},
+	{"terrain", [](bool quick) { return makeTerrain(quick ? 256 : 1024); }},
+	{"city", [](bool quick) { return makeCity(quick ? 12 : 32); }},
+};
+
+struct RayResult
+{
+	uint64_t rays = 0;
+	uint64_t hits = 0;
+	double seconds = 0.0;
+
+	double mraysPerSecond() const { return seconds > 0.0 ? rays / seconds / 1e6 : 0.0; }
+};
+
+// Ray throughput of one traversal layout.
+struct TraversalResult
+{
+	std::string name;
+	double buildSeconds = 0.0;
+	size_t bytes = 0;
+	RayResult primary;
+	RayResult incoherent;
+	RayResult shadow;
+	// The primary and shadow rays again, traced as packets of neighbouring pixels.
+	RayResult primaryPacket;
+	RayResult shadowPacket;
+};
+
+struct WavefrontResult
+{
+	double samplesPerSecond = 0.0;
+	double extendSeconds = 0.0;
+	double sortSeconds = 0.0;
+};
+
+// Wavefront passes with the geometry paged in from a scene cache and a quarter of it resident.
+struct PagedResult
+{
+	double samplesPerSecond = 0.0;
+	size_t pageDataBytes = 0;
+	size_t budgetBytes = 0;
+	PageStats pages;
+};
+
+// Tile renderer passes with the diffuse materials textured, and an eighth of the texture's tiles
+// allowed to be resident.
+struct TexturedResult
+{
+	double samplesPerSecond = 0.0;
+	size_t budgetBytes = 0;
+	TextureStats textures;
+};
+
+// Scenes lit by emissive triangles: the light tree build, and tile renderer passes with the lights
+// picked by area rather than by the tree.
+struct LightResult
+{
+	uint32_t lights = 0;
+	double treeSeconds = 0.0;
+	double areaSamplesPerSecond = 0.0;
+};
+
+// Scenes under a sky: the sampling tables of a lat-long map of a sky with a sun, and tile renderer
+// passes lit by it.
+struct EnvironmentResult
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	double buildSeconds = 0.0;
+	double samplesPerSecond = 0.0;
+};
+
+// The preview denoiser over the image of the tile renderer passes, fastest of the repeats.
+struct DenoiseResult
+{
+	std::string kernel;
+	double seconds = 0.0;
+};
+
+struct SceneResult
+{
+	std::string name;
+	uint32_t triangles = 0;
+	uint32_t instances = 0;
+	double sceneSeconds = 0.0;
+	BvhBuildStats bvh;
+	TraversalResult traversal;
+	// The same rays through the compressed wide layout, for comparing footprint and throughput.
+	TraversalResult compressed;
+	double samplesPerSecond = 0.0;
+	// Wavefront passes without and with secondary ray sorting; extend covers the secondary bounces.
+	WavefrontResult wavefront;
+	WavefrontResult sortedWavefront;
+	PagedResult paged;
+	TexturedResult textured;
+	LightResult lights;
+	EnvironmentResult environment;
+	DenoiseResult denoise;
+	double updateSeconds = 0.0;
+	uint32_t updateRebuiltSubtrees = 0;
+	uint32_t updateFullRebuilds = 0;
+	float updateSahGrowth = 1.0f;
+	size_t peakResidentBytes = 0;
+};
+
+void printUsage()
+{
+	std::cerr << "Usage: ptgpu_bench [--output results.json] [--scenes cornell,sphereflake,forest,terrain,city] [--threads count]\n"
+		"                   [--quick] [--resolution WxH] [--repeats count] [--passes count] [--frames count]" << std::endl;
+}
+
+BenchOptions parseOptions(int argc, char** argv)
+{
+	BenchOptions options;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+		{
+			options.output = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--scenes") == 0 && i + 1 < argc)
+		{
+			std::stringstream list(argv[++i]);
+			std::string name;
+			while (std::getline(list, name, ','))
+			{
+				options.scenes.push_back(name);
+			}
+		}
+		else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			options.threads = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--quick") == 0)
+		{
+			options.quick = true;
+		}
+		else if (std::strcmp(argv[i], "--resolution") == 0 && i + 1 < argc)
+		{
+			if (std::sscanf(argv[++i], "%ux%u", &options.width, &options.height) != 2 || options.width == 0 || options.height == 0)
+			{
+				printUsage();
+				std::exit(1);
+			}
+		}
+		else if (std::strcmp(argv[i], "--repeats") == 0 && i + 1 < argc)
+		{
+			options.repeats = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			options.frames = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--passes") == 0 && i + 1 < argc)
+		{
+			options.passes = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		}
+		else
+		{
+			printUsage();
+			std::exit(1);
+		}
+	}
+	for (const std::string& name : options.scenes)
+	{
+		if (std::none_of(std::begin(SceneCases), std::end(SceneCases), [&](const SceneCase& c) { return name == c.name; }))
+		{
+			std::cerr << "Unknown scene " << name << std::endl;
+			std::exit(1);
+		}
+	}
+	return options;
+}
+
+// Resets the peak resident set where the OS allows it (Linux clear_refs), so that every scene
+// reports its own peak rather than the process high water mark so far.
+void resetPeakResident()
+{
+#ifdef __linux__
+	std::ofstream clearRefs("/proc/self/clear_refs");
+	clearRefs << "5";
+#endif
+}
+
+size_t peakResidentBytes()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.PeakWorkingSetSize;
+#else
+#ifdef __linux__
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line))
+	{
+		if (line.compare(0, 6, "VmHWM:") == 0)
+		{
+			return static_cast<size_t>(std::strtoull(line.c_str() + 6, nullptr, 10)) * 1024;
+		}
+	}
+#endif
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return static_cast<size_t>(usage.ru_maxrss);
+#else
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Traces rayCount rays in count calls of trace(index), which returns how many of its rays hit, and
+// keeps the fastest of the repeated runs.
+RayResult traceBatch(ThreadPool& pool, uint32_t count, uint32_t rayCount, uint32_t repeats, const std::function<uint32_t(uint32_t)>& trace)
+{
+	RayResult best;
+	for (uint32_t run = 0; run < repeats; ++run)
+	{
+		std::vector<uint64_t> hits(pool.size() * 8, 0);
+		Timer timer;
+		pool.parallelFor(count, [&](uint32_t i, uint32_t thread)
+		{
+			hits[thread * 8] += trace(i);
+		}, 256);
+		double seconds = timer.seconds();
+		if (run == 0 || seconds < best.seconds)
+		{
+			best.seconds = seconds;
+			best.rays = rayCount;
+			best.hits = 0;
+			for (uint32_t t = 0; t < pool.size(); ++t)
+			{
+				best.hits += hits[t * 8];
+			}
+		}
+	}
+	return best;
+}
+
+// Side of the bench texture and how often it repeats across a scene.
+constexpr uint32_t BenchTextureSize = 4096;
+constexpr float BenchTextureRepeats = 4.0f;
+
+// Checkerboard with a gradient across it, so that every MIP level differs.
+void writeBenchTexture(const std::string& path)
+{
+	std::vector<float> rgba(4 * static_cast<size_t>(BenchTextureSize) * BenchTextureSize);
+	for (uint32_t y = 0; y < BenchTextureSize; ++y)
+	{
+		for (uint32_t x = 0; x < BenchTextureSize; ++x)
+		{
+			float* texel = &rgba[4 * (static_cast<size_t>(y) * BenchTextureSize + x)];
+			bool dark = ((x / 32) ^ (y / 32)) & 1;
+			texel[0] = dark ? 0.1f : 0.9f;
+			texel[1] = dark ? 0.1f : static_cast<float>(x) / BenchTextureSize;
+			texel[2] = dark ? 0.1f : static_cast<float>(y) / BenchTextureSize;
+			texel[3] = 1.0f;
+		}
+	}
+	writeTiledTexture(path, BenchTextureSize, BenchTextureSize, rgba.data());
+}
+
+// Sky getting darker towards the zenith over a dim ground, with a small sun about 2000 times as bright.
+std::vector<float> makeBenchEnvironment(uint32_t width, uint32_t height)
+{
+	std::vector<float> rgba(4 * static_cast<size_t>(width) * height);
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		float t = (y + 0.5f) / height;
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			float s = (x + 0.5f) / width;
+			bool sun = std::abs(t - 0.25f) < 0.01f && std::abs(s - 0.3f) < 0.005f;
+			Vec3 sky = t < 0.5f ? Vec3(0.4f, 0.6f, 1.0f) * (0.5f + t) : Vec3(0.1f);
+			Vec3 color = sun ? Vec3(2000.0f, 1800.0f, 1500.0f) : sky;
+			float* pixel = &rgba[4 * (static_cast<size_t>(y) * width + x)];
+			pixel[0] = color.x;
+			pixel[1] = color.y;
+			pixel[2] = color.z;
+			pixel[3] = 1.0f;
+		}
+	}
+	return rgba;
+}
+
+SceneResult runScene(const SceneCase& sceneCase, const BenchOptions& options, ThreadPool& pool, const std::string& texturePath)
+{
+	SceneResult result;
+	result.name = sceneCase.name;
+	resetPeakResident();
+
+	Timer timer;
+	Scene scene = sceneCase.make(options.quick);
+	result.sceneSeconds = timer.seconds();
+	result.triangles = scene.triangleCount();
+	result.instances = static_cast<uint32_t>(scene.instances.size());
+
+	// Instanced scenes build both levels, including the wide bottom-level layouts, in one go.
+	std::unique_ptr<Bvh> bvh;
+	std::unique_ptr<Accelerator> accelerator;
+	if (scene.instanced())
+	{
+		auto instanceBvh = std::make_unique<InstanceBvh>(scene, pool);
+		result.bvh = instanceBvh->stats();
+		accelerator = std::move(instanceBvh);
+	}
+	else
+	{
+		bvh = std::make_unique<Bvh>(scene, pool);
+		result.bvh = bvh->stats();
+		timer.reset();
+		accelerator = createAccelerator(*bvh);
+		result.traversal.buildSeconds = timer.seconds();
+	}
+
+	// Primary rays through jittered pixel positions; the hits of the first layout traced seed the
+	// secondary rays.
+	uint32_t pixelCount = options.width * options.height;
+	float aspect = static_cast<float>(options.width) / options.height;
+	std::vector<Vec3> hitPositions(pixelCount);
+	std::vector<Vec3> hitNormals(pixelCount);
+	std::vector<uint8_t> hitFlags(pixelCount, 0);
+	std::vector<uint32_t> surfaces;
+	LightSet lights(scene);
+	Vec3 sun = normalize(Vec3(0.4f, 1.0f, 0.3f));
+	auto cameraRay = [&](uint32_t pixel)
+	{
+		Sampler sampler(pixel, 0, SamplerType::Random);
+		float u = (pixel % options.width + sampler.nextFloat()) / options.width;
+		float v = (pixel / options.width + sampler.nextFloat()) / options.height;
+		return scene.camera.generateRay(u, v, aspect);
+	};
+	// Shadow rays towards sampled light points, or towards a sun direction in scenes lit by the sky.
+	auto shadowRay = [&](uint32_t pixel)
+	{
+		Sampler sampler(pixel, 2, SamplerType::Random);
+		float u0 = sampler.nextFloat();
+		float u1 = sampler.nextFloat();
+		float u2 = sampler.nextFloat();
+		Ray shadow;
+		if (lights.empty())
+		{
+			shadow.origin = hitPositions[pixel] + hitNormals[pixel] * RayEpsilon;
+			shadow.direction = normalize(sun + Vec3(u0 - 0.5f, u1 - 0.5f, u2 - 0.5f) * 0.1f);
+		}
+		else
+		{
+			Vec3 radiance;
+			if (!lights.sampleDirect(hitPositions[pixel], hitNormals[pixel], u0, u1, u2, shadow, radiance))
+			{
+				shadow.origin = hitPositions[pixel] + hitNormals[pixel] * RayEpsilon;
+				shadow.direction = hitNormals[pixel];
+			}
+		}
+		return shadow;
+	};
+	auto traceRays = [&](const Accelerator& traversal, TraversalResult& layout)
+	{
+		layout.name = traversal.name();
+		layout.bytes = traversal.memoryBytes();
+		bool seed = surfaces.empty();
+		layout.primary = traceBatch(pool, pixelCount, pixelCount, options.repeats, [&](uint32_t pixel)
+		{
+			Ray ray = cameraRay(pixel);
+			Hit hit;
+			if (!traversal.intersect(ray, hit))
+			{
+				return false;
+			}
+			if (seed)
+			{
+				Vec3 normal = scene.geometricNormal(hit.instance, hit.primitive);
+				hitNormals[pixel] = dot(normal, ray.direction) < 0.0f ? normal : -normal;
+				hitPositions[pixel] = ray.origin + ray.direction * hit.t;
+				hitFlags[pixel] = 1;
+			}
+			return true;
+		});
+		if (seed)
+		{
+			for (uint32_t pixel = 0; pixel < pixelCount; ++pixel)
+			{
+				if (hitFlags[pixel])
+				{
+					surfaces.push_back(pixel);
+				}
+			}
+		}
+
+		// Diffuse bounce directions: the incoherent rays of the second path vertex.
+		uint32_t surfaceCount = static_cast<uint32_t>(surfaces.size());
+		layout.incoherent = traceBatch(pool, surfaceCount, surfaceCount, options.repeats, [&](uint32_t i)
+		{
+			uint32_t pixel = surfaces[i];
+			Sampler sampler(pixel, 1, SamplerType::Random);
+			float u1 = sampler.nextFloat();
+			float u2 = sampler.nextFloat();
+			Ray ray;
+			ray.origin = hitPositions[pixel] + hitNormals[pixel] * RayEpsilon;
+			ray.direction = cosineSampleHemisphere(hitNormals[pixel], u1, u2);
+			Hit hit;
+			return traversal.intersect(ray, hit);
+		});
+
+		layout.shadow = traceBatch(pool, surfaceCount, surfaceCount, options.repeats, [&](uint32_t i)
+		{
+			return traversal.occluded(shadowRay(surfaces[i]));
+		});
+
+		uint32_t packetCount = (pixelCount + RayPacketSize - 1) / RayPacketSize;
+		layout.primaryPacket = traceBatch(pool, packetCount, pixelCount, options.repeats, [&](uint32_t packet)
+		{
+			uint32_t first = packet * RayPacketSize;
+			uint32_t size = std::min(RayPacketSize, pixelCount - first);
+			Ray rays[RayPacketSize];
+			Hit hits[RayPacketSize];
+			for (uint32_t i = 0; i < size; ++i)
+			{
+				rays[i] = cameraRay(first + i);
+			}
+			traversal.intersectRays(rays, hits, size);
+			uint32_t hitCount = 0;
+			for (uint32_t i = 0; i < size; ++i)
+			{
+				hitCount += hits[i].valid();
+			}
+			return hitCount;
+		});
+		packetCount = (surfaceCount + RayPacketSize - 1) / RayPacketSize;
+		layout.shadowPacket = traceBatch(pool, packetCount, surfaceCount, options.repeats, [&](uint32_t packet)
+		{
+			uint32_t first = packet * RayPacketSize;
+			uint32_t size = std::min(RayPacketSize, surfaceCount - first);
+			Ray rays[RayPacketSize];
+			for (uint32_t i = 0; i < size; ++i)
+			{
+				rays[i] = shadowRay(surfaces[first + i]);
+			}
+			uint32_t occluded = traversal.occludedRays(rays, size);
+			uint32_t hitCount = 0;
+			for (uint32_t i = 0; i < size; ++i)
+			{
+				hitCount += occluded >> i & 1;
+			}
+			return hitCount;
+		});
+	};
+	traceRays(*accelerator, result.traversal);
+
+	{
+		// For instanced scenes the build time covers both levels.
+		timer.reset();
+		std::unique_ptr<Accelerator> compressed;
+		if (scene.instanced())
+		{
+			compressed = std::make_unique<InstanceBvh>(scene, pool, AcceleratorKind::Compressed);
+		}
+		else
+		{
+			compressed = createAccelerator(*bvh, AcceleratorKind::Compressed);
+		}
+		result.compressed.buildSeconds = timer.seconds();
+		traceRays(*compressed, result.compressed);
+	}
+
+	{
+		RenderSettings settings;
+		settings.width = options.width;
+		settings.height = options.height;
+		settings.aovs = DenoiseAovs;
+		CpuRenderer renderer(scene, *accelerator, pool, settings);
+		for (uint32_t pass = 0; pass < options.passes; ++pass)
+		{
+			renderer.renderPass();
+		}
+		result.samplesPerSecond = renderer.stats().samplesPerSecond();
+
+		Denoiser denoiser(settings.width, settings.height, pool);
+		std::vector<float> denoised(4 * static_cast<size_t>(settings.width) * settings.height);
+		result.denoise.kernel = denoiser.kernelName();
+		for (uint32_t run = 0; run < options.repeats; ++run)
+		{
+			denoiser.denoise(renderer, denoised.data());
+			result.denoise.seconds = run == 0 ? denoiser.lastSeconds() : std::min(result.denoise.seconds, denoiser.lastSeconds());
+		}
+	}
+	if (!lights.empty())
+	{
+		timer.reset();
+		LightSet tree(scene, pool);
+		result.lights.treeSeconds = timer.seconds();
+		result.lights.lights = tree.size();
+		RenderSettings settings;
+		settings.width = options.width;
+		settings.height = options.height;
+		settings.lightTree = false;
+		CpuRenderer renderer(scene, *accelerator, pool, settings);
+		for (uint32_t pass = 0; pass < options.passes; ++pass)
+		{
+			renderer.renderPass();
+		}
+		result.lights.areaSamplesPerSecond = renderer.stats().samplesPerSecond();
+	}
+	if (!isBlack(scene.background))
+	{
+		uint32_t width = options.quick ? 1024 : 4096;
+		EnvironmentMap environment(width, width / 2, makeBenchEnvironment(width, width / 2), pool);
+		result.environment.width = environment.width();
+		result.environment.height = environment.height();
+		result.environment.buildSeconds = environment.buildSeconds();
+		LightSet environmentLights(scene, pool, &environment);
+		RenderSettings settings;
+		settings.width = options.width;
+		settings.height = options.height;
+		CpuRenderer renderer(scene, *accelerator, pool, settings, nullptr, &environmentLights);
+		for (uint32_t pass = 0; pass < options.passes; ++pass)
+		{
+			renderer.renderPass();
+		}
+		result.environment.samplesPerSecond = renderer.stats().samplesPerSecond();
+	}
+	for (bool sortRays : {false, true})
+	{
+		RenderSettings settings;
+		settings.width = options.width;
+		settings.height = options.height;
+		settings.sortRays = sortRays;
+		WavefrontRenderer renderer(scene, *accelerator, pool, settings);
+		for (uint32_t pass = 0; pass < options.passes; ++pass)
+		{
+			renderer.renderPass();
+		}
+		WavefrontResult& wavefront = sortRays ? result.sortedWavefront : result.wavefront;
+		wavefront.samplesPerSecond = renderer.stats().samplesPerSecond();
+		for (uint32_t bounce = 1; bounce < renderer.timings().bounces(); ++bounce)
+		{
+			wavefront.extendSeconds += renderer.timings().seconds(bounce, WavefrontStage::Extend);
+			wavefront.sortSeconds += renderer.timings().seconds(bounce, WavefrontStage::Sort);
+		}
+	}
+
+	if (!scene.instanced())
+	{
+		std::string path = (std::filesystem::temp_directory_path() / ("ptgpu_bench_" + result.name + ".cache")).string();
+		{
+			PagedGeometry pages = buildGeometryPages(*bvh, pool, AcceleratorKind::Auto, 256 * 1024);
+			SceneCache::write(path, 0, scene, *bvh, nullptr, &pages);
+			result.paged.pageDataBytes = pages.data.size();
+			result.paged.budgetBytes = pages.data.size() / 4;
+			for (const GeometryPage& page : pages.pages)
+			{
+				result.paged.budgetBytes = std::max(result.paged.budgetBytes, static_cast<size_t>(page.size));
+			}
+		}
+		std::unique_ptr<SceneCache> cache = SceneCache::open(path, 0);
+		std::unique_ptr<PagedBvh> paged = cache ? cache->createPagedAccelerator(pool, result.paged.budgetBytes) : nullptr;
+		if (paged)
+		{
+			RenderSettings settings;
+			settings.width = options.width;
+			settings.height = options.height;
+			WavefrontRenderer renderer(cache->scene(), *paged, pool, settings);
+			for (uint32_t pass = 0; pass < options.passes; ++pass)
+			{
+				renderer.renderPass();
+			}
+			result.paged.samplesPerSecond = renderer.stats().samplesPerSecond();
+			result.paged.pages = paged->stats();
+		}
+		paged.reset();
+		cache.reset();
+		std::error_code error;
+		std::filesystem::remove(path, error);
+	}
+
+	// Textured: the mesh gets texture coordinates projected from above over its bounds and the diffuse
+	// materials the bench texture.
+	{
+		Scene textured = scene;
+		Aabb bounds;
+		for (const Vec3& position : scene.positions)
+		{
+			bounds.extend(position);
+		}
+		Vec3 extent = max(bounds.diagonal(), Vec3(1e-6f));
+		textured.texcoords.resize(scene.indices.size());
+		for (size_t i = 0; i < scene.indices.size(); ++i)
+		{
+			const Vec3& position = scene.positions[scene.indices[i]];
+			textured.texcoords[i] = {(position.x - bounds.min.x) / extent.x * BenchTextureRepeats, (position.z - bounds.min.z) / extent.z * BenchTextureRepeats};
+		}
+		for (size_t i = 0; i < textured.materials.size(); ++i)
+		{
+			if (textured.materials[i].type == MaterialType::Diffuse)
+			{
+				textured.materials[i].texture = 0;
+			}
+		}
+		textured.textures = {texturePath};
+
+		std::error_code error;
+		result.textured.budgetBytes = static_cast<size_t>(std::filesystem::file_size(texturePath, error) / 8);
+		TextureCache textures(textured.textures, result.textured.budgetBytes);
+		RenderSettings settings;
+		settings.width = options.width;
+		settings.height = options.height;
+		CpuRenderer renderer(textured, *accelerator, pool, settings, &textures);
+		for (uint32_t pass = 0; pass < options.passes; ++pass)
+		{
+			renderer.renderPass();
+		}
+		result.textured.samplesPerSecond = renderer.stats().samplesPerSecond();
+		result.textured.textures = textures.stats();
+	}
+
+	// Animation: triangle soups swirl around the vertical axis through their center, more strongly
+	// near the axis and further every frame; instances bob up and down. Both are followed through
+	// updates instead of rebuilds.
+	if (options.frames > 0)
+	{
+		Aabb bounds = scene.bounds();
+		Vec3 center = bounds.centroid();
+		float radius = 0.5f * length(bounds.diagonal());
+		std::vector<Vec3> rest(scene.positions.begin(), scene.positions.end());
+		std::vector<Transform> placements;
+		for (const Instance& instance : scene.instances)
+		{
+			placements.push_back(instance.transform);
+		}
+		for (uint32_t frame = 1; frame <= options.frames; ++frame)
+		{
+			if (scene.instanced())
+			{
+				for (uint32_t i = 0; i < scene.instances.size(); ++i)
+				{
+					float offset = 0.05f * radius * std::sin(0.7f * frame + 0.1f * i);
+					scene.instances[i].transform = Transform::translate(Vec3(0.0f, offset, 0.0f)) * placements[i];
+				}
+			}
+			else
+			{
+				Vec3* positions = scene.positions.data();
+				pool.parallelFor(static_cast<uint32_t>(rest.size()), [&](uint32_t i, uint32_t)
+				{
+					Vec3 p = rest[i] - center;
+					float angle = 0.3f * frame * std::exp(-std::sqrt(p.x * p.x + p.z * p.z) / radius);
+					float c = std::cos(angle);
+					float s = std::sin(angle);
+					positions[i] = center + Vec3(c * p.x + s * p.z, p.y, -s * p.x + c * p.z);
+				}, 4096);
+			}
+
+			timer.reset();
+			if (bvh)
+			{
+				BvhUpdateStats update = bvh->update(pool);
+				updateAccelerator(accelerator, *bvh, update, pool);
+				result.updateRebuiltSubtrees += update.rebuiltSubtrees;
+				result.updateFullRebuilds += update.fullRebuild;
+				result.updateSahGrowth = update.sahGrowth;
+			}
+			else
+			{
+				static_cast<InstanceBvh&>(*accelerator).refit();
+			}
+			result.updateSeconds += timer.seconds();
+		}
+		result.updateSeconds /= options.frames;
+	}
+
+	result.peakResidentBytes = peakResidentBytes();
+	return result;
+}
+
+void writeJson(const std::string& path, const BenchOptions& options, uint32_t threads, const std::vector<SceneResult>& results)
+{
+	std::ofstream out(path);
+	if (!out)
+	{
+		throw std::runtime_error("Cannot write " + path);
+	}
+	out << "{\n"
+		<< "  \"version\": 1,\n"
+		<< "  \"threads\": " << threads << ",\n"
+		<< "  \"quick\": " << (options.quick ? "true" : "false") << ",\n"
+		<< "  \"resolution\": [" << options.width << ", " << options.height << "],\n"
+		<< "  \"passes\": " << options.passes << ",\n"
+		<< "  \"frames\": " << options.frames << ",\n"
+		<< "  \"scenes\": [\n";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const SceneResult& r = results[i];
+		out << "    {\n"
+			<< "      \"name\": \"" << r.name << "\",\n"
+			<< "      \"triangles\": " << r.triangles << ",\n"
+			<< "      \"instances\": " << r.instances << ",\n"
+			<< "      \"scene_seconds\": " << r.sceneSeconds << ",\n"
+			<< "      \"bvh_build_seconds\": " << r.bvh.buildSeconds << ",\n"
+			<< "      \"bvh_nodes\": " << r.bvh.nodeCount << ",\n"
+			<< "      \"bvh_sah_cost\": " << r.bvh.sahCost << ",\n"
+			<< "      \"bvh_peak_build_bytes\": " << r.bvh.peakBuildBytes << ",\n"
+			<< "      \"traversal\": \"" << r.traversal.name << "\",\n"
+			<< "      \"traversal_build_seconds\": " << r.traversal.buildSeconds << ",\n"
+			<< "      \"traversal_bytes\": " << r.traversal.bytes << ",\n"
+			<< "      \"primary_mrays_per_second\": " << r.traversal.primary.mraysPerSecond() << ",\n"
+			<< "      \"primary_hit_rate\": " << (r.traversal.primary.rays ? static_cast<double>(r.traversal.primary.hits) / r.traversal.primary.rays : 0.0) << ",\n"
+			<< "      \"incoherent_mrays_per_second\": " << r.traversal.incoherent.mraysPerSecond() << ",\n"
+			<< "      \"shadow_mrays_per_second\": " << r.traversal.shadow.mraysPerSecond() << ",\n"
+			<< "      \"primary_packet_mrays_per_second\": " << r.traversal.primaryPacket.mraysPerSecond() << ",\n"
+			<< "      \"shadow_packet_mrays_per_second\": " << r.traversal.shadowPacket.mraysPerSecond() << ",\n"
+			<< "      \"compressed\": {\"traversal\": \"" << r.compressed.name << "\", \"traversal_build_seconds\": " << r.compressed.buildSeconds
+			<< ", \"traversal_bytes\": " << r.compressed.bytes << ", \"primary_mrays_per_second\": " << r.compressed.primary.mraysPerSecond()
+			<< ", \"incoherent_mrays_per_second\": " << r.compressed.incoherent.mraysPerSecond() << ", \"shadow_mrays_per_second\": "
+			<< r.compressed.shadow.mraysPerSecond() << "},\n"
+			<< "      \"samples_per_second\": " << r.samplesPerSecond << ",\n"
+			<< "      \"wavefront_samples_per_second\": " << r.wavefront.samplesPerSecond << ",\n"
+			<< "      \"wavefront_secondary_extend_seconds\": " << r.wavefront.extendSeconds << ",\n"
+			<< "      \"sorted_wavefront_samples_per_second\": " << r.sortedWavefront.samplesPerSecond << ",\n"
+			<< "      \"sorted_wavefront_secondary_extend_seconds\": " << r.sortedWavefront.extendSeconds << ",\n"
+			<< "      \"sorted_wavefront_sort_seconds\": " << r.sortedWavefront.sortSeconds << ",\n"
+			<< "      \"paged\": {\"samples_per_second\": " << r.paged.samplesPerSecond << ", \"page_data_bytes\": " << r.paged.pageDataBytes
+			<< ", \"budget_bytes\": " << r.paged.budgetBytes << ", \"page_faults\": " << r.paged.pages.faults << ", \"evictions\": "
+			<< r.paged.pages.evictions << ", \"fetched_bytes\": " << r.paged.pages.fetchedBytes << ", \"deferred_rays\": " << r.paged.pages.deferredRays
+			<< "},\n"
+			<< "      \"textured\": {\"samples_per_second\": " << r.textured.samplesPerSecond << ", \"budget_bytes\": " << r.textured.budgetBytes
+			<< ", \"tile_requests\": " << r.textured.textures.tileRequests << ", \"tile_loads\": " << r.textured.textures.tileLoads
+			<< ", \"evictions\": " << r.textured.textures.evictions << ", \"resident_bytes\": " << r.textured.textures.residentBytes << "},\n"
+			<< "      \"lights\": {\"emissive_triangles\": " << r.lights.lights << ", \"tree_build_seconds\": " << r.lights.treeSeconds
+			<< ", \"area_samples_per_second\": " << r.lights.areaSamplesPerSecond << "},\n"
+			<< "      \"environment\": {\"resolution\": [" << r.environment.width << ", " << r.environment.height << "], \"build_seconds\": "
+			<< r.environment.buildSeconds << ", \"samples_per_second\": " << r.environment.samplesPerSecond << "},\n"
+			<< "      \"denoise\": {\"kernel\": \"" << r.denoise.kernel << "\", \"seconds_per_frame\": " << r.denoise.seconds << "},\n"
+			<< "      \"update_seconds_per_frame\": " << r.updateSeconds << ",\n"
+			<< "      \"update_rebuilt_subtrees\": " << r.updateRebuiltSubtrees << ",\n"
+			<< "      \"update_full_rebuilds\": " << r.updateFullRebuilds << ",\n"
+			<< "      \"update_sah_growth\": " << r.updateSahGrowth << ",\n"
+			<< "      \"peak_resident_bytes\": " << r.peakResidentBytes << "\n"
+			<< "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n"
+		<< "}\n";
+}
+
+int run(const BenchOptions& options)
+{
+	ThreadPool pool(options.threads);
+	std::cout << "ptgpu_bench: " << pool.size() << " threads, " << options.width << "x" << options.height << (options.quick ? ", quick" : "")
+		<< std::endl;
+
+	std::string texturePath = (std::filesystem::temp_directory_path() / "ptgpu_bench_texture.tiled").string();
+	writeBenchTexture(texturePath);
+
+	std::vector<SceneResult> results;
+	for (const SceneCase& sceneCase : SceneCases)
+	{
+		if (!options.scenes.empty() && std::find(options.scenes.begin(), options.scenes.end(), sceneCase.name) == options.scenes.end())
+		{
+			continue;
+		}
+		SceneResult r = runScene(sceneCase, options, pool, texturePath);
+		const TraversalResult& t = r.traversal;
+		std::cout << r.name << ": " << r.triangles << " triangles, " << r.instances << " instances, BVH " << r.bvh.buildSeconds * 1000.0 << " ms + " << t.name << " "
+			<< t.buildSeconds * 1000.0 << " ms, primary " << t.primary.mraysPerSecond() << " Mrays/s, incoherent "
+			<< t.incoherent.mraysPerSecond() << " Mrays/s, shadow " << t.shadow.mraysPerSecond() << " Mrays/s, "
+			<< r.samplesPerSecond / 1e6 << " Msamples/s, update " << r.updateSeconds * 1000.0 << " ms/frame, peak " << r.peakResidentBytes / (1024.0 * 1024.0) << " MiB" << std::endl;
+		std::cout << "  packets: primary " << t.primaryPacket.mraysPerSecond() << " Mrays/s, shadow " << t.shadowPacket.mraysPerSecond() << " Mrays/s"
+			<< std::endl;
+		const TraversalResult& c = r.compressed;
+		std::cout << "  " << c.name << ": " << c.bytes / (1024.0 * 1024.0) << " MiB against " << t.bytes / (1024.0 * 1024.0) << " MiB, primary "
+			<< c.primary.mraysPerSecond() << " Mrays/s, incoherent " << c.incoherent.mraysPerSecond() << " Mrays/s, shadow "
+			<< c.shadow.mraysPerSecond() << " Mrays/s" << std::endl;
+		std::cout << "  wavefront: " << r.wavefront.samplesPerSecond / 1e6 << " Msamples/s, secondary extend " << r.wavefront.extendSeconds * 1000.0
+			<< " ms; sorted " << r.sortedWavefront.samplesPerSecond / 1e6 << " Msamples/s, secondary extend " << r.sortedWavefront.extendSeconds * 1000.0
+			<< " ms + sort " << r.sortedWavefront.sortSeconds * 1000.0 << " ms" << std::endl;
+		if (r.paged.samplesPerSecond > 0.0)
+		{
+			std::cout << "  paged: " << r.paged.samplesPerSecond / 1e6 << " Msamples/s with " << r.paged.budgetBytes / (1024.0 * 1024.0) << " of "
+				<< r.paged.pageDataBytes / (1024.0 * 1024.0) << " MiB resident, " << r.paged.pages.faults << " page faults, "
+				<< r.paged.pages.deferredRays << " deferred rays" << std::endl;
+		}
+		const TextureStats& textures = r.textured.textures;
+		std::cout << "  textured: " << r.textured.samplesPerSecond / 1e6 << " Msamples/s, " << textures.tileLoads << " of "
+			<< textures.tileRequests << " tile lookups loaded, " << textures.evictions << " evicted, "
+			<< textures.residentBytes / (1024.0 * 1024.0) << " MiB resident" << std::endl;
+		if (r.lights.lights > 0)
+		{
+			std::cout << "  lights: " << r.lights.lights << " emissive triangles, tree built in " << r.lights.treeSeconds * 1000.0 << " ms, "
+				<< r.lights.areaSamplesPerSecond / 1e6 << " Msamples/s picking by area" << std::endl;
+		}
+		if (r.environment.width > 0)
+		{
+			std::cout << "  environment: " << r.environment.width << "x" << r.environment.height << " tables built in "
+				<< r.environment.buildSeconds * 1000.0 << " ms, " << r.environment.samplesPerSecond / 1e6 << " Msamples/s" << std::endl;
+		}
+		std::cout << "  denoise: " << r.denoise.seconds * 1000.0 << " ms per frame (" << r.denoise.kernel << ")" << std::endl;
+		results.push_back(r);
+	}
+	std::error_code error;
+	std::filesystem::remove(texturePath, error);
+
+	writeJson(options.output, options, pool.size(), results);
+	std::cout << "Wrote " << options.output << std::endl;
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	BenchOptions options = parseOptions(argc, argv);
+	try
+	{
+		return run(options);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "ptgpu_bench: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,414 @@
+// Definitions shared by the path tracing kernels: scene layout, traversal and sampling. Mirrors the
+// host code in Bvh.cpp, Lights.cpp, EnvironmentMap.cpp and Shading.h.
+
+#include "environment.h"
+#include "sampling.h"
+
+// 1 for Owen-scrambled Sobol samples, 0 for Philox random numbers; set from RenderSettings::sampler.
+#ifndef SOBOL_SAMPLER
+#define SOBOL_SAMPLER 1
+#endif
+
+#define PI 3.14159265358979323846f
+#define INV_PI (1.0f / PI)
+#define RAY_EPSILON 1e-4f
+#define STACK_SIZE 96
+#define INVALID_INDEX 0xffffffffu
+
+#define MATERIAL_DIFFUSE 0u
+#define MATERIAL_MIRROR 1u
+#define MATERIAL_GLASS 2u
+
+// Matches BvhNode on the host, 32 bytes.
+typedef struct
+{
+	float minX, minY, minZ;
+	uint offset;
+	float maxX, maxY, maxZ;
+	ushort count;
+	ushort axis;
+} BvhNode;
+
+// Matches Material on the host, 36 bytes. The kernels do not sample textures.
+typedef struct
+{
+	float albedo[3];
+	uint type;
+	float emission[3];
+	float ior;
+	uint texture;
+} Material;
+
+typedef struct
+{
+	float3 origin;
+	float3 direction;
+	float tMin;
+	float tMax;
+} Ray;
+
+typedef struct
+{
+	float t;
+	uint primitive;
+} Hit;
+
+typedef struct
+{
+	__global const float4* positions;
+	__global const uint* indices;
+	__global const uint* materialIds;
+	__global const Material* materials;
+	__global const BvhNode* nodes;
+	__global const uint* primitives;
+	__global const uint* lights;
+	__global const float* lightCdf;
+	uint lightCount;
+	float lightArea;
+	__global const float4* environment;
+	__global const AliasEntry* environmentMarginal;
+	__global const AliasEntry* environmentConditional;
+	uint environmentWidth;
+	uint environmentHeight;
+	float environmentProbability;
+} SceneData;
+
+// Kernel parameters describing the scene, bound by ClScene::setArgs in this order.
+#define SCENE_PARAMETERS \
+	__global const float4* positions, \
+	__global const uint* indices, \
+	__global const uint* materialIds, \
+	__global const Material* materials, \
+	__global const BvhNode* nodes, \
+	__global const uint* primitives, \
+	__global const uint* lights, \
+	__global const float* lightCdf, \
+	uint lightCount, \
+	float lightArea, \
+	__global const float4* environment, \
+	__global const AliasEntry* environmentMarginal, \
+	__global const AliasEntry* environmentConditional, \
+	uint environmentWidth, \
+	uint environmentHeight, \
+	float environmentProbability
+
+#define LOAD_SCENE(scene) \
+	SceneData scene; \
+	scene.positions = positions; \
+	scene.indices = indices; \
+	scene.materialIds = materialIds; \
+	scene.materials = materials; \
+	scene.nodes = nodes; \
+	scene.primitives = primitives; \
+	scene.lights = lights; \
+	scene.lightCdf = lightCdf; \
+	scene.lightCount = lightCount; \
+	scene.lightArea = lightArea; \
+	scene.environment = environment; \
+	scene.environmentMarginal = environmentMarginal; \
+	scene.environmentConditional = environmentConditional; \
+	scene.environmentWidth = environmentWidth; \
+	scene.environmentHeight = environmentHeight; \
+	scene.environmentProbability = environmentProbability
+
+float3 vertexPosition(const SceneData* scene, uint triangle, uint corner)
+{
+	return scene->positions[scene->indices[3 * triangle + corner]].xyz;
+}
+
+bool intersectTriangle(const Ray* ray, float3 v0, float3 v1, float3 v2, float* t)
+{
+	float3 e1 = v1 - v0;
+	float3 e2 = v2 - v0;
+	float3 p = cross(ray->direction, e2);
+	float det = dot(e1, p);
+	if (fabs(det) < 1e-12f)
+	{
+		return false;
+	}
+	float invDet = 1.0f / det;
+	float3 s = ray->origin - v0;
+	float u = dot(s, p) * invDet;
+	if (u < 0.0f || u > 1.0f)
+	{
+		return false;
+	}
+	float3 q = cross(s, e1);
+	float v = dot(ray->direction, q) * invDet;
+	if (v < 0.0f || u + v > 1.0f)
+	{
+		return false;
+	}
+	*t = dot(e2, q) * invDet;
+	return *t > ray->tMin && *t < ray->tMax;
+}
+
+float intersectNode(__global const BvhNode* node, float3 origin, float3 inverseDirection, float tMin, float tMax)
+{
+	float3 t0 = ((float3)(node->minX, node->minY, node->minZ) - origin) * inverseDirection;
+	float3 t1 = ((float3)(node->maxX, node->maxY, node->maxZ) - origin) * inverseDirection;
+	float3 tSmall = fmin(t0, t1);
+	float3 tLarge = fmax(t0, t1);
+	float tNear = fmax(fmax(tSmall.x, tSmall.y), fmax(tSmall.z, tMin));
+	float tFar = fmin(fmin(tLarge.x, tLarge.y), fmin(tLarge.z, tMax));
+	return tNear <= tFar ? tNear : INFINITY;
+}
+
+float3 safeInverse(float3 d)
+{
+	float3 tiny = copysign((float3)(1e-20f), d);
+	return 1.0f / select(d, tiny, isless(fabs(d), (float3)(1e-20f)));
+}
+
+// Closest hit when anyHit is false, otherwise returns as soon as anything is found.
+bool traverse(const SceneData* scene, Ray* ray, Hit* hit, bool anyHit)
+{
+	float3 inverseDirection = safeInverse(ray->direction);
+	uint stack[STACK_SIZE];
+	uint stackSize = 0;
+	bool found = false;
+
+	// The root of a tree without primitives has empty bounds and no children, and is the only node
+	// with a zero offset that is no leaf.
+	uint nodeIndex = 0;
+	if ((scene->nodes[0].count == 0 && scene->nodes[0].offset == 0) || intersectNode(&scene->nodes[0], ray->origin, inverseDirection, ray->tMin, ray->tMax) == INFINITY)
+	{
+		return false;
+	}
+
+	for (;;)
+	{
+		__global const BvhNode* node = &scene->nodes[nodeIndex];
+		if (node->count > 0)
+		{
+			for (uint i = node->offset; i < node->offset + node->count; ++i)
+			{
+				uint primitive = scene->primitives[i];
+				float t;
+				if (intersectTriangle(ray, vertexPosition(scene, primitive, 0), vertexPosition(scene, primitive, 1), vertexPosition(scene, primitive, 2), &t))
+				{
+					if (anyHit)
+					{
+						return true;
+					}
+					ray->tMax = t;
+					hit->t = t;
+					hit->primitive = primitive;
+					found = true;
+				}
+			}
+		}
+		else
+		{
+			uint left = node->offset;
+			uint right = left + 1;
+			float tLeft = intersectNode(&scene->nodes[left], ray->origin, inverseDirection, ray->tMin, ray->tMax);
+			float tRight = intersectNode(&scene->nodes[right], ray->origin, inverseDirection, ray->tMin, ray->tMax);
+			if (tLeft > tRight)
+			{
+				float t = tLeft;
+				tLeft = tRight;
+				tRight = t;
+				uint n = left;
+				left = right;
+				right = n;
+			}
+			if (tLeft != INFINITY)
+			{
+				if (tRight != INFINITY)
+				{
+					stack[stackSize++] = right;
+				}
+				nodeIndex = left;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+		nodeIndex = stack[--stackSize];
+	}
+	return found;
+}
+
+float3 geometricNormal(const SceneData* scene, uint triangle)
+{
+	float3 v0 = vertexPosition(scene, triangle, 0);
+	return normalize(cross(vertexPosition(scene, triangle, 1) - v0, vertexPosition(scene, triangle, 2) - v0));
+}
+
+void makeBasis(float3 n, float3* tangent, float3* bitangent)
+{
+	float sign = copysign(1.0f, n.z);
+	float a = -1.0f / (sign + n.z);
+	float b = n.x * n.y * a;
+	*tangent = (float3)(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+	*bitangent = (float3)(b, sign + n.y * n.y * a, -n.y);
+}
+
+float3 cosineSampleHemisphere(float3 normal, float u1, float u2)
+{
+	float r = sqrt(u1);
+	float phi = 2.0f * PI * u2;
+	float3 tangent, bitangent;
+	makeBasis(normal, &tangent, &bitangent);
+	return normalize(tangent * (r * cos(phi)) + bitangent * (r * sin(phi)) + normal * sqrt(fmax(0.0f, 1.0f - u1)));
+}
+
+float fresnelDielectric(float cosThetaI, float eta)
+{
+	float sinThetaT2 = eta * eta * fmax(0.0f, 1.0f - cosThetaI * cosThetaI);
+	if (sinThetaT2 >= 1.0f)
+	{
+		return 1.0f;
+	}
+	float cosThetaT = sqrt(1.0f - sinThetaT2);
+	float rs = (eta * cosThetaI - cosThetaT) / (eta * cosThetaI + cosThetaT);
+	float rp = (cosThetaI - eta * cosThetaT) / (cosThetaI + eta * cosThetaT);
+	return 0.5f * (rs * rs + rp * rp);
+}
+
+// Texel of the environment map seen along direction, or the constant background without one.
+// Matches LightSet::background.
+float3 backgroundRadiance(const SceneData* scene, float3 direction, float3 background)
+{
+	if (scene->environmentWidth == 0)
+	{
+		return background;
+	}
+	float phi = atan2(direction.z, direction.x);
+	float s = (phi < 0.0f ? phi + 2.0f * PI : phi) * (0.5f * INV_PI);
+	float t = acos(clamp(direction.y, -1.0f, 1.0f)) * INV_PI;
+	uint x = min((uint)(s * scene->environmentWidth), scene->environmentWidth - 1);
+	uint y = min((uint)(t * scene->environmentHeight), scene->environmentHeight - 1);
+	return scene->environment[y * scene->environmentWidth + x].xyz;
+}
+
+// Samples a direction towards the environment map. Matches EnvironmentMap::sample.
+bool sampleEnvironmentConnection(const SceneData* scene, float3 position, float3 normal, float u, float v, Ray* shadow, float3* radiance)
+{
+	float s;
+	float t;
+	float pdfSquare = sampleEnvironmentTables(scene->environmentMarginal, scene->environmentConditional, scene->environmentWidth,
+		scene->environmentHeight, u, v, &s, &t);
+	float sinTheta = sin(t * PI);
+	if (sinTheta <= 0.0f || pdfSquare <= 0.0f)
+	{
+		return false;
+	}
+	float phi = s * 2.0f * PI;
+	float3 direction = (float3)(sinTheta * cos(phi), cos(t * PI), sinTheta * sin(phi));
+	float cosSurface = dot(normal, direction);
+	if (cosSurface <= 0.0f)
+	{
+		return false;
+	}
+	uint x = min((uint)(s * scene->environmentWidth), scene->environmentWidth - 1);
+	uint y = min((uint)(t * scene->environmentHeight), scene->environmentHeight - 1);
+	float pdf = pdfSquare * scene->environmentProbability / (2.0f * PI * PI * sinTheta);
+
+	shadow->origin = position + normal * RAY_EPSILON;
+	shadow->direction = direction;
+	shadow->tMin = 0.0f;
+	shadow->tMax = INFINITY;
+	*radiance = scene->environment[y * scene->environmentWidth + x].xyz * (cosSurface / pdf);
+	return true;
+}
+
+// Samples a light as seen from a surface point. On success the shadow ray spans the unoccluded segment
+// and radiance holds Le * cos / pdf in solid angle. Matches LightSet::sampleDirect without its MIS
+// weight: the kernels only add emission and environment found by specular bounces.
+bool sampleLightConnection(const SceneData* scene, float3 position, float3 normal, SamplerState* rng, Ray* shadow, float3* radiance)
+{
+	float uSelect = nextFloat(rng);
+	startPair(rng);
+	float u = nextFloat(rng);
+	float v = nextFloat(rng);
+	if (uSelect < scene->environmentProbability)
+	{
+		return sampleEnvironmentConnection(scene, position, normal, u, v, shadow, radiance);
+	}
+
+	float lightChance = 1.0f - scene->environmentProbability;
+	float target = (uSelect - scene->environmentProbability) / lightChance * scene->lightArea;
+	uint lo = 0;
+	uint hi = scene->lightCount - 1;
+	while (lo < hi)
+	{
+		uint mid = (lo + hi) / 2;
+		if (scene->lightCdf[mid] <= target)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	uint triangle = scene->lights[lo];
+
+	float su = sqrt(u);
+	float b0 = 1.0f - su;
+	float b1 = v * su;
+	float3 lightPosition = vertexPosition(scene, triangle, 0) * b0 + vertexPosition(scene, triangle, 1) * b1
+		+ vertexPosition(scene, triangle, 2) * (1.0f - b0 - b1);
+	float3 lightNormal = geometricNormal(scene, triangle);
+	__global const Material* lightMaterial = &scene->materials[scene->materialIds[triangle]];
+
+	float3 toLight = lightPosition - position;
+	float distance2 = dot(toLight, toLight);
+	float distance = sqrt(distance2);
+	float3 direction = toLight / distance;
+	float cosSurface = dot(normal, direction);
+	float cosLight = -dot(lightNormal, direction);
+	if (cosSurface <= 0.0f || cosLight <= 0.0f)
+	{
+		return false;
+	}
+
+	shadow->origin = position + normal * RAY_EPSILON;
+	shadow->direction = direction;
+	shadow->tMin = 0.0f;
+	shadow->tMax = distance * (1.0f - 1e-3f);
+	float3 emission = (float3)(lightMaterial->emission[0], lightMaterial->emission[1], lightMaterial->emission[2]);
+	*radiance = emission * (cosSurface * cosLight * scene->lightArea / (distance2 * lightChance));
+	return true;
+}
+
+float3 sampleDirectLight(const SceneData* scene, float3 position, float3 normal, float3 albedo, SamplerState* rng, uint* rays)
+{
+	if (scene->lightCount == 0 && scene->environmentProbability == 0.0f)
+	{
+		return (float3)(0.0f);
+	}
+
+	Ray shadow;
+	float3 radiance;
+	if (!sampleLightConnection(scene, position, normal, rng, &shadow, &radiance))
+	{
+		return (float3)(0.0f);
+	}
+	Hit unused;
+	(*rays)++;
+	if (traverse(scene, &shadow, &unused, true))
+	{
+		return (float3)(0.0f);
+	}
+	return albedo * INV_PI * radiance;
+}
+
+// Picks reflection or refraction with the Fresnel probability, n faces the incoming ray. Returns true on refraction.
+bool sampleDielectric(float3 direction, float3 n, float eta, float u, float3* sampled)
+{
+	float cosThetaI = -dot(direction, n);
+	if (u < fresnelDielectric(cosThetaI, eta))
+	{
+		*sampled = direction - n * (2.0f * dot(direction, n));
+		return false;
+	}
+	float cosThetaT = sqrt(1.0f - eta * eta * (1.0f - cosThetaI * cosThetaI));
+	*sampled = normalize(direction * eta + n * (eta * cosThetaI - cosThetaT));
+	return true;
+}
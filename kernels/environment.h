@@ -0,0 +1,67 @@
+// Alias tables of the environment map distribution, shared by the host (src/EnvironmentMap.cpp) and
+// the OpenCL kernels, so it is written in the subset of C that OpenCL C and C++ both accept, like
+// sampling.h. Directions are mapped to the unit square on each side with the functions of its vector
+// type.
+
+#ifndef PTGPU_ENVIRONMENT_H
+#define PTGPU_ENVIRONMENT_H
+
+#ifdef __OPENCL_VERSION__
+#define ENVIRONMENT_FUNCTION
+#define ENVIRONMENT_GLOBAL __global
+#else
+#define ENVIRONMENT_FUNCTION inline
+#define ENVIRONMENT_GLOBAL
+#endif
+
+// Entry of an alias table over count outcomes (Walker 1977): outcome i keeps a pick with probability
+// threshold and hands it to alias otherwise. pdf is count times the probability of outcome i, its
+// density over the unit interval. 12 bytes on both sides.
+typedef struct
+{
+	float threshold;
+	unsigned int alias;
+	float pdf;
+} AliasEntry;
+
+// Picks an outcome of table with one uniform number u. What is left of u after the choice is returned
+// in remainder, uniform in [0, 1) again.
+ENVIRONMENT_FUNCTION unsigned int sampleAlias(const ENVIRONMENT_GLOBAL AliasEntry* table, unsigned int count, float u, float* remainder)
+{
+	float scaled = u * count;
+	unsigned int index = (unsigned int)scaled;
+	index = index < count ? index : count - 1u;
+	float fraction = scaled - index;
+	float threshold = table[index].threshold;
+	float kept = fraction < threshold ? fraction / threshold : (fraction - threshold) / (1.0f - threshold);
+	*remainder = kept < 0x1.fffffep-1f ? kept : 0x1.fffffep-1f;
+	return fraction < threshold ? index : table[index].alias;
+}
+
+// Samples a point (s, t) of the unit square from a piecewise-constant distribution over width x height
+// cells, given as an alias table over the rows and one over the cells of each row. Returns the density
+// of the point over the square.
+ENVIRONMENT_FUNCTION float sampleEnvironmentTables(const ENVIRONMENT_GLOBAL AliasEntry* marginal, const ENVIRONMENT_GLOBAL AliasEntry* conditional,
+	unsigned int width, unsigned int height, float u, float v, float* s, float* t)
+{
+	float rowRemainder;
+	float columnRemainder;
+	unsigned int row = sampleAlias(marginal, height, v, &rowRemainder);
+	unsigned int column = sampleAlias(conditional + row * width, width, u, &columnRemainder);
+	*s = (column + columnRemainder) / width;
+	*t = (row + rowRemainder) / height;
+	return marginal[row].pdf * conditional[row * width + column].pdf;
+}
+
+// Density of the point (s, t) under sampleEnvironmentTables.
+ENVIRONMENT_FUNCTION float environmentTablesPdf(const ENVIRONMENT_GLOBAL AliasEntry* marginal, const ENVIRONMENT_GLOBAL AliasEntry* conditional,
+	unsigned int width, unsigned int height, float s, float t)
+{
+	unsigned int column = (unsigned int)(s * width);
+	unsigned int row = (unsigned int)(t * height);
+	column = column < width ? column : width - 1u;
+	row = row < height ? row : height - 1u;
+	return marginal[row].pdf * conditional[row * width + column].pdf;
+}
+
+#endif
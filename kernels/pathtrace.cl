@@ -0,0 +1,118 @@
+// Progressive megakernel path tracer, one work item per pixel. Mirrors CpuRenderer::tracePath.
+
+#include "common.cl"
+
+__kernel void renderPass(
+	SCENE_PARAMETERS,
+	float4 background,
+	float4 cameraPosition,
+	float4 cameraForward,
+	float4 cameraRight,
+	float4 cameraUp,
+	float tanHalfFov,
+	uint width,
+	uint height,
+	uint sampleIndex,
+	uint maxDepth,
+	__global float4* accumulation,
+	__global uint* rayCounter)
+{
+	uint x = get_global_id(0);
+	uint y = get_global_id(1);
+	if (x >= width || y >= height)
+	{
+		return;
+	}
+
+	LOAD_SCENE(scene);
+
+	uint pixel = y * width + x;
+	SamplerState rng = makeSampler(pixel, sampleIndex, SOBOL_SAMPLER);
+
+	float aspect = (float)width / height;
+	float u = (x + nextFloat(&rng)) / width;
+	float v = (y + nextFloat(&rng)) / height;
+	float sx = (2.0f * u - 1.0f) * tanHalfFov * aspect;
+	float sy = (1.0f - 2.0f * v) * tanHalfFov;
+
+	Ray ray;
+	ray.origin = cameraPosition.xyz;
+	ray.direction = normalize(cameraForward.xyz + cameraRight.xyz * sx + cameraUp.xyz * sy);
+	ray.tMin = 0.0f;
+	ray.tMax = INFINITY;
+
+	float3 radiance = (float3)(0.0f);
+	float3 throughput = (float3)(1.0f);
+	bool specularBounce = true;
+	uint rays = 0;
+
+	for (uint depth = 0; depth < maxDepth; ++depth)
+	{
+		Hit hit;
+		rays++;
+		if (!traverse(&scene, &ray, &hit, false))
+		{
+			// A sampled environment is found by next-event estimation after diffuse bounces.
+			if (specularBounce || scene.environmentProbability == 0.0f)
+			{
+				radiance += throughput * backgroundRadiance(&scene, ray.direction, background.xyz);
+			}
+			break;
+		}
+
+		__global const Material* material = &materials[materialIds[hit.primitive]];
+		float3 albedo = (float3)(material->albedo[0], material->albedo[1], material->albedo[2]);
+		float3 emission = (float3)(material->emission[0], material->emission[1], material->emission[2]);
+		float3 position = ray.origin + ray.direction * hit.t;
+		float3 normal = geometricNormal(&scene, hit.primitive);
+		bool frontFace = dot(normal, ray.direction) < 0.0f;
+		float3 n = frontFace ? normal : -normal;
+
+		if (specularBounce && frontFace && any(isgreater(emission, (float3)(0.0f))))
+		{
+			radiance += throughput * emission;
+		}
+
+		Ray next;
+		next.tMin = 0.0f;
+		next.tMax = INFINITY;
+		if (material->type == MATERIAL_DIFFUSE)
+		{
+			radiance += throughput * sampleDirectLight(&scene, position, n, albedo, &rng, &rays);
+			next.origin = position + n * RAY_EPSILON;
+			startPair(&rng);
+			float u1 = nextFloat(&rng);
+			float u2 = nextFloat(&rng);
+			next.direction = cosineSampleHemisphere(n, u1, u2);
+			specularBounce = false;
+		}
+		else if (material->type == MATERIAL_MIRROR)
+		{
+			next.origin = position + n * RAY_EPSILON;
+			next.direction = ray.direction - n * (2.0f * dot(ray.direction, n));
+			specularBounce = true;
+		}
+		else
+		{
+			float eta = frontFace ? 1.0f / material->ior : material->ior;
+			bool refracted = sampleDielectric(ray.direction, n, eta, nextFloat(&rng), &next.direction);
+			next.origin = position + (refracted ? -n : n) * RAY_EPSILON;
+			specularBounce = true;
+		}
+		throughput *= albedo;
+
+		if (depth >= 3)
+		{
+			float survival = fmin(0.95f, fmax(throughput.x, fmax(throughput.y, throughput.z)));
+			if (nextFloat(&rng) >= survival)
+			{
+				break;
+			}
+			throughput /= survival;
+		}
+		ray = next;
+	}
+
+	accumulation[pixel] += (float4)(radiance, 1.0f);
+	atomic_add(rayCounter, rays);
+}
@@ -0,0 +1,122 @@
+// Counter-based random numbers and Owen-scrambled Sobol points, shared by the host (src/Random.h)
+// and the OpenCL kernels, so it is written in the subset of C that OpenCL C and C++ both accept.
+// Every value is a pure function of pixel, sample index and dimension: an image does not depend on
+// which thread or work item traced a path, or in which order.
+
+#ifndef PTGPU_SAMPLING_H
+#define PTGPU_SAMPLING_H
+
+#ifdef __OPENCL_VERSION__
+#define SAMPLING_FUNCTION
+#define SAMPLING_MUL_HI(a, b) mul_hi(a, b)
+#else
+#define SAMPLING_FUNCTION inline
+#define SAMPLING_MUL_HI(a, b) (unsigned int)(((unsigned long long)(a) * (b)) >> 32)
+#endif
+
+SAMPLING_FUNCTION unsigned int pcgHash(unsigned int v)
+{
+	unsigned int state = v * 747796405u + 2891336453u;
+	unsigned int word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+// Philox 2x32 with 10 rounds, keyed by the pixel and counting over (sample index, dimension).
+SAMPLING_FUNCTION unsigned int philox(unsigned int counter0, unsigned int counter1, unsigned int key)
+{
+	for (int round = 0; round < 10; ++round)
+	{
+		unsigned int hi = SAMPLING_MUL_HI(0xd256d193u, counter0);
+		unsigned int lo = 0xd256d193u * counter0;
+		counter0 = hi ^ key ^ counter1;
+		counter1 = lo;
+		key += 0x9e3779b9u;
+	}
+	return counter0;
+}
+
+SAMPLING_FUNCTION unsigned int reverseBits(unsigned int x)
+{
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+// Hash that only lets lower bits affect higher ones, applied to reversed bits it is an Owen scramble
+// (Laine and Karras 2011 with Burley's 2020 constants).
+SAMPLING_FUNCTION unsigned int nestedUniformScramble(unsigned int x, unsigned int seed)
+{
+	x = reverseBits(x);
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1u;
+	x ^= x * 0x05526c56u;
+	x ^= x * 0x53a22864u;
+	return reverseBits(x);
+}
+
+// First two Sobol dimensions in 0.32 fixed point: van der Corput and the sequence of x + 1.
+SAMPLING_FUNCTION unsigned int sobol(unsigned int index, unsigned int dimension)
+{
+	if (dimension == 0)
+	{
+		return reverseBits(index);
+	}
+	unsigned int result = 0;
+	for (unsigned int v = 0x80000000u; index != 0; index >>= 1, v ^= v >> 1)
+	{
+		if (index & 1u)
+		{
+			result ^= v;
+		}
+	}
+	return result;
+}
+
+// Owen-scrambled Sobol padded to any dimension count (Burley 2020): dimensions are consumed in pairs
+// and each pair reads its own shuffle of the sequence, so pairs are stratified and independent.
+SAMPLING_FUNCTION unsigned int sobolOwen(unsigned int pixel, unsigned int sampleIndex, unsigned int dimension)
+{
+	unsigned int pairSeed = pcgHash(pixel ^ pcgHash(dimension >> 1));
+	unsigned int index = nestedUniformScramble(sampleIndex, pairSeed);
+	return nestedUniformScramble(sobol(index, dimension & 1u), pcgHash(pairSeed + dimension));
+}
+
+// Sampling state of one path, 16 bytes so it can live in per-path buffers on both sides.
+typedef struct
+{
+	unsigned int pixel;
+	unsigned int sampleIndex;
+	unsigned int dimension;
+	unsigned int sobol;
+} SamplerState;
+
+SAMPLING_FUNCTION SamplerState makeSampler(unsigned int pixel, unsigned int sampleIndex, unsigned int sobol)
+{
+	SamplerState state;
+	state.pixel = pixel;
+	state.sampleIndex = sampleIndex;
+	state.dimension = 0;
+	state.sobol = sobol;
+	return state;
+}
+
+// Skips to the start of the next dimension pair, so the two values drawn next form a stratified
+// 2D point. Dimensions are counters, skipping one costs nothing.
+SAMPLING_FUNCTION void startPair(SamplerState* state)
+{
+	state->dimension = (state->dimension + 1u) & ~1u;
+}
+
+// Next dimension of the sample in [0, 1).
+SAMPLING_FUNCTION float nextFloat(SamplerState* state)
+{
+	unsigned int bits = state->sobol ? sobolOwen(state->pixel, state->sampleIndex, state->dimension)
+		: philox(state->sampleIndex, state->dimension, state->pixel);
+	state->dimension++;
+	return (bits >> 8) * (1.0f / 16777216.0f);
+}
+
+#endif
@@ -0,0 +1,345 @@
+// Wavefront path tracer: every stage is a separate kernel working on SoA path state and index
+// queues. Mirrors WavefrontRenderer on the host.
+
+#include "common.cl"
+
+// Slots of the counter buffer.
+#define COUNTER_DIFFUSE 0
+#define COUNTER_MIRROR 1
+#define COUNTER_GLASS 2
+#define COUNTER_SHADOW 3
+#define COUNTER_NEXT 4
+
+__kernel void generate(
+	uint firstPixel,
+	uint pathCount,
+	float4 cameraPosition,
+	float4 cameraForward,
+	float4 cameraRight,
+	float4 cameraUp,
+	float tanHalfFov,
+	uint width,
+	uint height,
+	uint sampleIndex,
+	__global float4* origins,
+	__global float4* directions,
+	__global float4* throughputs,
+	__global float4* radiances,
+	__global uint* pixels,
+	__global SamplerState* rngs,
+	__global uint* specularBounces,
+	__global uint* activeQueue)
+{
+	uint path = get_global_id(0);
+	if (path >= pathCount)
+	{
+		return;
+	}
+
+	uint pixel = firstPixel + path;
+	uint x = pixel % width;
+	uint y = pixel / width;
+	SamplerState rng = makeSampler(pixel, sampleIndex, SOBOL_SAMPLER);
+
+	float aspect = (float)width / height;
+	float u = (x + nextFloat(&rng)) / width;
+	float v = (y + nextFloat(&rng)) / height;
+	float sx = (2.0f * u - 1.0f) * tanHalfFov * aspect;
+	float sy = (1.0f - 2.0f * v) * tanHalfFov;
+
+	origins[path] = cameraPosition;
+	directions[path] = (float4)(normalize(cameraForward.xyz + cameraRight.xyz * sx + cameraUp.xyz * sy), 0.0f);
+	throughputs[path] = (float4)(1.0f);
+	radiances[path] = (float4)(0.0f);
+	pixels[path] = pixel;
+	rngs[path] = rng;
+	specularBounces[path] = 1;
+	activeQueue[path] = path;
+}
+
+__kernel void extend(
+	SCENE_PARAMETERS,
+	__global const uint* activeQueue,
+	uint activeCount,
+	__global const float4* origins,
+	__global const float4* directions,
+	__global float* hitDistances,
+	__global uint* hitPrimitives)
+{
+	uint i = get_global_id(0);
+	if (i >= activeCount)
+	{
+		return;
+	}
+	LOAD_SCENE(scene);
+
+	uint path = activeQueue[i];
+	Ray ray;
+	ray.origin = origins[path].xyz;
+	ray.direction = directions[path].xyz;
+	ray.tMin = 0.0f;
+	ray.tMax = INFINITY;
+	Hit hit;
+	hit.primitive = INVALID_INDEX;
+	traverse(&scene, &ray, &hit, false);
+	hitDistances[path] = hit.t;
+	hitPrimitives[path] = hit.primitive;
+}
+
+// Resolves misses and appends hits to the queue of their material type.
+__kernel void classify(
+	SCENE_PARAMETERS,
+	float4 background,
+	__global const uint* activeQueue,
+	uint activeCount,
+	uint queueCapacity,
+	__global const uint* hitPrimitives,
+	__global const float4* throughputs,
+	__global float4* radiances,
+	__global uint* alive,
+	__global uint* materialQueues,
+	__global uint* counters,
+	__global const float4* directions,
+	__global const uint* specularBounces)
+{
+	uint i = get_global_id(0);
+	if (i >= activeCount)
+	{
+		return;
+	}
+
+	uint path = activeQueue[i];
+	uint primitive = hitPrimitives[path];
+	if (primitive == INVALID_INDEX)
+	{
+		// A sampled environment is found by next-event estimation after diffuse bounces.
+		if (specularBounces[path] || environmentProbability == 0.0f)
+		{
+			LOAD_SCENE(scene);
+			float3 radiance = backgroundRadiance(&scene, directions[path].xyz, background.xyz);
+			radiances[path] += throughputs[path] * (float4)(radiance, 0.0f);
+		}
+		alive[path] = 0;
+		return;
+	}
+	uint type = materials[materialIds[primitive]].type;
+	uint slot = atomic_inc(&counters[type]);
+	materialQueues[type * queueCapacity + slot] = path;
+}
+
+typedef struct
+{
+	float3 position;
+	float3 n;
+	bool frontFace;
+	float3 albedo;
+	float ior;
+} SurfaceHit;
+
+// Reconstructs the hit point and adds emission seen through specular chains.
+SurfaceHit loadSurface(const SceneData* scene, uint path, __global const float4* origins, __global const float4* directions,
+	__global const float* hitDistances, __global const uint* hitPrimitives, __global const uint* specularBounces,
+	__global const float4* throughputs, __global float4* radiances)
+{
+	uint primitive = hitPrimitives[path];
+	__global const Material* material = &scene->materials[scene->materialIds[primitive]];
+	float3 direction = directions[path].xyz;
+	float3 normal = geometricNormal(scene, primitive);
+
+	SurfaceHit surface;
+	surface.position = origins[path].xyz + direction * hitDistances[path];
+	surface.frontFace = dot(normal, direction) < 0.0f;
+	surface.n = surface.frontFace ? normal : -normal;
+	surface.albedo = (float3)(material->albedo[0], material->albedo[1], material->albedo[2]);
+	surface.ior = material->ior;
+
+	float3 emission = (float3)(material->emission[0], material->emission[1], material->emission[2]);
+	if (specularBounces[path] && surface.frontFace && any(isgreater(emission, (float3)(0.0f))))
+	{
+		radiances[path] += throughputs[path] * (float4)(emission, 0.0f);
+	}
+	return surface;
+}
+
+uint russianRoulette(uint depth, __global float4* throughputs, uint path, SamplerState* rng)
+{
+	if (depth < 3)
+	{
+		return 1;
+	}
+	float4 throughput = throughputs[path];
+	float survival = fmin(0.95f, fmax(throughput.x, fmax(throughput.y, throughput.z)));
+	if (nextFloat(rng) >= survival)
+	{
+		return 0;
+	}
+	throughputs[path] = throughput / survival;
+	return 1;
+}
+
+#define SHADE_PARAMETERS \
+	SCENE_PARAMETERS, \
+	uint depth, \
+	__global const uint* materialQueues, \
+	uint queueOffset, \
+	__global uint* counters, \
+	__global float4* origins, \
+	__global float4* directions, \
+	__global float4* throughputs, \
+	__global float4* radiances, \
+	__global SamplerState* rngs, \
+	__global uint* specularBounces, \
+	__global uint* alive, \
+	__global const float* hitDistances, \
+	__global const uint* hitPrimitives
+
+__kernel void shadeDiffuse(
+	SHADE_PARAMETERS,
+	__global float4* shadowOrigins,
+	__global float4* shadowDirections,
+	__global float4* shadowContributions,
+	__global uint* shadowPaths)
+{
+	uint i = get_global_id(0);
+	if (i >= counters[COUNTER_DIFFUSE])
+	{
+		return;
+	}
+	LOAD_SCENE(scene);
+
+	uint path = materialQueues[queueOffset + i];
+	SurfaceHit surface = loadSurface(&scene, path, origins, directions, hitDistances, hitPrimitives, specularBounces, throughputs, radiances);
+	SamplerState rng = rngs[path];
+
+	if (scene.lightCount > 0 || scene.environmentProbability > 0.0f)
+	{
+		Ray shadow;
+		float3 radiance;
+		if (sampleLightConnection(&scene, surface.position, surface.n, &rng, &shadow, &radiance))
+		{
+			uint slot = atomic_inc(&counters[COUNTER_SHADOW]);
+			shadowOrigins[slot] = (float4)(shadow.origin, 0.0f);
+			shadowDirections[slot] = (float4)(shadow.direction, shadow.tMax);
+			shadowContributions[slot] = throughputs[path] * (float4)(surface.albedo * INV_PI * radiance, 0.0f);
+			shadowPaths[slot] = path;
+		}
+	}
+
+	origins[path] = (float4)(surface.position + surface.n * RAY_EPSILON, 0.0f);
+	startPair(&rng);
+	float u1 = nextFloat(&rng);
+	float u2 = nextFloat(&rng);
+	directions[path] = (float4)(cosineSampleHemisphere(surface.n, u1, u2), 0.0f);
+	throughputs[path] *= (float4)(surface.albedo, 1.0f);
+	specularBounces[path] = 0;
+	alive[path] = russianRoulette(depth, throughputs, path, &rng);
+	rngs[path] = rng;
+}
+
+__kernel void shadeMirror(SHADE_PARAMETERS)
+{
+	uint i = get_global_id(0);
+	if (i >= counters[COUNTER_MIRROR])
+	{
+		return;
+	}
+	LOAD_SCENE(scene);
+
+	uint path = materialQueues[queueOffset + i];
+	SurfaceHit surface = loadSurface(&scene, path, origins, directions, hitDistances, hitPrimitives, specularBounces, throughputs, radiances);
+	SamplerState rng = rngs[path];
+	float3 direction = directions[path].xyz;
+
+	origins[path] = (float4)(surface.position + surface.n * RAY_EPSILON, 0.0f);
+	directions[path] = (float4)(direction - surface.n * (2.0f * dot(direction, surface.n)), 0.0f);
+	throughputs[path] *= (float4)(surface.albedo, 1.0f);
+	specularBounces[path] = 1;
+	alive[path] = russianRoulette(depth, throughputs, path, &rng);
+	rngs[path] = rng;
+}
+
+__kernel void shadeGlass(SHADE_PARAMETERS)
+{
+	uint i = get_global_id(0);
+	if (i >= counters[COUNTER_GLASS])
+	{
+		return;
+	}
+	LOAD_SCENE(scene);
+
+	uint path = materialQueues[queueOffset + i];
+	SurfaceHit surface = loadSurface(&scene, path, origins, directions, hitDistances, hitPrimitives, specularBounces, throughputs, radiances);
+	SamplerState rng = rngs[path];
+
+	float eta = surface.frontFace ? 1.0f / surface.ior : surface.ior;
+	float3 direction;
+	bool refracted = sampleDielectric(directions[path].xyz, surface.n, eta, nextFloat(&rng), &direction);
+	origins[path] = (float4)(surface.position + (refracted ? -surface.n : surface.n) * RAY_EPSILON, 0.0f);
+	directions[path] = (float4)(direction, 0.0f);
+	throughputs[path] *= (float4)(surface.albedo, 1.0f);
+	specularBounces[path] = 1;
+	alive[path] = russianRoulette(depth, throughputs, path, &rng);
+	rngs[path] = rng;
+}
+
+// Traces the queued shadow rays; every path owns at most one entry so the radiance update does not race.
+__kernel void connect(
+	SCENE_PARAMETERS,
+	__global const uint* counters,
+	__global const float4* shadowOrigins,
+	__global const float4* shadowDirections,
+	__global const float4* shadowContributions,
+	__global const uint* shadowPaths,
+	__global float4* radiances)
+{
+	uint i = get_global_id(0);
+	if (i >= counters[COUNTER_SHADOW])
+	{
+		return;
+	}
+	LOAD_SCENE(scene);
+
+	Ray shadow;
+	shadow.origin = shadowOrigins[i].xyz;
+	shadow.direction = shadowDirections[i].xyz;
+	shadow.tMin = 0.0f;
+	shadow.tMax = shadowDirections[i].w;
+	Hit unused;
+	if (!traverse(&scene, &shadow, &unused, true))
+	{
+		radiances[shadowPaths[i]] += shadowContributions[i];
+	}
+}
+
+__kernel void compact(
+	__global const uint* activeQueue,
+	uint activeCount,
+	__global const uint* alive,
+	__global uint* nextQueue,
+	__global uint* counters)
+{
+	uint i = get_global_id(0);
+	if (i >= activeCount)
+	{
+		return;
+	}
+	uint path = activeQueue[i];
+	if (alive[path])
+	{
+		nextQueue[atomic_inc(&counters[COUNTER_NEXT])] = path;
+	}
+}
+
+__kernel void accumulate(
+	uint pathCount,
+	__global const uint* pixels,
+	__global const float4* radiances,
+	__global float4* accumulation)
+{
+	uint path = get_global_id(0);
+	if (path >= pathCount)
+	{
+		return;
+	}
+	accumulation[pixels[path]] += (float4)(radiances[path].xyz, 1.0f);
+}
@@ -1,21 +1,1060 @@
-
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Accelerator.h"
+#include "Bvh.h"
+#include "Checkpoint.h"
+#include "CpuRenderer.h"
+#include "Denoiser.h"
+#include "EnvironmentMap.h"
+#include "ImageIO.h"
+#include "ImageWriter.h"
+#include "InstanceBvh.h"
+#include "Lights.h"
+#include "PagedBvh.h"
+#include "ProceduralScenes.h"
+#include "SceneCache.h"
+#include "SceneLoader.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+#include "WavefrontRenderer.h"
+
+#ifdef PTGPU_HAS_OPENGL
+#include "TextureStream.h"
+#endif
+
+#ifdef PTGPU_HAS_EGL
+#include "EglContext.h"
+#endif
+
+#ifdef PTGPU_HAS_OPENCL
+#include "ClRenderer.h"
+#include "ClWavefrontRenderer.h"
+#endif
+
+struct Options
+{
+	bool openCl = false;
+	bool wavefront = false;
+	std::string clDevice = "any";
+	// Batch mode: renders without touching OpenGL until samplesPerPixel or timeBudget is reached.
+	bool headless = false;
+	uint32_t samplesPerPixel = 0;
+	double timeBudget = 0.0;
+	std::string output;
+	// Render passes written to .exr outputs, and whether their colors are stored as half floats. The
+	// framebuffer still accumulates 32 bit floats: its planes hold per pixel sums, and a half float
+	// sum of samples near 1 stops growing after some 2048 samples.
+	AovMask aovs = aovBit(Aov::Beauty);
+	bool halfFloat = false;
+	// Headless: writes the output every this many passes while the render goes on, 0 only at the end.
+	uint32_t outputInterval = 0;
+	// Headless: file the accumulated samples are saved to every checkpointInterval passes and at the
+	// end, and with resume restored from before rendering.
+	std::string checkpoint;
+	uint32_t checkpointInterval = 16;
+	bool resume = false;
+	// Background threads encoding and writing files.
+	uint32_t writerThreads = 2;
+	// Render threads including the main thread; 0 uses every hardware thread.
+	uint32_t threads = 0;
+	SamplerType sampler = SamplerType::Sobol;
+	// Adaptive sampling threshold on the relative error, 0 disables it.
+	float adaptiveThreshold = 0.0f;
+	uint32_t adaptiveMinSamples = 16;
+	std::string convergenceMask;
+	// Wavefront pipeline: Morton sort of the secondary rays before traversal.
+	bool sortRays = false;
+	// Traces coherent rays as 8-wide packets; off traces every ray on its own.
+	bool packetTraversal = true;
+	// Picks lights with a light tree; off picks them by area.
+	bool lightTree = true;
+	// Renders with 1, 4 and 64 threads and fails unless the images are bit-identical.
+	bool checkDeterminism = false;
+	// OBJ or PLY file, or the name of a procedural scene, rendered instead of the Cornell box.
+	std::string scene;
+	// Binary scene cache, mapped instead of rebuilding the scene and BVH when it is current.
+	std::string sceneCache;
+	// Lat-long .pfm or .ppm radiance map lighting the scene in place of its background.
+	std::string environment;
+	// Out-of-core geometry: budget of resident geometry pages from the scene cache, 0 keeps the whole
+	// BVH in memory, and the size the pages are cut to. A budget selects the wavefront pipeline unless
+	// another is asked for, since only its batched traversal defers rays whose pages are still loading.
+	size_t pageBudgetMiB = 0;
+	size_t pageSizeKiB = 256;
+	// Resident texture tiles; textures are read tile by tile as rays reach them.
+	size_t textureBudgetMiB = 512;
+	// Denoises the preview every this many passes and the final image; 0 shows the samples as they are.
+	uint32_t denoiseInterval = 0;
+	// Display path: force Mesa llvmpipe and compare the streamed texture with the resolved image.
+	bool glSoftware = false;
+	bool verifyDisplay = false;
+	// CPU traversal layout, compressed layouts quantize the wide node bounds to 8 bits.
+	AcceleratorKind acceleratorKind = AcceleratorKind::Auto;
+};
+
+void printUsage()
+{
+	std::cerr << "Usage: PTGPU [--backend cpu|opencl] [--pipeline tile|wavefront] [--cl-device any|gpu|cpu]\n"
+		"             [--headless] [--spp samples] [--time seconds] [--output image.ppm|image.png|image.pfm|image.exr]\n"
+		"             [--aovs beauty,emission,albedo,normal,depth,id,samples,variance|all] [--half] [--output-interval passes]\n"
+		"             [--checkpoint file] [--checkpoint-interval passes] [--resume] [--writer-threads count]\n"
+		"             [--gl-software] [--verify-display] [--scene file.obj|file.ply|cornell|sphereflake|forest|terrain|city] [--scene-cache file]\n"
+		"             [--environment image.pfm|image.ppm] [--denoise passes]\n"
+		"             [--sampler sobol|random] [--check-determinism] [--threads count]\n"
+		"             [--adaptive threshold] [--adaptive-min-spp samples] [--convergence-mask image]\n"
+		"             [--bvh auto|bvh2|bvh4|bvh8|compressed|cbvh4|cbvh8] [--sort-rays] [--no-packets]\n"
+		"             [--page-budget MiB] [--page-size KiB] [--texture-budget MiB] [--no-light-tree]\n"
+		"--half rounds the .exr channels to half floats as they are written; the render accumulates 32 bit floats." << std::endl;
+}
+
+bool parseAcceleratorKind(const std::string& name, AcceleratorKind& kind)
+{
+	const std::pair<const char*, AcceleratorKind> kinds[] = {
+		{"auto", AcceleratorKind::Auto},
+		{"bvh2", AcceleratorKind::Binary},
+		{"bvh4", AcceleratorKind::Wide4},
+		{"bvh8", AcceleratorKind::Wide8},
+		{"compressed", AcceleratorKind::Compressed},
+		{"cbvh4", AcceleratorKind::Compressed4},
+		{"cbvh8", AcceleratorKind::Compressed8},
+	};
+	for (const auto& entry : kinds)
+	{
+		if (name == entry.first)
+		{
+			kind = entry.second;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Count argument of option, which has to fit 32 bits; exits with a message otherwise.
+uint32_t parseCount(const char* option, const char* text)
+{
+	unsigned long value = std::strtoul(text, nullptr, 10);
+	if (value > std::numeric_limits<uint32_t>::max())
+	{
+		std::cerr << option << " " << text << " is out of range" << std::endl;
+		std::exit(1);
+	}
+	return static_cast<uint32_t>(value);
+}
+
+Options parseOptions(int argc, char** argv)
+{
+	Options options;
+	bool pipelineGiven = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+		{
+			options.openCl = std::strcmp(argv[++i], "opencl") == 0;
+		}
+		else if (std::strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc)
+		{
+			options.wavefront = std::strcmp(argv[++i], "wavefront") == 0;
+			pipelineGiven = true;
+		}
+		else if (std::strcmp(argv[i], "--cl-device") == 0 && i + 1 < argc)
+		{
+			options.clDevice = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--headless") == 0)
+		{
+			options.headless = true;
+		}
+		else if (std::strcmp(argv[i], "--spp") == 0 && i + 1 < argc)
+		{
+			options.samplesPerPixel = parseCount("--spp", argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--time") == 0 && i + 1 < argc)
+		{
+			options.timeBudget = std::strtod(argv[++i], nullptr);
+		}
+		else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+		{
+			options.output = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--aovs") == 0 && i + 1 < argc)
+		{
+			try
+			{
+				options.aovs = parseAovs(argv[++i]);
+			}
+			catch (const std::exception& e)
+			{
+				std::cerr << e.what() << std::endl;
+				std::exit(1);
+			}
+		}
+		else if (std::strcmp(argv[i], "--half") == 0)
+		{
+			options.halfFloat = true;
+		}
+		else if (std::strcmp(argv[i], "--output-interval") == 0 && i + 1 < argc)
+		{
+			options.outputInterval = parseCount("--output-interval", argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+		{
+			options.checkpoint = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc)
+		{
+			options.checkpointInterval = std::max(1u, parseCount("--checkpoint-interval", argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--resume") == 0)
+		{
+			options.resume = true;
+		}
+		else if (std::strcmp(argv[i], "--writer-threads") == 0 && i + 1 < argc)
+		{
+			options.writerThreads = std::max(1u, parseCount("--writer-threads", argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--sampler") == 0 && i + 1 < argc)
+		{
+			options.sampler = std::strcmp(argv[++i], "random") == 0 ? SamplerType::Random : SamplerType::Sobol;
+		}
+		else if (std::strcmp(argv[i], "--adaptive") == 0 && i + 1 < argc)
+		{
+			options.adaptiveThreshold = std::strtof(argv[++i], nullptr);
+		}
+		else if (std::strcmp(argv[i], "--adaptive-min-spp") == 0 && i + 1 < argc)
+		{
+			options.adaptiveMinSamples = parseCount("--adaptive-min-spp", argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--convergence-mask") == 0 && i + 1 < argc)
+		{
+			options.convergenceMask = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			options.threads = parseCount("--threads", argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--check-determinism") == 0)
+		{
+			options.checkDeterminism = true;
+		}
+		else if (std::strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+		{
+			options.scene = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--environment") == 0 && i + 1 < argc)
+		{
+			options.environment = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--denoise") == 0 && i + 1 < argc)
+		{
+			options.denoiseInterval = parseCount("--denoise", argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--scene-cache") == 0 && i + 1 < argc)
+		{
+			options.sceneCache = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--page-budget") == 0 && i + 1 < argc)
+		{
+			options.pageBudgetMiB = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--page-size") == 0 && i + 1 < argc)
+		{
+			options.pageSizeKiB = std::max<size_t>(4, std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+		{
+			options.textureBudgetMiB = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--gl-software") == 0)
+		{
+			options.glSoftware = true;
+		}
+		else if (std::strcmp(argv[i], "--verify-display") == 0)
+		{
+			options.verifyDisplay = true;
+		}
+		else if (std::strcmp(argv[i], "--sort-rays") == 0)
+		{
+			options.sortRays = true;
+		}
+		else if (std::strcmp(argv[i], "--no-packets") == 0)
+		{
+			options.packetTraversal = false;
+		}
+		else if (std::strcmp(argv[i], "--no-light-tree") == 0)
+		{
+			options.lightTree = false;
+		}
+		else if (std::strcmp(argv[i], "--bvh") == 0 && i + 1 < argc && parseAcceleratorKind(argv[i + 1], options.acceleratorKind))
+		{
+			++i;
+		}
+		else
+		{
+			printUsage();
+			std::exit(1);
+		}
+	}
+	for (const std::string& image : {options.output, options.convergenceMask})
+	{
+		if (!image.empty() && !isSupportedImage(image))
+		{
+			std::cerr << "Unsupported output format: " << image << " (expected .ppm, .png, .pfm or .exr)" << std::endl;
+			std::exit(1);
+		}
+	}
+	if ((options.aovs != aovBit(Aov::Beauty) || options.halfFloat) && !isLayeredImage(options.output))
+	{
+		std::cerr << "Render passes and half floats need an .exr output" << std::endl;
+		std::exit(1);
+	}
+	if (options.resume && options.checkpoint.empty())
+	{
+		std::cerr << "--resume needs the --checkpoint to resume from" << std::endl;
+		std::exit(1);
+	}
+	if (!options.scene.empty() && !isSceneFile(options.scene) && !isProceduralScene(options.scene))
+	{
+		std::cerr << "Unsupported scene: " << options.scene << " (expected .obj, .ply, cornell, sphereflake, forest, terrain or city)" << std::endl;
+		std::exit(1);
+	}
+	if (options.pageBudgetMiB > 0 && !options.openCl && !options.wavefront)
+	{
+		if (pipelineGiven)
+		{
+			std::cout << "The tile pipeline waits for every geometry page it misses, --pipeline wavefront defers those rays instead" << std::endl;
+		}
+		else
+		{
+			options.wavefront = true;
+		}
+	}
+	if (options.samplesPerPixel == 0 && options.timeBudget <= 0.0)
+	{
+		// With adaptive sampling the sample count is only a cap, convergence usually ends the render.
+		options.samplesPerPixel = options.adaptiveThreshold > 0.0f ? 4096 : 16;
+	}
+#ifndef PTGPU_HAS_OPENGL
+	options.headless = true;
+#endif
+	return options;
+}
+
+void printPass(const RenderStats& stats, const Timer& startup)
+{
+	if (stats.passes == 1)
+	{
+		std::cout << "time to first sample: " << startup.milliseconds() << " ms" << std::endl;
+	}
+	std::cout << "pass " << stats.passes << ": " << stats.samplesPerSecond() / 1e6 << " Msamples/s, "
+		<< stats.raysPerSecond() / 1e6 << " Mrays/s" << std::endl;
+}
+
+// The sample count and time budget cover the whole render, including the passes before a resume.
+bool finished(const Options& options, const Renderer& renderer)
+{
+	const RenderStats& stats = renderer.stats();
+	if (renderer.converged() || (options.samplesPerPixel > 0 && stats.passes >= options.samplesPerPixel))
+	{
+		return true;
+	}
+	return options.timeBudget > 0.0 && stats.seconds >= options.timeBudget;
+}
+
+void writeConvergenceMask(const Renderer& renderer, const Options& options)
+{
+	if (options.convergenceMask.empty())
+	{
+		return;
+	}
+	const RenderSettings& settings = renderer.settings();
+	std::vector<float> mask(4 * static_cast<size_t>(settings.width) * settings.height);
+	if (!renderer.convergenceMask(mask.data()))
+	{
+		std::cerr << "The " << renderer.name() << " renderer has no adaptive sampling, no convergence mask written" << std::endl;
+		return;
+	}
+	writeImage(options.convergenceMask, settings.width, settings.height, mask.data());
+	std::cout << "Wrote " << options.convergenceMask << std::endl;
+}
+
+// Resolves renderer into pixels through denoiser, or as it is without one. Renderers without denoising
+// features are reported and have denoiser dropped.
+void resolveImage(const Renderer& renderer, std::unique_ptr<Denoiser>& denoiser, float* pixels)
+{
+	if (!denoiser)
+	{
+		renderer.resolve(pixels);
+	}
+	else if (!denoiser->denoise(renderer, pixels))
+	{
+		std::cerr << "The " << renderer.name() << " renderer records no denoising features, the image is not denoised" << std::endl;
+		denoiser.reset();
+	}
+}
+
+// Image written to --output: the resolved pixels, plus the render passes of --aovs for .exr outputs.
+struct OutputImage
+{
+	std::vector<float> pixels;
+	LayeredImage layers;
+};
+
+// Adds the layers of image, sized and with its pixels resolved, from those pixels and the passes
+// recorded by renderer. Returns the requested passes that renderer could not write.
+AovMask resolvePasses(const Renderer& renderer, const Options& options, OutputImage& image)
+{
+	if (!isLayeredImage(options.output))
+	{
+		return 0;
+	}
+	if (options.aovs & aovBit(Aov::Beauty))
+	{
+		image.layers.addRgb("", image.pixels.data(), options.halfFloat);
+	}
+	AovMask passes = options.aovs & ~aovBit(Aov::Beauty);
+	return passes & ~renderer.resolveAovs(passes, options.halfFloat, image.layers);
+}
+
+// Resolves renderer into image as resolveImage does, then adds its passes as resolvePasses does.
+AovMask captureOutput(const Renderer& renderer, const Options& options, std::unique_ptr<Denoiser>& denoiser, OutputImage& image)
+{
+	const RenderSettings& settings = renderer.settings();
+	image.pixels.resize(4 * static_cast<size_t>(settings.width) * settings.height);
+	image.layers.width = settings.width;
+	image.layers.height = settings.height;
+	resolveImage(renderer, denoiser, image.pixels.data());
+	return resolvePasses(renderer, options, image);
+}
+
+// Writes image to path, compressing .exr files over pool when one is given.
+void writeOutput(const std::string& path, const OutputImage& image, ThreadPool* pool = nullptr)
+{
+	if (isLayeredImage(path))
+	{
+		writeExr(path, image.layers, pool);
+	}
+	else
+	{
+		writeImage(path, image.layers.width, image.layers.height, image.pixels.data());
+	}
+}
+
+void reportMissingPasses(const Renderer& renderer, AovMask missing)
+{
+	for (uint32_t aov = 0; aov < static_cast<uint32_t>(Aov::Count); ++aov)
+	{
+		if (missing & aovBit(static_cast<Aov>(aov)))
+		{
+			std::cerr << "The " << renderer.name() << " renderer does not record the " << aovName(static_cast<Aov>(aov)) << " pass" << std::endl;
+		}
+	}
+}
+
+// Set by the first interrupt of a headless render with --checkpoint, which then stops after the pass it
+// is in and writes its checkpoint and output; a second interrupt ends the process.
+volatile std::sig_atomic_t interrupted = 0;
+
+void onInterrupt(int)
+{
+	interrupted = 1;
+	std::signal(SIGINT, SIG_DFL);
+}
+
+// What the samples of a checkpoint depend on besides its renderer state; resuming with anything else
+// would blend two different images.
+std::string describeRender(const Renderer& renderer, const Options& options)
+{
+	const RenderSettings& settings = renderer.settings();
+	std::ostringstream description;
+	description << "renderer " << renderer.name() << "\nscene " << (options.scene.empty() ? "cornell" : options.scene) << "\nenvironment "
+		<< options.environment << "\nresolution " << settings.width << "x" << settings.height << "\ntile size " << settings.tileSize
+		<< "\nmax depth " << settings.maxDepth << "\nsampler " << static_cast<int>(settings.sampler) << "\nadaptive " << settings.adaptiveThreshold
+		<< " after " << settings.adaptiveMinSamples << "\npackets " << settings.packetTraversal << "\nsort rays " << settings.sortRays
+		<< "\nlight tree " << settings.lightTree << "\nbvh " << static_cast<int>(options.acceleratorKind) << "\npasses " << settings.aovs << "\n";
+	return description.str();
+}
+
+// Continues renderer from --checkpoint. Throws std::runtime_error when the checkpoint is missing or
+// was taken from another render.
+void resumeRender(Renderer& renderer, const Options& options)
+{
+	RenderCheckpoint checkpoint;
+	if (!readCheckpoint(options.checkpoint, checkpoint))
+	{
+		throw std::runtime_error("No checkpoint to resume from at " + options.checkpoint);
+	}
+	std::string description = describeRender(renderer, options);
+	if (checkpoint.description != description)
+	{
+		throw std::runtime_error(options.checkpoint + " is the checkpoint of another render:\n" + checkpoint.description + "this render is:\n"
+			+ description);
+	}
+	if (!renderer.restoreCheckpoint(checkpoint))
+	{
+		throw std::runtime_error("The " + std::string(renderer.name()) + " renderer cannot resume from " + options.checkpoint);
+	}
+	std::cout << "Resumed from " << options.checkpoint << " after " << checkpoint.stats.passes << " passes" << std::endl;
+}
+
+// Queues a copy of the checkpoint of renderer for writing.
+void submitCheckpoint(ImageWriter& writer, const Renderer& renderer, const Options& options, bool wait)
+{
+	auto checkpoint = std::make_shared<RenderCheckpoint>();
+	checkpoint->description = describeRender(renderer, options);
+	renderer.saveCheckpoint(*checkpoint);
+	writer.submit(options.checkpoint, [checkpoint](const std::string& file, ThreadPool& pool) { writeCheckpoint(file, *checkpoint, &pool); }, wait);
+}
+
+void printWriteErrors(ImageWriter& writer)
+{
+	for (const std::string& error : writer.takeErrors())
+	{
+		std::cerr << error << std::endl;
+	}
+}
+
+// Renders until the sample count or time budget is reached, then writes the image and a summary that
+// batch queues can parse. With --output-interval and --checkpoint-interval the image and checkpoint
+// are also written every so many passes. Between passes they are only copied out; the writer threads
+// encode, compress and write them while the next passes render, and one that comes due while the
+// previous write of its file is still going on is skipped.
+void renderHeadless(Renderer& renderer, const Options& options, const Timer& startup, ThreadPool& pool)
+{
+	const RenderSettings& settings = renderer.settings();
+	std::unique_ptr<Denoiser> denoiser;
+	if (options.denoiseInterval > 0)
+	{
+		denoiser = std::make_unique<Denoiser>(settings.width, settings.height, pool);
+	}
+	bool checkpoints = !options.checkpoint.empty();
+	if (checkpoints)
+	{
+		RenderCheckpoint probe;
+		if (!renderer.saveCheckpoint(probe))
+		{
+			throw std::runtime_error("The " + std::string(renderer.name()) + " renderer does not support checkpoints");
+		}
+		if (options.resume)
+		{
+			resumeRender(renderer, options);
+		}
+		std::signal(SIGINT, onInterrupt);
+	}
+
+	ImageWriter writer(options.writerThreads, 2 * options.writerThreads);
+	uint32_t snapshotCount = 0;
+	uint32_t checkpointCount = 0;
+	while (!finished(options, renderer) && !interrupted)
+	{
+		renderer.renderPass();
+		printPass(renderer.stats(), startup);
+		printWriteErrors(writer);
+		uint32_t passes = renderer.stats().passes;
+		if (finished(options, renderer) || interrupted)
+		{
+			break;
+		}
+		if (checkpoints && passes % options.checkpointInterval == 0)
+		{
+			if (writer.canSubmit(options.checkpoint))
+			{
+				submitCheckpoint(writer, renderer, options, false);
+				checkpointCount++;
+			}
+			else
+			{
+				std::cout << "pass " << passes << ": previous checkpoint still being written, skipped" << std::endl;
+			}
+		}
+		if (!options.output.empty() && options.outputInterval > 0 && passes % options.outputInterval == 0)
+		{
+			if (writer.canSubmit(options.output))
+			{
+				auto snapshot = std::make_shared<OutputImage>();
+				captureOutput(renderer, options, denoiser, *snapshot);
+				writer.submit(options.output, [snapshot](const std::string& file, ThreadPool& compression) { writeOutput(file, *snapshot, &compression); }, false);
+				snapshotCount++;
+			}
+			else
+			{
+				std::cout << "pass " << passes << ": previous snapshot still being written, skipped" << std::endl;
+			}
+		}
+	}
+
+	Timer timer;
+	if (checkpoints)
+	{
+		submitCheckpoint(writer, renderer, options, true);
+	}
+	auto image = std::make_shared<OutputImage>();
+	AovMask missing = captureOutput(renderer, options, denoiser, *image);
+	if (!options.output.empty())
+	{
+		reportMissingPasses(renderer, missing);
+		writer.submit(options.output, [image](const std::string& file, ThreadPool& compression) { writeOutput(file, *image, &compression); }, true);
+	}
+	writeConvergenceMask(renderer, options);
+	writer.flush();
+	std::vector<std::string> errors = writer.takeErrors();
+	for (const std::string& error : errors)
+	{
+		std::cerr << error << std::endl;
+	}
+	if (!errors.empty())
+	{
+		throw std::runtime_error("Output not written");
+	}
+	if (!options.output.empty())
+	{
+		std::cout << "Wrote " << options.output << std::endl;
+	}
+	if (checkpoints)
+	{
+		std::cout << "Wrote " << options.checkpoint << std::endl;
+	}
+	double outputSeconds = timer.seconds();
+
+	const RenderStats& stats = renderer.stats();
+	std::cout << "renderer: " << renderer.name() << "\n"
+		<< "resolution: " << settings.width << "x" << settings.height << "\n"
+		<< "spp: " << stats.passes << "\n"
+		<< "samples: " << stats.pathSamples << "\n"
+		<< "render seconds: " << stats.seconds << "\n"
+		<< "output seconds: " << outputSeconds << "\n"
+		<< "Msamples/s: " << stats.samplesPerSecond() / 1e6 << "\n"
+		<< "Mrays/s: " << stats.raysPerSecond() / 1e6 << std::endl;
+	if (options.outputInterval > 0)
+	{
+		std::cout << "snapshots: " << snapshotCount << std::endl;
+	}
+	if (checkpoints)
+	{
+		std::cout << "checkpoints: " << checkpointCount + 1 << std::endl;
+	}
+	if (denoiser)
+	{
+		std::cout << "denoise seconds: " << denoiser->lastSeconds() << std::endl;
+	}
+	if (interrupted)
+	{
+		std::cout << "interrupted after " << stats.passes << " passes, continue with --resume" << std::endl;
+	}
+}
+
+#ifdef PTGPU_HAS_OPENGL
+// Streams every pass into a texture. Without a window system the context is an offscreen EGL one.
+void renderInteractive(Renderer& renderer, const Options& options, const Timer& startup, ThreadPool& pool)
+{
+	const RenderSettings& settings = renderer.settings();
+#ifdef PTGPU_HAS_EGL
+	EglContext context(options.glSoftware);
+	std::cout << "OpenGL: " << context.renderer() << std::endl;
+#endif
+	TextureStream stream(settings);
+	std::cout << "Texture upload: " << (stream.persistent() ? "persistent mapped" : "mapped per frame") << " pixel buffer ring" << std::endl;
 
-#include <OpenGL/gl3.h>
+	// With --denoise the display shows the first pass and then changes every denoiseInterval passes,
+	// filtered as a whole.
+	std::unique_ptr<Denoiser> denoiser;
+	if (options.denoiseInterval > 0)
+	{
+		denoiser = std::make_unique<Denoiser>(settings.width, settings.height, pool);
+	}
+	std::vector<float> pixels(4 * static_cast<size_t>(settings.width) * settings.height);
+	while (!finished(options, renderer))
+	{
+		renderer.renderPass();
+		if (!denoiser)
+		{
+			stream.update(renderer);
+		}
+		else if ((renderer.stats().passes == 1 || renderer.stats().passes % options.denoiseInterval == 0) && !finished(options, renderer))
+		{
+			stream.updateFrame([&](float* rgba) { resolveImage(renderer, denoiser, rgba); });
+		}
+		printPass(renderer.stats(), startup);
+	}
+	resolveImage(renderer, denoiser, pixels.data());
+	if (denoiser)
+	{
+		stream.updateFrame([&](float* rgba) { std::copy(pixels.begin(), pixels.end(), rgba); });
+		std::cout << "denoiser: " << denoiser->frames() << " frames, " << 1e3 * denoiser->totalSeconds() / denoiser->frames() << " ms per frame ("
+			<< denoiser->kernelName() << ")" << std::endl;
+	}
+	glFinish();
+	std::cout << "display: " << stream.frames() << " uploads, " << 1e3 * stream.uploadSeconds() / std::max(1u, stream.frames()) << " ms and "
+		<< stream.uploadedBytes() / (1024.0 * 1024.0) / std::max(1u, stream.frames()) << " MiB per upload" << std::endl;
 
-#ifndef GL_SILENCE_DEPRECATION
-#define GL_SILENCE_DEPRECATION
+	if (options.verifyDisplay)
+	{
+		std::vector<float> texels;
+		stream.readBack(texels);
+		float maxError = 0.0f;
+		for (size_t i = 0; i < pixels.size(); ++i)
+		{
+			maxError = std::max(maxError, std::abs(pixels[i] - texels[i]));
+		}
+		std::cout << "display verification: max error " << maxError << std::endl;
+		if (maxError > 0.0f)
+		{
+			throw std::runtime_error("Streamed texture does not match the resolved image");
+		}
+	}
+	if (!options.output.empty())
+	{
+		OutputImage image;
+		image.pixels = std::move(pixels);
+		image.layers.width = settings.width;
+		image.layers.height = settings.height;
+		reportMissingPasses(renderer, resolvePasses(renderer, options, image));
+		writeOutput(options.output, image);
+	}
+	writeConvergenceMask(renderer, options);
+}
 #endif
 
-int main()
+// Renders the scene with several thread counts, building the BVH with each, and compares the images
+// bit for bit, denoised with --denoise. Scheduling must not leak into the result.
+int checkDeterminism(const Options& options, const Scene& scene, const RenderSettings& settings, const TextureCache* textures,
+	const EnvironmentMap* environment)
+{
+	const uint32_t threadCounts[] = {1, 4, 64};
+	std::vector<float> reference;
+	bool identical = true;
+	for (uint32_t threads : threadCounts)
+	{
+		ThreadPool pool(threads);
+		std::unique_ptr<Bvh> bvh;
+		std::unique_ptr<Accelerator> accelerator;
+		if (scene.instanced())
+		{
+			accelerator = std::make_unique<InstanceBvh>(scene, pool, options.acceleratorKind);
+		}
+		else
+		{
+			bvh = std::make_unique<Bvh>(scene, pool);
+			accelerator = createAccelerator(*bvh, options.acceleratorKind);
+		}
+		LightSet lights = options.lightTree ? LightSet(scene, pool, environment) : LightSet(scene, environment);
+		std::unique_ptr<Renderer> renderer;
+		if (options.wavefront)
+		{
+			renderer = std::make_unique<WavefrontRenderer>(scene, *accelerator, pool, settings, textures, &lights);
+		}
+		else
+		{
+			renderer = std::make_unique<CpuRenderer>(scene, *accelerator, pool, settings, textures, &lights);
+		}
+		while (!finished(options, *renderer))
+		{
+			renderer->renderPass();
+		}
+
+		std::vector<float> pixels(4 * static_cast<size_t>(settings.width) * settings.height);
+		std::unique_ptr<Denoiser> denoiser;
+		if (options.denoiseInterval > 0)
+		{
+			denoiser = std::make_unique<Denoiser>(settings.width, settings.height, pool);
+		}
+		resolveImage(*renderer, denoiser, pixels.data());
+		if (reference.empty())
+		{
+			reference = pixels;
+		}
+		size_t mismatches = 0;
+		for (size_t i = 0; i < pixels.size(); ++i)
+		{
+			mismatches += std::memcmp(&pixels[i], &reference[i], sizeof(float)) != 0;
+		}
+		std::cout << "threads " << threads << ": " << renderer->stats().passes << " spp, " << mismatches << " mismatching channels" << std::endl;
+		identical = identical && mismatches == 0;
+	}
+	std::cout << "determinism: " << (identical ? "passed" : "FAILED") << std::endl;
+	return identical ? 0 : 1;
+}
+
+// Scene and BVH, either built in memory or mapped from the scene cache. Instanced scenes are always
+// built in memory and get a two-level InstanceBvh instead of the BVH.
+struct LoadedScene
+{
+	Scene built;
+	std::unique_ptr<Bvh> builtBvh;
+	std::unique_ptr<SceneCache> cache;
+	// Kept when it was built for writing the cache, in the requested layout.
+	std::unique_ptr<Accelerator> accelerator;
+	std::unique_ptr<InstanceBvh> instanceBvh;
+	// Light tree, when it was built alongside the BVH.
+	std::unique_ptr<LightSet> lights;
+
+	const Scene& scene() const { return cache ? cache->scene() : built; }
+	const Bvh& bvh() const { return cache ? cache->bvh() : *builtBvh; }
+
+	std::unique_ptr<Accelerator> takeAccelerator(AcceleratorKind kind)
+	{
+		if (instanceBvh)
+		{
+			return std::move(instanceBvh);
+		}
+		if (accelerator)
+		{
+			return std::move(accelerator);
+		}
+		return cache ? cache->createAccelerator(kind) : createAccelerator(*builtBvh, kind);
+	}
+};
+
+// Builds the light tree of a scene built in memory as a task of its own, so that it runs while the
+// BVH build takes the rest of the pool. The OpenCL kernels pick lights by area.
+void startLightTree(LoadedScene& loaded, const Options& options, ThreadPool& pool, TaskGroup& group, const EnvironmentMap* environment)
 {
-	std::cout << "Hello, World!" << std::endl;
+	if (options.lightTree && !options.openCl)
+	{
+		pool.run(group, [&loaded, &pool, environment] { loaded.lights = std::make_unique<LightSet>(loaded.built, pool, environment); });
+	}
+}
 
-	GLuint textureReference;
-	glGenTextures(1, &textureReference);
+std::unique_ptr<LoadedScene> loadScene(const Options& options, ThreadPool& pool, const EnvironmentMap* environment)
+{
+	auto loaded = std::make_unique<LoadedScene>();
+	BvhBuildSettings settings;
+	bool fileScene = !options.scene.empty() && isSceneFile(options.scene);
+	if (!fileScene)
+	{
+		loaded->built = options.scene.empty() ? makeCornellBox() : makeProceduralScene(options.scene);
+	}
+	bool useCache = !options.sceneCache.empty();
+	if (!useCache && options.pageBudgetMiB > 0)
+	{
+		std::cout << "Geometry paging reads from the scene cache, without --scene-cache the BVH stays in memory" << std::endl;
+	}
+	if (useCache && loaded->built.instanced())
+	{
+		std::cout << "The scene cache does not store instanced scenes, building in memory" << std::endl;
+		useCache = false;
+	}
+	uint64_t key = 0;
+	if (useCache)
+	{
+		// A file scene is keyed by the file itself, so a current cache skips parsing entirely.
+		key = fileScene ? fileSourceKey(options.scene, settings) : sceneSourceKey(loaded->built, settings);
+		loaded->cache = SceneCache::open(options.sceneCache, key);
+		if (loaded->cache && options.pageBudgetMiB > 0 && !loaded->cache->hasPages())
+		{
+			std::cout << "Scene cache " << options.sceneCache << " has no geometry pages, rebuilding it" << std::endl;
+			loaded->cache.reset();
+		}
+		if (loaded->cache)
+		{
+			std::cout << "Mapped scene cache " << options.sceneCache << " (" << loaded->cache->fileBytes() / (1024.0 * 1024.0) << " MiB)" << std::endl;
+			return loaded;
+		}
+	}
+	if (fileScene)
+	{
+		SceneLoadStats stats;
+		loaded->built = loadSceneFile(options.scene, pool, SceneLoadSettings(), &stats);
+		stats.print(std::cout);
+	}
+	TaskGroup lightTree;
+	startLightTree(*loaded, options, pool, lightTree, environment);
+	if (loaded->built.instanced())
+	{
+		loaded->instanceBvh = std::make_unique<InstanceBvh>(loaded->built, pool, options.acceleratorKind, settings);
+		pool.wait(lightTree);
+		return loaded;
+	}
+	loaded->builtBvh = std::make_unique<Bvh>(loaded->built, pool, settings);
+	pool.wait(lightTree);
+	if (useCache)
+	{
+		loaded->accelerator = createAccelerator(*loaded->builtBvh, options.acceleratorKind);
+		if (options.pageBudgetMiB == 0)
+		{
+			SceneCache::write(options.sceneCache, key, loaded->built, *loaded->builtBvh, loaded->accelerator.get());
+			std::cout << "Wrote scene cache " << options.sceneCache << std::endl;
+			return loaded;
+		}
+
+		// Paged rendering reads the geometry from the cache, so the scene built here is dropped again.
+		PagedGeometry pages = buildGeometryPages(*loaded->builtBvh, pool, options.acceleratorKind, options.pageSizeKiB * 1024);
+		SceneCache::write(options.sceneCache, key, loaded->built, *loaded->builtBvh, loaded->accelerator.get(), &pages);
+		std::cout << "Wrote scene cache " << options.sceneCache << " with " << pages.pages.size() << " geometry pages" << std::endl;
+		loaded = std::make_unique<LoadedScene>();
+		loaded->cache = SceneCache::open(options.sceneCache, key);
+		if (!loaded->cache)
+		{
+			throw std::runtime_error("Cannot map the scene cache " + options.sceneCache + " just written");
+		}
+	}
+	return loaded;
+}
 
+int run(const Options& options)
+{
+	Timer startup;
+	ThreadPool pool(options.threads);
+	std::unique_ptr<EnvironmentMap> environment;
+	if (!options.environment.empty())
+	{
+		environment = std::make_unique<EnvironmentMap>(options.environment, pool);
+		environment->printStats(std::cout);
+	}
+	std::unique_ptr<LoadedScene> loaded = loadScene(options, pool, environment.get());
+	const Scene& scene = loaded->scene();
+	if (loaded->instanceBvh)
+	{
+		loaded->instanceBvh->printStats(std::cout);
+	}
+	else
+	{
+		loaded->bvh().stats().print(std::cout);
+	}
 
+	RenderSettings settings;
+	settings.sampler = options.sampler;
+	settings.adaptiveThreshold = options.adaptiveThreshold;
+	settings.adaptiveMinSamples = options.adaptiveMinSamples;
+	settings.sortRays = options.sortRays;
+	settings.packetTraversal = options.packetTraversal;
+	settings.lightTree = options.lightTree;
+	settings.aovs = options.aovs | (options.denoiseInterval > 0 ? DenoiseAovs : 0);
 
+	// Only images without a current tiled copy are read here; tiled textures are not opened until a
+	// ray reaches them.
+	std::unique_ptr<TextureCache> textures;
+	if (!scene.textures.empty())
+	{
+		textures = std::make_unique<TextureCache>(prepareTiledTextures(scene.textures, pool), options.textureBudgetMiB * 1024 * 1024);
+		std::cout << "Textures: " << scene.textures.size() << ", " << options.textureBudgetMiB << " MiB tile budget" << std::endl;
+	}
+	if (options.checkDeterminism)
+	{
+		return checkDeterminism(options, scene, settings, textures.get(), environment.get());
+	}
+
+	std::unique_ptr<Accelerator> accelerator;
+	std::unique_ptr<Renderer> renderer;
+#ifdef PTGPU_HAS_OPENCL
+	std::unique_ptr<ClContext> clContext;
+	std::unique_ptr<ClScene> clScene;
+	// The kernels have no instancing, so instanced scenes are uploaded flattened.
+	Scene flattened;
+	std::unique_ptr<Bvh> flattenedBvh;
+	if (options.openCl)
+	{
+		ClDeviceType deviceType = options.clDevice == "cpu" ? ClDeviceType::Cpu : options.clDevice == "gpu" ? ClDeviceType::Gpu : ClDeviceType::Any;
+		clContext = std::make_unique<ClContext>(deviceType);
+		std::cout << "OpenCL device: " << clContext->deviceName() << std::endl;
+		if (textures)
+		{
+			std::cout << "The OpenCL kernels do not sample textures, rendering the material albedo" << std::endl;
+		}
+		if (scene.instanced())
+		{
+			flattened = flattenInstances(scene);
+			flattenedBvh = std::make_unique<Bvh>(flattened, pool);
+			clScene = std::make_unique<ClScene>(*clContext, flattened, *flattenedBvh, environment.get());
+		}
+		else
+		{
+			clScene = std::make_unique<ClScene>(*clContext, scene, loaded->bvh(), environment.get());
+		}
+		if (options.wavefront)
+		{
+			renderer = std::make_unique<ClWavefrontRenderer>(*clContext, *clScene, settings);
+		}
+		else
+		{
+			renderer = std::make_unique<ClRenderer>(*clContext, *clScene, settings);
+		}
+	}
+#else
+	if (options.openCl)
+	{
+		std::cerr << "PTGPU was built without OpenCL, using the CPU renderer" << std::endl;
+	}
+#endif
+	if (!renderer)
+	{
+		if (options.pageBudgetMiB > 0 && loaded->cache)
+		{
+			accelerator = loaded->cache->createPagedAccelerator(pool, options.pageBudgetMiB * 1024 * 1024);
+			if (!accelerator)
+			{
+				std::cout << "The scene cache has no geometry pages this CPU can trace, keeping the BVH in memory" << std::endl;
+			}
+		}
+		if (!accelerator)
+		{
+			accelerator = loaded->takeAccelerator(options.acceleratorKind);
+		}
+		std::cout << "Traversal: " << accelerator->name() << ", " << accelerator->memoryBytes() / (1024.0 * 1024.0) << " MiB" << std::endl;
+		// Mapped scenes have no BVH build to overlap with.
+		if (!loaded->lights)
+		{
+			loaded->lights = options.lightTree ? std::make_unique<LightSet>(scene, pool, environment.get())
+				: std::make_unique<LightSet>(scene, environment.get());
+		}
+		loaded->lights->printStats(std::cout);
+		if (options.wavefront)
+		{
+			renderer = std::make_unique<WavefrontRenderer>(scene, *accelerator, pool, settings, textures.get(), loaded->lights.get());
+		}
+		else
+		{
+			renderer = std::make_unique<CpuRenderer>(scene, *accelerator, pool, settings, textures.get(), loaded->lights.get());
+		}
+	}
+
+	std::cout << "Rendering " << settings.width << "x" << settings.height << " with the " << renderer->name() << " renderer" << std::endl;
+#ifdef PTGPU_HAS_OPENGL
+	if (!options.headless)
+	{
+		renderInteractive(*renderer, options, startup, pool);
+	}
+	else
+#endif
+	{
+		renderHeadless(*renderer, options, startup, pool);
+	}
+	renderer->printStats(std::cout);
+	if (auto paged = dynamic_cast<const PagedBvh*>(accelerator.get()))
+	{
+		paged->printStats(std::cout);
+	}
+	if (textures)
+	{
+		textures->printStats(std::cout);
+	}
 
 	return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv)
+{
+	Options options = parseOptions(argc, argv);
+	try
+	{
+		return run(options);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "PTGPU: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Ray.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Largest number of rays traced together by intersectRays and occludedRays.
+constexpr uint32_t RayPacketSize = 8;
+
+// Ray query interface shared by the acceleration structure layouts.
+class Accelerator
+{
+public:
+	virtual ~Accelerator() = default;
+
+	virtual bool intersect(Ray& ray, Hit& hit) const = 0;
+	virtual bool occluded(const Ray& ray) const = 0;
+
+	// Traces up to RayPacketSize coherent rays together, e.g. the camera rays of neighbouring pixels
+	// or their shadow rays. Results match intersect and occluded per ray; layouts without packet
+	// traversal trace the rays one by one.
+	virtual void intersectRays(Ray* rays, Hit* hits, uint32_t count) const
+	{
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			intersect(rays[i], hits[i]);
+		}
+	}
+
+	// Returns a bit mask of the occluded rays.
+	virtual uint32_t occludedRays(const Ray* rays, uint32_t count) const
+	{
+		uint32_t mask = 0;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			mask |= occluded(rays[i]) ? 1u << i : 0u;
+		}
+		return mask;
+	}
+
+	virtual const char* name() const = 0;
+	virtual size_t memoryBytes() const = 0;
+};
+
+class Bvh;
+class ThreadPool;
+struct BvhUpdateStats;
+
+enum class AcceleratorKind
+{
+	Auto,
+	Binary,
+	Wide4,
+	Wide8,
+	// Wide layouts with 8 bit quantized child bounds; Compressed picks the width like Auto.
+	Compressed,
+	Compressed4,
+	Compressed8,
+};
+
+// Maps Auto and Compressed to the width createAccelerator would pick on this CPU, other kinds are
+// returned as is.
+AcceleratorKind resolveAcceleratorKind(AcceleratorKind kind);
+
+// Builds the requested layout from a binary BVH. Auto picks the widest layout the CPU runs natively.
+// The binary layout is returned as a non-owning wrapper, so bvh has to outlive the result either way.
+std::unique_ptr<Accelerator> createAccelerator(const Bvh& bvh, AcceleratorKind kind = AcceleratorKind::Auto);
+
+// Brings an accelerator made by createAccelerator up to date after Bvh::update: wide layouts are refit
+// in place when the BVH kept its topology and collapsed again when it did not. Compressed layouts are
+// always collapsed again.
+void updateAccelerator(std::unique_ptr<Accelerator>& accelerator, const Bvh& bvh, const BvhUpdateStats& update, ThreadPool& pool);
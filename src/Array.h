@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// Contiguous array that either owns its elements or views memory owned elsewhere, such as a
+// mapped scene cache. Reads never copy; the first mutation of a view copies it into owned storage.
+template <typename T>
+class Array
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Array elements have to be storable in mapped files");
+
+public:
+	using value_type = T;
+
+	Array() = default;
+
+	static Array view(const T* data, size_t count)
+	{
+		Array result;
+		result.first = data;
+		result.count = count;
+		result.viewing = true;
+		return result;
+	}
+
+	Array(const Array& other) { *this = other; }
+	Array(Array&& other) noexcept { *this = std::move(other); }
+
+	Array& operator=(const Array& other)
+	{
+		if (this != &other)
+		{
+			storage = other.storage;
+			viewing = other.viewing;
+			first = viewing ? other.first : storage.data();
+			count = other.count;
+		}
+		return *this;
+	}
+
+	Array& operator=(Array&& other) noexcept
+	{
+		storage = std::move(other.storage);
+		viewing = other.viewing;
+		first = viewing ? other.first : storage.data();
+		count = other.count;
+		other.clear();
+		return *this;
+	}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	bool isView() const { return viewing; }
+
+	const T* data() const { return first; }
+	const T* begin() const { return first; }
+	const T* end() const { return first + count; }
+	const T& operator[](size_t i) const { return first[i]; }
+	const T& back() const { return first[count - 1]; }
+
+	T* data() { return mutableData(); }
+	T* begin() { return mutableData(); }
+	T* end() { return mutableData() + count; }
+	T& operator[](size_t i) { return mutableData()[i]; }
+
+	void push_back(const T& value)
+	{
+		detach();
+		storage.push_back(value);
+		sync();
+	}
+
+	T& emplace_back()
+	{
+		detach();
+		storage.emplace_back();
+		sync();
+		return storage.back();
+	}
+
+	void resize(size_t size)
+	{
+		detach();
+		storage.resize(size);
+		sync();
+	}
+
+	void reserve(size_t capacity)
+	{
+		detach();
+		storage.reserve(capacity);
+		sync();
+	}
+
+	void shrink_to_fit()
+	{
+		detach();
+		storage.shrink_to_fit();
+		sync();
+	}
+
+	void clear()
+	{
+		storage.clear();
+		viewing = false;
+		sync();
+	}
+
+private:
+	T* mutableData()
+	{
+		detach();
+		return storage.data();
+	}
+
+	void detach()
+	{
+		if (viewing)
+		{
+			storage.assign(first, first + count);
+			viewing = false;
+			sync();
+		}
+	}
+
+	void sync()
+	{
+		first = storage.data();
+		count = storage.size();
+	}
+
+	std::vector<T> storage;
+	const T* first = nullptr;
+	size_t count = 0;
+	bool viewing = false;
+};
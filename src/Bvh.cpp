@@ -0,0 +1,867 @@
+#include "Bvh.h"
+
+#include "Timer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <ostream>
+#include <utility>
+
+namespace
+{
+	constexpr uint32_t BinningChunkSize = 16384;
+	constexpr uint32_t MaxBins = 64;
+	// Beyond MaxSahDepth ranges are halved, which keeps the depth below BvhMaxDepth for 2^32 primitives.
+	constexpr uint32_t MaxSahDepth = BvhMaxDepth - 32;
+	constexpr uint32_t TraversalStackSize = BvhMaxDepth;
+	// Refit splits the tree into parallel tasks down to this depth.
+	constexpr uint32_t RefitTaskDepth = 6;
+	// Update cuts the tree into subtrees of about 1/UpdateSubtreeDivisor of the primitives each.
+	constexpr uint32_t UpdateSubtreeDivisor = 64;
+	constexpr uint32_t MinUpdateSubtreeSize = 4096;
+
+	// Trivially constructible so that only the bins in use get initialized for every node.
+	struct Bin
+	{
+		float boundsMin[3];
+		float boundsMax[3];
+		uint32_t count;
+
+		void reset()
+		{
+			boundsMin[0] = boundsMin[1] = boundsMin[2] = Infinity;
+			boundsMax[0] = boundsMax[1] = boundsMax[2] = -Infinity;
+			count = 0;
+		}
+
+		void extend(const Vec3& lower, const Vec3& upper)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				boundsMin[axis] = std::min(boundsMin[axis], lower[axis]);
+				boundsMax[axis] = std::max(boundsMax[axis], upper[axis]);
+			}
+		}
+
+		Aabb bounds() const
+		{
+			return {Vec3(boundsMin[0], boundsMin[1], boundsMin[2]), Vec3(boundsMax[0], boundsMax[1], boundsMax[2])};
+		}
+	};
+
+	struct BinSet
+	{
+		uint32_t binCount;
+		Bin bins[3][MaxBins];
+
+		explicit BinSet(uint32_t binCount) : binCount(binCount)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				for (uint32_t b = 0; b < binCount; ++b)
+				{
+					bins[axis][b].reset();
+				}
+			}
+		}
+
+		void merge(const BinSet& other)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				for (uint32_t b = 0; b < binCount; ++b)
+				{
+					const Bin& bin = other.bins[axis][b];
+					bins[axis][b].extend(Vec3(bin.boundsMin[0], bin.boundsMin[1], bin.boundsMin[2]), Vec3(bin.boundsMax[0], bin.boundsMax[1], bin.boundsMax[2]));
+					bins[axis][b].count += bin.count;
+				}
+			}
+		}
+	};
+
+	// Build-time primitive record, partitioned in place so that binning streams through memory.
+	struct PrimitiveReference
+	{
+		Vec3 boundsMin;
+		uint32_t index;
+		Vec3 boundsMax;
+		float padding;
+
+		Vec3 centroid() const { return (boundsMin + boundsMax) * 0.5f; }
+	};
+
+	void atomicMax(std::atomic<uint32_t>& target, uint32_t value)
+	{
+		uint32_t current = target.load(std::memory_order_relaxed);
+		while (current < value && !target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+		{
+		}
+	}
+}
+
+struct Bvh::BuildContext
+{
+	ThreadPool& pool;
+	BvhBuildSettings settings;
+	std::vector<PrimitiveReference> references;
+	// Added to leaf offsets, for rebuilding the subtree over part of the primitive list.
+	uint32_t leafOffset = 0;
+	std::atomic<uint32_t> nodeCount{2};
+	std::atomic<uint32_t> leafCount{0};
+	std::atomic<uint32_t> maxDepth{0};
+	TaskGroup tasks;
+
+	BuildContext(ThreadPool& pool, const BvhBuildSettings& settings)
+		: pool(pool), settings(settings)
+	{
+	}
+
+	// Computes the bounds and centroid bounds of references [begin, end).
+	void rangeBounds(uint32_t begin, uint32_t end, Aabb& bounds, Aabb& centroidBounds)
+	{
+		auto accumulate = [&](uint32_t first, uint32_t last, Aabb& b, Aabb& c)
+		{
+			for (uint32_t i = first; i < last; ++i)
+			{
+				b.extend({references[i].boundsMin, references[i].boundsMax});
+				c.extend(references[i].centroid());
+			}
+		};
+
+		uint32_t count = end - begin;
+		if (count < settings.parallelBinningThreshold)
+		{
+			accumulate(begin, end, bounds, centroidBounds);
+			return;
+		}
+
+		uint32_t chunks = (count + BinningChunkSize - 1) / BinningChunkSize;
+		std::vector<Aabb> chunkBounds(chunks);
+		std::vector<Aabb> chunkCentroids(chunks);
+		pool.parallelFor(chunks, [&](uint32_t chunk, uint32_t)
+		{
+			uint32_t first = begin + chunk * BinningChunkSize;
+			accumulate(first, std::min(end, first + BinningChunkSize), chunkBounds[chunk], chunkCentroids[chunk]);
+		});
+		for (uint32_t chunk = 0; chunk < chunks; ++chunk)
+		{
+			bounds.extend(chunkBounds[chunk]);
+			centroidBounds.extend(chunkCentroids[chunk]);
+		}
+	}
+
+	void binRange(uint32_t begin, uint32_t end, const Aabb& centroidBounds, const Vec3& scale, BinSet& result)
+	{
+		uint32_t binCount = result.binCount;
+		auto accumulate = [&](uint32_t first, uint32_t last, BinSet& set)
+		{
+			for (uint32_t i = first; i < last; ++i)
+			{
+				const PrimitiveReference& reference = references[i];
+				Vec3 c = reference.centroid();
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					uint32_t b = std::min(binCount - 1, static_cast<uint32_t>((c[axis] - centroidBounds.min[axis]) * scale[axis]));
+					set.bins[axis][b].extend(reference.boundsMin, reference.boundsMax);
+					set.bins[axis][b].count++;
+				}
+			}
+		};
+
+		uint32_t count = end - begin;
+		if (count < settings.parallelBinningThreshold)
+		{
+			accumulate(begin, end, result);
+			return;
+		}
+
+		uint32_t chunks = (count + BinningChunkSize - 1) / BinningChunkSize;
+		std::vector<BinSet> chunkBins(chunks, BinSet(binCount));
+		pool.parallelFor(chunks, [&](uint32_t chunk, uint32_t)
+		{
+			uint32_t first = begin + chunk * BinningChunkSize;
+			accumulate(first, std::min(end, first + BinningChunkSize), chunkBins[chunk]);
+		});
+		for (const BinSet& set : chunkBins)
+		{
+			result.merge(set);
+		}
+	}
+};
+
+Bvh::Bvh(const Scene& scene, ThreadPool& pool, const BvhBuildSettings& settings)
+	: Bvh(scene, Mesh{0, scene.triangleCount()}, pool, settings)
+{
+}
+
+Bvh::Bvh(const Scene& scene, const Mesh& mesh, ThreadPool& pool, const BvhBuildSettings& settings) : source(&scene)
+{
+	build(pool, settings, mesh.triangleCount, mesh.firstTriangle, [&](uint32_t i) { return scene.triangleBounds(i); });
+}
+
+Bvh::Bvh(const std::vector<Aabb>& boxes, ThreadPool& pool, const BvhBuildSettings& settings) : source(nullptr)
+{
+	build(pool, settings, static_cast<uint32_t>(boxes.size()), 0, [&](uint32_t i) { return boxes[i]; });
+}
+
+void Bvh::build(ThreadPool& pool, const BvhBuildSettings& settings, uint32_t count, uint32_t firstPrimitive, const std::function<Aabb(uint32_t)>& primitiveBounds)
+{
+	Timer timer;
+	buildSettings = settings;
+	buildSettings.binCount = std::min(std::max(2u, settings.binCount), MaxBins);
+	buildSettings.maxLeafSize = std::min(std::max(1u, settings.maxLeafSize), 0xffffu);
+	BuildContext context(pool, buildSettings);
+
+	subtrees.clear();
+	upperNodes.clear();
+	if (count == 0)
+	{
+		// See empty(): the root alone, whose empty bounds every walker has to skip.
+		Aabb empty;
+		nodeList.resize(1);
+		nodeList[0] = {empty.min, 0, empty.max, 0, 0};
+		primitives.resize(0);
+		buildStats = BvhBuildStats();
+		buildStats.buildSeconds = timer.seconds();
+		buildStats.nodeCount = 1;
+		buildStats.nodeBytes = sizeof(BvhNode);
+		buildStats.peakBuildBytes = sizeof(BvhNode);
+		return;
+	}
+
+	context.references.resize(count);
+	pool.parallelFor(count, [&](uint32_t i, uint32_t)
+	{
+		Aabb bounds = primitiveBounds(firstPrimitive + i);
+		context.references[i] = {bounds.min, firstPrimitive + i, bounds.max, 0.0f};
+	}, 4096);
+
+	// Root at 0, index 1 is padding so that sibling pairs start at even indices.
+	nodeList.resize(std::max(3u, 2 * count + 1));
+	Aabb bounds;
+	Aabb centroidBounds;
+	context.rangeBounds(0, count, bounds, centroidBounds);
+	buildRange(context, 0, 0, count, bounds, centroidBounds, 0);
+	pool.wait(context.tasks);
+
+	primitives.resize(count);
+	pool.parallelFor(count, [&](uint32_t i, uint32_t)
+	{
+		primitives[i] = context.references[i].index;
+	}, 4096);
+	nodeList.resize(context.nodeCount.load());
+	nodeList.shrink_to_fit();
+
+	buildStats.buildSeconds = timer.seconds();
+	buildStats.primitiveCount = count;
+	buildStats.nodeCount = static_cast<uint32_t>(nodeList.size());
+	buildStats.leafCount = context.leafCount.load();
+	buildStats.maxDepth = context.maxDepth.load();
+	buildStats.nodeBytes = nodeList.size() * sizeof(BvhNode);
+	buildStats.indexBytes = primitives.size() * sizeof(uint32_t);
+	buildStats.peakBuildBytes = (2 * static_cast<size_t>(count) + 1) * sizeof(BvhNode) + buildStats.indexBytes
+		+ count * sizeof(PrimitiveReference);
+	buildStats.sahCost = computeSahCost(settings.traversalCost, settings.intersectionCost);
+}
+
+Bvh::Bvh(const Scene& scene, Array<BvhNode> nodes, Array<uint32_t> primitiveIndices, const BvhBuildStats& stats)
+	: source(&scene), nodeList(std::move(nodes)), primitives(std::move(primitiveIndices)), buildStats(stats)
+{
+}
+
+void Bvh::buildRange(BuildContext& context, uint32_t nodeIndex, uint32_t begin, uint32_t end, const Aabb& bounds, const Aabb& centroidBounds, uint32_t depth)
+{
+	const BvhBuildSettings& settings = context.settings;
+	uint32_t count = end - begin;
+
+	BvhNode& node = nodeList[nodeIndex];
+	node.boundsMin = bounds.min;
+	node.boundsMax = bounds.max;
+	node.axis = 0;
+
+	auto makeLeaf = [&]
+	{
+		node.offset = context.leafOffset + begin;
+		node.count = static_cast<uint16_t>(count);
+		context.leafCount.fetch_add(1, std::memory_order_relaxed);
+		atomicMax(context.maxDepth, depth);
+	};
+
+	if (count <= 1)
+	{
+		makeLeaf();
+		return;
+	}
+
+	int bestAxis = -1;
+	uint32_t bestBin = 0;
+	float bestCost = Infinity;
+	// Small ranges use fewer bins, there is nothing to gain from more bins than primitives.
+	uint32_t binCount = std::min(settings.binCount, std::max(4u, count));
+	BinSet binSet(binCount);
+	Vec3 extent = centroidBounds.diagonal();
+	Vec3 scale;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		scale[axis] = extent[axis] > 0.0f ? binCount / extent[axis] : 0.0f;
+	}
+
+	if (maxComponent(extent) > 0.0f && depth < MaxSahDepth)
+	{
+		context.binRange(begin, end, centroidBounds, scale, binSet);
+
+		float rightArea[MaxBins];
+		uint32_t rightCount[MaxBins];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (extent[axis] <= 0.0f)
+			{
+				continue;
+			}
+			const Bin* bins = binSet.bins[axis];
+			Aabb accumulated;
+			uint32_t accumulatedCount = 0;
+			for (uint32_t b = binCount - 1; b > 0; --b)
+			{
+				accumulated.extend(bins[b].bounds());
+				accumulatedCount += bins[b].count;
+				rightArea[b] = accumulated.surfaceArea();
+				rightCount[b] = accumulatedCount;
+			}
+			accumulated = Aabb();
+			accumulatedCount = 0;
+			for (uint32_t b = 0; b + 1 < binCount; ++b)
+			{
+				accumulated.extend(bins[b].bounds());
+				accumulatedCount += bins[b].count;
+				if (accumulatedCount == 0 || rightCount[b + 1] == 0)
+				{
+					continue;
+				}
+				float cost = accumulated.surfaceArea() * accumulatedCount + rightArea[b + 1] * rightCount[b + 1];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+	}
+
+	float area = bounds.surfaceArea();
+	float leafCost = settings.intersectionCost * count;
+	float splitCost = settings.traversalCost + settings.intersectionCost * bestCost / std::max(area, 1e-30f);
+
+	uint32_t middle;
+	Aabb childBounds[2];
+	Aabb childCentroidBounds[2];
+	if (bestAxis >= 0)
+	{
+		if (count <= settings.maxLeafSize && leafCost <= splitCost)
+		{
+			makeLeaf();
+			return;
+		}
+		float axisMin = centroidBounds.min[bestAxis];
+		float axisScale = scale[bestAxis];
+		std::vector<PrimitiveReference>& references = context.references;
+		uint32_t left = begin;
+		uint32_t right = end;
+		while (left < right)
+		{
+			Vec3 c = references[left].centroid();
+			if (std::min(binCount - 1, static_cast<uint32_t>((c[bestAxis] - axisMin) * axisScale)) <= bestBin)
+			{
+				childCentroidBounds[0].extend(c);
+				++left;
+			}
+			else
+			{
+				childCentroidBounds[1].extend(c);
+				std::swap(references[left], references[--right]);
+			}
+		}
+		middle = left;
+		node.axis = static_cast<uint16_t>(bestAxis);
+		for (uint32_t b = 0; b < binCount; ++b)
+		{
+			childBounds[b > bestBin].extend(binSet.bins[bestAxis][b].bounds());
+		}
+	}
+	else
+	{
+		// All centroids coincide or the tree got too deep: keep small ranges as leaves, halve larger ones.
+		if (count <= settings.maxLeafSize)
+		{
+			makeLeaf();
+			return;
+		}
+		middle = begin + count / 2;
+		context.rangeBounds(begin, middle, childBounds[0], childCentroidBounds[0]);
+		context.rangeBounds(middle, end, childBounds[1], childCentroidBounds[1]);
+	}
+
+	uint32_t child = context.nodeCount.fetch_add(2, std::memory_order_relaxed);
+	node.offset = child;
+	node.count = 0;
+
+	if (count >= settings.parallelThreshold)
+	{
+		Aabb leftBounds = childBounds[0];
+		Aabb leftCentroidBounds = childCentroidBounds[0];
+		context.pool.run(context.tasks, [this, &context, child, begin, middle, leftBounds, leftCentroidBounds, depth]
+		{
+			buildRange(context, child, begin, middle, leftBounds, leftCentroidBounds, depth + 1);
+		});
+	}
+	else
+	{
+		buildRange(context, child, begin, middle, childBounds[0], childCentroidBounds[0], depth + 1);
+	}
+	buildRange(context, child + 1, middle, end, childBounds[1], childCentroidBounds[1], depth + 1);
+}
+
+void Bvh::refit(const std::function<Aabb(uint32_t)>& primitiveBounds)
+{
+	if (empty())
+	{
+		return;
+	}
+	// Children are always allocated after their parent, so a reverse sweep visits them first.
+	for (size_t i = nodeList.size(); i-- > 0;)
+	{
+		if (i == 1)
+		{
+			continue;
+		}
+		BvhNode& node = nodeList[i];
+		Aabb bounds;
+		if (node.leaf())
+		{
+			for (uint32_t p = node.offset; p < node.offset + node.count; ++p)
+			{
+				bounds.extend(primitiveBounds(primitives[p]));
+			}
+		}
+		else
+		{
+			bounds.extend(nodeList[node.offset].bounds());
+			bounds.extend(nodeList[node.offset + 1].bounds());
+		}
+		node.boundsMin = bounds.min;
+		node.boundsMax = bounds.max;
+	}
+}
+
+void Bvh::refit(ThreadPool& pool)
+{
+	if (empty())
+	{
+		return;
+	}
+	refitNode(pool, nodeList.data(), 0, 0);
+}
+
+void Bvh::refitNode(ThreadPool& pool, BvhNode* nodes, uint32_t nodeIndex, uint32_t depth)
+{
+	const Array<uint32_t>& order = primitives;
+	BvhNode& node = nodes[nodeIndex];
+	Aabb bounds;
+	if (node.leaf())
+	{
+		for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+		{
+			bounds.extend(source->triangleBounds(order[i]));
+		}
+	}
+	else
+	{
+		uint32_t left = node.offset;
+		if (depth < RefitTaskDepth)
+		{
+			TaskGroup group;
+			pool.run(group, [this, &pool, nodes, left, depth] { refitNode(pool, nodes, left, depth + 1); });
+			refitNode(pool, nodes, left + 1, depth + 1);
+			pool.wait(group);
+		}
+		else
+		{
+			refitNode(pool, nodes, left, depth + 1);
+			refitNode(pool, nodes, left + 1, depth + 1);
+		}
+		bounds.extend(nodes[left].bounds());
+		bounds.extend(nodes[left + 1].bounds());
+	}
+	node.boundsMin = bounds.min;
+	node.boundsMax = bounds.max;
+}
+
+BvhUpdateStats Bvh::update(ThreadPool& pool, float maxSahGrowth)
+{
+	BvhUpdateStats stats;
+	if (empty())
+	{
+		return stats;
+	}
+	Timer timer;
+	refit(pool);
+	if (subtrees.empty())
+	{
+		findSubtrees();
+	}
+	std::vector<double> costs(subtrees.size());
+	pool.parallelFor(static_cast<uint32_t>(subtrees.size()), [&](uint32_t i, uint32_t)
+	{
+		costs[i] = subtreeAreaCost(subtrees[i].node);
+	});
+	stats.refitSeconds = timer.seconds();
+	stats.subtreeCount = static_cast<uint32_t>(subtrees.size());
+
+	timer.reset();
+	for (size_t i = 0; i < subtrees.size(); ++i)
+	{
+		Subtree& subtree = subtrees[i];
+		float area = std::max(nodeList[subtree.node].bounds().surfaceArea(), 1e-30f);
+		if (costs[i] / area <= subtree.sahCost * maxSahGrowth)
+		{
+			continue;
+		}
+		rebuildSubtree(pool, subtree.node, subtree.depth, subtree.firstPrimitive, subtree.primitiveCount);
+		costs[i] = subtreeAreaCost(subtree.node);
+		subtree.sahCost = static_cast<float>(costs[i] / area);
+		stats.rebuiltSubtrees++;
+		stats.rebuiltPrimitives += subtree.primitiveCount;
+	}
+
+	auto totalCost = [&]
+	{
+		double cost = 0.0;
+		for (uint32_t node : upperNodes)
+		{
+			cost += nodeList[node].bounds().surfaceArea() * buildSettings.traversalCost;
+		}
+		for (double subtreeCost : costs)
+		{
+			cost += subtreeCost;
+		}
+		float rootArea = nodeList[0].bounds().surfaceArea();
+		return rootArea > 0.0f ? static_cast<float>(cost / rootArea) : 0.0f;
+	};
+	stats.sahCost = totalCost();
+	// The levels above the subtrees are only ever refit, so they can only recover through a full rebuild.
+	if (stats.sahCost > buildStats.sahCost * maxSahGrowth)
+	{
+		rebuildSubtree(pool, 0, 0, 0, static_cast<uint32_t>(primitives.size()));
+		compact();
+		findSubtrees();
+		buildStats.sahCost = computeSahCost(buildSettings.traversalCost, buildSettings.intersectionCost);
+		stats.sahCost = buildStats.sahCost;
+		stats.fullRebuild = true;
+		stats.rebuiltPrimitives = static_cast<uint32_t>(primitives.size());
+	}
+	else if (stats.rebuiltSubtrees > 0)
+	{
+		compact();
+	}
+	stats.rebuildSeconds = timer.seconds();
+	stats.sahGrowth = buildStats.sahCost > 0.0f ? stats.sahCost / buildStats.sahCost : 1.0f;
+	return stats;
+}
+
+void Bvh::rebuildSubtree(ThreadPool& pool, uint32_t nodeIndex, uint32_t depth, uint32_t firstPrimitive, uint32_t primitiveCount)
+{
+	uint32_t* order = primitives.data();
+	BuildContext context(pool, buildSettings);
+	context.leafOffset = firstPrimitive;
+	context.references.resize(primitiveCount);
+	pool.parallelFor(primitiveCount, [&](uint32_t i, uint32_t)
+	{
+		uint32_t primitive = order[firstPrimitive + i];
+		Aabb bounds = source->triangleBounds(primitive);
+		context.references[i] = {bounds.min, primitive, bounds.max, 0.0f};
+	}, 4096);
+
+	// The new nodes go after the existing ones, the subtree root keeps its slot; compact() drops the old nodes.
+	uint32_t base = static_cast<uint32_t>(nodeList.size() + 1) & ~1u;
+	context.nodeCount = base;
+	nodeList.resize(base + 2 * static_cast<size_t>(primitiveCount));
+	Aabb bounds;
+	Aabb centroidBounds;
+	context.rangeBounds(0, primitiveCount, bounds, centroidBounds);
+	buildRange(context, nodeIndex, 0, primitiveCount, bounds, centroidBounds, depth);
+	pool.wait(context.tasks);
+
+	pool.parallelFor(primitiveCount, [&](uint32_t i, uint32_t)
+	{
+		order[firstPrimitive + i] = context.references[i].index;
+	}, 4096);
+	nodeList.resize(context.nodeCount.load());
+}
+
+void Bvh::compact()
+{
+	std::vector<uint32_t> remap(nodeList.size(), InvalidIndex);
+	Array<BvhNode> compacted;
+	compacted.resize(nodeList.size());
+	compacted[0] = nodeList[0];
+	compacted[1] = nodeList[1];
+	remap[0] = 0;
+
+	struct Entry
+	{
+		uint32_t node;
+		uint32_t depth;
+	};
+	std::vector<Entry> stack = {{0, 0}};
+	uint32_t next = 2;
+	uint32_t leafCount = 0;
+	uint32_t maxDepth = 0;
+	while (!stack.empty())
+	{
+		Entry entry = stack.back();
+		stack.pop_back();
+		BvhNode& node = compacted[entry.node];
+		if (node.leaf())
+		{
+			leafCount++;
+			maxDepth = std::max(maxDepth, entry.depth);
+			continue;
+		}
+		uint32_t child = node.offset;
+		compacted[next] = nodeList[child];
+		compacted[next + 1] = nodeList[child + 1];
+		remap[child] = next;
+		remap[child + 1] = next + 1;
+		node.offset = next;
+		stack.push_back({next + 1, entry.depth + 1});
+		stack.push_back({next, entry.depth + 1});
+		next += 2;
+	}
+	compacted.resize(next);
+	nodeList = std::move(compacted);
+
+	for (Subtree& subtree : subtrees)
+	{
+		subtree.node = remap[subtree.node];
+	}
+	for (uint32_t& node : upperNodes)
+	{
+		node = remap[node];
+	}
+	buildStats.nodeCount = next;
+	buildStats.leafCount = leafCount;
+	buildStats.maxDepth = maxDepth;
+	buildStats.nodeBytes = nodeList.size() * sizeof(BvhNode);
+}
+
+void Bvh::findSubtrees()
+{
+	subtrees.clear();
+	upperNodes.clear();
+	uint32_t cutSize = std::max(static_cast<uint32_t>(primitives.size()) / UpdateSubtreeDivisor, MinUpdateSubtreeSize);
+
+	struct Entry
+	{
+		uint32_t node;
+		uint32_t depth;
+		uint32_t first;
+		uint32_t count;
+	};
+	std::vector<Entry> stack = {{0, 0, 0, static_cast<uint32_t>(primitives.size())}};
+	while (!stack.empty())
+	{
+		Entry entry = stack.back();
+		stack.pop_back();
+		const BvhNode& node = nodeList[entry.node];
+		if (node.leaf() || entry.count <= cutSize)
+		{
+			float area = std::max(node.bounds().surfaceArea(), 1e-30f);
+			subtrees.push_back({entry.node, entry.depth, entry.first, entry.count, static_cast<float>(subtreeAreaCost(entry.node) / area)});
+			continue;
+		}
+		upperNodes.push_back(entry.node);
+		// Children cover adjacent primitive ranges, the right one starting at its leftmost leaf.
+		uint32_t middle = firstPrimitive(node.offset + 1);
+		stack.push_back({node.offset, entry.depth + 1, entry.first, middle - entry.first});
+		stack.push_back({node.offset + 1, entry.depth + 1, middle, entry.first + entry.count - middle});
+	}
+}
+
+double Bvh::subtreeAreaCost(uint32_t nodeIndex) const
+{
+	double cost = 0.0;
+	uint32_t stack[TraversalStackSize];
+	uint32_t stackSize = 0;
+	stack[stackSize++] = nodeIndex;
+	while (stackSize > 0)
+	{
+		const BvhNode& node = nodeList[stack[--stackSize]];
+		float area = node.bounds().surfaceArea();
+		if (node.leaf())
+		{
+			cost += area * buildSettings.intersectionCost * node.count;
+			continue;
+		}
+		cost += area * buildSettings.traversalCost;
+		stack[stackSize++] = node.offset;
+		stack[stackSize++] = node.offset + 1;
+	}
+	return cost;
+}
+
+uint32_t Bvh::firstPrimitive(uint32_t nodeIndex) const
+{
+	while (!nodeList[nodeIndex].leaf())
+	{
+		nodeIndex = nodeList[nodeIndex].offset;
+	}
+	return nodeList[nodeIndex].offset;
+}
+
+float Bvh::computeSahCost(float traversalCost, float intersectionCost) const
+{
+	float rootArea = nodeList[0].bounds().surfaceArea();
+	if (empty() || rootArea <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	double cost = 0.0;
+	for (size_t i = 0; i < nodeList.size(); ++i)
+	{
+		if (i == 1)
+		{
+			continue;
+		}
+		const BvhNode& node = nodeList[i];
+		float area = node.bounds().surfaceArea();
+		cost += area * (node.leaf() ? intersectionCost * node.count : traversalCost);
+	}
+	return static_cast<float>(cost / rootArea);
+}
+
+bool Bvh::intersect(Ray& ray, Hit& hit) const
+{
+	const Scene& scene = *source;
+	Vec3 inverseDirection = safeInverse(ray.direction);
+	uint32_t stack[TraversalStackSize];
+	uint32_t stackSize = 0;
+	bool found = false;
+
+	const BvhNode* node = &nodeList[0];
+	if (empty() || intersectAabb(node->boundsMin, node->boundsMax, ray.origin, inverseDirection, ray.tMin, ray.tMax) == Infinity)
+	{
+		return false;
+	}
+
+	for (;;)
+	{
+		if (node->leaf())
+		{
+			for (uint32_t i = node->offset; i < node->offset + node->count; ++i)
+			{
+				uint32_t primitive = primitives[i];
+				float t, u, v;
+				if (intersectTriangle(ray, scene.vertex(primitive, 0), scene.vertex(primitive, 1), scene.vertex(primitive, 2), t, u, v))
+				{
+					ray.tMax = t;
+					hit.t = t;
+					hit.u = u;
+					hit.v = v;
+					hit.primitive = primitive;
+					found = true;
+				}
+			}
+		}
+		else
+		{
+			const BvhNode* left = &nodeList[node->offset];
+			const BvhNode* right = left + 1;
+			float tLeft = intersectAabb(left->boundsMin, left->boundsMax, ray.origin, inverseDirection, ray.tMin, ray.tMax);
+			float tRight = intersectAabb(right->boundsMin, right->boundsMax, ray.origin, inverseDirection, ray.tMin, ray.tMax);
+			if (tLeft > tRight)
+			{
+				std::swap(tLeft, tRight);
+				std::swap(left, right);
+			}
+			if (tLeft != Infinity)
+			{
+				if (tRight != Infinity)
+				{
+					stack[stackSize++] = static_cast<uint32_t>(right - nodeList.data());
+				}
+				node = left;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+		node = &nodeList[stack[--stackSize]];
+	}
+	return found;
+}
+
+bool Bvh::occluded(const Ray& ray) const
+{
+	const Scene& scene = *source;
+	Vec3 inverseDirection = safeInverse(ray.direction);
+	uint32_t stack[TraversalStackSize];
+	uint32_t stackSize = 0;
+
+	const BvhNode* node = &nodeList[0];
+	if (empty() || intersectAabb(node->boundsMin, node->boundsMax, ray.origin, inverseDirection, ray.tMin, ray.tMax) == Infinity)
+	{
+		return false;
+	}
+
+	for (;;)
+	{
+		if (node->leaf())
+		{
+			for (uint32_t i = node->offset; i < node->offset + node->count; ++i)
+			{
+				uint32_t primitive = primitives[i];
+				float t, u, v;
+				if (intersectTriangle(ray, scene.vertex(primitive, 0), scene.vertex(primitive, 1), scene.vertex(primitive, 2), t, u, v))
+				{
+					return true;
+				}
+			}
+		}
+		else
+		{
+			const BvhNode* left = &nodeList[node->offset];
+			const BvhNode* right = left + 1;
+			bool hitLeft = intersectAabb(left->boundsMin, left->boundsMax, ray.origin, inverseDirection, ray.tMin, ray.tMax) != Infinity;
+			bool hitRight = intersectAabb(right->boundsMin, right->boundsMax, ray.origin, inverseDirection, ray.tMin, ray.tMax) != Infinity;
+			if (hitLeft || hitRight)
+			{
+				if (hitLeft && hitRight)
+				{
+					stack[stackSize++] = static_cast<uint32_t>(right - nodeList.data());
+				}
+				node = hitLeft ? left : right;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			break;
+		}
+		node = &nodeList[stack[--stackSize]];
+	}
+	return false;
+}
+
+void BvhBuildStats::print(std::ostream& out) const
+{
+	out << "BVH: " << primitiveCount << " triangles, " << nodeCount << " nodes, " << leafCount << " leaves, depth "
+		<< maxDepth << ", SAH cost " << sahCost << "\n"
+		<< "BVH build: " << buildSeconds * 1000.0 << " ms, nodes " << nodeBytes / (1024.0 * 1024.0) << " MiB, indices "
+		<< indexBytes / (1024.0 * 1024.0) << " MiB, peak during build " << peakBuildBytes / (1024.0 * 1024.0) << " MiB" << std::endl;
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include "Array.h"
+#include "Math.h"
+#include "Ray.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <utility>
+#include <vector>
+
+// 32 byte node. Children of an interior node are stored as an adjacent pair starting at
+// offset; leaves reference count primitives starting at offset in the primitive index list.
+struct BvhNode
+{
+	Vec3 boundsMin;
+	uint32_t offset;
+	Vec3 boundsMax;
+	uint16_t count;
+	uint16_t axis;
+
+	bool leaf() const { return count > 0; }
+	Aabb bounds() const { return {boundsMin, boundsMax}; }
+};
+
+static_assert(sizeof(BvhNode) == 32, "BvhNode is expected to be 32 bytes");
+
+// Upper bound on the tree depth; the builder falls back to median splits before reaching it.
+constexpr uint32_t BvhMaxDepth = 96;
+
+struct BvhBuildSettings
+{
+	uint32_t binCount = 16;
+	uint32_t maxLeafSize = 8;
+	// Ranges with at least this many primitives are split into parallel tasks.
+	uint32_t parallelThreshold = 4096;
+	// Ranges with at least this many primitives bin their centroids in parallel.
+	uint32_t parallelBinningThreshold = 65536;
+	float traversalCost = 1.0f;
+	float intersectionCost = 1.0f;
+};
+
+struct BvhBuildStats
+{
+	double buildSeconds = 0.0;
+	uint32_t primitiveCount = 0;
+	uint32_t nodeCount = 0;
+	uint32_t leafCount = 0;
+	uint32_t maxDepth = 0;
+	float sahCost = 0.0f;
+	size_t nodeBytes = 0;
+	size_t indexBytes = 0;
+	size_t peakBuildBytes = 0;
+
+	void print(std::ostream& out) const;
+};
+
+// Outcome of Bvh::update.
+struct BvhUpdateStats
+{
+	double refitSeconds = 0.0;
+	double rebuildSeconds = 0.0;
+	uint32_t subtreeCount = 0;
+	uint32_t rebuiltSubtrees = 0;
+	uint32_t rebuiltPrimitives = 0;
+	bool fullRebuild = false;
+	float sahCost = 0.0f;
+	// SAH cost relative to the last full build.
+	float sahGrowth = 1.0f;
+
+	// Node indices moved, so layouts derived from the tree have to be rebuilt rather than refit.
+	bool topologyChanged() const { return rebuiltSubtrees > 0 || fullRebuild; }
+};
+
+// Binary BVH over the triangles of a scene, built with a binned surface area heuristic. Primitive
+// indices are triangle indices of the scene, or box indices for a BVH over boxes.
+class Bvh
+{
+public:
+	Bvh(const Scene& scene, ThreadPool& pool, const BvhBuildSettings& settings = {});
+	// Over the triangles of one mesh, e.g. the bottom level of an instanced scene.
+	Bvh(const Scene& scene, const Mesh& mesh, ThreadPool& pool, const BvhBuildSettings& settings = {});
+	// Over arbitrary boxes, e.g. instance bounds. Has no scene, so intersect and occluded do not apply.
+	Bvh(const std::vector<Aabb>& boxes, ThreadPool& pool, const BvhBuildSettings& settings = {});
+	// Adopts a previously built tree, e.g. views into a mapped scene cache.
+	Bvh(const Scene& scene, Array<BvhNode> nodes, Array<uint32_t> primitiveIndices, const BvhBuildStats& stats);
+
+	bool intersect(Ray& ray, Hit& hit) const;
+	bool occluded(const Ray& ray) const;
+
+	const Scene& scene() const { return *source; }
+	const Array<BvhNode>& nodes() const { return nodeList; }
+	const Array<uint32_t>& primitiveIndices() const { return primitives; }
+	const BvhBuildStats& stats() const { return buildStats; }
+	// A tree without primitives is its root alone, with empty bounds and neither primitives nor
+	// children, which BvhNode::leaf() cannot tell from an interior node. Walkers check this first.
+	bool empty() const { return primitives.empty(); }
+
+	// Expected traversal cost relative to the root, summed over all nodes.
+	float computeSahCost(float traversalCost = 1.0f, float intersectionCost = 1.0f) const;
+
+	// Recomputes node bounds bottom up from new primitive bounds, keeping the topology.
+	void refit(const std::function<Aabb(uint32_t)>& primitiveBounds);
+	// Same for moved scene vertices, with the top levels of the tree split into parallel tasks.
+	void refit(ThreadPool& pool);
+
+	// Follows moved vertices for animation: refits in parallel, then rebuilds every subtree whose SAH
+	// cost grew by more than maxSahGrowth since it was built, and the whole tree when its total cost
+	// did. Subtrees are cut at about 1/64 of the primitives. Infinity gives a pure refit.
+	BvhUpdateStats update(ThreadPool& pool, float maxSahGrowth = 1.3f);
+
+private:
+	struct BuildContext;
+
+	// Independently rebuilt part of the tree, covering a contiguous range of primitive indices.
+	struct Subtree
+	{
+		uint32_t node;
+		uint32_t depth;
+		uint32_t firstPrimitive;
+		uint32_t primitiveCount;
+		// Relative to the subtree root, as of its last build.
+		float sahCost;
+	};
+
+	void build(ThreadPool& pool, const BvhBuildSettings& settings, uint32_t count, uint32_t firstPrimitive, const std::function<Aabb(uint32_t)>& primitiveBounds);
+	void buildRange(BuildContext& context, uint32_t nodeIndex, uint32_t begin, uint32_t end, const Aabb& bounds, const Aabb& centroidBounds, uint32_t depth);
+	void refitNode(ThreadPool& pool, BvhNode* nodes, uint32_t nodeIndex, uint32_t depth);
+	void rebuildSubtree(ThreadPool& pool, uint32_t nodeIndex, uint32_t depth, uint32_t firstPrimitive, uint32_t primitiveCount);
+	// Drops unreachable nodes left by subtree rebuilds, keeping parents ahead of their children.
+	void compact();
+	void findSubtrees();
+	// Sum of area times cost over the nodes below and including nodeIndex.
+	double subtreeAreaCost(uint32_t nodeIndex) const;
+	uint32_t firstPrimitive(uint32_t nodeIndex) const;
+
+	const Scene* source;
+	Array<BvhNode> nodeList;
+	Array<uint32_t> primitives;
+	BvhBuildStats buildStats;
+	BvhBuildSettings buildSettings;
+	std::vector<Subtree> subtrees;
+	// Interior nodes above the subtree roots.
+	std::vector<uint32_t> upperNodes;
+};
+
+// Slab test against a box, returns the entry distance or Infinity.
+inline float intersectAabb(const Vec3& boundsMin, const Vec3& boundsMax, const Vec3& origin, const Vec3& inverseDirection, float tMin, float tMax)
+{
+	float tx0 = (boundsMin.x - origin.x) * inverseDirection.x;
+	float tx1 = (boundsMax.x - origin.x) * inverseDirection.x;
+	float ty0 = (boundsMin.y - origin.y) * inverseDirection.y;
+	float ty1 = (boundsMax.y - origin.y) * inverseDirection.y;
+	float tz0 = (boundsMin.z - origin.z) * inverseDirection.z;
+	float tz1 = (boundsMax.z - origin.z) * inverseDirection.z;
+	float tNear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), tMin));
+	float tFar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), tMax));
+	return tNear <= tFar ? tNear : Infinity;
+}
+
+// Calls visit(primitive) for the primitives of the leaves the ray overlaps, nearer child first, e.g.
+// the instances of a top-level tree. Stops when visit returns true. Rereads ray.tMax, so closer hits
+// prune the rest of the traversal.
+template <typename Visit>
+void traverseLeaves(const Bvh& tree, const Ray& ray, Visit&& visit)
+{
+	const Array<BvhNode>& nodes = tree.nodes();
+	const Array<uint32_t>& primitives = tree.primitiveIndices();
+	Vec3 inverseDirection = safeInverse(ray.direction);
+	uint32_t stack[BvhMaxDepth];
+	uint32_t stackSize = 0;
+
+	const BvhNode* node = &nodes[0];
+	if (tree.empty() || intersectAabb(node->boundsMin, node->boundsMax, ray.origin, inverseDirection, ray.tMin, ray.tMax) == Infinity)
+	{
+		return;
+	}
+
+	for (;;)
+	{
+		if (node->leaf())
+		{
+			for (uint32_t i = node->offset; i < node->offset + node->count; ++i)
+			{
+				if (visit(primitives[i]))
+				{
+					return;
+				}
+			}
+		}
+		else
+		{
+			const BvhNode* left = &nodes[node->offset];
+			const BvhNode* right = left + 1;
+			float tLeft = intersectAabb(left->boundsMin, left->boundsMax, ray.origin, inverseDirection, ray.tMin, ray.tMax);
+			float tRight = intersectAabb(right->boundsMin, right->boundsMax, ray.origin, inverseDirection, ray.tMin, ray.tMax);
+			if (tLeft > tRight)
+			{
+				std::swap(tLeft, tRight);
+				std::swap(left, right);
+			}
+			if (tLeft != Infinity)
+			{
+				if (tRight != Infinity)
+				{
+					stack[stackSize++] = static_cast<uint32_t>(right - nodes.data());
+				}
+				node = left;
+				continue;
+			}
+		}
+
+		if (stackSize == 0)
+		{
+			return;
+		}
+		node = &nodes[stack[--stackSize]];
+	}
+}
@@ -0,0 +1,267 @@
+#include "Checkpoint.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+#ifdef PTGPU_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+namespace
+{
+	constexpr char Magic[8] = {'P', 'T', 'G', 'P', 'U', 'C', 'K', '\0'};
+	constexpr uint32_t Version = 2;
+	constexpr uint32_t EndianMarker = 0x01020304;
+	// Compressed samples are cut into blocks of this size, which are packed independently.
+	constexpr uint32_t BlockBytes = 1u << 20;
+
+	// Followed by the description, the renderer state and the samples. Samples are stored as they are
+	// when blockBytes is 0; otherwise as the stored size of every block followed by the blocks, each
+	// deflated unless that would not shrink it, which its stored size tells.
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t endianMarker;
+		uint64_t descriptionBytes;
+		uint64_t stateBytes;
+		uint64_t sampleBytes;
+		// Bytes the samples take in the file, block sizes included.
+		uint64_t storedSampleBytes;
+		uint32_t blockBytes;
+		uint32_t reserved;
+		RenderStats stats;
+	};
+
+	static_assert(std::is_trivially_copyable<Header>::value, "The checkpoint header is written as raw bytes");
+
+	uint32_t blockCount(uint64_t sampleBytes, uint32_t blockBytes)
+	{
+		return static_cast<uint32_t>((sampleBytes + blockBytes - 1) / blockBytes);
+	}
+
+#ifdef PTGPU_HAS_ZLIB
+	// The samples are 4 byte floats and counts. Grouping the same byte of every value lines up the
+	// signs and exponents of neighbouring pixels, which deflates to about a sixth less than the values
+	// as they are. Trailing bytes that make up no whole value stay where they are.
+	void shuffle(const uint8_t* bytes, size_t size, uint8_t* shuffled)
+	{
+		size_t values = size / 4;
+		for (size_t i = 0; i < values; ++i)
+		{
+			for (size_t b = 0; b < 4; ++b)
+			{
+				shuffled[b * values + i] = bytes[4 * i + b];
+			}
+		}
+		std::copy(bytes + 4 * values, bytes + size, shuffled + 4 * values);
+	}
+
+	void unshuffle(const uint8_t* shuffled, size_t size, uint8_t* bytes)
+	{
+		size_t values = size / 4;
+		for (size_t i = 0; i < values; ++i)
+		{
+			for (size_t b = 0; b < 4; ++b)
+			{
+				bytes[4 * i + b] = shuffled[b * values + i];
+			}
+		}
+		std::copy(shuffled + 4 * values, shuffled + size, bytes + 4 * values);
+	}
+
+	// Deflates the samples block by block. Checkpoints are rewritten throughout a render, so the fastest
+	// level is used: it already gets most of what the slower ones do on this data.
+	std::vector<std::vector<uint8_t>> compressSamples(const std::vector<uint8_t>& samples, ThreadPool* pool)
+	{
+		uint32_t count = blockCount(samples.size(), BlockBytes);
+		std::vector<std::vector<uint8_t>> blocks(count);
+		auto compressBlock = [&](uint32_t block, uint32_t)
+		{
+			size_t offset = static_cast<size_t>(block) * BlockBytes;
+			size_t size = std::min<size_t>(BlockBytes, samples.size() - offset);
+			std::vector<uint8_t> shuffled(size);
+			shuffle(samples.data() + offset, size, shuffled.data());
+			uLongf packedSize = compressBound(static_cast<uLong>(size));
+			std::vector<uint8_t>& packed = blocks[block];
+			packed.resize(packedSize);
+			if (compress2(packed.data(), &packedSize, shuffled.data(), static_cast<uLong>(size), Z_BEST_SPEED) != Z_OK)
+			{
+				throw std::runtime_error("zlib compression failed");
+			}
+			if (packedSize < size)
+			{
+				packed.resize(packedSize);
+			}
+			else
+			{
+				packed.assign(samples.data() + offset, samples.data() + offset + size);
+			}
+		};
+		if (pool)
+		{
+			pool->parallelFor(count, compressBlock);
+		}
+		else
+		{
+			for (uint32_t block = 0; block < count; ++block)
+			{
+				compressBlock(block, 0);
+			}
+		}
+		return blocks;
+	}
+#endif
+
+	// Restores samples from stored, the block sizes and blocks of a compressed checkpoint. Returns false
+	// when they do not add up or a block does not inflate to its size.
+	bool decompressSamples(const std::vector<uint8_t>& stored, uint32_t blockBytes, std::vector<uint8_t>& samples)
+	{
+		uint32_t count = blockCount(samples.size(), blockBytes);
+		uint64_t tableBytes = 4 * static_cast<uint64_t>(count);
+		if (stored.size() < tableBytes)
+		{
+			return false;
+		}
+		uint64_t offset = tableBytes;
+		for (uint32_t block = 0; block < count; ++block)
+		{
+			uint32_t packedSize;
+			std::memcpy(&packedSize, stored.data() + 4 * block, sizeof(packedSize));
+			size_t start = static_cast<size_t>(block) * blockBytes;
+			size_t size = std::min<size_t>(blockBytes, samples.size() - start);
+			if (packedSize > size || packedSize > stored.size() - offset)
+			{
+				return false;
+			}
+			const uint8_t* packed = stored.data() + offset;
+			offset += packedSize;
+			if (packedSize == size)
+			{
+				std::copy(packed, packed + size, samples.data() + start);
+				continue;
+			}
+#ifdef PTGPU_HAS_ZLIB
+			std::vector<uint8_t> shuffled(size);
+			uLongf inflated = static_cast<uLongf>(size);
+			if (uncompress(shuffled.data(), &inflated, packed, packedSize) != Z_OK || inflated != size)
+			{
+				return false;
+			}
+			unshuffle(shuffled.data(), size, samples.data() + start);
+#else
+			return false;
+#endif
+		}
+		return offset == stored.size();
+	}
+}
+
+void writeCheckpoint(const std::string& path, const RenderCheckpoint& checkpoint, ThreadPool* pool)
+{
+	Header header = {};
+	std::memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.endianMarker = EndianMarker;
+	header.descriptionBytes = checkpoint.description.size();
+	header.stateBytes = checkpoint.state.size();
+	header.sampleBytes = checkpoint.samples.size();
+	header.storedSampleBytes = checkpoint.samples.size();
+	header.stats = checkpoint.stats;
+
+#ifdef PTGPU_HAS_ZLIB
+	std::vector<std::vector<uint8_t>> blocks = compressSamples(checkpoint.samples, pool);
+	std::vector<uint32_t> blockSizes;
+	header.blockBytes = BlockBytes;
+	header.storedSampleBytes = 4 * static_cast<uint64_t>(blocks.size());
+	for (const std::vector<uint8_t>& block : blocks)
+	{
+		blockSizes.push_back(static_cast<uint32_t>(block.size()));
+		header.storedSampleBytes += block.size();
+	}
+#else
+	(void)pool;
+#endif
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		throw std::runtime_error("Cannot open " + path + " for writing");
+	}
+	out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+	out.write(checkpoint.description.data(), static_cast<std::streamsize>(checkpoint.description.size()));
+	out.write(reinterpret_cast<const char*>(checkpoint.state.data()), static_cast<std::streamsize>(checkpoint.state.size()));
+#ifdef PTGPU_HAS_ZLIB
+	out.write(reinterpret_cast<const char*>(blockSizes.data()), static_cast<std::streamsize>(blockSizes.size() * sizeof(uint32_t)));
+	for (const std::vector<uint8_t>& block : blocks)
+	{
+		out.write(reinterpret_cast<const char*>(block.data()), static_cast<std::streamsize>(block.size()));
+	}
+#else
+	out.write(reinterpret_cast<const char*>(checkpoint.samples.data()), static_cast<std::streamsize>(checkpoint.samples.size()));
+#endif
+	if (!out.flush())
+	{
+		throw std::runtime_error("Failed to write " + path);
+	}
+}
+
+bool readCheckpoint(const std::string& path, RenderCheckpoint& checkpoint)
+{
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	if (!in)
+	{
+		return false;
+	}
+	uint64_t fileBytes = static_cast<uint64_t>(in.tellg());
+	in.seekg(0);
+	Header header;
+	if (!in.read(reinterpret_cast<char*>(&header), sizeof(Header)) || std::memcmp(header.magic, Magic, sizeof(Magic)) != 0
+		|| header.version != Version || header.endianMarker != EndianMarker || (header.blockBytes != 0 && header.blockBytes != BlockBytes))
+	{
+		throw std::runtime_error(path + " is not a checkpoint of this version");
+	}
+	// Checked against the file size before anything is allocated for them. Compressed samples are
+	// bounded by their block count instead, since no block inflates to more than BlockBytes.
+	bool compressed = header.blockBytes != 0;
+	uint64_t sampleLimit = compressed ? fileBytes / 4 * BlockBytes : fileBytes;
+	if (header.descriptionBytes > fileBytes || header.stateBytes > fileBytes || header.storedSampleBytes > fileBytes
+		|| header.sampleBytes > sampleLimit || (!compressed && header.storedSampleBytes != header.sampleBytes)
+		|| sizeof(Header) + header.descriptionBytes + header.stateBytes + header.storedSampleBytes != fileBytes)
+	{
+		throw std::runtime_error("Truncated checkpoint " + path);
+	}
+#ifndef PTGPU_HAS_ZLIB
+	if (compressed)
+	{
+		throw std::runtime_error(path + " is compressed, and this build has no zlib");
+	}
+#endif
+	checkpoint.stats = header.stats;
+	checkpoint.description.resize(header.descriptionBytes);
+	checkpoint.state.resize(header.stateBytes);
+	checkpoint.samples.resize(header.sampleBytes);
+	in.read(&checkpoint.description[0], static_cast<std::streamsize>(header.descriptionBytes));
+	in.read(reinterpret_cast<char*>(checkpoint.state.data()), static_cast<std::streamsize>(header.stateBytes));
+	if (!compressed)
+	{
+		in.read(reinterpret_cast<char*>(checkpoint.samples.data()), static_cast<std::streamsize>(header.sampleBytes));
+	}
+	else
+	{
+		std::vector<uint8_t> stored(header.storedSampleBytes);
+		if (in.read(reinterpret_cast<char*>(stored.data()), static_cast<std::streamsize>(stored.size()))
+			&& !decompressSamples(stored, header.blockBytes, checkpoint.samples))
+		{
+			throw std::runtime_error("Corrupt checkpoint " + path);
+		}
+	}
+	if (!in)
+	{
+		throw std::runtime_error("Truncated checkpoint " + path);
+	}
+	return true;
+}
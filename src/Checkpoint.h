@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Renderer.h"
+#include "ThreadPool.h"
+
+#include <string>
+
+// Checkpoint files store a RenderCheckpoint in host layout, like scene caches, and are only read back
+// by the build that wrote them.
+
+// Built with zlib, the samples are compressed in blocks, in parallel over pool when one is given.
+// Throws std::runtime_error when the file cannot be written.
+void writeCheckpoint(const std::string& path, const RenderCheckpoint& checkpoint, ThreadPool* pool = nullptr);
+
+// Returns false when there is no file at path. Throws std::runtime_error for files that are not
+// checkpoints of this format version and byte order, that are truncated or corrupt, or that are
+// compressed while this build has no zlib.
+bool readCheckpoint(const std::string& path, RenderCheckpoint& checkpoint);
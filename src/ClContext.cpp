@@ -0,0 +1,177 @@
+#include "ClContext.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef PTGPU_KERNEL_DIR
+#define PTGPU_KERNEL_DIR "kernels"
+#endif
+
+void checkCl(cl_int status, const char* what)
+{
+	if (status != CL_SUCCESS)
+	{
+		throw std::runtime_error(std::string(what) + " failed with OpenCL error " + std::to_string(status));
+	}
+}
+
+namespace
+{
+	std::string deviceString(cl_device_id device, cl_device_info info)
+	{
+		size_t size = 0;
+		clGetDeviceInfo(device, info, 0, nullptr, &size);
+		std::string value(size, '\0');
+		clGetDeviceInfo(device, info, size, value.data(), nullptr);
+		value.erase(std::find(value.begin(), value.end(), '\0'), value.end());
+		return value;
+	}
+
+	bool findDevice(cl_device_type type, cl_device_id& result)
+	{
+		cl_uint platformCount = 0;
+		if (clGetPlatformIDs(0, nullptr, &platformCount) != CL_SUCCESS || platformCount == 0)
+		{
+			return false;
+		}
+		std::vector<cl_platform_id> platforms(platformCount);
+		clGetPlatformIDs(platformCount, platforms.data(), nullptr);
+
+		for (cl_platform_id platform : platforms)
+		{
+			cl_uint deviceCount = 0;
+			if (clGetDeviceIDs(platform, type, 1, &result, &deviceCount) == CL_SUCCESS && deviceCount > 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+ClContext::ClContext(ClDeviceType type)
+{
+	bool found = false;
+	if (type != ClDeviceType::Cpu)
+	{
+		found = findDevice(CL_DEVICE_TYPE_GPU, clDevice);
+	}
+	if (!found && type != ClDeviceType::Gpu)
+	{
+		found = findDevice(CL_DEVICE_TYPE_CPU, clDevice);
+	}
+	if (!found)
+	{
+		throw std::runtime_error("No suitable OpenCL device found");
+	}
+
+	cl_device_type deviceType = 0;
+	clGetDeviceInfo(clDevice, CL_DEVICE_TYPE, sizeof(deviceType), &deviceType, nullptr);
+	cpuDevice = (deviceType & CL_DEVICE_TYPE_CPU) != 0;
+	name = deviceString(clDevice, CL_DEVICE_NAME) + " (" + deviceString(clDevice, CL_DEVICE_VERSION) + ")";
+
+	cl_int status;
+	clContext = clCreateContext(nullptr, 1, &clDevice, nullptr, nullptr, &status);
+	checkCl(status, "clCreateContext");
+	clQueue = clCreateCommandQueue(clContext, clDevice, 0, &status);
+	checkCl(status, "clCreateCommandQueue");
+}
+
+ClContext::~ClContext()
+{
+	if (clQueue)
+	{
+		clReleaseCommandQueue(clQueue);
+	}
+	if (clContext)
+	{
+		clReleaseContext(clContext);
+	}
+}
+
+cl_program ClContext::buildProgram(const std::string& file, const std::string& options) const
+{
+	std::string path = std::string(PTGPU_KERNEL_DIR) + "/" + file;
+	std::ifstream stream(path);
+	if (!stream)
+	{
+		throw std::runtime_error("Cannot open kernel source " + path);
+	}
+	std::stringstream buffer;
+	buffer << stream.rdbuf();
+	std::string source = buffer.str();
+
+	const char* text = source.c_str();
+	size_t length = source.size();
+	cl_int status;
+	cl_program program = clCreateProgramWithSource(clContext, 1, &text, &length, &status);
+	checkCl(status, "clCreateProgramWithSource");
+
+	std::string buildOptions = "-cl-mad-enable -I \"" PTGPU_KERNEL_DIR "\" " + options;
+	status = clBuildProgram(program, 1, &clDevice, buildOptions.c_str(), nullptr, nullptr);
+	if (status != CL_SUCCESS)
+	{
+		size_t logSize = 0;
+		clGetProgramBuildInfo(program, clDevice, CL_PROGRAM_BUILD_LOG, 0, nullptr, &logSize);
+		std::string log(logSize, '\0');
+		clGetProgramBuildInfo(program, clDevice, CL_PROGRAM_BUILD_LOG, logSize, log.data(), nullptr);
+		clReleaseProgram(program);
+		throw std::runtime_error("Building " + file + " failed:\n" + log);
+	}
+	return program;
+}
+
+cl_kernel ClContext::createKernel(cl_program program, const char* kernelName) const
+{
+	cl_int status;
+	cl_kernel kernel = clCreateKernel(program, kernelName, &status);
+	checkCl(status, kernelName);
+	return kernel;
+}
+
+ClBuffer::ClBuffer(const ClContext& context, cl_mem_flags flags, size_t bytes, const void* data)
+	: bytes(std::max<size_t>(bytes, 16))
+{
+	std::vector<unsigned char> padded;
+	if (data && bytes > 0)
+	{
+		if (bytes < this->bytes)
+		{
+			padded.resize(this->bytes, 0);
+			std::memcpy(padded.data(), data, bytes);
+			data = padded.data();
+		}
+		flags |= CL_MEM_COPY_HOST_PTR;
+	}
+	else
+	{
+		data = nullptr;
+	}
+	cl_int status;
+	memory = clCreateBuffer(context.context(), flags, this->bytes, const_cast<void*>(data), &status);
+	checkCl(status, "clCreateBuffer");
+}
+
+ClBuffer::~ClBuffer()
+{
+	if (memory)
+	{
+		clReleaseMemObject(memory);
+	}
+}
+
+ClBuffer::ClBuffer(ClBuffer&& other) noexcept : memory(other.memory), bytes(other.bytes)
+{
+	other.memory = nullptr;
+	other.bytes = 0;
+}
+
+ClBuffer& ClBuffer::operator=(ClBuffer&& other) noexcept
+{
+	std::swap(memory, other.memory);
+	std::swap(bytes, other.bytes);
+	return *this;
+}
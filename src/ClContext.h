@@ -0,0 +1,92 @@
+#pragma once
+
+#if defined(__APPLE__)
+#include <OpenCL/opencl.h>
+#else
+#ifndef CL_TARGET_OPENCL_VERSION
+#define CL_TARGET_OPENCL_VERSION 120
+#endif
+#include <CL/cl.h>
+#endif
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Throws std::runtime_error naming the failed call when status is not CL_SUCCESS.
+void checkCl(cl_int status, const char* what);
+
+enum class ClDeviceType
+{
+	// Prefers a GPU and falls back to a CPU runtime such as PoCL.
+	Any,
+	Gpu,
+	Cpu,
+};
+
+// Owns the OpenCL context and command queue of one device and builds programs from the kernel directory.
+class ClContext
+{
+public:
+	explicit ClContext(ClDeviceType type = ClDeviceType::Any);
+	~ClContext();
+
+	ClContext(const ClContext&) = delete;
+	ClContext& operator=(const ClContext&) = delete;
+
+	// Loads kernels/<file> and builds it with the kernel directory on the include path.
+	cl_program buildProgram(const std::string& file, const std::string& options = "") const;
+	cl_kernel createKernel(cl_program program, const char* name) const;
+
+	cl_context context() const { return clContext; }
+	cl_command_queue queue() const { return clQueue; }
+	cl_device_id device() const { return clDevice; }
+	const std::string& deviceName() const { return name; }
+	bool isCpuDevice() const { return cpuDevice; }
+
+private:
+	cl_device_id clDevice = nullptr;
+	cl_context clContext = nullptr;
+	cl_command_queue clQueue = nullptr;
+	std::string name;
+	bool cpuDevice = false;
+};
+
+// Device buffer with RAII ownership. Zero sized requests allocate a small placeholder because
+// OpenCL does not allow empty buffers.
+class ClBuffer
+{
+public:
+	ClBuffer() = default;
+	ClBuffer(const ClContext& context, cl_mem_flags flags, size_t bytes, const void* data = nullptr);
+	~ClBuffer();
+
+	ClBuffer(ClBuffer&& other) noexcept;
+	ClBuffer& operator=(ClBuffer&& other) noexcept;
+
+	// Works for any contiguous container, e.g. std::vector or Array.
+	template <typename Container>
+	static ClBuffer fromVector(const ClContext& context, const Container& data, cl_mem_flags flags = CL_MEM_READ_ONLY)
+	{
+		return ClBuffer(context, flags, data.size() * sizeof(typename Container::value_type), data.data());
+	}
+
+	cl_mem get() const { return memory; }
+	size_t size() const { return bytes; }
+
+private:
+	cl_mem memory = nullptr;
+	size_t bytes = 0;
+};
+
+template <typename T>
+void setKernelArg(cl_kernel kernel, cl_uint index, const T& value)
+{
+	checkCl(clSetKernelArg(kernel, index, sizeof(T), &value), "clSetKernelArg");
+}
+
+inline void setKernelArg(cl_kernel kernel, cl_uint index, const ClBuffer& buffer)
+{
+	cl_mem memory = buffer.get();
+	checkCl(clSetKernelArg(kernel, index, sizeof(cl_mem), &memory), "clSetKernelArg");
+}
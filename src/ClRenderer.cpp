@@ -0,0 +1,94 @@
+#include "ClRenderer.h"
+
+#include "Timer.h"
+
+ClRenderer::ClRenderer(ClContext& context, const ClScene& scene, const RenderSettings& settings)
+	: context(context), config(settings)
+{
+	accumulation = ClBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_float4) * config.width * config.height);
+	rayCounter = ClBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+	readback.resize(static_cast<size_t>(config.width) * config.height);
+
+	program = context.buildProgram("pathtrace.cl", samplerOptions(settings));
+	kernel = context.createKernel(program, "renderPass");
+
+	const Camera& camera = scene.camera();
+	cl_uint arg = scene.setArgs(kernel, 0);
+	setKernelArg(kernel, arg++, toFloat4(scene.background()));
+	setKernelArg(kernel, arg++, toFloat4(camera.position));
+	setKernelArg(kernel, arg++, toFloat4(camera.forward));
+	setKernelArg(kernel, arg++, toFloat4(camera.right));
+	setKernelArg(kernel, arg++, toFloat4(camera.up));
+	setKernelArg(kernel, arg++, static_cast<cl_float>(camera.tanHalfFov));
+	setKernelArg(kernel, arg++, static_cast<cl_uint>(config.width));
+	setKernelArg(kernel, arg++, static_cast<cl_uint>(config.height));
+	passArgs = arg;
+
+	reset();
+}
+
+ClRenderer::~ClRenderer()
+{
+	clReleaseKernel(kernel);
+	clReleaseProgram(program);
+}
+
+void ClRenderer::reset()
+{
+	cl_float4 zero = {};
+	checkCl(clEnqueueFillBuffer(context.queue(), accumulation.get(), &zero, sizeof(zero), 0, accumulation.size(), 0, nullptr, nullptr), "clEnqueueFillBuffer");
+	checkCl(clFinish(context.queue()), "clFinish");
+	sampleIndex = 0;
+	statistics = RenderStats();
+}
+
+void ClRenderer::renderPass()
+{
+	Timer timer;
+	cl_uint zero = 0;
+	checkCl(clEnqueueWriteBuffer(context.queue(), rayCounter.get(), CL_FALSE, 0, sizeof(zero), &zero, 0, nullptr, nullptr), "clEnqueueWriteBuffer");
+
+	cl_uint arg = passArgs;
+	setKernelArg(kernel, arg++, static_cast<cl_uint>(sampleIndex));
+	setKernelArg(kernel, arg++, static_cast<cl_uint>(config.maxDepth));
+	setKernelArg(kernel, arg++, accumulation);
+	setKernelArg(kernel, arg++, rayCounter);
+
+	size_t local[2] = {8, 8};
+	size_t global[2] = {(config.width + 7) / 8 * 8, (config.height + 7) / 8 * 8};
+	checkCl(clEnqueueNDRangeKernel(context.queue(), kernel, 2, nullptr, global, local, 0, nullptr, nullptr), "clEnqueueNDRangeKernel");
+
+	cl_uint rays = 0;
+	checkCl(clEnqueueReadBuffer(context.queue(), rayCounter.get(), CL_TRUE, 0, sizeof(rays), &rays, 0, nullptr, nullptr), "clEnqueueReadBuffer");
+
+	sampleIndex++;
+	statistics.rays += rays;
+	statistics.passes++;
+	statistics.pathSamples += static_cast<uint64_t>(config.width) * config.height;
+	statistics.lastPassSeconds = timer.seconds();
+	statistics.seconds += statistics.lastPassSeconds;
+}
+
+void ClRenderer::resolve(float* rgba) const
+{
+	resolveAccumulation(context, accumulation, readback, rgba);
+}
+
+void resolveAccumulation(const ClContext& context, const ClBuffer& accumulation, std::vector<cl_float4>& readback, float* rgba)
+{
+	checkCl(clEnqueueReadBuffer(context.queue(), accumulation.get(), CL_TRUE, 0, readback.size() * sizeof(cl_float4), readback.data(), 0, nullptr, nullptr), "clEnqueueReadBuffer");
+	for (size_t i = 0; i < readback.size(); ++i)
+	{
+		float count = readback[i].s[3];
+		float scale = count > 0.0f ? 1.0f / count : 0.0f;
+		rgba[4 * i + 0] = readback[i].s[0] * scale;
+		rgba[4 * i + 1] = readback[i].s[1] * scale;
+		rgba[4 * i + 2] = readback[i].s[2] * scale;
+		rgba[4 * i + 3] = 1.0f;
+	}
+}
+
+std::string samplerOptions(const RenderSettings& settings)
+{
+	return settings.sampler == SamplerType::Sobol ? "-D SOBOL_SAMPLER=1" : "-D SOBOL_SAMPLER=0";
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "ClContext.h"
+#include "ClScene.h"
+#include "Renderer.h"
+
+#include <string>
+#include <vector>
+
+// Progressive megakernel path tracer running kernels/pathtrace.cl, one work item per pixel. Traverses the
+// binary BVH, which maps directly onto the 32 byte node layout used by the kernel.
+class ClRenderer : public Renderer
+{
+public:
+	ClRenderer(ClContext& context, const ClScene& scene, const RenderSettings& settings);
+	~ClRenderer() override;
+
+	void renderPass() override;
+	void reset() override;
+	void resolve(float* rgba) const override;
+
+	const RenderStats& stats() const override { return statistics; }
+	const RenderSettings& settings() const override { return config; }
+	const char* name() const override { return "OpenCL"; }
+
+private:
+	ClContext& context;
+	RenderSettings config;
+	RenderStats statistics;
+	uint32_t sampleIndex = 0;
+	cl_uint passArgs = 0;
+
+	cl_program program = nullptr;
+	cl_kernel kernel = nullptr;
+
+	ClBuffer accumulation;
+	ClBuffer rayCounter;
+
+	mutable std::vector<cl_float4> readback;
+};
+
+// Averages a float4 accumulation buffer whose w component counts samples into RGBA32F.
+void resolveAccumulation(const ClContext& context, const ClBuffer& accumulation, std::vector<cl_float4>& readback, float* rgba);
+
+// Program build options selecting the kernels' sampler to match settings.sampler.
+std::string samplerOptions(const RenderSettings& settings);
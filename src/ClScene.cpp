@@ -0,0 +1,66 @@
+#include "ClScene.h"
+
+ClScene::ClScene(const ClContext& context, const Scene& scene, const Bvh& bvh, const EnvironmentMap* environment)
+	: sceneCamera(scene.camera), sceneBackground(scene.background)
+{
+	static_assert(sizeof(Material) == 36, "Material layout has to match kernels/common.cl");
+	static_assert(sizeof(AliasEntry) == 12, "AliasEntry layout has to match kernels/environment.h");
+
+	std::vector<cl_float4> positionData(scene.positions.size());
+	for (size_t i = 0; i < scene.positions.size(); ++i)
+	{
+		positionData[i] = toFloat4(scene.positions[i]);
+	}
+	LightSet lightSet(scene, environment);
+
+	positions = ClBuffer::fromVector(context, positionData);
+	indices = ClBuffer::fromVector(context, scene.indices);
+	materialIds = ClBuffer::fromVector(context, scene.materialIds);
+	materials = ClBuffer::fromVector(context, scene.materials);
+	nodes = ClBuffer::fromVector(context, bvh.nodes());
+	primitives = ClBuffer::fromVector(context, bvh.primitiveIndices());
+	lights = ClBuffer::fromVector(context, lightSet.triangleList());
+	lightCdf = ClBuffer::fromVector(context, lightSet.cdfList());
+	lightCount = lightSet.size();
+	lightArea = lightSet.area();
+
+	// The pixels are RGBA already, as the kernels read them.
+	if (environment)
+	{
+		size_t texels = static_cast<size_t>(environment->width()) * environment->height();
+		environmentTexels = ClBuffer::fromVector(context, environment->pixelList());
+		environmentMarginal = ClBuffer::fromVector(context, environment->marginalList());
+		environmentConditional = ClBuffer(context, CL_MEM_READ_ONLY, texels * sizeof(AliasEntry), environment->conditionalTable());
+		environmentWidth = environment->width();
+		environmentHeight = environment->height();
+	}
+	else
+	{
+		environmentTexels = ClBuffer(context, CL_MEM_READ_ONLY, 0);
+		environmentMarginal = ClBuffer(context, CL_MEM_READ_ONLY, 0);
+		environmentConditional = ClBuffer(context, CL_MEM_READ_ONLY, 0);
+	}
+	environmentProbability = lightSet.environmentChance();
+}
+
+cl_uint ClScene::setArgs(cl_kernel kernel, cl_uint first) const
+{
+	cl_uint arg = first;
+	setKernelArg(kernel, arg++, positions);
+	setKernelArg(kernel, arg++, indices);
+	setKernelArg(kernel, arg++, materialIds);
+	setKernelArg(kernel, arg++, materials);
+	setKernelArg(kernel, arg++, nodes);
+	setKernelArg(kernel, arg++, primitives);
+	setKernelArg(kernel, arg++, lights);
+	setKernelArg(kernel, arg++, lightCdf);
+	setKernelArg(kernel, arg++, lightCount);
+	setKernelArg(kernel, arg++, lightArea);
+	setKernelArg(kernel, arg++, environmentTexels);
+	setKernelArg(kernel, arg++, environmentMarginal);
+	setKernelArg(kernel, arg++, environmentConditional);
+	setKernelArg(kernel, arg++, environmentWidth);
+	setKernelArg(kernel, arg++, environmentHeight);
+	setKernelArg(kernel, arg++, environmentProbability);
+	return arg;
+}
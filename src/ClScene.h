@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Bvh.h"
+#include "ClContext.h"
+#include "EnvironmentMap.h"
+#include "Lights.h"
+#include "Scene.h"
+
+// Scene data uploaded in the layout expected by SCENE_PARAMETERS in kernels/common.cl.
+class ClScene
+{
+public:
+	// The environment map, when given, takes the place of the background.
+	ClScene(const ClContext& context, const Scene& scene, const Bvh& bvh, const EnvironmentMap* environment = nullptr);
+
+	// Binds the scene parameters starting at argument index first, returns the next free index.
+	cl_uint setArgs(cl_kernel kernel, cl_uint first) const;
+
+	const Camera& camera() const { return sceneCamera; }
+	const Vec3& background() const { return sceneBackground; }
+
+private:
+	ClBuffer positions;
+	ClBuffer indices;
+	ClBuffer materialIds;
+	ClBuffer materials;
+	ClBuffer nodes;
+	ClBuffer primitives;
+	ClBuffer lights;
+	ClBuffer lightCdf;
+	cl_uint lightCount;
+	cl_float lightArea;
+	ClBuffer environmentTexels;
+	ClBuffer environmentMarginal;
+	ClBuffer environmentConditional;
+	cl_uint environmentWidth = 0;
+	cl_uint environmentHeight = 0;
+	cl_float environmentProbability;
+	Camera sceneCamera;
+	Vec3 sceneBackground;
+};
+
+inline cl_float4 toFloat4(const Vec3& v, float w = 0.0f)
+{
+	cl_float4 result;
+	result.s[0] = v.x;
+	result.s[1] = v.y;
+	result.s[2] = v.z;
+	result.s[3] = w;
+	return result;
+}
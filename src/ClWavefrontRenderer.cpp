@@ -0,0 +1,262 @@
+#include "ClWavefrontRenderer.h"
+
+#include "ClRenderer.h"
+#include "Timer.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+	constexpr cl_uint MaxWaveSize = 1u << 20;
+	constexpr size_t LocalSize = 64;
+
+	// Matches the COUNTER_ slots in kernels/wavefront.cl.
+	constexpr cl_uint CounterShadow = 3;
+	constexpr cl_uint CounterNext = 4;
+}
+
+ClWavefrontRenderer::ClWavefrontRenderer(ClContext& context, const ClScene& scene, const RenderSettings& settings)
+	: context(context), scene(scene), config(settings),
+	waveCapacity(std::min(static_cast<cl_uint>(settings.width * settings.height), MaxWaveSize))
+{
+	auto pathBuffer = [&](size_t elementSize)
+	{
+		return ClBuffer(context, CL_MEM_READ_WRITE, elementSize * waveCapacity);
+	};
+	origins = pathBuffer(sizeof(cl_float4));
+	directions = pathBuffer(sizeof(cl_float4));
+	throughputs = pathBuffer(sizeof(cl_float4));
+	radiances = pathBuffer(sizeof(cl_float4));
+	pixels = pathBuffer(sizeof(cl_uint));
+	rngs = pathBuffer(sizeof(SamplerState));
+	specularBounces = pathBuffer(sizeof(cl_uint));
+	alive = pathBuffer(sizeof(cl_uint));
+	hitDistances = pathBuffer(sizeof(cl_float));
+	hitPrimitives = pathBuffer(sizeof(cl_uint));
+	shadowOrigins = pathBuffer(sizeof(cl_float4));
+	shadowDirections = pathBuffer(sizeof(cl_float4));
+	shadowContributions = pathBuffer(sizeof(cl_float4));
+	shadowPaths = pathBuffer(sizeof(cl_uint));
+	activeQueue = pathBuffer(sizeof(cl_uint));
+	nextQueue = pathBuffer(sizeof(cl_uint));
+	materialQueues = pathBuffer(sizeof(cl_uint) * MaterialQueueCount);
+	counters = ClBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * CounterCount);
+	accumulation = ClBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_float4) * config.width * config.height);
+	readback.resize(static_cast<size_t>(config.width) * config.height);
+
+	program = context.buildProgram("wavefront.cl", samplerOptions(settings));
+	generateKernel = context.createKernel(program, "generate");
+	extendKernel = context.createKernel(program, "extend");
+	classifyKernel = context.createKernel(program, "classify");
+	shadeKernels[0] = context.createKernel(program, "shadeDiffuse");
+	shadeKernels[1] = context.createKernel(program, "shadeMirror");
+	shadeKernels[2] = context.createKernel(program, "shadeGlass");
+	connectKernel = context.createKernel(program, "connect");
+	compactKernel = context.createKernel(program, "compact");
+	accumulateKernel = context.createKernel(program, "accumulate");
+
+	// Arguments that stay fixed for the lifetime of the renderer; queue sizes and offsets are set per launch.
+	const Camera& camera = scene.camera();
+	setKernelArg(generateKernel, 2, toFloat4(camera.position));
+	setKernelArg(generateKernel, 3, toFloat4(camera.forward));
+	setKernelArg(generateKernel, 4, toFloat4(camera.right));
+	setKernelArg(generateKernel, 5, toFloat4(camera.up));
+	setKernelArg(generateKernel, 6, static_cast<cl_float>(camera.tanHalfFov));
+	setKernelArg(generateKernel, 7, static_cast<cl_uint>(config.width));
+	setKernelArg(generateKernel, 8, static_cast<cl_uint>(config.height));
+	setKernelArg(generateKernel, 10, origins);
+	setKernelArg(generateKernel, 11, directions);
+	setKernelArg(generateKernel, 12, throughputs);
+	setKernelArg(generateKernel, 13, radiances);
+	setKernelArg(generateKernel, 14, pixels);
+	setKernelArg(generateKernel, 15, rngs);
+	setKernelArg(generateKernel, 16, specularBounces);
+
+	cl_uint arg = scene.setArgs(extendKernel, 0);
+	setKernelArg(extendKernel, arg + 2, origins);
+	setKernelArg(extendKernel, arg + 3, directions);
+	setKernelArg(extendKernel, arg + 4, hitDistances);
+	setKernelArg(extendKernel, arg + 5, hitPrimitives);
+
+	arg = scene.setArgs(classifyKernel, 0);
+	setKernelArg(classifyKernel, arg, toFloat4(scene.background()));
+	setKernelArg(classifyKernel, arg + 3, waveCapacity);
+	setKernelArg(classifyKernel, arg + 4, hitPrimitives);
+	setKernelArg(classifyKernel, arg + 5, throughputs);
+	setKernelArg(classifyKernel, arg + 6, radiances);
+	setKernelArg(classifyKernel, arg + 7, alive);
+	setKernelArg(classifyKernel, arg + 8, materialQueues);
+	setKernelArg(classifyKernel, arg + 9, counters);
+	setKernelArg(classifyKernel, arg + 10, directions);
+	setKernelArg(classifyKernel, arg + 11, specularBounces);
+
+	for (cl_uint type = 0; type < MaterialQueueCount; ++type)
+	{
+		cl_kernel kernel = shadeKernels[type];
+		arg = scene.setArgs(kernel, 0);
+		setKernelArg(kernel, arg + 1, materialQueues);
+		setKernelArg(kernel, arg + 2, type * waveCapacity);
+		setKernelArg(kernel, arg + 3, counters);
+		setKernelArg(kernel, arg + 4, origins);
+		setKernelArg(kernel, arg + 5, directions);
+		setKernelArg(kernel, arg + 6, throughputs);
+		setKernelArg(kernel, arg + 7, radiances);
+		setKernelArg(kernel, arg + 8, rngs);
+		setKernelArg(kernel, arg + 9, specularBounces);
+		setKernelArg(kernel, arg + 10, alive);
+		setKernelArg(kernel, arg + 11, hitDistances);
+		setKernelArg(kernel, arg + 12, hitPrimitives);
+	}
+	arg += 13;
+	setKernelArg(shadeKernels[0], arg++, shadowOrigins);
+	setKernelArg(shadeKernels[0], arg++, shadowDirections);
+	setKernelArg(shadeKernels[0], arg++, shadowContributions);
+	setKernelArg(shadeKernels[0], arg++, shadowPaths);
+
+	arg = scene.setArgs(connectKernel, 0);
+	setKernelArg(connectKernel, arg++, counters);
+	setKernelArg(connectKernel, arg++, shadowOrigins);
+	setKernelArg(connectKernel, arg++, shadowDirections);
+	setKernelArg(connectKernel, arg++, shadowContributions);
+	setKernelArg(connectKernel, arg++, shadowPaths);
+	setKernelArg(connectKernel, arg++, radiances);
+
+	setKernelArg(compactKernel, 2, alive);
+	setKernelArg(compactKernel, 4, counters);
+
+	setKernelArg(accumulateKernel, 1, pixels);
+	setKernelArg(accumulateKernel, 2, radiances);
+	setKernelArg(accumulateKernel, 3, accumulation);
+
+	reset();
+}
+
+ClWavefrontRenderer::~ClWavefrontRenderer()
+{
+	cl_kernel kernels[] = {generateKernel, extendKernel, classifyKernel, shadeKernels[0], shadeKernels[1], shadeKernels[2],
+		connectKernel, compactKernel, accumulateKernel};
+	for (cl_kernel kernel : kernels)
+	{
+		clReleaseKernel(kernel);
+	}
+	clReleaseProgram(program);
+}
+
+void ClWavefrontRenderer::reset()
+{
+	cl_float4 zero = {};
+	checkCl(clEnqueueFillBuffer(context.queue(), accumulation.get(), &zero, sizeof(zero), 0, accumulation.size(), 0, nullptr, nullptr), "clEnqueueFillBuffer");
+	checkCl(clFinish(context.queue()), "clFinish");
+	sampleIndex = 0;
+	statistics = RenderStats();
+	stageTimings.clear();
+}
+
+void ClWavefrontRenderer::renderPass()
+{
+	Timer timer;
+	cl_uint pixelCount = config.width * config.height;
+	for (cl_uint first = 0; first < pixelCount; first += waveCapacity)
+	{
+		renderWave(first, std::min(waveCapacity, pixelCount - first));
+	}
+
+	sampleIndex++;
+	statistics.passes++;
+	statistics.pathSamples += pixelCount;
+	statistics.lastPassSeconds = timer.seconds();
+	statistics.seconds += statistics.lastPassSeconds;
+}
+
+void ClWavefrontRenderer::renderWave(cl_uint firstPixel, cl_uint pathCount)
+{
+	// The active and next queues swap roles every bounce, so the kernels reading them are rebound.
+	const ClBuffer* active = &activeQueue;
+	const ClBuffer* next = &nextQueue;
+
+	Timer timer;
+	setKernelArg(generateKernel, 0, firstPixel);
+	setKernelArg(generateKernel, 1, pathCount);
+	setKernelArg(generateKernel, 9, static_cast<cl_uint>(sampleIndex));
+	setKernelArg(generateKernel, 17, *active);
+	launch(generateKernel, pathCount);
+	checkCl(clFinish(context.queue()), "clFinish");
+	stageTimings.add(0, WavefrontStage::Generate, timer.seconds());
+
+	cl_uint activeCount = pathCount;
+	cl_uint sceneArgs = scene.setArgs(extendKernel, 0);
+	for (uint32_t depth = 0; depth < config.maxDepth && activeCount > 0; ++depth)
+	{
+		stageTimings.addPaths(depth, activeCount);
+		statistics.rays += activeCount;
+
+		cl_uint zero = 0;
+		checkCl(clEnqueueFillBuffer(context.queue(), counters.get(), &zero, sizeof(zero), 0, counters.size(), 0, nullptr, nullptr), "clEnqueueFillBuffer");
+
+		timer.reset();
+		setKernelArg(extendKernel, sceneArgs, *active);
+		setKernelArg(extendKernel, sceneArgs + 1, activeCount);
+		launch(extendKernel, activeCount);
+		checkCl(clFinish(context.queue()), "clFinish");
+		stageTimings.add(depth, WavefrontStage::Extend, timer.seconds());
+
+		timer.reset();
+		setKernelArg(classifyKernel, sceneArgs + 1, *active);
+		setKernelArg(classifyKernel, sceneArgs + 2, activeCount);
+		launch(classifyKernel, activeCount);
+		cl_uint queueSizes[CounterCount];
+		readCounters(queueSizes);
+		for (cl_uint type = 0; type < MaterialQueueCount; ++type)
+		{
+			if (queueSizes[type] > 0)
+			{
+				setKernelArg(shadeKernels[type], sceneArgs, static_cast<cl_uint>(depth));
+				launch(shadeKernels[type], queueSizes[type]);
+			}
+		}
+		stageTimings.add(depth, WavefrontStage::Shade, timer.seconds());
+
+		timer.reset();
+		readCounters(queueSizes);
+		if (queueSizes[CounterShadow] > 0)
+		{
+			statistics.rays += queueSizes[CounterShadow];
+			launch(connectKernel, queueSizes[CounterShadow]);
+		}
+		stageTimings.add(depth, WavefrontStage::Connect, timer.seconds());
+
+		timer.reset();
+		setKernelArg(compactKernel, 0, *active);
+		setKernelArg(compactKernel, 1, activeCount);
+		setKernelArg(compactKernel, 3, *next);
+		launch(compactKernel, activeCount);
+		readCounters(queueSizes);
+		activeCount = queueSizes[CounterNext];
+		std::swap(active, next);
+		stageTimings.add(depth, WavefrontStage::Compact, timer.seconds());
+	}
+
+	timer.reset();
+	setKernelArg(accumulateKernel, 0, pathCount);
+	launch(accumulateKernel, pathCount);
+	checkCl(clFinish(context.queue()), "clFinish");
+	stageTimings.add(0, WavefrontStage::Accumulate, timer.seconds());
+}
+
+void ClWavefrontRenderer::launch(cl_kernel kernel, size_t count)
+{
+	size_t global = (count + LocalSize - 1) / LocalSize * LocalSize;
+	size_t local = LocalSize;
+	checkCl(clEnqueueNDRangeKernel(context.queue(), kernel, 1, nullptr, &global, &local, 0, nullptr, nullptr), "clEnqueueNDRangeKernel");
+}
+
+void ClWavefrontRenderer::readCounters(cl_uint* values)
+{
+	checkCl(clEnqueueReadBuffer(context.queue(), counters.get(), CL_TRUE, 0, sizeof(cl_uint) * CounterCount, values, 0, nullptr, nullptr), "clEnqueueReadBuffer");
+}
+
+void ClWavefrontRenderer::resolve(float* rgba) const
+{
+	resolveAccumulation(context, accumulation, readback, rgba);
+}
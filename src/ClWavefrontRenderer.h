@@ -0,0 +1,79 @@
+#pragma once
+
+#include "ClContext.h"
+#include "ClScene.h"
+#include "Renderer.h"
+#include "Wavefront.h"
+
+#include <vector>
+
+// Wavefront variant of ClRenderer running kernels/wavefront.cl. Each stage is its own kernel launch
+// and the host drives the bounce loop, reading back queue sizes between stages.
+class ClWavefrontRenderer : public Renderer
+{
+public:
+	ClWavefrontRenderer(ClContext& context, const ClScene& scene, const RenderSettings& settings);
+	~ClWavefrontRenderer() override;
+
+	void renderPass() override;
+	void reset() override;
+	void resolve(float* rgba) const override;
+
+	const RenderStats& stats() const override { return statistics; }
+	const RenderSettings& settings() const override { return config; }
+	const char* name() const override { return "OpenCL wavefront"; }
+	void printStats(std::ostream& out) const override { stageTimings.print(out); }
+
+	const WavefrontTimings& timings() const { return stageTimings; }
+
+private:
+	static constexpr cl_uint MaterialQueueCount = 3;
+	static constexpr cl_uint CounterCount = 5;
+
+	void renderWave(cl_uint firstPixel, cl_uint pathCount);
+	void launch(cl_kernel kernel, size_t count);
+	void readCounters(cl_uint* values);
+
+	ClContext& context;
+	const ClScene& scene;
+	RenderSettings config;
+	RenderStats statistics;
+	WavefrontTimings stageTimings;
+	uint32_t sampleIndex = 0;
+	cl_uint waveCapacity;
+
+	cl_program program = nullptr;
+	cl_kernel generateKernel = nullptr;
+	cl_kernel extendKernel = nullptr;
+	cl_kernel classifyKernel = nullptr;
+	cl_kernel shadeKernels[MaterialQueueCount] = {};
+	cl_kernel connectKernel = nullptr;
+	cl_kernel compactKernel = nullptr;
+	cl_kernel accumulateKernel = nullptr;
+
+	// Per path state, indexed by path.
+	ClBuffer origins;
+	ClBuffer directions;
+	ClBuffer throughputs;
+	ClBuffer radiances;
+	ClBuffer pixels;
+	ClBuffer rngs;
+	ClBuffer specularBounces;
+	ClBuffer alive;
+	ClBuffer hitDistances;
+	ClBuffer hitPrimitives;
+
+	// Shadow rays, at most one per diffuse hit; the direction's w holds the ray length.
+	ClBuffer shadowOrigins;
+	ClBuffer shadowDirections;
+	ClBuffer shadowContributions;
+	ClBuffer shadowPaths;
+
+	ClBuffer activeQueue;
+	ClBuffer nextQueue;
+	ClBuffer materialQueues;
+	ClBuffer counters;
+	ClBuffer accumulation;
+
+	mutable std::vector<cl_float4> readback;
+};
@@ -0,0 +1,4 @@
+#pragma once
+
+// Runtime checks for the instruction sets the optional kernels are compiled for.
+bool cpuSupportsAvx2();
@@ -0,0 +1,390 @@
+#include "CpuRenderer.h"
+
+#include "Timer.h"
+
+#include <algorithm>
+#include <numeric>
+#include <optional>
+#include <ostream>
+
+CpuRenderer::CpuRenderer(const Scene& scene, const Accelerator& accelerator, ThreadPool& pool, const RenderSettings& settings,
+	const TextureCache* textures, const LightSet* sharedLights)
+	: scene(scene), accelerator(accelerator), textures(textures), pool(pool), config(settings),
+	ownedLights(sharedLights ? nullptr : settings.lightTree ? std::make_unique<LightSet>(scene, pool) : std::make_unique<LightSet>(scene)),
+	lights(sharedLights ? *sharedLights : *ownedLights), accumulation(settings.width, settings.height, settings.aovs),
+	tiles(makeTiles(settings)), activeTiles(tiles.size()), convergedTiles(tiles.size(), 0), scheduler(pool, settings, tiles),
+	dirty(tiles.size(), 0), counters(pool.size())
+{
+	std::iota(activeTiles.begin(), activeTiles.end(), 0u);
+}
+
+void CpuRenderer::reset()
+{
+	accumulation.clear();
+	std::fill(dirty.begin(), dirty.end(), 1);
+	activeTiles.resize(tiles.size());
+	std::iota(activeTiles.begin(), activeTiles.end(), 0u);
+	std::fill(convergedTiles.begin(), convergedTiles.end(), 0);
+	scheduler.reset();
+	statistics = RenderStats();
+}
+
+void CpuRenderer::resolveTiles(float* rgba, const std::vector<uint32_t>& tileIndices) const
+{
+	for (uint32_t index : tileIndices)
+	{
+		const Tile& tile = tiles[index];
+		accumulation.resolveRect(rgba, tile.x0, tile.y0, tile.x1, tile.y1);
+	}
+}
+
+void CpuRenderer::takeDirtyTiles(std::vector<uint32_t>& tileIndices)
+{
+	for (uint32_t i = 0; i < dirty.size(); ++i)
+	{
+		if (dirty[i])
+		{
+			tileIndices.push_back(i);
+			dirty[i] = 0;
+		}
+	}
+}
+
+void CpuRenderer::renderPass()
+{
+	Timer timer;
+	for (ThreadCounters& c : counters)
+	{
+		c.rays = 0;
+	}
+
+	uint64_t samples = 0;
+	scheduler.run(activeTiles, [this](const Tile& rect, uint32_t, uint32_t thread)
+	{
+		renderTile(rect, thread);
+	});
+	for (uint32_t tile : activeTiles)
+	{
+		dirty[tile] = 1;
+		samples += static_cast<uint64_t>(tiles[tile].x1 - tiles[tile].x0) * (tiles[tile].y1 - tiles[tile].y0);
+	}
+
+	for (const ThreadCounters& c : counters)
+	{
+		statistics.rays += c.rays;
+	}
+	statistics.passes++;
+	statistics.pathSamples += samples;
+	updateConvergence();
+	statistics.lastPassSeconds = timer.seconds();
+	statistics.seconds += statistics.lastPassSeconds;
+}
+
+void CpuRenderer::updateConvergence()
+{
+	if (config.adaptiveThreshold <= 0.0f || statistics.passes < std::max(2u, config.adaptiveMinSamples))
+	{
+		return;
+	}
+	pool.parallelFor(static_cast<uint32_t>(activeTiles.size()), [this](uint32_t i, uint32_t)
+	{
+		const Tile& tile = tiles[activeTiles[i]];
+		for (uint32_t y = tile.y0; y < tile.y1; ++y)
+		{
+			for (uint32_t x = tile.x0; x < tile.x1; ++x)
+			{
+				if (accumulation.relativeError(y * config.width + x) > config.adaptiveThreshold)
+				{
+					return;
+				}
+			}
+		}
+		convergedTiles[activeTiles[i]] = 1;
+	});
+	activeTiles.erase(std::remove_if(activeTiles.begin(), activeTiles.end(), [this](uint32_t tile) { return convergedTiles[tile] != 0; }),
+		activeTiles.end());
+}
+
+bool CpuRenderer::saveCheckpoint(RenderCheckpoint& checkpoint) const
+{
+	// Samplers are seeded by pixel and sample index, so the samples and the finished tiles are the
+	// whole state.
+	checkpoint.stats = statistics;
+	checkpoint.state = convergedTiles;
+	accumulation.save(checkpoint.samples);
+	return true;
+}
+
+bool CpuRenderer::restoreCheckpoint(const RenderCheckpoint& checkpoint)
+{
+	if (checkpoint.state.size() != tiles.size() || !accumulation.load(checkpoint.samples))
+	{
+		return false;
+	}
+	statistics = checkpoint.stats;
+	convergedTiles = checkpoint.state;
+	activeTiles.clear();
+	for (uint32_t tile = 0; tile < tiles.size(); ++tile)
+	{
+		if (!convergedTiles[tile])
+		{
+			activeTiles.push_back(tile);
+		}
+	}
+	std::fill(dirty.begin(), dirty.end(), 1);
+	scheduler.reset();
+	return true;
+}
+
+bool CpuRenderer::convergenceMask(float* rgba) const
+{
+	uint32_t maxSamples = 1;
+	for (uint32_t i = 0; i < accumulation.pixelCount(); ++i)
+	{
+		maxSamples = std::max(maxSamples, accumulation.sampleCount(i));
+	}
+	float threshold = config.adaptiveThreshold > 0.0f ? config.adaptiveThreshold : 1.0f;
+	for (uint32_t t = 0; t < tiles.size(); ++t)
+	{
+		const Tile& tile = tiles[t];
+		for (uint32_t y = tile.y0; y < tile.y1; ++y)
+		{
+			for (uint32_t x = tile.x0; x < tile.x1; ++x)
+			{
+				uint32_t i = y * config.width + x;
+				rgba[4 * i + 0] = std::min(1.0f, accumulation.relativeError(i) / threshold);
+				rgba[4 * i + 1] = convergedTiles[t] ? 1.0f : 0.0f;
+				rgba[4 * i + 2] = static_cast<float>(accumulation.sampleCount(i)) / maxSamples;
+				rgba[4 * i + 3] = 1.0f;
+			}
+		}
+	}
+	return true;
+}
+
+void CpuRenderer::printStats(std::ostream& out) const
+{
+	scheduler.printStats(out);
+	if (config.adaptiveThreshold > 0.0f)
+	{
+		uint64_t uniform = static_cast<uint64_t>(statistics.passes) * accumulation.pixelCount();
+		uint64_t saved = uniform - statistics.pathSamples;
+		out << "Adaptive sampling: " << tiles.size() - activeTiles.size() << " of " << tiles.size() << " tiles converged, saved " << saved
+			<< " samples (" << 100.0 * saved / std::max<uint64_t>(1, uniform) << "% of " << uniform << ")" << std::endl;
+	}
+}
+
+void CpuRenderer::renderTile(const Tile& tile, uint32_t threadIndex)
+{
+	float aspect = static_cast<float>(config.width) / config.height;
+	float spread = scene.camera.pixelSpread(config.height);
+	uint64_t rays = 0;
+	for (uint32_t y = tile.y0; y < tile.y1; ++y)
+	{
+		for (uint32_t x0 = tile.x0; x0 < tile.x1; x0 += RayPacketSize)
+		{
+			uint32_t count = std::min(RayPacketSize, tile.x1 - x0);
+			std::optional<Sampler> rngs[RayPacketSize];
+			Ray cameraRays[RayPacketSize];
+			Hit hits[RayPacketSize];
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				uint32_t pixel = y * config.width + x0 + i;
+				Sampler& rng = rngs[i].emplace(pixel, accumulation.sampleCount(pixel), config.sampler);
+				float u = (x0 + i + rng.nextFloat()) / config.width;
+				float v = (y + rng.nextFloat()) / config.height;
+				cameraRays[i] = scene.camera.generateRay(u, v, aspect);
+			}
+			rays += count;
+			if (config.packetTraversal)
+			{
+				accelerator.intersectRays(cameraRays, hits, count);
+			}
+			else
+			{
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					accelerator.intersect(cameraRays[i], hits[i]);
+				}
+			}
+
+			// Shade the first hits, then test their shadow rays together.
+			Path paths[RayPacketSize];
+			bool alive[RayPacketSize];
+			Ray shadows[RayPacketSize];
+			uint32_t shadowPaths[RayPacketSize];
+			uint32_t shadowCount = 0;
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				Path& path = paths[i];
+				path.ray = cameraRays[i];
+				path.cone.spread = spread;
+				alive[i] = false;
+				if (!hits[i].valid())
+				{
+					path.radiance += path.throughput * lights.background(path.ray.direction);
+					path.first.emission = path.radiance;
+					continue;
+				}
+				alive[i] = shadeHit(path, hits[i], 0, *rngs[i], rays);
+				if (path.shadowPending)
+				{
+					shadows[shadowCount] = path.shadow;
+					shadowPaths[shadowCount++] = i;
+				}
+			}
+			uint32_t occluded = 0;
+			if (config.packetTraversal)
+			{
+				occluded = accelerator.occludedRays(shadows, shadowCount);
+			}
+			else
+			{
+				for (uint32_t s = 0; s < shadowCount; ++s)
+				{
+					occluded |= accelerator.occluded(shadows[s]) ? 1u << s : 0u;
+				}
+			}
+			for (uint32_t s = 0; s < shadowCount; ++s)
+			{
+				if (!(occluded >> s & 1))
+				{
+					Path& path = paths[shadowPaths[s]];
+					path.radiance += path.shadowContribution;
+				}
+			}
+
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				Vec3 radiance = alive[i] ? tracePath(paths[i], 1, *rngs[i], rays) : paths[i].radiance;
+				accumulation.addFirstHit(y * config.width + x0 + i, paths[i].first);
+				accumulation.addSample(y * config.width + x0 + i, radiance);
+			}
+		}
+	}
+	counters[threadIndex].rays += rays;
+}
+
+bool CpuRenderer::sampleDirectLight(const Vec3& position, const Vec3& normal, const Vec3& albedo, Sampler& rng, Ray& shadow, Vec3& contribution) const
+{
+	if (lights.empty())
+	{
+		return false;
+	}
+
+	Vec3 radiance;
+	// Drawn in a fixed order: argument evaluation order is unspecified and the dimensions are counted.
+	float u0 = rng.nextFloat();
+	rng.startPair();
+	float u1 = rng.nextFloat();
+	float u2 = rng.nextFloat();
+	if (!lights.sampleDirect(position, normal, u0, u1, u2, shadow, radiance))
+	{
+		return false;
+	}
+	contribution = albedo * InvPi * radiance;
+	return true;
+}
+
+bool CpuRenderer::shadeHit(Path& path, const Hit& hit, uint32_t depth, Sampler& rng, uint64_t& rays) const
+{
+	const Ray& ray = path.ray;
+	const Material& material = scene.material(hit.primitive);
+	Vec3 position = ray.at(hit.t);
+	Vec3 normal = scene.geometricNormal(hit.instance, hit.primitive);
+	bool frontFace = dot(normal, ray.direction) < 0.0f;
+	Vec3 albedo = surfaceAlbedo(scene, textures, material, hit, ray.direction, path.cone.widthAt(hit.t));
+
+	if (frontFace && material.emissive())
+	{
+		float weight = path.specularBounce ? 1.0f : lights.emissionWeight(path.lastPosition, path.lastNormal, ray.direction, hit);
+		path.radiance += path.throughput * material.emission * weight;
+	}
+
+	if (depth == 0)
+	{
+		path.first.emission = path.radiance;
+		path.first.albedo = albedo;
+		path.first.normal = frontFace ? normal : -normal;
+		path.first.depth = hit.t;
+		path.first.object = scene.object(hit);
+	}
+
+	Ray next;
+	path.shadowPending = false;
+	if (material.type == MaterialType::Diffuse)
+	{
+		Vec3 n = frontFace ? normal : -normal;
+		Vec3 contribution;
+		if (sampleDirectLight(position, n, albedo, rng, path.shadow, contribution))
+		{
+			rays++;
+			path.shadowPending = true;
+			path.shadowContribution = path.throughput * contribution;
+		}
+		next.origin = position + n * RayEpsilon;
+		rng.startPair();
+		float u1 = rng.nextFloat();
+		float u2 = rng.nextFloat();
+		next.direction = cosineSampleHemisphere(n, u1, u2);
+		path.throughput *= albedo;
+		path.specularBounce = false;
+		path.lastPosition = position;
+		path.lastNormal = n;
+	}
+	else if (material.type == MaterialType::Mirror)
+	{
+		Vec3 n = frontFace ? normal : -normal;
+		next.origin = position + n * RayEpsilon;
+		next.direction = reflect(ray.direction, n);
+		path.throughput *= albedo;
+		path.specularBounce = true;
+	}
+	else
+	{
+		Vec3 n = frontFace ? normal : -normal;
+		float eta = frontFace ? 1.0f / material.ior : material.ior;
+		bool refracted = sampleDielectric(ray.direction, n, eta, rng.nextFloat(), next.direction);
+		next.origin = position + (refracted ? -n : n) * RayEpsilon;
+		path.throughput *= albedo;
+		path.specularBounce = true;
+	}
+	path.cone.bounce(hit.t, path.specularBounce);
+	path.ray = next;
+
+	if (depth >= 3)
+	{
+		float survival = std::min(0.95f, maxComponent(path.throughput));
+		if (rng.nextFloat() >= survival)
+		{
+			return false;
+		}
+		path.throughput *= 1.0f / survival;
+	}
+	return true;
+}
+
+Vec3 CpuRenderer::tracePath(Path& path, uint32_t depth, Sampler& rng, uint64_t& rays) const
+{
+	for (; depth < config.maxDepth; ++depth)
+	{
+		Hit hit;
+		rays++;
+		if (!accelerator.intersect(path.ray, hit))
+		{
+			float weight = path.specularBounce ? 1.0f : lights.backgroundWeight(path.lastNormal, path.ray.direction);
+			path.radiance += path.throughput * lights.background(path.ray.direction) * weight;
+			break;
+		}
+		bool alive = shadeHit(path, hit, depth, rng, rays);
+		if (path.shadowPending && !accelerator.occluded(path.shadow))
+		{
+			path.radiance += path.shadowContribution;
+		}
+		if (!alive)
+		{
+			break;
+		}
+	}
+	return path.radiance;
+}
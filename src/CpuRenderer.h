@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Accelerator.h"
+#include "Framebuffer.h"
+#include "Lights.h"
+#include "Random.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "Shading.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include "TileScheduler.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Progressive tile-based path tracer. Each pass adds one sample to every pixel of the active tiles,
+// tiles are distributed over the thread pool by a work-stealing TileScheduler. With adaptive
+// sampling, tiles whose pixels have converged leave the active set. Camera rays of neighbouring
+// pixels, and the shadow rays of their first hits, are traced as packets. Textures, when given, are
+// filtered over the ray cone of each path. Direct light combines light and BSDF samples by multiple
+// importance sampling; without a shared LightSet the renderer builds its own.
+class CpuRenderer : public Renderer
+{
+public:
+	CpuRenderer(const Scene& scene, const Accelerator& accelerator, ThreadPool& pool, const RenderSettings& settings,
+		const TextureCache* textures = nullptr, const LightSet* sharedLights = nullptr);
+
+	void renderPass() override;
+	void reset() override;
+	void resolve(float* rgba) const override { accumulation.resolve(rgba); }
+	bool resolveFeatures(PixelFeatures& features) const override { return accumulation.resolveFeatures(features); }
+	AovMask resolveAovs(AovMask aovs, bool half, LayeredImage& image) const override { return accumulation.resolveAovs(aovs, half, image); }
+	void resolveTiles(float* rgba, const std::vector<uint32_t>& tileIndices) const override;
+	void takeDirtyTiles(std::vector<uint32_t>& tileIndices) override;
+	void printStats(std::ostream& out) const override;
+	bool converged() const override { return activeTiles.empty(); }
+	bool convergenceMask(float* rgba) const override;
+	bool saveCheckpoint(RenderCheckpoint& checkpoint) const override;
+	bool restoreCheckpoint(const RenderCheckpoint& checkpoint) override;
+
+	const RenderStats& stats() const override { return statistics; }
+	const RenderSettings& settings() const override { return config; }
+	const char* name() const override { return "CPU"; }
+
+	const Framebuffer& framebuffer() const { return accumulation; }
+
+private:
+	struct alignas(64) ThreadCounters
+	{
+		uint64_t rays = 0;
+	};
+
+	struct Path
+	{
+		Ray ray;
+		Vec3 radiance = Vec3(0.0f);
+		Vec3 throughput = Vec3(1.0f);
+		RayCone cone;
+		bool specularBounce = true;
+		// Last diffuse vertex, for weighting the emission that its bounce finds.
+		Vec3 lastPosition;
+		Vec3 lastNormal;
+		// Light sample of the last vertex, added unless the shadow ray is occluded.
+		bool shadowPending = false;
+		Ray shadow;
+		Vec3 shadowContribution;
+		FirstHit first;
+	};
+
+	void renderTile(const Tile& tile, uint32_t threadIndex);
+	void updateConvergence();
+	// Shades the hit of path.ray at the given depth and sets up the next ray. Returns false when the
+	// path ends there. A pending shadow ray is left for the caller to trace.
+	bool shadeHit(Path& path, const Hit& hit, uint32_t depth, Sampler& rng, uint64_t& rays) const;
+	// Traces the path from its next ray at the given depth to the end and returns its radiance.
+	Vec3 tracePath(Path& path, uint32_t depth, Sampler& rng, uint64_t& rays) const;
+	bool sampleDirectLight(const Vec3& position, const Vec3& normal, const Vec3& albedo, Sampler& rng, Ray& shadow, Vec3& contribution) const;
+
+	const Scene& scene;
+	const Accelerator& accelerator;
+	const TextureCache* textures;
+	ThreadPool& pool;
+	RenderSettings config;
+	std::unique_ptr<LightSet> ownedLights;
+	const LightSet& lights;
+	Framebuffer accumulation;
+	std::vector<Tile> tiles;
+	// Tiles still being sampled, all of them without adaptive sampling.
+	std::vector<uint32_t> activeTiles;
+	std::vector<uint8_t> convergedTiles;
+	TileScheduler scheduler;
+	// Set for the tiles a pass rendered, cleared by takeDirtyTiles.
+	std::vector<uint8_t> dirty;
+	std::vector<ThreadCounters> counters;
+	RenderStats statistics;
+};
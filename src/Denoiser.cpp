@@ -0,0 +1,246 @@
+#include "Denoiser.h"
+
+#include "CpuFeatures.h"
+#include "Timer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	enum Plane : uint32_t
+	{
+		ColorA = 0,
+		ColorB = 4,
+		NormalX = 8,
+		Depth = 11,
+		Slope = 12,
+		Deviation = 13,
+		// Per pixel deviation before smoothing, negative where the sample count gives none.
+		RawDeviation = 14,
+		PlaneCount = 15
+	};
+
+	constexpr uint32_t TileWidth = 128;
+	constexpr uint32_t TileHeight = 16;
+	// Far enough from every unit normal and from 0, the normal of background pixels, that padding
+	// pixels weigh nothing next to real ones.
+	constexpr float PaddingNormal = 1e4f;
+	// Albedo channels are floored before dividing by them, so that black surfaces keep finite values.
+	constexpr float MinAlbedo = 0.01f;
+
+	uint32_t roundUp8(uint32_t n)
+	{
+		return (n + 7) & ~7u;
+	}
+}
+
+Denoiser::Denoiser(uint32_t width, uint32_t height, ThreadPool& pool, const DenoiseSettings& settings)
+	: width(width), height(height), pool(pool), config(settings), avx2(cpuSupportsAvx2())
+{
+	config.iterations = std::max(1u, std::min(config.iterations, 10u));
+	// Taps of the last pass reach twice its step beyond the vectors at either end of a row.
+	padding = roundUp8(2u << (config.iterations - 1));
+	stride = padding + roundUp8(width) + padding;
+	planeFloats = stride * height;
+	planes.resize(PlaneCount * planeFloats / 8);
+
+	for (uint32_t axis = 0; axis < 3; ++axis)
+	{
+		float* normal = plane(NormalX + axis);
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			std::fill(normal + y * stride - padding, normal + y * stride, PaddingNormal);
+			std::fill(normal + y * stride + width, normal + y * stride + stride - padding, PaddingNormal);
+		}
+	}
+
+	// Tiles are cut at multiples of 8 and run into the padding on the right rather than stopping at the
+	// image edge, so that the kernels only process whole vectors.
+	uint32_t paddedWidth = roundUp8(width);
+	for (uint32_t y = 0; y < height; y += TileHeight)
+	{
+		for (uint32_t x = 0; x < paddedWidth; x += TileWidth)
+		{
+			tiles.push_back({x, y, std::min(x + TileWidth, paddedWidth), std::min(y + TileHeight, height)});
+		}
+	}
+}
+
+const char* Denoiser::kernelName() const
+{
+	return avx2 ? "AVX2" : "SSE";
+}
+
+bool Denoiser::denoise(const Renderer& renderer, float* output)
+{
+	if (!renderer.resolveFeatures(features))
+	{
+		renderer.resolve(output);
+		return false;
+	}
+	resolved.resize(4 * static_cast<size_t>(width) * height);
+	renderer.resolve(resolved.data());
+	denoise(resolved.data(), features, output);
+	return true;
+}
+
+void Denoiser::denoise(const float* rgba, const PixelFeatures& guides, float* output)
+{
+	Timer timer;
+	prepare(rgba, guides);
+
+	DenoisePass pass;
+	pass.normal[0] = plane(NormalX);
+	pass.normal[1] = plane(NormalX + 1);
+	pass.normal[2] = plane(NormalX + 2);
+	pass.depth = plane(Depth);
+	pass.slope = plane(Slope);
+	pass.deviation = plane(Deviation);
+	pass.height = height;
+	pass.stride = stride;
+	pass.normalWeight = config.normalSharpness;
+	pass.depthScale = config.depthSigma;
+	uint32_t source = ColorA;
+	uint32_t target = ColorB;
+	for (uint32_t i = 0; i < config.iterations; ++i)
+	{
+		for (uint32_t c = 0; c < 4; ++c)
+		{
+			pass.color[c] = plane(source + c);
+			pass.filtered[c] = plane(target + c);
+		}
+		pass.step = 1 << i;
+		pass.deviationScale = config.colorSigma / static_cast<float>(pass.step);
+		pool.parallelFor(static_cast<uint32_t>(tiles.size()), [&](uint32_t t, uint32_t)
+		{
+			if (avx2)
+			{
+				denoiseTileAvx2(pass, tiles[t]);
+			}
+			else
+			{
+				denoiseTileSse(pass, tiles[t]);
+			}
+		});
+		std::swap(source, target);
+	}
+
+	const float* color[3] = {plane(source), plane(source + 1), plane(source + 2)};
+	finish(color, guides, output);
+	lastTime = timer.seconds();
+	totalTime += lastTime;
+	frameCount++;
+}
+
+void Denoiser::prepare(const float* rgba, const PixelFeatures& guides)
+{
+	float* color[4] = {plane(ColorA), plane(ColorA + 1), plane(ColorA + 2), plane(ColorA + 3)};
+	float* normal[3] = {plane(NormalX), plane(NormalX + 1), plane(NormalX + 2)};
+	float* depth = plane(Depth);
+	float* raw = plane(RawDeviation);
+	pool.parallelFor(height, [&](uint32_t y, uint32_t)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			size_t pixel = static_cast<size_t>(y) * width + x;
+			size_t index = y * stride + x;
+			const Vec3& emission = guides.emission[pixel];
+			const Vec3& albedo = guides.albedo[pixel];
+			Vec3 illumination((rgba[4 * pixel] - emission.x) / std::max(albedo.x, MinAlbedo), (rgba[4 * pixel + 1] - emission.y) / std::max(albedo.y, MinAlbedo),
+				(rgba[4 * pixel + 2] - emission.z) / std::max(albedo.z, MinAlbedo));
+			color[0][index] = illumination.x;
+			color[1][index] = illumination.y;
+			color[2][index] = illumination.z;
+			color[3][index] = luminance(illumination);
+			normal[0][index] = guides.normal[pixel].x;
+			normal[1][index] = guides.normal[pixel].y;
+			normal[2][index] = guides.normal[pixel].z;
+			depth[index] = guides.depth[pixel];
+			float variance = guides.variance[pixel];
+			raw[index] = variance < 0.0f ? -1.0f : std::sqrt(variance) / std::max(luminance(albedo), MinAlbedo);
+		}
+	}, 4);
+
+	float* slope = plane(Slope);
+	float* deviation = plane(Deviation);
+	pool.parallelFor(height, [&](uint32_t y, uint32_t)
+	{
+		uint32_t y0 = y > 0 ? y - 1 : y;
+		uint32_t y1 = std::min(y + 1, height - 1);
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			uint32_t x0 = x > 0 ? x - 1 : x;
+			uint32_t x1 = std::min(x + 1, width - 1);
+			size_t index = y * stride + x;
+
+			// Depth slope against the neighbours on the same surface side of the background.
+			float z = depth[index];
+			float steepest = 0.0f;
+			for (size_t neighbour : {y * stride + x0, y * stride + x1, y0 * stride + x, y1 * stride + x})
+			{
+				if ((depth[neighbour] > 0.0f) == (z > 0.0f))
+				{
+					steepest = std::max(steepest, std::abs(depth[neighbour] - z));
+				}
+			}
+			slope[index] = steepest;
+
+			// Smooths the per pixel estimates over 3x3 pixels, outliers keeping their own so that they
+			// blend into their surroundings. Pixels with fewer than two samples have none and take the
+			// spread of the luminance around them instead.
+			float spread = raw[index];
+			if (spread >= 0.0f)
+			{
+				float sum = 0.0f;
+				uint32_t known = 0;
+				for (uint32_t ny = y0; ny <= y1; ++ny)
+				{
+					for (uint32_t nx = x0; nx <= x1; ++nx)
+					{
+						float neighbour = raw[ny * stride + nx];
+						sum += neighbour >= 0.0f ? neighbour : 0.0f;
+						known += neighbour >= 0.0f ? 1 : 0;
+					}
+				}
+				spread = std::max(spread, sum / known);
+			}
+			else
+			{
+				float mean = 0.0f;
+				float square = 0.0f;
+				for (uint32_t ny = y0; ny <= y1; ++ny)
+				{
+					for (uint32_t nx = x0; nx <= x1; ++nx)
+					{
+						float l = color[3][ny * stride + nx];
+						mean += l;
+						square += l * l;
+					}
+				}
+				float n = static_cast<float>((y1 - y0 + 1) * (x1 - x0 + 1));
+				mean /= n;
+				spread = std::sqrt(std::max(0.0f, square / n - mean * mean));
+			}
+			deviation[index] = std::max(spread, 1e-4f * color[3][index] + 1e-6f);
+		}
+	}, 4);
+}
+
+void Denoiser::finish(const float* color[3], const PixelFeatures& guides, float* output)
+{
+	pool.parallelFor(height, [&](uint32_t y, uint32_t)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			size_t pixel = static_cast<size_t>(y) * width + x;
+			size_t index = y * stride + x;
+			const Vec3& emission = guides.emission[pixel];
+			const Vec3& albedo = guides.albedo[pixel];
+			output[4 * pixel] = color[0][index] * std::max(albedo.x, MinAlbedo) + emission.x;
+			output[4 * pixel + 1] = color[1][index] * std::max(albedo.y, MinAlbedo) + emission.y;
+			output[4 * pixel + 2] = color[2][index] * std::max(albedo.z, MinAlbedo) + emission.z;
+			output[4 * pixel + 3] = 1.0f;
+		}
+	}, 4);
+}
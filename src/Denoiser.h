@@ -0,0 +1,102 @@
+#pragma once
+
+#include "Framebuffer.h"
+#include "Renderer.h"
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct DenoiseSettings
+{
+	// A-trous passes, each spreading the 5x5 kernel twice as far: 5 passes reach 62 pixels.
+	uint32_t iterations = 5;
+	// Luminance differences are measured in noise standard deviations, the allowance halving with
+	// every pass.
+	float colorSigma = 4.0f;
+	// Weight falloff with the squared distance between normals.
+	float normalSharpness = 64.0f;
+	// Depth differences are measured against the local depth slope over the tap distance.
+	float depthSigma = 1.0f;
+};
+
+// One a-trous pass over padded planes, as handed to the per instruction set kernels. Pixel (x, y) of a
+// plane is plane[y * stride + x]; the rows are padded on either side so that taps may reach past the
+// image, where the normals hold a value far from any unit vector and weigh nothing.
+struct DenoisePass
+{
+	// Illumination as red, green, blue and luminance planes, read and written.
+	const float* color[4];
+	float* filtered[4];
+	const float* normal[3];
+	const float* depth;
+	// Largest depth change to a neighbouring pixel, for the depth weight.
+	const float* slope;
+	// Standard deviation of the noise in each pixel's luminance.
+	const float* deviation;
+	uint32_t height;
+	size_t stride;
+	int32_t step;
+	float deviationScale;
+	float normalWeight;
+	float depthScale;
+};
+
+// Filters the tile of pass, whose x0 is a multiple of 8 and whose x1 may run into the padding.
+void denoiseTileSse(const DenoisePass& pass, const Tile& tile);
+void denoiseTileAvx2(const DenoisePass& pass, const Tile& tile);
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al., "Edge-Avoiding A-Trous Wavelet Transform for
+// fast Global Illumination Filtering", 2010) for the progressive preview. The radiance emitted towards
+// the camera is set aside and the rest divided by the first hit albedo, so that lights and texture
+// detail stay sharp, and the remaining illumination is filtered with weights that stop at changes of
+// normal and depth and at luminance steps larger than the noise (Schied et al., "Spatiotemporal
+// Variance-Guided Filtering", 2017). Tiles of every pass run in parallel on SSE or AVX2 kernels; the
+// result depends only on the input, not on the thread count.
+class Denoiser
+{
+public:
+	Denoiser(uint32_t width, uint32_t height, ThreadPool& pool, const DenoiseSettings& settings = DenoiseSettings());
+
+	// Filters rgba, RGBA32F rows as written by Renderer::resolve, guided by features, into output,
+	// which may be rgba.
+	void denoise(const float* rgba, const PixelFeatures& features, float* output);
+	// Resolves renderer and filters its image into output. Renderers without features have their image
+	// written as it is, and false is returned.
+	bool denoise(const Renderer& renderer, float* output);
+
+	const char* kernelName() const;
+	double lastSeconds() const { return lastTime; }
+	double totalSeconds() const { return totalTime; }
+	uint32_t frames() const { return frameCount; }
+
+private:
+	struct alignas(32) Lanes
+	{
+		float v[8];
+	};
+
+	float* plane(uint32_t index) { return planes.data()->v + index * planeFloats + padding; }
+	void prepare(const float* rgba, const PixelFeatures& features);
+	void finish(const float* color[3], const PixelFeatures& guides, float* output);
+
+	uint32_t width;
+	uint32_t height;
+	ThreadPool& pool;
+	DenoiseSettings config;
+	bool avx2;
+	// Pixels in front of each row and row length including both paddings, multiples of 8.
+	uint32_t padding;
+	size_t stride;
+	size_t planeFloats;
+	std::vector<Lanes> planes;
+	std::vector<Tile> tiles;
+
+	std::vector<float> resolved;
+	PixelFeatures features;
+
+	double lastTime = 0.0;
+	double totalTime = 0.0;
+	uint32_t frameCount = 0;
+};
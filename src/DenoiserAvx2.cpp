@@ -0,0 +1,15 @@
+#include "DenoiserKernels.h"
+
+#include "Simd.h"
+
+// Built with AVX2 and FMA enabled on x86; Denoiser only selects it when the CPU supports both.
+#if PTGPU_SIMD_AVX2
+using Float8 = avx2::Float;
+#else
+using Float8 = generic::Float<8>;
+#endif
+
+void denoiseTileAvx2(const DenoisePass& pass, const Tile& tile)
+{
+	denoiseTile<Float8>(pass, tile);
+}
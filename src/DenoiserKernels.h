@@ -0,0 +1,111 @@
+#pragma once
+
+// A-trous pass shared by the per instruction set translation units. Only include this from
+// DenoiserSse.cpp and DenoiserAvx2.cpp. As in WideBvhKernels.h, everything here has internal linkage
+// and only reads plain fields, so that no inline definition compiled for AVX2 can replace the one the
+// rest of the program uses.
+
+#include "Denoiser.h"
+
+#include <cstddef>
+
+namespace
+{
+	// exp(-16 x) for x >= 0 as 1 / (1 + x)^16 with an approximate reciprocal: within a few percent where
+	// the weights matter. Weights stop at 2^-96 rather than reaching denormals, which would slow every
+	// product with them down by orders of magnitude.
+	template <typename F>
+	inline F edgeWeight(F x)
+	{
+		F r = min(F::broadcast(1.0f) + x, F::broadcast(64.0f));
+		r = r * r;
+		r = r * r;
+		r = r * r;
+		r = r * r;
+		return reciprocal(r);
+	}
+
+	template <typename F>
+	void denoiseTile(const DenoisePass& pass, const Tile& tile)
+	{
+		// B3 spline taps 1/16, 1/4, 3/8, 1/4, 1/16 by distance from the center.
+		constexpr float Taps[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+		// Exponents are summed divided by 16 for edgeWeight.
+		const F sixteenth = F::broadcast(1.0f / 16.0f);
+		const F tiny = F::broadcast(1e-12f);
+		const F deviationScale = F::broadcast(pass.deviationScale);
+		const F normalWeight = F::broadcast(pass.normalWeight / 16.0f);
+		const F depthScale = F::broadcast(pass.depthScale * pass.step);
+		const F relativeDepth = F::broadcast(1e-3f);
+		const F centerTap = F::broadcast(Taps[0] * Taps[0]);
+		// Depth differences grow with the number of pixels between the taps.
+		F tapDistance[5];
+		for (int d = 1; d <= 4; ++d)
+		{
+			tapDistance[d] = F::broadcast(1.0f / d);
+		}
+		int32_t height = static_cast<int32_t>(pass.height);
+		ptrdiff_t stride = static_cast<ptrdiff_t>(pass.stride);
+		int32_t step = pass.step;
+
+		for (int32_t y = static_cast<int32_t>(tile.y0); y < static_cast<int32_t>(tile.y1); ++y)
+		{
+			for (uint32_t x = tile.x0; x < tile.x1; x += F::Width)
+			{
+				ptrdiff_t center = y * stride + x;
+				F color[4];
+				F sums[4];
+				for (int c = 0; c < 4; ++c)
+				{
+					color[c] = F::load(pass.color[c] + center);
+					sums[c] = color[c] * centerTap;
+				}
+				F nx = F::load(pass.normal[0] + center);
+				F ny = F::load(pass.normal[1] + center);
+				F nz = F::load(pass.normal[2] + center);
+				F z = F::load(pass.depth + center);
+				F luminanceScale = sixteenth / (F::load(pass.deviation + center) * deviationScale + tiny);
+				F depthWeight = sixteenth / (F::load(pass.slope + center) * depthScale + z * relativeDepth + tiny);
+				F weights = centerTap;
+
+				for (int32_t dy = -2; dy <= 2; ++dy)
+				{
+					int32_t row = y + dy * step;
+					if (row < 0 || row >= height)
+					{
+						continue;
+					}
+					for (int32_t dx = -2; dx <= 2; ++dx)
+					{
+						if (dx == 0 && dy == 0)
+						{
+							continue;
+						}
+						ptrdiff_t tap = row * stride + x + dx * step;
+						int32_t ax = dx < 0 ? -dx : dx;
+						int32_t ay = dy < 0 ? -dy : dy;
+						F l = F::loadUnaligned(pass.color[3] + tap);
+						F ex = F::loadUnaligned(pass.normal[0] + tap) - nx;
+						F ey = F::loadUnaligned(pass.normal[1] + tap) - ny;
+						F ez = F::loadUnaligned(pass.normal[2] + tap) - nz;
+						F dz = abs(F::loadUnaligned(pass.depth + tap) - z);
+						F exponent = abs(l - color[3]) * luminanceScale + (ex * ex + ey * ey + ez * ez) * normalWeight
+							+ dz * depthWeight * tapDistance[ax + ay];
+						F w = edgeWeight(exponent) * F::broadcast(Taps[ax] * Taps[ay]);
+						sums[0] = sums[0] + F::loadUnaligned(pass.color[0] + tap) * w;
+						sums[1] = sums[1] + F::loadUnaligned(pass.color[1] + tap) * w;
+						sums[2] = sums[2] + F::loadUnaligned(pass.color[2] + tap) * w;
+						sums[3] = sums[3] + l * w;
+						weights = weights + w;
+					}
+				}
+
+				F inverse = F::broadcast(1.0f) / weights;
+				for (int c = 0; c < 4; ++c)
+				{
+					(sums[c] * inverse).store(pass.filtered[c] + center);
+				}
+			}
+		}
+	}
+}
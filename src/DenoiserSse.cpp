@@ -0,0 +1,14 @@
+#include "DenoiserKernels.h"
+
+#include "Simd.h"
+
+#if PTGPU_SIMD_SSE
+using Float4 = sse::Float;
+#else
+using Float4 = generic::Float<4>;
+#endif
+
+void denoiseTileSse(const DenoisePass& pass, const Tile& tile)
+{
+	denoiseTile<Float4>(pass, tile);
+}
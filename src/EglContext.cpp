@@ -0,0 +1,82 @@
+#include "EglContext.h"
+
+#include "Gl.h"
+
+#include <EGL/eglext.h>
+
+#include <cstdlib>
+#include <stdexcept>
+
+namespace
+{
+	EGLDisplay openDisplay()
+	{
+		auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+		if (getPlatformDisplay)
+		{
+			EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+			if (display != EGL_NO_DISPLAY)
+			{
+				return display;
+			}
+		}
+		return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+}
+
+EglContext::EglContext(bool software)
+{
+	if (software)
+	{
+		// Honoured by Mesa when it picks the driver during eglInitialize.
+#ifdef _WIN32
+		_putenv_s("LIBGL_ALWAYS_SOFTWARE", "1");
+#else
+		setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+#endif
+	}
+
+	display = openDisplay();
+	EGLint major = 0;
+	EGLint minor = 0;
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+	{
+		throw std::runtime_error("eglInitialize failed");
+	}
+	if (!eglBindAPI(EGL_OPENGL_API))
+	{
+		throw std::runtime_error("EGL has no desktop OpenGL support");
+	}
+
+	// Prefer 4.5 for persistent mapping; 3.3 still runs the fallback upload path.
+	const EGLint versions[][2] = {{4, 5}, {3, 3}};
+	for (const EGLint* version : versions)
+	{
+		const EGLint attributes[] = {
+			EGL_CONTEXT_MAJOR_VERSION, version[0],
+			EGL_CONTEXT_MINOR_VERSION, version[1],
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE};
+		context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+		if (context != EGL_NO_CONTEXT)
+		{
+			break;
+		}
+	}
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+	{
+		eglTerminate(display);
+		throw std::runtime_error("Cannot create a surfaceless OpenGL 3.3+ context");
+	}
+
+	const GLubyte* name = glGetString(GL_RENDERER);
+	const GLubyte* version = glGetString(GL_VERSION);
+	rendererName = std::string(reinterpret_cast<const char*>(name)) + ", OpenGL " + reinterpret_cast<const char*>(version);
+}
+
+EglContext::~EglContext()
+{
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(display, context);
+	eglTerminate(display);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <EGL/egl.h>
+
+#include <string>
+
+// Offscreen desktop OpenGL context on the Mesa surfaceless platform. Needs no display server, which
+// makes it usable for the display path on render nodes and, with software set, for testing the
+// upload path against llvmpipe.
+class EglContext
+{
+public:
+	explicit EglContext(bool software = false);
+	~EglContext();
+
+	EglContext(const EglContext&) = delete;
+	EglContext& operator=(const EglContext&) = delete;
+
+	const std::string& renderer() const { return rendererName; }
+
+private:
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+	std::string rendererName;
+};
@@ -0,0 +1,189 @@
+#include "EnvironmentMap.h"
+
+#include "ImageIO.h"
+#include "Timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+
+namespace
+{
+	// Turns the weights held in the pdf fields of table, which add up to sum, into an alias table.
+	// Sweeps two cursors over the table in one pass instead of keeping worklists (Huebschle-Schneider
+	// and Sanders 2019): each outcome below the average is topped up from the current one above it,
+	// which turns into a light outcome itself once it drops below the average.
+	void buildAliasTable(AliasEntry* table, uint32_t count, double sum)
+	{
+		if (sum <= 0.0)
+		{
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				table[i] = {1.0f, i, 0.0f};
+			}
+			return;
+		}
+		double scale = count / sum;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			table[i] = {1.0f, i, static_cast<float>(table[i].pdf * scale)};
+		}
+		auto nextLight = [&](uint32_t i)
+		{
+			while (i < count && table[i].pdf >= 1.0f)
+			{
+				++i;
+			}
+			return i;
+		};
+		auto nextHeavy = [&](uint32_t i)
+		{
+			while (i < count && table[i].pdf < 1.0f)
+			{
+				++i;
+			}
+			return i;
+		};
+
+		uint32_t heavy = nextHeavy(0);
+		double residual = heavy < count ? table[heavy].pdf : 1.0;
+		for (uint32_t light = nextLight(0); light < count && heavy < count; light = nextLight(light + 1))
+		{
+			table[light].threshold = table[light].pdf;
+			table[light].alias = heavy;
+			residual -= 1.0 - table[light].pdf;
+			while (residual < 1.0)
+			{
+				uint32_t next = nextHeavy(heavy + 1);
+				if (next == count)
+				{
+					// Rounding left the last heavy outcome short, it keeps its own picks.
+					heavy = count;
+					break;
+				}
+				table[heavy].threshold = static_cast<float>(residual);
+				table[heavy].alias = next;
+				residual = table[next].pdf - (1.0 - residual);
+				heavy = next;
+			}
+		}
+		// Outcomes not reached hold the average up to rounding and keep threshold 1.
+	}
+}
+
+EnvironmentMap::EnvironmentMap(const std::string& path, ThreadPool& pool)
+{
+	pixels = readImage(path, mapWidth, mapHeight);
+	build(pool);
+}
+
+EnvironmentMap::EnvironmentMap(uint32_t width, uint32_t height, std::vector<float> rgba, ThreadPool& pool)
+	: mapWidth(width), mapHeight(height), pixels(std::move(rgba))
+{
+	build(pool);
+}
+
+void EnvironmentMap::build(ThreadPool& pool)
+{
+	Timer timer;
+	conditional.reset(new AliasEntry[static_cast<size_t>(mapWidth) * mapHeight]);
+	marginal.resize(mapHeight);
+	std::vector<double> rowSums(mapHeight);
+
+	// Rows do not depend on each other, so the tables come out the same for any number of threads.
+	pool.parallelFor(mapHeight, [&](uint32_t y, uint32_t)
+	{
+		// Texels of a row cover less solid angle towards the poles.
+		float sinTheta = std::sin((y + 0.5f) * Pi / mapHeight);
+		size_t first = static_cast<size_t>(y) * mapWidth;
+		double sum = 0.0;
+		for (uint32_t x = 0; x < mapWidth; ++x)
+		{
+			float* pixel = &pixels[4 * (first + x)];
+			for (int c = 0; c < 3; ++c)
+			{
+				pixel[c] = std::max(pixel[c], 0.0f);
+			}
+			float weight = luminance(Vec3(pixel[0], pixel[1], pixel[2])) * sinTheta;
+			conditional[first + x].pdf = weight;
+			sum += weight;
+		}
+		rowSums[y] = sum;
+		buildAliasTable(&conditional[first], mapWidth, sum);
+	});
+
+	for (uint32_t y = 0; y < mapHeight; ++y)
+	{
+		marginal[y].pdf = static_cast<float>(rowSums[y]);
+		total += rowSums[y];
+	}
+	buildAliasTable(marginal.data(), mapHeight, total);
+	buildTime = timer.seconds();
+}
+
+void EnvironmentMap::coordinates(const Vec3& direction, float& s, float& t) const
+{
+	float phi = std::atan2(direction.z, direction.x);
+	s = (phi < 0.0f ? phi + 2.0f * Pi : phi) * (0.5f * InvPi);
+	t = std::acos(std::min(1.0f, std::max(-1.0f, direction.y))) * InvPi;
+}
+
+Vec3 EnvironmentMap::texel(float s, float t) const
+{
+	uint32_t x = std::min(static_cast<uint32_t>(s * mapWidth), mapWidth - 1);
+	uint32_t y = std::min(static_cast<uint32_t>(t * mapHeight), mapHeight - 1);
+	const float* pixel = &pixels[4 * (static_cast<size_t>(y) * mapWidth + x)];
+	return Vec3(pixel[0], pixel[1], pixel[2]);
+}
+
+Vec3 EnvironmentMap::radiance(const Vec3& direction) const
+{
+	float s;
+	float t;
+	coordinates(direction, s, t);
+	return texel(s, t);
+}
+
+bool EnvironmentMap::sample(float u, float v, Vec3& direction, Vec3& radiance, float& pdf) const
+{
+	if (!sampleable())
+	{
+		return false;
+	}
+	float s;
+	float t;
+	float pdfSquare = sampleEnvironmentTables(marginal.data(), conditional.get(), mapWidth, mapHeight, u, v, &s, &t);
+	float theta = t * Pi;
+	float phi = s * 2.0f * Pi;
+	float sinTheta = std::sin(theta);
+	if (sinTheta <= 0.0f || pdfSquare <= 0.0f)
+	{
+		return false;
+	}
+	direction = Vec3(sinTheta * std::cos(phi), std::cos(theta), sinTheta * std::sin(phi));
+	radiance = texel(s, t);
+	pdf = pdfSquare / (2.0f * Pi * Pi * sinTheta);
+	return true;
+}
+
+float EnvironmentMap::pdf(const Vec3& direction) const
+{
+	if (!sampleable())
+	{
+		return 0.0f;
+	}
+	float s;
+	float t;
+	coordinates(direction, s, t);
+	float sinTheta = std::sin(t * Pi);
+	if (sinTheta <= 0.0f)
+	{
+		return 0.0f;
+	}
+	return environmentTablesPdf(marginal.data(), conditional.get(), mapWidth, mapHeight, s, t) / (2.0f * Pi * Pi * sinTheta);
+}
+
+void EnvironmentMap::printStats(std::ostream& out) const
+{
+	out << "Environment: " << mapWidth << "x" << mapHeight << ", sampling tables built in " << buildTime * 1000.0 << " ms" << std::endl;
+}
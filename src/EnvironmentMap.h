@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Math.h"
+#include "ThreadPool.h"
+#include "environment.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Lat-long radiance map lighting a scene from infinitely far away. The top row looks along +y, u turns
+// around y from +x towards +z. Directions are importance sampled from a piecewise-constant
+// distribution proportional to luminance times sin theta, stored as alias tables (kernels/environment.h)
+// so that a sample costs two table lookups at any resolution.
+class EnvironmentMap
+{
+public:
+	// Reads a .pfm or .ppm image with readImage, which throws std::runtime_error on failure.
+	EnvironmentMap(const std::string& path, ThreadPool& pool);
+	// rgba holds width x height pixels, top row first.
+	EnvironmentMap(uint32_t width, uint32_t height, std::vector<float> rgba, ThreadPool& pool);
+
+	// False for a black map, which cannot be sampled.
+	bool sampleable() const { return total > 0.0; }
+
+	Vec3 radiance(const Vec3& direction) const;
+	// Picks a direction for the uniform numbers u and v, with pdf in solid angle. Fails for black maps
+	// and at the poles.
+	bool sample(float u, float v, Vec3& direction, Vec3& radiance, float& pdf) const;
+	// Density in solid angle with which sample picks direction.
+	float pdf(const Vec3& direction) const;
+
+	uint32_t width() const { return mapWidth; }
+	uint32_t height() const { return mapHeight; }
+	// RGBA radiance with negative values clamped, the layout of a float4 buffer.
+	const std::vector<float>& pixelList() const { return pixels; }
+	const std::vector<AliasEntry>& marginalList() const { return marginal; }
+	// width x height entries, row after row.
+	const AliasEntry* conditionalTable() const { return conditional.get(); }
+	double buildSeconds() const { return buildTime; }
+
+	void printStats(std::ostream& out) const;
+
+private:
+	// Builds the tables, each row in a task of its own.
+	void build(ThreadPool& pool);
+	// Maps direction to the unit square.
+	void coordinates(const Vec3& direction, float& s, float& t) const;
+	Vec3 texel(float s, float t) const;
+
+	uint32_t mapWidth;
+	uint32_t mapHeight;
+	std::vector<float> pixels;
+	// Alias tables over the rows and over the texels of each row. The per-row tables are left
+	// uninitialized until their row task writes them, so that a large map is not cleared first.
+	std::vector<AliasEntry> marginal;
+	std::unique_ptr<AliasEntry[]> conditional;
+	double total = 0.0;
+	double buildTime = 0.0;
+};
@@ -0,0 +1,252 @@
+#include "Framebuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+	const char* const AovNames[] = {"beauty", "emission", "albedo", "normal", "depth", "id", "samples", "variance"};
+	static_assert(sizeof(AovNames) / sizeof(AovNames[0]) == static_cast<size_t>(Aov::Count), "Every Aov needs a name");
+}
+
+const char* aovName(Aov aov)
+{
+	return AovNames[static_cast<uint32_t>(aov)];
+}
+
+AovMask parseAovs(const std::string& list)
+{
+	AovMask aovs = 0;
+	std::istringstream names(list);
+	std::string name;
+	while (std::getline(names, name, ','))
+	{
+		if (name == "all")
+		{
+			aovs |= aovBit(Aov::Count) - 1;
+			continue;
+		}
+		uint32_t aov = 0;
+		while (aov < static_cast<uint32_t>(Aov::Count) && name != AovNames[aov])
+		{
+			aov++;
+		}
+		if (aov == static_cast<uint32_t>(Aov::Count))
+		{
+			throw std::runtime_error("Unknown render pass: " + name);
+		}
+		aovs |= aovBit(static_cast<Aov>(aov));
+	}
+	return aovs;
+}
+
+Framebuffer::Framebuffer(uint32_t width, uint32_t height, AovMask aovs)
+	: w(width), h(height), recorded(AlwaysRecordedAovs | aovs), counts(static_cast<size_t>(width) * height, 0)
+{
+	size_t pixels = static_cast<size_t>(width) * height;
+	for (uint32_t plane = Red; plane <= Square; ++plane)
+	{
+		planes[plane].resize(pixels, 0.0f);
+	}
+	const std::pair<Aov, Plane> channels[] = {{Aov::Emission, EmissionR}, {Aov::Albedo, AlbedoR}, {Aov::Normal, NormalX}};
+	for (const auto& channel : channels)
+	{
+		if (records(channel.first))
+		{
+			for (uint32_t c = 0; c < 3; ++c)
+			{
+				planes[channel.second + c].resize(pixels, 0.0f);
+			}
+		}
+	}
+	if (records(Aov::Depth))
+	{
+		planes[Depth].resize(pixels, 0.0f);
+	}
+	if (records(Aov::ObjectId))
+	{
+		objects.resize(pixels, InvalidIndex);
+	}
+}
+
+void Framebuffer::clear()
+{
+	for (std::vector<float>& plane : planes)
+	{
+		std::fill(plane.begin(), plane.end(), 0.0f);
+	}
+	std::fill(counts.begin(), counts.end(), 0u);
+	std::fill(objects.begin(), objects.end(), InvalidIndex);
+}
+
+float Framebuffer::meanVariance(uint32_t pixel) const
+{
+	uint32_t n = counts[pixel];
+	if (n < 2)
+	{
+		return -1.0f;
+	}
+	float mean = luminance(average(pixel));
+	return std::max(0.0f, (planes[Square][pixel] - mean * mean * n) / (n - 1)) / n;
+}
+
+float Framebuffer::relativeError(uint32_t pixel) const
+{
+	float variance = meanVariance(pixel);
+	if (variance < 0.0f)
+	{
+		return std::numeric_limits<float>::infinity();
+	}
+	return std::sqrt(variance) / std::max(luminance(average(pixel)), MinLuminance);
+}
+
+void Framebuffer::resolve(float* rgba) const
+{
+	resolveRect(rgba, 0, 0, w, h);
+}
+
+void Framebuffer::resolveRect(float* rgba, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const
+{
+	for (uint32_t y = y0; y < y1; ++y)
+	{
+		for (uint32_t i = y * w + x0; i < y * w + x1; ++i)
+		{
+			Vec3 c = average(i);
+			rgba[4 * i + 0] = c.x;
+			rgba[4 * i + 1] = c.y;
+			rgba[4 * i + 2] = c.z;
+			rgba[4 * i + 3] = 1.0f;
+		}
+	}
+}
+
+bool Framebuffer::resolveFeatures(PixelFeatures& features) const
+{
+	if ((recorded & DenoiseAovs) != DenoiseAovs)
+	{
+		return false;
+	}
+	features.emission.resize(pixelCount());
+	features.albedo.resize(pixelCount());
+	features.normal.resize(pixelCount());
+	features.depth.resize(pixelCount());
+	features.variance.resize(pixelCount());
+	for (uint32_t i = 0; i < pixelCount(); ++i)
+	{
+		float scale = counts[i] ? 1.0f / counts[i] : 0.0f;
+		features.emission[i] = Vec3(planes[EmissionR][i], planes[EmissionR + 1][i], planes[EmissionR + 2][i]) * scale;
+		features.albedo[i] = Vec3(planes[AlbedoR][i], planes[AlbedoR + 1][i], planes[AlbedoR + 2][i]) * scale;
+		features.normal[i] = Vec3(planes[NormalX][i], planes[NormalX + 1][i], planes[NormalX + 2][i]) * scale;
+		features.depth[i] = planes[Depth][i] * scale;
+		features.variance[i] = meanVariance(i);
+	}
+	return true;
+}
+
+AovMask Framebuffer::resolveAovs(AovMask aovs, bool half, LayeredImage& image) const
+{
+	aovs &= recorded;
+	std::vector<float> values(pixelCount());
+	// Averages one summed plane into values.
+	auto averagePlane = [&](uint32_t plane)
+	{
+		for (uint32_t i = 0; i < pixelCount(); ++i)
+		{
+			values[i] = counts[i] ? planes[plane][i] / counts[i] : 0.0f;
+		}
+	};
+
+	const std::pair<Aov, Plane> colors[] = {{Aov::Beauty, Red}, {Aov::Emission, EmissionR}, {Aov::Albedo, AlbedoR}, {Aov::Normal, NormalX}};
+	for (const auto& color : colors)
+	{
+		if (!(aovs & aovBit(color.first)))
+		{
+			continue;
+		}
+		// The beauty channels form the main image, the others layers named after their channel.
+		std::string layer = color.first == Aov::Beauty ? "" : std::string(aovName(color.first)) + ".";
+		const char* components = color.first == Aov::Normal ? "XYZ" : "RGB";
+		for (uint32_t c = 0; c < 3; ++c)
+		{
+			averagePlane(color.second + c);
+			image.addFloats(layer + components[c], values.data(), 1, half);
+		}
+	}
+	if (aovs & aovBit(Aov::Depth))
+	{
+		averagePlane(Depth);
+		image.addFloats("depth.Z", values.data(), 1, false);
+	}
+	if (aovs & aovBit(Aov::ObjectId))
+	{
+		uint32_t* ids = image.addUint("id.ID");
+		for (uint32_t i = 0; i < pixelCount(); ++i)
+		{
+			ids[i] = objects[i] + 1;
+		}
+	}
+	if (aovs & aovBit(Aov::SampleCount))
+	{
+		std::copy(counts.begin(), counts.end(), image.addUint("samples.N"));
+	}
+	if (aovs & aovBit(Aov::Variance))
+	{
+		for (uint32_t i = 0; i < pixelCount(); ++i)
+		{
+			values[i] = std::max(0.0f, meanVariance(i));
+		}
+		image.addFloats("variance.Y", values.data(), 1, half);
+	}
+	return aovs;
+}
+
+void Framebuffer::save(std::vector<uint8_t>& data) const
+{
+	const uint32_t header[3] = {w, h, recorded};
+	auto append = [&](const void* bytes, size_t size)
+	{
+		const uint8_t* begin = static_cast<const uint8_t*>(bytes);
+		data.insert(data.end(), begin, begin + size);
+	};
+	data.clear();
+	append(header, sizeof(header));
+	for (const std::vector<float>& plane : planes)
+	{
+		append(plane.data(), plane.size() * sizeof(float));
+	}
+	append(counts.data(), counts.size() * sizeof(uint32_t));
+	append(objects.data(), objects.size() * sizeof(uint32_t));
+}
+
+bool Framebuffer::load(const std::vector<uint8_t>& data)
+{
+	// Channels that are not recorded have empty planes, so equal headers mean equal layouts.
+	size_t bytes = 3 * sizeof(uint32_t) + (counts.size() + objects.size()) * sizeof(uint32_t);
+	for (const std::vector<float>& plane : planes)
+	{
+		bytes += plane.size() * sizeof(float);
+	}
+	const uint32_t header[3] = {w, h, recorded};
+	if (data.size() != bytes || std::memcmp(data.data(), header, sizeof(header)) != 0)
+	{
+		return false;
+	}
+	const uint8_t* source = data.data() + sizeof(header);
+	auto read = [&](void* target, size_t size)
+	{
+		std::memcpy(target, source, size);
+		source += size;
+	};
+	for (std::vector<float>& plane : planes)
+	{
+		read(plane.data(), plane.size() * sizeof(float));
+	}
+	read(counts.data(), counts.size() * sizeof(uint32_t));
+	read(objects.data(), objects.size() * sizeof(uint32_t));
+	return true;
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include "ImageIO.h"
+#include "Math.h"
+#include "Ray.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Render passes (arbitrary output values) a framebuffer can write out next to the beauty image. The
+// radiance, sample counts and variance are always accumulated; the first hit channels only when
+// requested, since each costs up to 12 bytes per pixel and a branch per sample.
+enum class Aov : uint32_t
+{
+	Beauty,
+	// Radiance emitted towards the camera by the first surface, the background for rays that miss.
+	Emission,
+	Albedo,
+	// First hit normal facing the camera.
+	Normal,
+	// Distance along the camera ray to the first hit.
+	Depth,
+	// Instance of the first hit of the pixel's first sample, or its material for scenes without
+	// instances; written plus one, with 0 for the background.
+	ObjectId,
+	SampleCount,
+	// Variance of the pixel's mean luminance.
+	Variance,
+	Count
+};
+
+using AovMask = uint32_t;
+
+constexpr AovMask aovBit(Aov aov)
+{
+	return 1u << static_cast<uint32_t>(aov);
+}
+
+// Channels that Framebuffer records without being asked.
+constexpr AovMask AlwaysRecordedAovs = aovBit(Aov::Beauty) | aovBit(Aov::SampleCount) | aovBit(Aov::Variance);
+// First hit channels that the denoiser is guided by.
+constexpr AovMask DenoiseAovs = aovBit(Aov::Emission) | aovBit(Aov::Albedo) | aovBit(Aov::Normal) | aovBit(Aov::Depth);
+
+// Lower case name of aov, as --aovs lists it and as its image layer is called.
+const char* aovName(Aov aov);
+// Parses a comma separated list of aov names, or "all". Throws std::runtime_error on unknown names.
+AovMask parseAovs(const std::string& list);
+
+// First surface a camera ray hit, recorded once per sample. Rays leaving the scene keep the defaults
+// apart from the emission, which holds the background they see.
+struct FirstHit
+{
+	Vec3 emission;
+	Vec3 albedo = Vec3(1.0f);
+	Vec3 normal;
+	float depth = 0.0f;
+	uint32_t object = InvalidIndex;
+};
+
+// Per pixel guides for denoising, averaged over the samples of each pixel: the first hit emission,
+// albedo, normal and depth of FirstHit, plus the variance of the pixel's mean luminance, negative below
+// two samples.
+struct PixelFeatures
+{
+	std::vector<Vec3> emission;
+	std::vector<Vec3> albedo;
+	std::vector<Vec3> normal;
+	std::vector<float> depth;
+	std::vector<float> variance;
+};
+
+// Running sums of radiance samples per pixel, plus the sum of squared luminance for variance estimates
+// and the sums of the requested first hit channels. Every channel component is a plane of its own, so
+// that resolving one channel streams through only its own memory.
+class Framebuffer
+{
+public:
+	// aovs selects the first hit channels to record; the others are ignored.
+	Framebuffer(uint32_t width, uint32_t height, AovMask aovs = 0);
+
+	uint32_t width() const { return w; }
+	uint32_t height() const { return h; }
+	uint32_t pixelCount() const { return w * h; }
+	// Channels that resolveAovs can write.
+	AovMask aovs() const { return recorded; }
+	bool records(Aov aov) const { return (recorded & aovBit(aov)) != 0; }
+
+	void clear();
+	void addSample(uint32_t pixel, const Vec3& radiance)
+	{
+		planes[Red][pixel] += radiance.x;
+		planes[Green][pixel] += radiance.y;
+		planes[Blue][pixel] += radiance.z;
+		float l = luminance(radiance);
+		planes[Square][pixel] += l * l;
+		counts[pixel]++;
+	}
+	// Adds the first hit of one sample, before its addSample.
+	void addFirstHit(uint32_t pixel, const FirstHit& hit)
+	{
+		if (records(Aov::Emission))
+		{
+			add(EmissionR, pixel, hit.emission);
+		}
+		if (records(Aov::Albedo))
+		{
+			add(AlbedoR, pixel, hit.albedo);
+		}
+		if (records(Aov::Normal))
+		{
+			add(NormalX, pixel, hit.normal);
+		}
+		if (records(Aov::Depth))
+		{
+			planes[Depth][pixel] += hit.depth;
+		}
+		if (records(Aov::ObjectId) && counts[pixel] == 0)
+		{
+			objects[pixel] = hit.object;
+		}
+	}
+
+	Vec3 average(uint32_t pixel) const
+	{
+		float scale = counts[pixel] ? 1.0f / counts[pixel] : 0.0f;
+		return Vec3(planes[Red][pixel], planes[Green][pixel], planes[Blue][pixel]) * scale;
+	}
+	uint32_t sampleCount(uint32_t pixel) const { return counts[pixel]; }
+
+	// Standard error of the pixel's mean luminance relative to that mean. The denominator is floored
+	// at MinLuminance so black pixels can converge. Infinite below two samples.
+	float relativeError(uint32_t pixel) const;
+
+	static constexpr float MinLuminance = 0.01f;
+
+	// Writes averaged linear radiance as RGBA32F rows, top row first.
+	void resolve(float* rgba) const;
+	// Same for the rectangle [x0, x1) x [y0, y1); rgba still addresses the full image.
+	void resolveRect(float* rgba, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const;
+	// Returns false, leaving features untouched, unless every channel of DenoiseAovs is recorded.
+	bool resolveFeatures(PixelFeatures& features) const;
+	// Appends a layer per recorded channel of aovs to image, which must have this framebuffer's size,
+	// and returns the channels written. Colors, normals and variance are stored as half floats when half
+	// is set; depth stays 32 bit float and object IDs and sample counts unsigned integers. The planes
+	// themselves are sums and stay 32 bit floats, which half floats could not accumulate.
+	AovMask resolveAovs(AovMask aovs, bool half, LayeredImage& image) const;
+
+	// Raw copy of the sums and counts for checkpoints, and back. load() returns false, leaving the
+	// framebuffer untouched, for data saved by a framebuffer of another size or with other channels.
+	void save(std::vector<uint8_t>& data) const;
+	bool load(const std::vector<uint8_t>& data);
+
+private:
+	enum Plane : uint32_t
+	{
+		Red,
+		Green,
+		Blue,
+		Square,
+		EmissionR,
+		AlbedoR = EmissionR + 3,
+		NormalX = AlbedoR + 3,
+		Depth = NormalX + 3,
+		PlaneCount
+	};
+
+	void add(uint32_t plane, uint32_t pixel, const Vec3& v)
+	{
+		planes[plane][pixel] += v.x;
+		planes[plane + 1][pixel] += v.y;
+		planes[plane + 2][pixel] += v.z;
+	}
+	// Variance of the mean luminance of pixel, negative below two samples.
+	float meanVariance(uint32_t pixel) const;
+
+	uint32_t w;
+	uint32_t h;
+	AovMask recorded;
+	// Planes of channels that are not recorded stay empty.
+	std::vector<float> planes[PlaneCount];
+	std::vector<uint32_t> counts;
+	std::vector<uint32_t> objects;
+};
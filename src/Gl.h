@@ -0,0 +1,18 @@
+#pragma once
+
+// OpenGL headers for the display path. Entry points beyond GL 1.1 are taken from the GLVND/Mesa
+// libraries directly, so no loader is needed on Linux; macOS provides GL 3.2+ via gl3.h.
+
+#ifndef GL_SILENCE_DEPRECATION
+#define GL_SILENCE_DEPRECATION
+#endif
+
+#ifdef __APPLE__
+#include <OpenGL/gl3.h>
+#else
+#ifndef GL_GLEXT_PROTOTYPES
+#define GL_GLEXT_PROTOTYPES
+#endif
+#include <GL/gl.h>
+#include <GL/glext.h>
+#endif
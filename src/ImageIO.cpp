@@ -0,0 +1,670 @@
+#include "ImageIO.h"
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <stdexcept>
+#include <vector>
+
+#ifdef PTGPU_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+namespace
+{
+	struct SrgbTable
+	{
+		float values[256];
+
+		SrgbTable()
+		{
+			for (uint32_t i = 0; i < 256; ++i)
+			{
+				float c = i / 255.0f;
+				values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+		}
+	};
+
+	const SrgbTable SrgbDecoding;
+
+	std::ofstream openOutput(const std::string& path)
+	{
+		std::ofstream file(path, std::ios::binary);
+		if (!file)
+		{
+			throw std::runtime_error("Cannot open " + path + " for writing");
+		}
+		return file;
+	}
+
+	void finishOutput(std::ofstream& file, const std::string& path)
+	{
+		file.flush();
+		if (!file)
+		{
+			throw std::runtime_error("Failed to write " + path);
+		}
+	}
+
+	// Next whitespace separated header token, skipping # comments.
+	std::string headerToken(std::ifstream& file)
+	{
+		std::string token;
+		while (file >> token && token[0] == '#')
+		{
+			std::string comment;
+			std::getline(file, comment);
+		}
+		return token;
+	}
+
+	// Width and height of a PPM or PFM header, consuming the single whitespace that ends it.
+	void readHeader(std::ifstream& file, const std::string& path, uint32_t& width, uint32_t& height, std::string& last)
+	{
+		std::string w = headerToken(file);
+		std::string h = headerToken(file);
+		last = headerToken(file);
+		file.get();
+		unsigned long parsedWidth = std::strtoul(w.c_str(), nullptr, 10);
+		unsigned long parsedHeight = std::strtoul(h.c_str(), nullptr, 10);
+		if (!file || parsedWidth == 0 || parsedHeight == 0 || parsedWidth > 65536 || parsedHeight > 65536)
+		{
+			throw std::runtime_error("Malformed image header in " + path);
+		}
+		width = static_cast<uint32_t>(parsedWidth);
+		height = static_cast<uint32_t>(parsedHeight);
+	}
+
+	// Little endian encoding of OpenEXR headers.
+	void appendBytes(std::vector<char>& out, const void* data, size_t size)
+	{
+		const char* bytes = static_cast<const char*>(data);
+		out.insert(out.end(), bytes, bytes + size);
+	}
+
+	void appendInt(std::vector<char>& out, uint32_t value)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			out.push_back(static_cast<char>(value >> (8 * i) & 0xff));
+		}
+	}
+
+	// PNG is big endian throughout.
+	void appendBigEndian(std::vector<uint8_t>& out, uint32_t value)
+	{
+		for (int i = 3; i >= 0; --i)
+		{
+			out.push_back(static_cast<uint8_t>(value >> (8 * i) & 0xff));
+		}
+	}
+
+	void appendString(std::vector<char>& out, const std::string& value)
+	{
+		appendBytes(out, value.c_str(), value.size() + 1);
+	}
+
+	void appendAttribute(std::vector<char>& out, const char* name, const char* type, const std::vector<char>& value)
+	{
+		appendString(out, name);
+		appendString(out, type);
+		appendInt(out, static_cast<uint32_t>(value.size()));
+		appendBytes(out, value.data(), value.size());
+	}
+
+	std::vector<char> boxAttribute(uint32_t width, uint32_t height)
+	{
+		std::vector<char> box;
+		appendInt(box, 0);
+		appendInt(box, 0);
+		appendInt(box, width - 1);
+		appendInt(box, height - 1);
+		return box;
+	}
+
+#ifdef PTGPU_HAS_ZLIB
+	constexpr bool HasZlib = true;
+#else
+	constexpr bool HasZlib = false;
+#endif
+	constexpr char ExrNoCompression = 0;
+	constexpr char ExrZipCompression = 3;
+
+	std::vector<uint8_t> zlibCompress(const std::vector<uint8_t>& data)
+	{
+		const uint8_t* bytes = data.data();
+#ifdef PTGPU_HAS_ZLIB
+		uLongf size = compressBound(static_cast<uLong>(data.size()));
+		std::vector<uint8_t> packed(size);
+		if (compress2(packed.data(), &size, bytes, static_cast<uLong>(data.size()), Z_DEFAULT_COMPRESSION) != Z_OK)
+		{
+			throw std::runtime_error("zlib compression failed");
+		}
+		packed.resize(size);
+		return packed;
+#else
+		// A zlib stream of stored deflate blocks, which every reader accepts, with its Adler-32 checksum.
+		std::vector<uint8_t> packed = {0x78, 0x01};
+		size_t offset = 0;
+		do
+		{
+			size_t length = std::min<size_t>(data.size() - offset, 65535);
+			uint8_t last = offset + length == data.size() ? 1 : 0;
+			packed.insert(packed.end(), {last, static_cast<uint8_t>(length), static_cast<uint8_t>(length >> 8), static_cast<uint8_t>(~length),
+				static_cast<uint8_t>(~length >> 8)});
+			packed.insert(packed.end(), bytes + offset, bytes + offset + length);
+			offset += length;
+		} while (offset < data.size());
+		uint32_t a = 1;
+		uint32_t b = 0;
+		for (size_t i = 0; i < data.size(); ++i)
+		{
+			a = (a + bytes[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		appendBigEndian(packed, b << 16 | a);
+		return packed;
+#endif
+	}
+
+	// OpenEXR ZIP blocks interleave the first and second half of the bytes and store the differences
+	// between neighbours, offset by 128, before deflating them.
+	std::vector<uint8_t> predictExrBytes(const std::vector<char>& values)
+	{
+		std::vector<uint8_t> bytes(values.size());
+		size_t half = (values.size() + 1) / 2;
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			bytes[(i & 1) ? half + i / 2 : i / 2] = static_cast<uint8_t>(values[i]);
+		}
+		uint8_t previous = bytes.empty() ? 0 : bytes[0];
+		for (size_t i = 1; i < bytes.size(); ++i)
+		{
+			uint8_t current = bytes[i];
+			bytes[i] = static_cast<uint8_t>(current - previous + 128);
+			previous = current;
+		}
+		return bytes;
+	}
+
+	uint32_t pngCrc(const char* type, const std::vector<uint8_t>& data)
+	{
+		static const std::vector<uint32_t> table = []
+		{
+			std::vector<uint32_t> entries(256);
+			for (uint32_t n = 0; n < 256; ++n)
+			{
+				uint32_t c = n;
+				for (int k = 0; k < 8; ++k)
+				{
+					c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				}
+				entries[n] = c;
+			}
+			return entries;
+		}();
+		uint32_t crc = ~0u;
+		auto add = [&](uint8_t byte) { crc = table[(crc ^ byte) & 0xff] ^ (crc >> 8); };
+		for (int i = 0; i < 4; ++i)
+		{
+			add(static_cast<uint8_t>(type[i]));
+		}
+		for (uint8_t byte : data)
+		{
+			add(byte);
+		}
+		return ~crc;
+	}
+
+	void writePngChunk(std::ofstream& file, const char* type, const std::vector<uint8_t>& data)
+	{
+		std::vector<uint8_t> framing;
+		appendBigEndian(framing, static_cast<uint32_t>(data.size()));
+		file.write(reinterpret_cast<const char*>(framing.data()), 4);
+		file.write(type, 4);
+		file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+		framing.clear();
+		appendBigEndian(framing, pngCrc(type, data));
+		file.write(reinterpret_cast<const char*>(framing.data()), 4);
+	}
+
+	std::vector<char> floatAttribute(std::initializer_list<float> values)
+	{
+		std::vector<char> value;
+		for (float v : values)
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &v, sizeof(bits));
+			appendInt(value, bits);
+		}
+		return value;
+	}
+}
+
+bool hasExtension(const std::string& path, const char* extension)
+{
+	std::string lower = path;
+	std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	size_t length = std::char_traits<char>::length(extension);
+	return lower.size() >= length && lower.compare(lower.size() - length, length, extension) == 0;
+}
+
+uint8_t encodeSrgb(float linear)
+{
+	float c = std::min(std::max(linear, 0.0f), 1.0f);
+	float encoded = c <= 0.0031308f ? 12.92f * c : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+	return static_cast<uint8_t>(encoded * 255.0f + 0.5f);
+}
+
+float decodeSrgb(uint8_t value)
+{
+	return SrgbDecoding.values[value];
+}
+
+bool isSupportedImage(const std::string& path)
+{
+	return hasExtension(path, ".pfm") || hasExtension(path, ".ppm") || hasExtension(path, ".png") || isLayeredImage(path);
+}
+
+bool isLayeredImage(const std::string& path)
+{
+	return hasExtension(path, ".exr");
+}
+
+void writeImage(const std::string& path, uint32_t width, uint32_t height, const float* rgba)
+{
+	if (hasExtension(path, ".pfm"))
+	{
+		writePfm(path, width, height, rgba);
+	}
+	else if (hasExtension(path, ".ppm"))
+	{
+		writePpm(path, width, height, rgba);
+	}
+	else if (hasExtension(path, ".png"))
+	{
+		writePng(path, width, height, rgba);
+	}
+	else if (isLayeredImage(path))
+	{
+		LayeredImage image;
+		image.width = width;
+		image.height = height;
+		image.addRgb("", rgba, false);
+		writeExr(path, image);
+	}
+	else
+	{
+		throw std::runtime_error("Unsupported image format: " + path + " (expected .ppm, .png, .pfm or .exr)");
+	}
+}
+
+void writePfm(const std::string& path, uint32_t width, uint32_t height, const float* rgba)
+{
+	std::ofstream file = openOutput(path);
+	// A negative scale marks little endian data; PFM rows are stored bottom to top.
+	file << "PF\n" << width << " " << height << "\n-1.0\n";
+	std::vector<float> row(3 * static_cast<size_t>(width));
+	for (uint32_t y = height; y-- > 0;)
+	{
+		const float* source = rgba + 4 * static_cast<size_t>(y) * width;
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			row[3 * x + 0] = source[4 * x + 0];
+			row[3 * x + 1] = source[4 * x + 1];
+			row[3 * x + 2] = source[4 * x + 2];
+		}
+		file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+	}
+	finishOutput(file, path);
+}
+
+void writePpm(const std::string& path, uint32_t width, uint32_t height, const float* rgba)
+{
+	std::ofstream file = openOutput(path);
+	file << "P6\n" << width << " " << height << "\n255\n";
+	std::vector<uint8_t> row(3 * static_cast<size_t>(width));
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		const float* source = rgba + 4 * static_cast<size_t>(y) * width;
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			row[3 * x + 0] = encodeSrgb(source[4 * x + 0]);
+			row[3 * x + 1] = encodeSrgb(source[4 * x + 1]);
+			row[3 * x + 2] = encodeSrgb(source[4 * x + 2]);
+		}
+		file.write(reinterpret_cast<const char*>(row.data()), row.size());
+	}
+	finishOutput(file, path);
+}
+
+uint32_t* LayeredImage::addUint(const std::string& name)
+{
+	channels.push_back({name, ChannelType::Uint, std::vector<uint8_t>(4 * static_cast<size_t>(width) * height)});
+	return reinterpret_cast<uint32_t*>(channels.back().data.data());
+}
+
+float* LayeredImage::addFloat(const std::string& name)
+{
+	channels.push_back({name, ChannelType::Float, std::vector<uint8_t>(4 * static_cast<size_t>(width) * height)});
+	return reinterpret_cast<float*>(channels.back().data.data());
+}
+
+void LayeredImage::addFloats(const std::string& name, const float* values, size_t step, bool half)
+{
+	size_t count = static_cast<size_t>(width) * height;
+	if (!half)
+	{
+		float* target = addFloat(name);
+		for (size_t i = 0; i < count; ++i)
+		{
+			target[i] = values[i * step];
+		}
+		return;
+	}
+	channels.push_back({name, ChannelType::Half, std::vector<uint8_t>(2 * count)});
+	uint16_t* target = reinterpret_cast<uint16_t*>(channels.back().data.data());
+	for (size_t i = 0; i < count; ++i)
+	{
+		target[i] = floatToHalf(values[i * step]);
+	}
+}
+
+void LayeredImage::addRgb(const std::string& layer, const float* rgba, bool half)
+{
+	std::string prefix = layer.empty() ? "" : layer + ".";
+	addFloats(prefix + "R", rgba, 4, half);
+	addFloats(prefix + "G", rgba + 1, 4, half);
+	addFloats(prefix + "B", rgba + 2, 4, half);
+}
+
+uint16_t floatToHalf(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = static_cast<uint16_t>(bits >> 16 & 0x8000);
+	uint32_t magnitude = bits & 0x7fffffff;
+	if (magnitude >= 0x7f800000)
+	{
+		// Infinity, or a quiet NaN.
+		return sign | (magnitude > 0x7f800000 ? 0x7e00 : 0x7c00);
+	}
+	if (magnitude >= 0x477ff000)
+	{
+		// Rounds past 65504, the largest half.
+		return sign | 0x7c00;
+	}
+	uint32_t half;
+	uint32_t remainder;
+	uint32_t halfway;
+	if (magnitude >= 0x38800000)
+	{
+		// Normal: rebias the exponent from 127 to 15 and drop 13 mantissa bits. Rounding up may carry
+		// into the exponent, which is still the right value.
+		half = (magnitude - 0x38000000) >> 13;
+		remainder = magnitude & 0x1fff;
+		halfway = 0x1000;
+	}
+	else if (magnitude > 0x33000000)
+	{
+		// Subnormal half: the mantissa with its implicit one in units of 2^-24.
+		uint32_t shift = 126 - (magnitude >> 23);
+		uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+		half = mantissa >> shift;
+		remainder = mantissa & ((1u << shift) - 1);
+		halfway = 1u << (shift - 1);
+	}
+	else
+	{
+		// At most half the smallest subnormal rounds to zero.
+		return sign;
+	}
+	if (remainder > halfway || (remainder == halfway && (half & 1)))
+	{
+		half++;
+	}
+	return static_cast<uint16_t>(sign | half);
+}
+
+void writeExr(const std::string& path, const LayeredImage& image, ThreadPool* pool)
+{
+	// Readers expect the channels sorted by name, in the header and within every scanline.
+	std::vector<const ImageChannel*> channels;
+	size_t lineBytes = 0;
+	for (const ImageChannel& channel : image.channels)
+	{
+		channels.push_back(&channel);
+		lineBytes += channel.valueSize() * image.width;
+	}
+	std::sort(channels.begin(), channels.end(), [](const ImageChannel* a, const ImageChannel* b) { return a->name < b->name; });
+
+	std::vector<char> header;
+	// Magic number and version 2, single part scanline file. Names longer than 31 characters need the
+	// long names flag, which older readers reject.
+	bool longNames = std::any_of(channels.begin(), channels.end(), [](const ImageChannel* c) { return c->name.size() > 31; });
+	appendInt(header, 20000630);
+	appendInt(header, longNames ? 2 | 0x400 : 2);
+	std::vector<char> list;
+	for (const ImageChannel* channel : channels)
+	{
+		appendString(list, channel->name);
+		appendInt(list, static_cast<uint32_t>(channel->type));
+		// pLinear and three reserved bytes, then the x and y sampling.
+		appendInt(list, 0);
+		appendInt(list, 1);
+		appendInt(list, 1);
+	}
+	list.push_back(0);
+	appendAttribute(header, "channels", "chlist", list);
+	appendAttribute(header, "compression", "compression", {HasZlib ? ExrZipCompression : ExrNoCompression});
+	appendAttribute(header, "dataWindow", "box2i", boxAttribute(image.width, image.height));
+	appendAttribute(header, "displayWindow", "box2i", boxAttribute(image.width, image.height));
+	appendAttribute(header, "lineOrder", "lineOrder", {0});
+	appendAttribute(header, "pixelAspectRatio", "float", floatAttribute({1.0f}));
+	appendAttribute(header, "screenWindowCenter", "v2f", floatAttribute({0.0f, 0.0f}));
+	appendAttribute(header, "screenWindowWidth", "float", floatAttribute({1.0f}));
+	header.push_back(0);
+
+	// Blocks of lines, each stored as its first line number, its byte count and the values of its lines
+	// channel by channel; ZIP compressed blocks hold 16 lines.
+	uint32_t blockLines = HasZlib ? 16 : 1;
+	uint32_t blockCount = (image.height + blockLines - 1) / blockLines;
+	std::vector<std::vector<char>> blocks(blockCount);
+	auto encode = [&](uint32_t block, uint32_t)
+	{
+		uint32_t y0 = block * blockLines;
+		uint32_t y1 = std::min(y0 + blockLines, image.height);
+		std::vector<char> values;
+		values.reserve(lineBytes * (y1 - y0));
+		for (uint32_t y = y0; y < y1; ++y)
+		{
+			for (const ImageChannel* channel : channels)
+			{
+				size_t rowBytes = channel->valueSize() * image.width;
+				// Values are little endian in the file, as they are on the hosts this builds for.
+				appendBytes(values, channel->data.data() + y * rowBytes, rowBytes);
+			}
+		}
+		std::vector<char>& out = blocks[block];
+		appendInt(out, y0);
+		if (HasZlib)
+		{
+			// Blocks that do not shrink are stored as they are, which readers recognize by their size.
+			std::vector<uint8_t> packed = zlibCompress(predictExrBytes(values));
+			if (packed.size() < values.size())
+			{
+				appendInt(out, static_cast<uint32_t>(packed.size()));
+				appendBytes(out, packed.data(), packed.size());
+				return;
+			}
+		}
+		appendInt(out, static_cast<uint32_t>(values.size()));
+		appendBytes(out, values.data(), values.size());
+	};
+	if (pool)
+	{
+		pool->parallelFor(blockCount, encode);
+	}
+	else
+	{
+		for (uint32_t block = 0; block < blockCount; ++block)
+		{
+			encode(block, 0);
+		}
+	}
+
+	uint64_t offset = header.size() + 8 * static_cast<uint64_t>(blockCount);
+	for (const std::vector<char>& block : blocks)
+	{
+		appendInt(header, static_cast<uint32_t>(offset));
+		appendInt(header, static_cast<uint32_t>(offset >> 32));
+		offset += block.size();
+	}
+	std::ofstream file = openOutput(path);
+	file.write(header.data(), static_cast<std::streamsize>(header.size()));
+	for (const std::vector<char>& block : blocks)
+	{
+		file.write(block.data(), static_cast<std::streamsize>(block.size()));
+	}
+	finishOutput(file, path);
+}
+
+void writePng(const std::string& path, uint32_t width, uint32_t height, const float* rgba)
+{
+	// Every row is filtered with whichever of the five PNG filters leaves the smallest sum of absolute
+	// differences, the usual heuristic for what deflate compresses best.
+	size_t rowBytes = 3 * static_cast<size_t>(width);
+	std::vector<uint8_t> previous(rowBytes, 0);
+	std::vector<uint8_t> row(rowBytes);
+	std::vector<uint8_t> filtered[5];
+	std::vector<uint8_t> scanlines;
+	scanlines.reserve((rowBytes + 1) * height);
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		const float* source = rgba + 4 * static_cast<size_t>(y) * width;
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			row[3 * x + 0] = encodeSrgb(source[4 * x + 0]);
+			row[3 * x + 1] = encodeSrgb(source[4 * x + 1]);
+			row[3 * x + 2] = encodeSrgb(source[4 * x + 2]);
+		}
+		uint32_t best = 0;
+		uint64_t bestCost = ~0ull;
+		for (uint32_t filter = 0; filter < 5; ++filter)
+		{
+			filtered[filter].resize(rowBytes);
+			uint64_t cost = 0;
+			for (size_t i = 0; i < rowBytes; ++i)
+			{
+				int a = i >= 3 ? row[i - 3] : 0;
+				int b = previous[i];
+				int c = i >= 3 ? previous[i - 3] : 0;
+				int predicted = 0;
+				switch (filter)
+				{
+				case 1: predicted = a; break;
+				case 2: predicted = b; break;
+				case 3: predicted = (a + b) / 2; break;
+				case 4:
+				{
+					int p = a + b - c;
+					int pa = std::abs(p - a);
+					int pb = std::abs(p - b);
+					int pc = std::abs(p - c);
+					predicted = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+					break;
+				}
+				}
+				uint8_t value = static_cast<uint8_t>(row[i] - predicted);
+				filtered[filter][i] = value;
+				cost += value < 128 ? value : 256 - value;
+			}
+			if (cost < bestCost)
+			{
+				best = filter;
+				bestCost = cost;
+			}
+		}
+		scanlines.push_back(static_cast<uint8_t>(best));
+		scanlines.insert(scanlines.end(), filtered[best].begin(), filtered[best].end());
+		std::swap(previous, row);
+	}
+
+	std::ofstream file = openOutput(path);
+	const char signature[8] = {'\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n'};
+	file.write(signature, sizeof(signature));
+	std::vector<uint8_t> header;
+	appendBigEndian(header, width);
+	appendBigEndian(header, height);
+	// 8 bits per channel, RGB, deflate, adaptive filtering, no interlacing.
+	header.insert(header.end(), {8, 2, 0, 0, 0});
+	writePngChunk(file, "IHDR", header);
+	writePngChunk(file, "IDAT", zlibCompress(scanlines));
+	writePngChunk(file, "IEND", {});
+	finishOutput(file, path);
+}
+
+std::vector<float> readImage(const std::string& path, uint32_t& width, uint32_t& height)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		throw std::runtime_error("Cannot open " + path);
+	}
+	std::string magic = headerToken(file);
+	std::string last;
+	if (magic != "PF" && magic != "P6")
+	{
+		throw std::runtime_error("Unsupported image format: " + path + " (expected binary .ppm or .pfm)");
+	}
+	readHeader(file, path, width, height, last);
+	std::vector<float> rgba(4 * static_cast<size_t>(width) * height, 1.0f);
+	if (magic == "PF")
+	{
+		// Rows are stored bottom to top; a negative scale marks little endian data, as this host writes.
+		if (std::strtod(last.c_str(), nullptr) >= 0.0)
+		{
+			throw std::runtime_error("Big endian PFM is not supported: " + path);
+		}
+		std::vector<float> row(3 * static_cast<size_t>(width));
+		for (uint32_t y = height; y-- > 0;)
+		{
+			file.read(reinterpret_cast<char*>(row.data()), static_cast<std::streamsize>(row.size() * sizeof(float)));
+			float* target = rgba.data() + 4 * static_cast<size_t>(y) * width;
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				std::copy(&row[3 * x], &row[3 * x] + 3, target + 4 * x);
+			}
+		}
+	}
+	else
+	{
+		if (std::strtoul(last.c_str(), nullptr, 10) != 255)
+		{
+			throw std::runtime_error("Only 8 bit PPM is supported: " + path);
+		}
+		std::vector<uint8_t> row(3 * static_cast<size_t>(width));
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			file.read(reinterpret_cast<char*>(row.data()), static_cast<std::streamsize>(row.size()));
+			float* target = rgba.data() + 4 * static_cast<size_t>(y) * width;
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				target[4 * x + 0] = decodeSrgb(row[3 * x + 0]);
+				target[4 * x + 1] = decodeSrgb(row[3 * x + 1]);
+				target[4 * x + 2] = decodeSrgb(row[3 * x + 2]);
+			}
+		}
+	}
+	if (!file)
+	{
+		throw std::runtime_error("Truncated image " + path);
+	}
+	return rgba;
+}
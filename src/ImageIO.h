@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// Writes RGBA32F pixels, top row first, as returned by Renderer::resolve. The format follows the file
+// extension: .pfm and .exr keep linear float radiance, .ppm and .png are clamped and sRGB encoded to
+// 8 bits.
+// Throws std::runtime_error when the file cannot be written or the extension is unknown.
+void writeImage(const std::string& path, uint32_t width, uint32_t height, const float* rgba);
+
+// Case insensitive test for the extension of path, given in lower case with its dot.
+bool hasExtension(const std::string& path, const char* extension);
+
+// 8 bit sRGB encoding of a linear value, clamped to [0, 1].
+uint8_t encodeSrgb(float linear);
+// Linear value of an 8 bit sRGB value, from a table.
+float decodeSrgb(uint8_t value);
+
+// True when writeImage knows the extension of path.
+bool isSupportedImage(const std::string& path);
+// True for .exr paths, the one format that holds several layers.
+bool isLayeredImage(const std::string& path);
+
+void writePfm(const std::string& path, uint32_t width, uint32_t height, const float* rgba);
+void writePpm(const std::string& path, uint32_t width, uint32_t height, const float* rgba);
+// 8 bit sRGB like .ppm, deflated with zlib, or in stored blocks when built without it.
+void writePng(const std::string& path, uint32_t width, uint32_t height, const float* rgba);
+
+// Value types of image channels, numbered as in OpenEXR files.
+enum class ChannelType : uint32_t
+{
+	Uint = 0,
+	Half = 1,
+	Float = 2
+};
+
+// One plane of width * height values, top row first. Names of the form "layer.channel" group channels
+// into layers; channels without a layer form the main image.
+struct ImageChannel
+{
+	std::string name;
+	ChannelType type = ChannelType::Float;
+	// Native endian values, 2 bytes each for Half and 4 for the other types.
+	std::vector<uint8_t> data;
+
+	size_t valueSize() const { return type == ChannelType::Half ? 2 : 4; }
+};
+
+struct LayeredImage
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<ImageChannel> channels;
+
+	// Appends a zeroed channel and returns its values, valid until the next channel is added.
+	uint32_t* addUint(const std::string& name);
+	float* addFloat(const std::string& name);
+	// Appends values[i * step] for every pixel i, rounded to half floats when half is set.
+	void addFloats(const std::string& name, const float* values, size_t step, bool half);
+	// Appends the red, green and blue of RGBA32F pixels as channels R, G and B of layer, or of the main
+	// image for an empty layer.
+	void addRgb(const std::string& layer, const float* rgba, bool half);
+};
+
+// Nearest half precision value of value, ties to even; out of range values become infinite.
+uint16_t floatToHalf(float value);
+
+// Writes a scanline OpenEXR file holding every channel of image, which readers group into layers by
+// name. Built with zlib, blocks of 16 lines are ZIP compressed, in parallel over pool when one is
+// given; otherwise the file is uncompressed. Throws std::runtime_error when the file cannot be written.
+void writeExr(const std::string& path, const LayeredImage& image, ThreadPool* pool = nullptr);
+
+// Reads a .pfm or binary 8 bit .ppm image as RGBA32F, top row first, with PPM values decoded from
+// sRGB to linear. Throws std::runtime_error when the file cannot be read or is malformed.
+std::vector<float> readImage(const std::string& path, uint32_t& width, uint32_t& height);
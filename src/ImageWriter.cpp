@@ -0,0 +1,88 @@
+#include "ImageWriter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <utility>
+
+ImageWriter::ImageWriter(uint32_t threadCount, uint32_t capacity)
+	: pool(std::max(1u, threadCount) + 1, ThreadPriority::Background), capacity(std::max(1u, capacity))
+{
+}
+
+ImageWriter::~ImageWriter()
+{
+	flush();
+}
+
+bool ImageWriter::submit(const std::string& path, Job job, bool wait)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		auto ready = [&] { return pending.size() < capacity && pending.count(path) == 0; };
+		if (!ready())
+		{
+			if (!wait)
+			{
+				return false;
+			}
+			done.wait(lock, ready);
+		}
+		pending.insert(path);
+	}
+	pool.run(group, [this, path, job = std::move(job)]
+	{
+		// One job per path at a time, so the temporary name is its own. It keeps the extension, which
+		// selects the file format.
+		std::filesystem::path temporaryPath(path);
+		temporaryPath.replace_extension(".partial" + temporaryPath.extension().string());
+		std::string temporary = temporaryPath.string();
+		std::string error;
+		try
+		{
+			job(temporary, pool);
+			std::filesystem::rename(temporary, path);
+		}
+		catch (const std::exception& e)
+		{
+			std::remove(temporary.c_str());
+			error = "Cannot write " + path + ": " + e.what();
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		if (error.empty())
+		{
+			writtenCount++;
+		}
+		else
+		{
+			errors.push_back(error);
+		}
+		pending.erase(path);
+		done.notify_all();
+	});
+	return true;
+}
+
+bool ImageWriter::canSubmit(const std::string& path) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return pending.size() < capacity && pending.count(path) == 0;
+}
+
+void ImageWriter::flush()
+{
+	pool.wait(group);
+}
+
+std::vector<std::string> ImageWriter::takeErrors()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return std::exchange(errors, {});
+}
+
+uint32_t ImageWriter::written() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return writtenCount;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+// Writes output files on background threads, so that a render loop hands a snapshot over and goes on
+// rendering instead of waiting for encoding and the disk. Jobs wait in a bounded queue: at most
+// capacity are queued or being written, which bounds the memory their snapshots hold, and at most one
+// per path, so that a file is replaced in the order its snapshots were taken. Every file is written
+// under a temporary name and renamed over its path when complete, so that an interrupted write never
+// leaves a truncated file behind. The writer threads run at background priority and also compress
+// the files they write, through the pool handed to each job.
+class ImageWriter
+{
+public:
+	// Writes the file it is given, a temporary next to the job's path with the same extension.
+	using Job = std::function<void(const std::string& file, ThreadPool& pool)>;
+
+	ImageWriter(uint32_t threadCount, uint32_t capacity);
+	// Finishes the jobs still queued.
+	~ImageWriter();
+
+	ImageWriter(const ImageWriter&) = delete;
+	ImageWriter& operator=(const ImageWriter&) = delete;
+
+	// Queues job to write path. Returns false without queueing it when the queue is full or a job for
+	// path is pending, unless wait is set, in which case it waits until neither is the case.
+	bool submit(const std::string& path, Job job, bool wait);
+	// True when a job for path would be queued without waiting. Jobs only ever leave the queue, so the
+	// answer holds for the thread that submits them until it submits again.
+	bool canSubmit(const std::string& path) const;
+	// Waits for every queued job; the calling thread helps writing.
+	void flush();
+
+	// Messages of the jobs that failed since the last call.
+	std::vector<std::string> takeErrors();
+	uint32_t written() const;
+
+private:
+	ThreadPool pool;
+	TaskGroup group;
+	uint32_t capacity;
+	mutable std::mutex mutex;
+	std::condition_variable done;
+	std::set<std::string> pending;
+	std::vector<std::string> errors;
+	uint32_t writtenCount = 0;
+};
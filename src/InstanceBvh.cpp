@@ -0,0 +1,133 @@
+#include "InstanceBvh.h"
+
+#include "Timer.h"
+
+#include <algorithm>
+#include <ostream>
+
+namespace
+{
+	void addStats(BvhBuildStats& total, const BvhBuildStats& part)
+	{
+		total.nodeCount += part.nodeCount;
+		total.leafCount += part.leafCount;
+		total.nodeBytes += part.nodeBytes;
+		total.indexBytes += part.indexBytes;
+		total.peakBuildBytes += part.peakBuildBytes;
+	}
+}
+
+InstanceBvh::InstanceBvh(const Scene& scene, ThreadPool& pool, AcceleratorKind meshKind, const BvhBuildSettings& settings)
+	: scene(scene), pool(pool)
+{
+	Timer timer;
+	AcceleratorKind kind = resolveAcceleratorKind(meshKind);
+	uint32_t meshCount = static_cast<uint32_t>(scene.meshes.size());
+	meshes.resize(meshCount);
+	// Meshes build side by side; large ones still split their own build over the pool.
+	pool.parallelFor(meshCount, [&](uint32_t i, uint32_t)
+	{
+		MeshAccelerator& mesh = meshes[i];
+		mesh.bvh = std::make_unique<Bvh>(scene, scene.meshes[i], pool, settings);
+		mesh.stats = mesh.bvh->stats();
+		mesh.bounds = mesh.bvh->nodes()[0].bounds();
+		mesh.accelerator = createAccelerator(*mesh.bvh, kind);
+		if (kind != AcceleratorKind::Binary)
+		{
+			mesh.bvh.reset();
+		}
+	});
+
+	uint32_t maxMeshDepth = 0;
+	buildStats.primitiveCount = scene.triangleCount();
+	for (const MeshAccelerator& mesh : meshes)
+	{
+		addStats(buildStats, mesh.stats);
+		maxMeshDepth = std::max(maxMeshDepth, mesh.stats.maxDepth);
+	}
+
+	records.resize(scene.instances.size());
+	instanceBounds.resize(scene.instances.size());
+	updateInstances();
+	BvhBuildSettings topSettings = settings;
+	topSettings.maxLeafSize = 2;
+	instanceTree = std::make_unique<Bvh>(instanceBounds, pool, topSettings);
+
+	addStats(buildStats, instanceTree->stats());
+	buildStats.maxDepth = instanceTree->stats().maxDepth + maxMeshDepth;
+	buildStats.sahCost = instanceTree->stats().sahCost;
+	buildStats.buildSeconds = timer.seconds();
+	layoutName = std::string("TLAS+") + (meshes.empty() ? "BVH2" : meshes[0].accelerator->name());
+}
+
+void InstanceBvh::updateInstances()
+{
+	pool.parallelFor(static_cast<uint32_t>(records.size()), [&](uint32_t i, uint32_t)
+	{
+		const Instance& instance = scene.instances[i];
+		records[i].worldToObject = instance.transform.inverse();
+		records[i].mesh = instance.mesh;
+		const Aabb& meshBounds = meshes[instance.mesh].bounds;
+		instanceBounds[i] = meshBounds.empty() ? Aabb() : instance.transform.bounds(meshBounds);
+	}, 1024);
+}
+
+void InstanceBvh::refit()
+{
+	updateInstances();
+	instanceTree->refit([&](uint32_t instance) { return instanceBounds[instance]; });
+}
+
+bool InstanceBvh::intersect(Ray& ray, Hit& hit) const
+{
+	bool found = false;
+	traverseLeaves(*instanceTree, ray, [&](uint32_t instance)
+	{
+		const InstanceRecord& record = records[instance];
+		Ray local = transformRay(record.worldToObject, ray);
+		if (meshes[record.mesh].accelerator->intersect(local, hit))
+		{
+			ray.tMax = hit.t;
+			hit.instance = instance;
+			found = true;
+		}
+		return false;
+	});
+	return found;
+}
+
+bool InstanceBvh::occluded(const Ray& ray) const
+{
+	bool blocked = false;
+	traverseLeaves(*instanceTree, ray, [&](uint32_t instance)
+	{
+		const InstanceRecord& record = records[instance];
+		blocked = meshes[record.mesh].accelerator->occluded(transformRay(record.worldToObject, ray));
+		return blocked;
+	});
+	return blocked;
+}
+
+size_t InstanceBvh::memoryBytes() const
+{
+	size_t bytes = instanceTree->stats().nodeBytes + instanceTree->stats().indexBytes + records.size() * sizeof(InstanceRecord)
+		+ instanceBounds.size() * sizeof(Aabb);
+	for (const MeshAccelerator& mesh : meshes)
+	{
+		bytes += mesh.accelerator->memoryBytes();
+	}
+	return bytes;
+}
+
+void InstanceBvh::printStats(std::ostream& out) const
+{
+	uint64_t instancedTriangles = 0;
+	for (const Instance& instance : scene.instances)
+	{
+		instancedTriangles += scene.meshes[instance.mesh].triangleCount;
+	}
+	out << "Instances: " << records.size() << " instances of " << meshes.size() << " meshes, " << scene.triangleCount() << " unique / "
+		<< instancedTriangles << " instanced triangles, top level " << instanceTree->stats().nodeCount << " nodes, SAH cost "
+		<< buildStats.sahCost << "\n"
+		<< "Instance build: " << buildStats.buildSeconds * 1000.0 << " ms, " << memoryBytes() / (1024.0 * 1024.0) << " MiB" << std::endl;
+}
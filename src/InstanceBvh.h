@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Accelerator.h"
+#include "Bvh.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Two-level acceleration structure for instanced scenes: one bottom-level accelerator per mesh,
+// shared by all of its instances, under a binary top-level BVH over the instances' world bounds.
+// Rays enter a mesh through the inverse instance transform, so memory scales with unique geometry
+// rather than with the number of instances.
+class InstanceBvh : public Accelerator
+{
+public:
+	// meshKind picks the bottom-level layout, as for createAccelerator.
+	InstanceBvh(const Scene& scene, ThreadPool& pool, AcceleratorKind meshKind = AcceleratorKind::Auto, const BvhBuildSettings& settings = {});
+
+	bool intersect(Ray& ray, Hit& hit) const override;
+	bool occluded(const Ray& ray) const override;
+
+	const char* name() const override { return layoutName.c_str(); }
+	size_t memoryBytes() const override;
+
+	// Picks up changed instance transforms in the scene: updates the instance bounds and refits the
+	// top level in place. Meshes and the instance count have to stay the same.
+	void refit();
+
+	// Summed over both levels; primitiveCount counts unique triangles.
+	const BvhBuildStats& stats() const { return buildStats; }
+	const Bvh& topLevel() const { return *instanceTree; }
+	void printStats(std::ostream& out) const;
+
+private:
+	struct MeshAccelerator
+	{
+		// Only kept for the binary layout, which traverses it directly.
+		std::unique_ptr<Bvh> bvh;
+		std::unique_ptr<Accelerator> accelerator;
+		BvhBuildStats stats;
+		Aabb bounds;
+	};
+
+	struct InstanceRecord
+	{
+		Transform worldToObject;
+		uint32_t mesh;
+	};
+
+	void updateInstances();
+
+	const Scene& scene;
+	ThreadPool& pool;
+	std::vector<MeshAccelerator> meshes;
+	std::vector<InstanceRecord> records;
+	std::vector<Aabb> instanceBounds;
+	std::unique_ptr<Bvh> instanceTree;
+	BvhBuildStats buildStats;
+	std::string layoutName;
+};
@@ -0,0 +1,618 @@
+#include "Lights.h"
+
+#include "Shading.h"
+#include "Timer.h"
+
+#include <algorithm>
+#include <ostream>
+
+namespace
+{
+	constexpr uint32_t LightBinCount = 12;
+	// Ranges with at least this many lights are split into parallel tasks.
+	constexpr uint32_t ParallelLightThreshold = 4096;
+	// Ranges with at least this many lights bin them in parallel, in chunks of this size.
+	constexpr uint32_t LightBinningChunkSize = 16384;
+	constexpr float OneBelow = 0x1.fffffep-1f;
+	// Probability of sampling the environment rather than a triangle in scenes with both.
+	constexpr float EnvironmentShare = 0.5f;
+
+	float powerHeuristic(float pdf, float otherPdf)
+	{
+		return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+	}
+
+	// Bounds, power and normal cone of a set of lights while building, the cone as an angle around axis.
+	struct LightBounds
+	{
+		Aabb bounds;
+		Vec3 axis = Vec3(0.0f, 0.0f, 1.0f);
+		float spread = 0.0f;
+		float power = 0.0f;
+
+		// Smallest cone holding both cones (Conty Estevez and Kulla, algorithm 1).
+		void extend(const LightBounds& other)
+		{
+			if (other.bounds.empty())
+			{
+				return;
+			}
+			if (bounds.empty())
+			{
+				*this = other;
+				return;
+			}
+			bounds.extend(other.bounds);
+			power += other.power;
+
+			Vec3 wideAxis = spread >= other.spread ? axis : other.axis;
+			Vec3 narrowAxis = spread >= other.spread ? other.axis : axis;
+			float wideSpread = std::max(spread, other.spread);
+			float narrowSpread = std::min(spread, other.spread);
+			float cosDelta = std::min(1.0f, std::max(-1.0f, dot(wideAxis, narrowAxis)));
+			float delta = std::acos(cosDelta);
+			axis = wideAxis;
+			spread = wideSpread;
+			if (std::min(delta + narrowSpread, Pi) <= wideSpread)
+			{
+				return;
+			}
+			float merged = 0.5f * (wideSpread + delta + narrowSpread);
+			if (merged >= Pi)
+			{
+				spread = Pi;
+				return;
+			}
+			// Rotate the wide axis towards the narrow one, around their common normal.
+			Vec3 ortho = narrowAxis - wideAxis * cosDelta;
+			float orthoLength = length(ortho);
+			if (orthoLength < 1e-6f)
+			{
+				Vec3 bitangent;
+				makeBasis(wideAxis, ortho, bitangent);
+			}
+			else
+			{
+				ortho = ortho / orthoLength;
+			}
+			float rotation = merged - wideSpread;
+			axis = normalize(wideAxis * std::cos(rotation) + ortho * std::sin(rotation));
+			spread = merged;
+		}
+
+		// Power times the solid angle measure of the cone, widened by the hemisphere every triangle
+		// emits into, times the surface area: the cost of a node in the orientation heuristic.
+		float cost() const
+		{
+			if (bounds.empty())
+			{
+				return 0.0f;
+			}
+			float cosSpread = std::cos(spread);
+			float sinSpread = std::sin(spread);
+			float outer = std::min(spread + 0.5f * Pi, Pi);
+			float measure = 2.0f * Pi * (1.0f - cosSpread)
+				+ 0.5f * Pi * (2.0f * outer * sinSpread - std::cos(spread - 2.0f * outer) - 2.0f * spread * sinSpread + cosSpread);
+			return power * measure * bounds.surfaceArea();
+		}
+	};
+
+	struct LightBinSet
+	{
+		LightBounds bins[3][LightBinCount];
+		uint32_t counts[3][LightBinCount] = {};
+
+		void merge(const LightBinSet& other)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				for (uint32_t b = 0; b < LightBinCount; ++b)
+				{
+					bins[axis][b].extend(other.bins[axis][b]);
+					counts[axis][b] += other.counts[axis][b];
+				}
+			}
+		}
+	};
+
+	// cos(a - b) for angles a and b given by their sines and cosines, 1 once b is the larger angle.
+	float cosSubClamped(float sinA, float cosA, float sinB, float cosB)
+	{
+		return cosA > cosB ? 1.0f : cosA * cosB + sinA * sinB;
+	}
+
+	float sinSubClamped(float sinA, float cosA, float sinB, float cosB)
+	{
+		return cosA > cosB ? 0.0f : sinA * cosB - cosA * sinB;
+	}
+
+	float safeSqrt(float x)
+	{
+		return std::sqrt(std::max(0.0f, x));
+	}
+
+	void atomicMax(std::atomic<uint32_t>& target, uint32_t value)
+	{
+		uint32_t current = target.load(std::memory_order_relaxed);
+		while (current < value && !target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+		{
+		}
+	}
+}
+
+struct LightSet::BuildContext
+{
+	ThreadPool& pool;
+	std::vector<LightBounds> lights;
+	std::vector<uint32_t> order;
+	std::atomic<uint32_t> maxDepth{0};
+	TaskGroup tasks;
+
+	explicit BuildContext(ThreadPool& pool) : pool(pool) {}
+
+	LightBounds rangeBounds(uint32_t begin, uint32_t end) const
+	{
+		LightBounds bounds;
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			bounds.extend(lights[order[i]]);
+		}
+		return bounds;
+	}
+
+	Aabb centroidBounds(uint32_t begin, uint32_t end) const
+	{
+		Aabb bounds;
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			bounds.extend(lights[order[i]].bounds.centroid());
+		}
+		return bounds;
+	}
+
+	// Bins the lights of [begin, end) by centroid along each axis. Large ranges are binned in parallel,
+	// in chunks merged in order, so that the bins do not depend on the number of threads.
+	void binRange(uint32_t begin, uint32_t end, const Aabb& centroids, const Vec3& scale, LightBinSet& binSet)
+	{
+		auto accumulate = [&](uint32_t first, uint32_t last, LightBinSet& set)
+		{
+			for (uint32_t i = first; i < last; ++i)
+			{
+				const LightBounds& light = lights[order[i]];
+				Vec3 c = light.bounds.centroid();
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					uint32_t bin = std::min(LightBinCount - 1, static_cast<uint32_t>((c[axis] - centroids.min[axis]) * scale[axis]));
+					set.bins[axis][bin].extend(light);
+					set.counts[axis][bin]++;
+				}
+			}
+		};
+
+		uint32_t count = end - begin;
+		if (count < 2 * LightBinningChunkSize)
+		{
+			accumulate(begin, end, binSet);
+			return;
+		}
+		uint32_t chunks = (count + LightBinningChunkSize - 1) / LightBinningChunkSize;
+		std::vector<LightBinSet> chunkBins(chunks);
+		pool.parallelFor(chunks, [&](uint32_t chunk, uint32_t)
+		{
+			uint32_t first = begin + chunk * LightBinningChunkSize;
+			accumulate(first, std::min(end, first + LightBinningChunkSize), chunkBins[chunk]);
+		});
+		for (const LightBinSet& set : chunkBins)
+		{
+			binSet.merge(set);
+		}
+	}
+};
+
+LightSet::LightSet(const Scene& scene, const EnvironmentMap* environment) : scene(scene), environment(environment)
+{
+	collect(false);
+}
+
+LightSet::LightSet(const Scene& scene, ThreadPool& pool, const EnvironmentMap* environment) : scene(scene), environment(environment)
+{
+	Timer timer;
+	collect(true);
+	uint32_t count = size();
+	if (count == 0)
+	{
+		return;
+	}
+
+	BuildContext context(pool);
+	context.lights.resize(count);
+	context.order.resize(count);
+	pool.parallelFor(count, [&](uint32_t i, uint32_t)
+	{
+		uint32_t instance = instances.empty() ? InvalidIndex : instances[i];
+		LightBounds& light = context.lights[i];
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			light.bounds.extend(scene.vertex(instance, triangles[i], corner));
+		}
+		float area = scene.triangleArea(instance, triangles[i]);
+		light.power = luminance(scene.material(triangles[i]).emission) * area;
+		if (area > 0.0f)
+		{
+			light.axis = scene.geometricNormal(instance, triangles[i]);
+		}
+		context.order[i] = i;
+	}, 4096);
+
+	nodes.resize(2 * static_cast<size_t>(count) - 1);
+	parents.resize(nodes.size());
+	leaves.resize(count);
+	parents[0] = InvalidIndex;
+	buildNode(context, 0, 0, count, 1, 0);
+	pool.wait(context.tasks);
+	treeDepth = context.maxDepth.load();
+	buildSeconds = timer.seconds();
+}
+
+void LightSet::collect(bool indexTriangles)
+{
+	if (indexTriangles)
+	{
+		triangleLights.assign(scene.triangleCount(), InvalidIndex);
+	}
+	auto addRange = [&](uint32_t first, uint32_t count, uint32_t instance)
+	{
+		uint32_t firstLight = size();
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			if (scene.material(i).emissive())
+			{
+				if (indexTriangles)
+				{
+					triangleLights[i] = size() - firstLight;
+				}
+				triangles.push_back(i);
+				totalArea += scene.triangleArea(instance, i);
+				cdf.push_back(totalArea);
+				if (scene.instanced())
+				{
+					instances.push_back(instance);
+				}
+			}
+		}
+	};
+
+	if (!scene.instanced())
+	{
+		addRange(0, scene.triangleCount(), InvalidIndex);
+	}
+	for (uint32_t i = 0; i < scene.instances.size(); ++i)
+	{
+		const Mesh& mesh = scene.meshes[scene.instances[i].mesh];
+		if (indexTriangles)
+		{
+			instanceLights.push_back(size());
+		}
+		addRange(mesh.firstTriangle, mesh.triangleCount, i);
+	}
+	if (environment && environment->sampleable())
+	{
+		environmentProbability = triangles.empty() ? 1.0f : EnvironmentShare;
+	}
+}
+
+void LightSet::buildNode(BuildContext& context, uint32_t nodeIndex, uint32_t begin, uint32_t end, uint32_t firstFree, uint32_t depth)
+{
+	uint32_t count = end - begin;
+	LightBounds bounds = context.rangeBounds(begin, end);
+	LightNode& node = nodes[nodeIndex];
+	node.center = bounds.bounds.centroid();
+	node.radius = 0.5f * length(bounds.bounds.diagonal());
+	node.axis = bounds.axis;
+	node.cosSpread = std::cos(bounds.spread);
+	node.power = bounds.power;
+	if (count == 1)
+	{
+		node.child = LightLeaf | context.order[begin];
+		leaves[context.order[begin]] = nodeIndex;
+		atomicMax(context.maxDepth, depth);
+		return;
+	}
+
+	// Binned surface area orientation heuristic, with splits across thin axes of the bounds penalized.
+	Aabb centroids = context.centroidBounds(begin, end);
+	Vec3 extent = centroids.diagonal();
+	Vec3 scale;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		scale[axis] = extent[axis] > 0.0f ? LightBinCount / extent[axis] : 0.0f;
+	}
+	int bestAxis = -1;
+	uint32_t bestBin = 0;
+	float bestCost = Infinity;
+	if (maxComponent(extent) > 0.0f)
+	{
+		LightBinSet binSet;
+		context.binRange(begin, end, centroids, scale, binSet);
+		Vec3 diagonal = bounds.bounds.diagonal();
+		float longest = maxComponent(diagonal);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			if (extent[axis] <= 0.0f)
+			{
+				continue;
+			}
+			float regularization = diagonal[axis] > 0.0f ? longest / diagonal[axis] : 1.0f;
+			float rightCost[LightBinCount];
+			LightBounds accumulated;
+			for (uint32_t b = LightBinCount - 1; b > 0; --b)
+			{
+				accumulated.extend(binSet.bins[axis][b]);
+				rightCost[b] = accumulated.cost();
+			}
+			accumulated = LightBounds();
+			uint32_t leftCount = 0;
+			for (uint32_t b = 0; b + 1 < LightBinCount; ++b)
+			{
+				accumulated.extend(binSet.bins[axis][b]);
+				leftCount += binSet.counts[axis][b];
+				if (leftCount == 0 || leftCount == count)
+				{
+					continue;
+				}
+				float cost = (accumulated.cost() + rightCost[b + 1]) * regularization;
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+	}
+
+	uint32_t middle = begin + count / 2;
+	if (bestAxis >= 0)
+	{
+		float axisMin = centroids.min[bestAxis];
+		float axisScale = scale[bestAxis];
+		middle = static_cast<uint32_t>(std::partition(context.order.begin() + begin, context.order.begin() + end, [&](uint32_t light)
+		{
+			float c = context.lights[light].bounds.centroid()[bestAxis];
+			return std::min(LightBinCount - 1, static_cast<uint32_t>((c - axisMin) * axisScale)) <= bestBin;
+		}) - context.order.begin());
+	}
+
+	// A subtree over n lights has 2n - 2 descendants: the children, then those of the left child, then
+	// those of the right one. The layout only depends on the splits, not on the order tasks run in.
+	uint32_t left = firstFree;
+	uint32_t right = firstFree + 1;
+	uint32_t leftFree = firstFree + 2;
+	uint32_t rightFree = leftFree + 2 * (middle - begin - 1);
+	node.child = left;
+	parents[left] = nodeIndex;
+	parents[right] = nodeIndex;
+	if (count >= ParallelLightThreshold)
+	{
+		context.pool.run(context.tasks, [this, &context, left, begin, middle, leftFree, depth]
+		{
+			buildNode(context, left, begin, middle, leftFree, depth + 1);
+		});
+	}
+	else
+	{
+		buildNode(context, left, begin, middle, leftFree, depth + 1);
+	}
+	buildNode(context, right, middle, end, rightFree, depth + 1);
+}
+
+float LightSet::importance(const LightNode& node, const Vec3& position, const Vec3& n) const
+{
+	// Distance to the center, no closer than the bounds reach, and the angle the bounds subtend.
+	Vec3 toPoint = position - node.center;
+	float distance2 = dot(toPoint, toPoint);
+	float radius2 = node.radius * node.radius;
+	float inverseDistance = distance2 > 0.0f ? 1.0f / std::sqrt(distance2) : 0.0f;
+	Vec3 w = distance2 > 0.0f ? toPoint * inverseDistance : node.axis;
+	float sinBounds = distance2 > radius2 ? node.radius * inverseDistance : 1.0f;
+	float cosBounds = distance2 > radius2 ? safeSqrt(1.0f - sinBounds * sinBounds) : -1.0f;
+
+	// Smallest angle between a normal in the cone and a direction towards the point. Triangles emit
+	// into the hemisphere around their normal, so the node is out of reach beyond a right angle.
+	float cosSpread = node.cosSpread;
+	float sinSpread = safeSqrt(1.0f - cosSpread * cosSpread);
+	float cosAxis = dot(node.axis, w);
+	float sinAxis = safeSqrt(1.0f - cosAxis * cosAxis);
+	float cosOutside = cosSubClamped(sinAxis, cosAxis, sinSpread, cosSpread);
+	float sinOutside = sinSubClamped(sinAxis, cosAxis, sinSpread, cosSpread);
+	float cosEmit = cosSubClamped(sinOutside, cosOutside, sinBounds, cosBounds);
+	if (cosEmit <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	// Same for the angle of incidence at the point.
+	float cosIncident = -dot(n, w);
+	float sinIncident = safeSqrt(1.0f - cosIncident * cosIncident);
+	float cosReceive = cosSubClamped(sinIncident, cosIncident, sinBounds, cosBounds);
+	if (cosReceive <= 0.0f)
+	{
+		return 0.0f;
+	}
+	return node.power * cosEmit * cosReceive / std::max(distance2, radius2);
+}
+
+float LightSet::leftProbability(uint32_t node, const Vec3& position, const Vec3& n) const
+{
+	const LightNode* children = &nodes[nodes[node].child];
+	float left = importance(children[0], position, n);
+	float right = importance(children[1], position, n);
+	return left + right > 0.0f ? left / (left + right) : -1.0f;
+}
+
+bool LightSet::sample(const Vec3& position, const Vec3& n, float uSelect, float u, float v, LightSample& sample) const
+{
+	if (triangles.empty())
+	{
+		return false;
+	}
+	size_t index;
+	float probability;
+	if (nodes.empty())
+	{
+		float target = uSelect * totalArea;
+		index = std::min(static_cast<size_t>(std::upper_bound(cdf.begin(), cdf.end(), target) - cdf.begin()), triangles.size() - 1);
+		probability = 0.0f;
+	}
+	else
+	{
+		// Each step reuses what is left of uSelect after the choice.
+		uint32_t node = 0;
+		probability = 1.0f;
+		while (!nodes[node].leaf())
+		{
+			float p = leftProbability(node, position, n);
+			if (p < 0.0f)
+			{
+				return false;
+			}
+			if (uSelect < p)
+			{
+				uSelect = std::min(uSelect / p, OneBelow);
+				probability *= p;
+				node = nodes[node].child;
+			}
+			else
+			{
+				uSelect = std::min((uSelect - p) / (1.0f - p), OneBelow);
+				probability *= 1.0f - p;
+				node = nodes[node].child + 1;
+			}
+		}
+		index = nodes[node].child & ~LightLeaf;
+	}
+	uint32_t triangle = triangles[index];
+	uint32_t instance = instances.empty() ? InvalidIndex : instances[index];
+
+	float su = std::sqrt(u);
+	float b0 = 1.0f - su;
+	float b1 = v * su;
+
+	sample.position = scene.vertex(instance, triangle, 0) * b0 + scene.vertex(instance, triangle, 1) * b1 + scene.vertex(instance, triangle, 2) * (1.0f - b0 - b1);
+	sample.normal = scene.geometricNormal(instance, triangle);
+	sample.emission = scene.material(triangle).emission;
+	sample.pdfArea = nodes.empty() ? 1.0f / totalArea : probability / scene.triangleArea(instance, triangle);
+	return true;
+}
+
+float LightSet::pdfArea(const Vec3& position, const Vec3& n, uint32_t instance, uint32_t triangle) const
+{
+	if (nodes.empty())
+	{
+		return 1.0f / totalArea;
+	}
+	uint32_t light = triangleLights[triangle] + (instanceLights.empty() ? 0 : instanceLights[instance]);
+	float probability = 1.0f;
+	for (uint32_t node = leaves[light]; node != 0; node = parents[node])
+	{
+		uint32_t parent = parents[node];
+		float p = leftProbability(parent, position, n);
+		if (p < 0.0f)
+		{
+			return 0.0f;
+		}
+		probability *= node == nodes[parent].child ? p : 1.0f - p;
+	}
+	return probability / scene.triangleArea(instance, triangle);
+}
+
+bool LightSet::sampleEnvironment(const Vec3& position, const Vec3& n, float u, float v, Ray& shadowRay, Vec3& radiance) const
+{
+	Vec3 direction;
+	Vec3 emission;
+	float pdf;
+	if (!environment->sample(u, v, direction, emission, pdf))
+	{
+		return false;
+	}
+	float cosSurface = dot(n, direction);
+	if (cosSurface <= 0.0f)
+	{
+		return false;
+	}
+	shadowRay.origin = position + n * RayEpsilon;
+	shadowRay.direction = direction;
+	shadowRay.tMin = 0.0f;
+	shadowRay.tMax = Infinity;
+	float pdfLight = pdf * environmentProbability;
+	radiance = emission * (cosSurface * powerHeuristic(pdfLight, cosSurface * InvPi) / pdfLight);
+	return true;
+}
+
+bool LightSet::sampleDirect(const Vec3& position, const Vec3& n, float uSelect, float u, float v, Ray& shadowRay, Vec3& radiance) const
+{
+	if (uSelect < environmentProbability)
+	{
+		return sampleEnvironment(position, n, u, v, shadowRay, radiance);
+	}
+	uSelect = std::min((uSelect - environmentProbability) / (1.0f - environmentProbability), OneBelow);
+	LightSample light;
+	if (!sample(position, n, uSelect, u, v, light))
+	{
+		return false;
+	}
+	Vec3 toLight = light.position - position;
+	float distance2 = dot(toLight, toLight);
+	float distance = std::sqrt(distance2);
+	Vec3 direction = toLight / distance;
+	float cosSurface = dot(n, direction);
+	float cosLight = -dot(light.normal, direction);
+	if (cosSurface <= 0.0f || cosLight <= 0.0f || light.pdfArea <= 0.0f)
+	{
+		return false;
+	}
+
+	shadowRay.origin = position + n * RayEpsilon;
+	shadowRay.direction = direction;
+	shadowRay.tMin = 0.0f;
+	shadowRay.tMax = distance * (1.0f - 1e-3f);
+	float pdfLight = light.pdfArea * (1.0f - environmentProbability) * distance2 / cosLight;
+	radiance = light.emission * (cosSurface * powerHeuristic(pdfLight, cosSurface * InvPi) / pdfLight);
+	return true;
+}
+
+float LightSet::emissionWeight(const Vec3& position, const Vec3& n, const Vec3& direction, const Hit& hit) const
+{
+	float cosLight = std::abs(dot(scene.geometricNormal(hit.instance, hit.primitive), direction));
+	if (cosLight <= 0.0f)
+	{
+		return 1.0f;
+	}
+	float pdfLight = pdfArea(position, n, hit.instance, hit.primitive) * (1.0f - environmentProbability) * hit.t * hit.t / cosLight;
+	return powerHeuristic(std::max(0.0f, dot(n, direction)) * InvPi, pdfLight);
+}
+
+Vec3 LightSet::background(const Vec3& direction) const
+{
+	return environment ? environment->radiance(direction) : scene.background;
+}
+
+float LightSet::backgroundWeight(const Vec3& n, const Vec3& direction) const
+{
+	if (environmentProbability == 0.0f)
+	{
+		return 1.0f;
+	}
+	float pdfLight = environment->pdf(direction) * environmentProbability;
+	return powerHeuristic(std::max(0.0f, dot(n, direction)) * InvPi, pdfLight);
+}
+
+void LightSet::printStats(std::ostream& out) const
+{
+	out << "Lights: " << size() << " emissive triangles, " << totalArea << " area";
+	if (!nodes.empty())
+	{
+		out << ", light tree " << nodes.size() << " nodes, depth " << treeDepth << ", built in " << buildSeconds * 1000.0 << " ms";
+	}
+	out << std::endl;
+}
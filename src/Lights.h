@@ -0,0 +1,123 @@
+#pragma once
+
+#include "EnvironmentMap.h"
+#include "Math.h"
+#include "Ray.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+struct LightSample
+{
+	Vec3 position;
+	Vec3 normal;
+	Vec3 emission;
+	float pdfArea = 0.0f;
+};
+
+// Marks the child of a light tree leaf as the index of its light.
+constexpr uint32_t LightLeaf = 0x80000000u;
+
+// 40 byte light tree node: the bounding sphere, emitted power and normal cone of the lights below it.
+// The children of an interior node are stored as an adjacent pair starting at child, so that one
+// step down the tree reads both from the same place.
+struct LightNode
+{
+	Vec3 center;
+	float radius;
+	Vec3 axis;
+	// Cosine of the angle around axis that holds the normals of the lights below.
+	float cosSpread;
+	float power;
+	uint32_t child;
+
+	bool leaf() const { return (child & LightLeaf) != 0; }
+};
+
+static_assert(sizeof(LightNode) == 40, "LightNode is expected to be 40 bytes");
+
+// Emissive triangles, repeated per instance in instanced scenes. Without a light tree they are picked
+// proportionally to their area. With one, the tree is walked from the root, picking each child by its
+// estimated contribution to the shaded point from its power, distance and normal cone (Conty Estevez
+// and Kulla, "Importance Sampling of Many Lights with Adaptive Tree Splitting", 2018), so that the
+// noise of direct lighting no longer grows with the number of lights. An environment map, when given,
+// replaces the background and takes half of the samples of scenes that also have emissive triangles.
+class LightSet
+{
+public:
+	explicit LightSet(const Scene& scene, const EnvironmentMap* environment = nullptr);
+	// Also builds the light tree, with a binned surface area orientation heuristic. The tree does not
+	// depend on the number of threads.
+	LightSet(const Scene& scene, ThreadPool& pool, const EnvironmentMap* environment = nullptr);
+
+	// True when sampleDirect has nothing to sample.
+	bool empty() const { return triangles.empty() && environmentProbability == 0.0f; }
+	uint32_t size() const { return static_cast<uint32_t>(triangles.size()); }
+	bool hasTree() const { return !nodes.empty(); }
+
+	// Picks a light for a surface point with normal n and a point on it. Fails when no light can
+	// reach the point.
+	bool sample(const Vec3& position, const Vec3& n, float uSelect, float u, float v, LightSample& sample) const;
+	// Density per unit area with which sample picks the hit point of an emissive triangle.
+	float pdfArea(const Vec3& position, const Vec3& n, uint32_t instance, uint32_t triangle) const;
+
+	// Samples a light as seen from a surface point with normal n. On success shadowRay spans the
+	// unoccluded segment and radiance holds Le * cos / pdf in solid angle, weighted against cosine
+	// sampling of the same direction by the power heuristic.
+	bool sampleDirect(const Vec3& position, const Vec3& n, float uSelect, float u, float v, Ray& shadowRay, Vec3& radiance) const;
+	// Power heuristic weight of emission found at hit by a cosine sampled direction from a surface
+	// point with normal n, the counterpart of the weight in sampleDirect.
+	float emissionWeight(const Vec3& position, const Vec3& n, const Vec3& direction, const Hit& hit) const;
+
+	// Radiance reaching a ray that leaves the scene along direction: the environment map or the
+	// scene background.
+	Vec3 background(const Vec3& direction) const;
+	// Power heuristic weight of the background found by a cosine sampled direction from a surface
+	// point with normal n, 1 unless the environment is sampled by sampleDirect.
+	float backgroundWeight(const Vec3& n, const Vec3& direction) const;
+
+	// Probability with which sampleDirect picks the environment rather than a triangle.
+	float environmentChance() const { return environmentProbability; }
+
+	const std::vector<uint32_t>& triangleList() const { return triangles; }
+	const std::vector<float>& cdfList() const { return cdf; }
+	float area() const { return totalArea; }
+
+	void printStats(std::ostream& out) const;
+
+private:
+	struct BuildContext;
+
+	void collect(bool indexTriangles);
+	bool sampleEnvironment(const Vec3& position, const Vec3& n, float u, float v, Ray& shadowRay, Vec3& radiance) const;
+	// Builds the subtree over lights [begin, end) at node, its descendants from firstFree on.
+	void buildNode(BuildContext& context, uint32_t node, uint32_t begin, uint32_t end, uint32_t firstFree, uint32_t depth);
+	float importance(const LightNode& node, const Vec3& position, const Vec3& n) const;
+	// Probability of descending from an interior node to its first child, -1 when neither child can
+	// reach the point.
+	float leftProbability(uint32_t node, const Vec3& position, const Vec3& n) const;
+
+	const Scene& scene;
+	std::vector<uint32_t> triangles;
+	// Instance of each light triangle, empty for scenes without instances.
+	std::vector<uint32_t> instances;
+	std::vector<float> cdf;
+	float totalArea = 0.0f;
+	const EnvironmentMap* environment;
+	float environmentProbability = 0.0f;
+
+	// Light tree, empty without one.
+	std::vector<LightNode> nodes;
+	std::vector<uint32_t> parents;
+	// Leaf node of each light.
+	std::vector<uint32_t> leaves;
+	// Light of each emissive triangle, counted from the first light of its instance for instanced
+	// scenes. InvalidIndex for other triangles.
+	std::vector<uint32_t> triangleLights;
+	std::vector<uint32_t> instanceLights;
+	uint32_t treeDepth = 0;
+	double buildSeconds = 0.0;
+};
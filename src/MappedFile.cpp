@@ -0,0 +1,151 @@
+#include "MappedFile.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const
+{
+	size = std::min(size, length - std::min(offset, length));
+	if (!bytes || size == 0)
+	{
+		return;
+	}
+#ifndef _WIN32
+	size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t begin = offset / page * page;
+	madvise(const_cast<uint8_t*>(bytes) + begin, offset + size - begin, MADV_WILLNEED);
+#else
+	const size_t page = 4096;
+#endif
+	// The sum keeps the loads from being optimized away.
+	volatile uint8_t sink = 0;
+	uint8_t sum = 0;
+	for (size_t i = offset; i < offset + size; i += page)
+	{
+		sum ^= bytes[i];
+	}
+	sum ^= bytes[offset + size - 1];
+	sink = sum;
+	(void)sink;
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string& path)
+{
+	close();
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+	HANDLE view = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void* address = view ? MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!address)
+	{
+		if (view)
+		{
+			CloseHandle(view);
+		}
+		CloseHandle(handle);
+		return false;
+	}
+	file = handle;
+	mapping = view;
+	bytes = static_cast<const uint8_t*>(address);
+	length = static_cast<size_t>(size.QuadPart);
+	return true;
+}
+
+void MappedFile::release(size_t offset, size_t size) const
+{
+	// Removing pages from the working set of a read-only view never discards data.
+	if (bytes && size > 0)
+	{
+		VirtualUnlock(const_cast<uint8_t*>(bytes) + offset, size);
+	}
+}
+
+void MappedFile::close()
+{
+	if (bytes)
+	{
+		UnmapViewOfFile(bytes);
+		CloseHandle(mapping);
+		CloseHandle(file);
+	}
+	bytes = nullptr;
+	length = 0;
+	file = nullptr;
+	mapping = nullptr;
+}
+#else
+bool MappedFile::open(const std::string& path)
+{
+	close();
+	int descriptor = ::open(path.c_str(), O_RDONLY);
+	if (descriptor < 0)
+	{
+		return false;
+	}
+	struct stat status;
+	if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+	{
+		::close(descriptor);
+		return false;
+	}
+	void* address = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+	// The mapping keeps its own reference to the file.
+	::close(descriptor);
+	if (address == MAP_FAILED)
+	{
+		return false;
+	}
+	bytes = static_cast<const uint8_t*>(address);
+	length = static_cast<size_t>(status.st_size);
+	return true;
+}
+
+void MappedFile::release(size_t offset, size_t size) const
+{
+	// Only whole pages inside the range are dropped; the mapping is read-only, so nothing is lost.
+	size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t begin = (offset + page - 1) / page * page;
+	size_t end = std::min(offset + size, length) / page * page;
+	if (bytes && begin < end)
+	{
+		madvise(const_cast<uint8_t*>(bytes) + begin, end - begin, MADV_DONTNEED);
+	}
+}
+
+void MappedFile::close()
+{
+	if (bytes)
+	{
+		munmap(const_cast<uint8_t*>(bytes), length);
+	}
+	bytes = nullptr;
+	length = 0;
+}
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file. Pages are loaded on first access, so opening is
+// constant time regardless of the file size.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Returns false when the file does not exist or cannot be mapped.
+	bool open(const std::string& path);
+	void close();
+
+	// Drops the resident pages of [offset, offset + size) that are already consumed, so streaming
+	// through a file larger than memory does not grow the resident set. Later reads fault them back in.
+	void release(size_t offset, size_t size) const;
+	// Reads [offset, offset + size) into memory now rather than on first access: asks for read ahead,
+	// then touches every page so that the range is resident when this returns.
+	void prefetch(size_t offset, size_t size) const;
+
+	const uint8_t* data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	const uint8_t* bytes = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
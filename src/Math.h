@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+constexpr float Pi = 3.14159265358979323846f;
+constexpr float InvPi = 1.0f / Pi;
+constexpr float Infinity = std::numeric_limits<float>::infinity();
+
+struct Vec3
+{
+	float x = 0.0f;
+	float y = 0.0f;
+	float z = 0.0f;
+
+	Vec3() = default;
+	constexpr Vec3(float x, float y, float z) : x(x), y(y), z(z) {}
+	explicit constexpr Vec3(float s) : x(s), y(s), z(s) {}
+
+	float operator[](int axis) const { return (&x)[axis]; }
+	float& operator[](int axis) { return (&x)[axis]; }
+
+	Vec3 operator-() const { return {-x, -y, -z}; }
+	Vec3 operator+(const Vec3& o) const { return {x + o.x, y + o.y, z + o.z}; }
+	Vec3 operator-(const Vec3& o) const { return {x - o.x, y - o.y, z - o.z}; }
+	Vec3 operator*(const Vec3& o) const { return {x * o.x, y * o.y, z * o.z}; }
+	Vec3 operator/(const Vec3& o) const { return {x / o.x, y / o.y, z / o.z}; }
+	Vec3 operator*(float s) const { return {x * s, y * s, z * s}; }
+	Vec3 operator/(float s) const { return *this * (1.0f / s); }
+
+	Vec3& operator+=(const Vec3& o) { x += o.x; y += o.y; z += o.z; return *this; }
+	Vec3& operator-=(const Vec3& o) { x -= o.x; y -= o.y; z -= o.z; return *this; }
+	Vec3& operator*=(const Vec3& o) { x *= o.x; y *= o.y; z *= o.z; return *this; }
+	Vec3& operator*=(float s) { x *= s; y *= s; z *= s; return *this; }
+};
+
+inline Vec3 operator*(float s, const Vec3& v) { return v * s; }
+
+inline float dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec3 cross(const Vec3& a, const Vec3& b)
+{
+	return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+inline float length(const Vec3& v) { return std::sqrt(dot(v, v)); }
+inline Vec3 normalize(const Vec3& v) { return v / length(v); }
+inline Vec3 min(const Vec3& a, const Vec3& b) { return {std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)}; }
+inline Vec3 max(const Vec3& a, const Vec3& b) { return {std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)}; }
+inline float maxComponent(const Vec3& v) { return std::max(v.x, std::max(v.y, v.z)); }
+inline float luminance(const Vec3& c) { return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z; }
+inline bool isBlack(const Vec3& c) { return c.x <= 0.0f && c.y <= 0.0f && c.z <= 0.0f; }
+
+inline Vec3 reflect(const Vec3& d, const Vec3& n) { return d - n * (2.0f * dot(d, n)); }
+
+// Builds an orthonormal basis around n (Duff et al. 2017).
+inline void makeBasis(const Vec3& n, Vec3& tangent, Vec3& bitangent)
+{
+	float sign = std::copysign(1.0f, n.z);
+	float a = -1.0f / (sign + n.z);
+	float b = n.x * n.y * a;
+	tangent = {1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x};
+	bitangent = {b, sign + n.y * n.y * a, -n.y};
+}
+
+struct Aabb
+{
+	Vec3 min = Vec3(Infinity);
+	Vec3 max = Vec3(-Infinity);
+
+	void extend(const Vec3& p) { min = ::min(min, p); max = ::max(max, p); }
+	void extend(const Aabb& b) { min = ::min(min, b.min); max = ::max(max, b.max); }
+
+	bool empty() const { return min.x > max.x; }
+	Vec3 diagonal() const { return max - min; }
+	Vec3 centroid() const { return (min + max) * 0.5f; }
+
+	float surfaceArea() const
+	{
+		if (empty())
+		{
+			return 0.0f;
+		}
+		Vec3 d = diagonal();
+		return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	int largestAxis() const
+	{
+		Vec3 d = diagonal();
+		return d.x > d.y ? (d.x > d.z ? 0 : 2) : (d.y > d.z ? 1 : 2);
+	}
+};
+
+// Affine transform p' = columns * p + translation.
+struct Transform
+{
+	Vec3 columns[3] = {Vec3(1.0f, 0.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f), Vec3(0.0f, 0.0f, 1.0f)};
+	Vec3 translation = Vec3(0.0f);
+
+	Vec3 vector(const Vec3& v) const { return columns[0] * v.x + columns[1] * v.y + columns[2] * v.z; }
+	Vec3 point(const Vec3& p) const { return vector(p) + translation; }
+
+	Transform operator*(const Transform& o) const
+	{
+		Transform result;
+		for (int i = 0; i < 3; ++i)
+		{
+			result.columns[i] = vector(o.columns[i]);
+		}
+		result.translation = point(o.translation);
+		return result;
+	}
+
+	Transform inverse() const
+	{
+		// Rows of the inverse are the cross products of column pairs over the determinant.
+		Vec3 r0 = cross(columns[1], columns[2]);
+		Vec3 r1 = cross(columns[2], columns[0]);
+		Vec3 r2 = cross(columns[0], columns[1]);
+		float invDet = 1.0f / dot(columns[0], r0);
+		Transform result;
+		result.columns[0] = Vec3(r0.x, r1.x, r2.x) * invDet;
+		result.columns[1] = Vec3(r0.y, r1.y, r2.y) * invDet;
+		result.columns[2] = Vec3(r0.z, r1.z, r2.z) * invDet;
+		result.translation = -result.vector(translation);
+		return result;
+	}
+
+	// Box around the transformed corners of b.
+	Aabb bounds(const Aabb& b) const
+	{
+		Aabb result;
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			result.extend(point(Vec3(corner & 1 ? b.max.x : b.min.x, corner & 2 ? b.max.y : b.min.y, corner & 4 ? b.max.z : b.min.z)));
+		}
+		return result;
+	}
+
+	static Transform translate(const Vec3& t)
+	{
+		Transform result;
+		result.translation = t;
+		return result;
+	}
+
+	static Transform scale(const Vec3& s)
+	{
+		Transform result;
+		for (int i = 0; i < 3; ++i)
+		{
+			result.columns[i] = result.columns[i] * s[i];
+		}
+		return result;
+	}
+
+	// Rotation by angle radians around a unit axis.
+	static Transform rotate(const Vec3& axis, float angle)
+	{
+		float c = std::cos(angle);
+		float s = std::sin(angle);
+		Transform result;
+		for (int i = 0; i < 3; ++i)
+		{
+			Vec3 e(0.0f);
+			e[i] = 1.0f;
+			result.columns[i] = e * c + cross(axis, e) * s + axis * (dot(axis, e) * (1.0f - c));
+		}
+		return result;
+	}
+};
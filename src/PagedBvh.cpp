@@ -0,0 +1,404 @@
+#include "PagedBvh.h"
+
+#include "Timer.h"
+#include "WideBvh.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <utility>
+
+namespace
+{
+	uint64_t alignPage(uint64_t value)
+	{
+		return (value + GeometryPageAlignment - 1) / GeometryPageAlignment * GeometryPageAlignment;
+	}
+
+	uint32_t pageWidth(AcceleratorKind kind)
+	{
+		kind = resolveAcceleratorKind(kind);
+		if (kind == AcceleratorKind::Wide8 || kind == AcceleratorKind::Compressed8)
+		{
+			return 8;
+		}
+		if (kind == AcceleratorKind::Wide4 || kind == AcceleratorKind::Compressed4)
+		{
+			return 4;
+		}
+		return resolveAcceleratorKind(AcceleratorKind::Auto) == AcceleratorKind::Wide8 ? 8 : 4;
+	}
+
+	// Copies the subtree under root into a tree of its own, children still adjacent and after their
+	// parents.
+	std::unique_ptr<Bvh> extractSubtree(const Bvh& bvh, uint32_t root)
+	{
+		const Array<BvhNode>& source = bvh.nodes();
+		const Array<uint32_t>& sourcePrimitives = bvh.primitiveIndices();
+		Array<BvhNode> nodes;
+		Array<uint32_t> primitives;
+		std::vector<uint32_t> sourceIndices = {root};
+		nodes.push_back(source[root]);
+		for (size_t i = 0; i < nodes.size(); ++i)
+		{
+			BvhNode node = source[sourceIndices[i]];
+			if (node.leaf())
+			{
+				uint32_t first = static_cast<uint32_t>(primitives.size());
+				for (uint32_t p = node.offset; p < node.offset + node.count; ++p)
+				{
+					primitives.push_back(sourcePrimitives[p]);
+				}
+				node.offset = first;
+			}
+			else
+			{
+				uint32_t first = static_cast<uint32_t>(nodes.size());
+				nodes.push_back(source[node.offset]);
+				nodes.push_back(source[node.offset + 1]);
+				sourceIndices.push_back(node.offset);
+				sourceIndices.push_back(node.offset + 1);
+				node.offset = first;
+			}
+			nodes[i] = node;
+		}
+		return std::make_unique<Bvh>(bvh.scene(), std::move(nodes), std::move(primitives), BvhBuildStats());
+	}
+
+	template <int Width>
+	std::vector<uint8_t> collapsePage(const Bvh& subtree, GeometryPage& page)
+	{
+		WideBvh<Width> wide(subtree);
+		size_t nodeBytes = wide.nodes().size() * sizeof(WideBvhNode<Width>);
+		size_t packetBytes = wide.packets().size() * sizeof(TrianglePacket<Width>);
+		std::vector<uint8_t> bytes(nodeBytes + packetBytes);
+		std::memcpy(bytes.data(), wide.nodes().data(), nodeBytes);
+		std::memcpy(bytes.data() + nodeBytes, wide.packets().data(), packetBytes);
+		page.nodeCount = static_cast<uint32_t>(wide.nodes().size());
+		page.packetCount = static_cast<uint32_t>(wide.packets().size());
+		return bytes;
+	}
+
+	template <int Width>
+	std::unique_ptr<Accelerator> viewPage(const uint8_t* data, const GeometryPage& page)
+	{
+		auto nodes = reinterpret_cast<const WideBvhNode<Width>*>(data);
+		auto packets = reinterpret_cast<const TrianglePacket<Width>*>(data + page.nodeCount * sizeof(WideBvhNode<Width>));
+		return std::make_unique<WideBvh<Width>>(Array<WideBvhNode<Width>>::view(nodes, page.nodeCount),
+			Array<TrianglePacket<Width>>::view(packets, page.packetCount));
+	}
+
+	bool overlaps(const GeometryPage& page, const Ray& ray)
+	{
+		return intersectAabb(page.bounds.min, page.bounds.max, ray.origin, safeInverse(ray.direction), ray.tMin, ray.tMax) != Infinity;
+	}
+}
+
+PagedGeometry buildGeometryPages(const Bvh& bvh, ThreadPool& pool, AcceleratorKind kind, size_t pageBytes)
+{
+	PagedGeometry result;
+	result.width = pageWidth(kind);
+	size_t nodeBytes = result.width == 8 ? sizeof(WideBvhNode<8>) : sizeof(WideBvhNode<4>);
+	size_t packetBytes = result.width == 8 ? sizeof(TrianglePacket<8>) : sizeof(TrianglePacket<4>);
+	if (bvh.empty())
+	{
+		return result;
+	}
+
+	// Collapsed size per subtree, estimated bottom up: a wide node replaces about width - 1 binary ones.
+	const Array<BvhNode>& nodes = bvh.nodes();
+	std::vector<uint64_t> subtreeBytes(nodes.size());
+	for (size_t i = nodes.size(); i-- > 0;)
+	{
+		const BvhNode& node = nodes[i];
+		subtreeBytes[i] = node.leaf() ? (node.count + result.width - 1) / result.width * packetBytes
+			: subtreeBytes[node.offset] + subtreeBytes[node.offset + 1] + nodeBytes / (result.width - 1);
+	}
+
+	// The largest subtrees that fit, in depth first order so that neighbouring pages are near in space.
+	std::vector<uint32_t> roots;
+	std::vector<uint32_t> stack = {0};
+	while (!stack.empty())
+	{
+		uint32_t index = stack.back();
+		stack.pop_back();
+		const BvhNode& node = nodes[index];
+		if (node.leaf() || subtreeBytes[index] + nodeBytes <= pageBytes)
+		{
+			roots.push_back(index);
+			continue;
+		}
+		stack.push_back(node.offset + 1);
+		stack.push_back(node.offset);
+	}
+
+	uint32_t pageCount = static_cast<uint32_t>(roots.size());
+	result.pages.resize(pageCount);
+	std::vector<std::vector<uint8_t>> contents(pageCount);
+	pool.parallelFor(pageCount, [&](uint32_t i, uint32_t)
+	{
+		std::unique_ptr<Bvh> subtree = extractSubtree(bvh, roots[i]);
+		GeometryPage& page = result.pages[i];
+		page.bounds = nodes[roots[i]].bounds();
+		contents[i] = result.width == 8 ? collapsePage<8>(*subtree, page) : collapsePage<4>(*subtree, page);
+		page.size = alignPage(contents[i].size());
+	}, 16);
+
+	uint64_t offset = 0;
+	for (GeometryPage& page : result.pages)
+	{
+		page.offset = offset;
+		offset += page.size;
+	}
+	result.data.resize(offset);
+	pool.parallelFor(pageCount, [&](uint32_t i, uint32_t)
+	{
+		std::memcpy(result.data.data() + result.pages[i].offset, contents[i].data(), contents[i].size());
+		std::vector<uint8_t>().swap(contents[i]);
+	}, 16);
+	return result;
+}
+
+void PageStats::print(std::ostream& out) const
+{
+	out << "Geometry pages: " << faults << " faults (" << blockingFaults << " blocking), " << evictions << " evictions, "
+		<< fetchedBytes / (1024.0 * 1024.0) << " MiB fetched in " << fetchSeconds * 1000.0 << " ms, " << deferredRays << " deferred rays, peak resident "
+		<< peakResidentBytes / (1024.0 * 1024.0) << " MiB" << std::endl;
+}
+
+PagedBvh::PagedBvh(const MappedFile& file, size_t pageData, Array<GeometryPage> pages, uint32_t width, ThreadPool& pool, size_t budgetBytes)
+	: file(file), pageData(pageData), pageTable(std::move(pages)), width(width), pool(pool), budget(budgetBytes),
+	threadDeferrals(pool.size())
+{
+	uint32_t pageCount = static_cast<uint32_t>(pageTable.size());
+	pageTrees.resize(pageCount);
+	std::vector<Aabb> bounds(pageCount);
+	for (uint32_t i = 0; i < pageCount; ++i)
+	{
+		const uint8_t* data = file.data() + pageData + pageTable[i].offset;
+		pageTrees[i] = width == 8 ? viewPage<8>(data, pageTable[i]) : viewPage<4>(data, pageTable[i]);
+		bounds[i] = pageTable[i].bounds;
+	}
+	resident = std::make_unique<std::atomic<uint8_t>[]>(pageCount);
+	lastUse = std::make_unique<std::atomic<uint64_t>[]>(pageCount);
+	for (uint32_t i = 0; i < pageCount; ++i)
+	{
+		resident[i].store(0, std::memory_order_relaxed);
+		lastUse[i].store(0, std::memory_order_relaxed);
+	}
+	BvhBuildSettings settings;
+	settings.maxLeafSize = 2;
+	topLevel = std::make_unique<Bvh>(bounds, pool, settings);
+	layoutName = std::string("Paged ") + (width == 8 ? "BVH8" : "BVH4");
+}
+
+void PagedBvh::touch(uint32_t page) const
+{
+	uint64_t now = clock.load(std::memory_order_relaxed);
+	if (lastUse[page].load(std::memory_order_relaxed) != now)
+	{
+		lastUse[page].store(now, std::memory_order_relaxed);
+	}
+}
+
+void PagedBvh::fetch(uint32_t page, bool blocking) const
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	if (resident[page].load(std::memory_order_relaxed))
+	{
+		return;
+	}
+	const GeometryPage& entry = pageTable[page];
+	while (statistics.residentBytes + entry.size > budget && !residentPages.empty())
+	{
+		evictLeastRecent();
+	}
+	Timer timer;
+	file.prefetch(pageData + entry.offset, entry.size);
+	statistics.fetchSeconds += timer.seconds();
+	statistics.faults++;
+	statistics.blockingFaults += blocking;
+	statistics.fetchedBytes += entry.size;
+	statistics.residentBytes += entry.size;
+	statistics.peakResidentBytes = std::max(statistics.peakResidentBytes, statistics.residentBytes);
+	residentPages.push_back(page);
+	lastUse[page].store(clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	resident[page].store(1, std::memory_order_release);
+}
+
+void PagedBvh::evictLeastRecent() const
+{
+	size_t oldest = 0;
+	for (size_t i = 1; i < residentPages.size(); ++i)
+	{
+		if (lastUse[residentPages[i]].load(std::memory_order_relaxed) < lastUse[residentPages[oldest]].load(std::memory_order_relaxed))
+		{
+			oldest = i;
+		}
+	}
+	uint32_t page = residentPages[oldest];
+	residentPages[oldest] = residentPages.back();
+	residentPages.pop_back();
+	// Queries still inside the page fault it back in from the file, so dropping it is always safe.
+	resident[page].store(0, std::memory_order_relaxed);
+	file.release(pageData + pageTable[page].offset, pageTable[page].size);
+	statistics.residentBytes -= pageTable[page].size;
+	statistics.evictions++;
+}
+
+bool PagedBvh::intersect(Ray& ray, Hit& hit) const
+{
+	bool found = false;
+	traverseLeaves(*topLevel, ray, [&](uint32_t page)
+	{
+		if (!resident[page].load(std::memory_order_acquire))
+		{
+			fetch(page, true);
+		}
+		touch(page);
+		found = pageTrees[page]->intersect(ray, hit) || found;
+		return false;
+	});
+	return found;
+}
+
+bool PagedBvh::occluded(const Ray& ray) const
+{
+	bool blocked = false;
+	traverseLeaves(*topLevel, ray, [&](uint32_t page)
+	{
+		if (!resident[page].load(std::memory_order_acquire))
+		{
+			fetch(page, true);
+		}
+		touch(page);
+		blocked = pageTrees[page]->occluded(ray);
+		return blocked;
+	});
+	return blocked;
+}
+
+template <typename Visit>
+void PagedBvh::deferRays(const Ray* rays, uint32_t count, Visit&& visit) const
+{
+	for (std::vector<uint64_t>& list : threadDeferrals)
+	{
+		list.clear();
+	}
+	pool.parallelFor(count, [&](uint32_t r, uint32_t thread)
+	{
+		std::vector<uint64_t>& list = threadDeferrals[thread];
+		traverseLeaves(*topLevel, rays[r], [&](uint32_t page)
+		{
+			if (!resident[page].load(std::memory_order_acquire))
+			{
+				list.push_back(static_cast<uint64_t>(page) << 32 | r);
+				return false;
+			}
+			touch(page);
+			return visit(r, page);
+		});
+	}, 64);
+
+	// Sorted, so the queues do not depend on which thread traced which ray.
+	deferrals.clear();
+	for (const std::vector<uint64_t>& list : threadDeferrals)
+	{
+		deferrals.insert(deferrals.end(), list.begin(), list.end());
+	}
+	std::sort(deferrals.begin(), deferrals.end());
+}
+
+template <typename Finish>
+void PagedBvh::finishDeferred(const Ray* rays, Finish&& finish) const
+{
+	std::vector<std::pair<uint32_t, uint32_t>> queues;
+	for (size_t begin = 0; begin < deferrals.size();)
+	{
+		size_t end = begin + 1;
+		while (end < deferrals.size() && deferrals[end] >> 32 == deferrals[begin] >> 32)
+		{
+			++end;
+		}
+		queues.emplace_back(static_cast<uint32_t>(begin), static_cast<uint32_t>(end));
+		begin = end;
+	}
+	std::stable_sort(queues.begin(), queues.end(), [](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b)
+	{
+		return a.second - a.first > b.second - b.first;
+	});
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		statistics.deferredRays += deferrals.size();
+	}
+
+	// A ray waits in at most one queue per page, so the rays of a queue are finished in parallel.
+	for (const std::pair<uint32_t, uint32_t>& queue : queues)
+	{
+		uint32_t page = static_cast<uint32_t>(deferrals[queue.first] >> 32);
+		fetch(page, false);
+		pool.parallelFor(queue.second - queue.first, [&](uint32_t i, uint32_t)
+		{
+			uint32_t r = static_cast<uint32_t>(deferrals[queue.first + i]);
+			if (overlaps(pageTable[page], rays[r]))
+			{
+				finish(r, page);
+			}
+		}, 64);
+	}
+}
+
+void PagedBvh::intersectBatch(Ray* rays, Hit* hits, uint32_t count) const
+{
+	deferRays(rays, count, [&](uint32_t r, uint32_t page)
+	{
+		pageTrees[page]->intersect(rays[r], hits[r]);
+		return false;
+	});
+	finishDeferred(rays, [&](uint32_t r, uint32_t page)
+	{
+		pageTrees[page]->intersect(rays[r], hits[r]);
+	});
+}
+
+void PagedBvh::occludedBatch(const Ray* rays, uint8_t* occluded, uint32_t count) const
+{
+	std::fill(occluded, occluded + count, uint8_t(0));
+	deferRays(rays, count, [&](uint32_t r, uint32_t page)
+	{
+		occluded[r] = pageTrees[page]->occluded(rays[r]);
+		return occluded[r] != 0;
+	});
+	finishDeferred(rays, [&](uint32_t r, uint32_t page)
+	{
+		if (!occluded[r])
+		{
+			occluded[r] = pageTrees[page]->occluded(rays[r]);
+		}
+	});
+}
+
+size_t PagedBvh::memoryBytes() const
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	return statistics.residentBytes + topLevel->stats().nodeBytes + topLevel->stats().indexBytes
+		+ pageTable.size() * (sizeof(WideBvh<8>) + sizeof(std::atomic<uint8_t>) + sizeof(std::atomic<uint64_t>));
+}
+
+PageStats PagedBvh::stats() const
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	return statistics;
+}
+
+void PagedBvh::printStats(std::ostream& out) const
+{
+	uint64_t pageBytes = 0;
+	for (const GeometryPage& page : pageTable)
+	{
+		pageBytes += page.size;
+	}
+	out << "Paged geometry: " << pageTable.size() << " pages, " << pageBytes / (1024.0 * 1024.0) << " MiB on file, budget "
+		<< budget / (1024.0 * 1024.0) << " MiB" << std::endl;
+	stats().print(out);
+}
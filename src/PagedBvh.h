@@ -0,0 +1,118 @@
+#pragma once
+
+#include "Accelerator.h"
+#include "Array.h"
+#include "Bvh.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Pages start on this boundary in the page data, so that each can be dropped from memory on its own.
+constexpr uint64_t GeometryPageAlignment = 4096;
+
+// Subtree of a BVH collapsed into a wide BVH of its own: its nodes, then its triangle packets, which
+// carry the vertex data. size covers both, padded to GeometryPageAlignment.
+struct GeometryPage
+{
+	Aabb bounds;
+	uint64_t offset;
+	uint64_t size;
+	uint32_t nodeCount;
+	uint32_t packetCount;
+};
+
+// Pages of a BVH as stored in a scene cache.
+struct PagedGeometry
+{
+	// Lanes of the wide layout, 4 or 8.
+	uint32_t width = 0;
+	std::vector<GeometryPage> pages;
+	std::vector<uint8_t> data;
+};
+
+// Cuts bvh into subtrees of about pageBytes each once collapsed, in depth first order. The width
+// follows kind as for createAccelerator; the binary layout pages like Auto.
+PagedGeometry buildGeometryPages(const Bvh& bvh, ThreadPool& pool, AcceleratorKind kind, size_t pageBytes);
+
+struct PageStats
+{
+	// Pages read from the file, and those a single ray query had to wait for.
+	uint64_t faults = 0;
+	uint64_t blockingFaults = 0;
+	uint64_t evictions = 0;
+	uint64_t fetchedBytes = 0;
+	double fetchSeconds = 0.0;
+	// Rays queued behind a page that was not resident, once per page.
+	uint64_t deferredRays = 0;
+	size_t residentBytes = 0;
+	size_t peakResidentBytes = 0;
+
+	void print(std::ostream& out) const;
+};
+
+// Out-of-core traversal over the geometry pages of a mapped scene cache. Only a budget of pages is
+// resident at a time, the least recently used ones are dropped from memory first, and a binary BVH
+// over the page bounds stays in memory to find the pages a ray reaches. Batches never wait on the
+// file: rays are traced through the resident pages and queued on the others, which are then fetched
+// fullest queue first to finish the rays waiting on them. Single ray queries fetch on the spot.
+class PagedBvh : public Accelerator
+{
+public:
+	// pageData is the start of the page data in file; both have to outlive the accelerator.
+	PagedBvh(const MappedFile& file, size_t pageData, Array<GeometryPage> pages, uint32_t width, ThreadPool& pool, size_t budgetBytes);
+
+	bool intersect(Ray& ray, Hit& hit) const override;
+	bool occluded(const Ray& ray) const override;
+
+	// Trace count rays with deferred page faults, spread over the pool. Results match intersect and
+	// occluded per ray. Batches must not overlap each other, single ray queries may run alongside.
+	void intersectBatch(Ray* rays, Hit* hits, uint32_t count) const;
+	void occludedBatch(const Ray* rays, uint8_t* occluded, uint32_t count) const;
+
+	const char* name() const override { return layoutName.c_str(); }
+	// The resident pages and the in-memory tables, not the file.
+	size_t memoryBytes() const override;
+
+	PageStats stats() const;
+	void printStats(std::ostream& out) const;
+
+private:
+	void touch(uint32_t page) const;
+	void fetch(uint32_t page, bool blocking) const;
+	void evictLeastRecent() const;
+	// Calls visit(ray, page) for the resident pages the rays reach and collects the rest in deferrals.
+	template <typename Visit>
+	void deferRays(const Ray* rays, uint32_t count, Visit&& visit) const;
+	// Fetches the deferred pages and calls finish(ray, page) for the rays still reaching them.
+	template <typename Finish>
+	void finishDeferred(const Ray* rays, Finish&& finish) const;
+
+	const MappedFile& file;
+	size_t pageData;
+	Array<GeometryPage> pageTable;
+	uint32_t width;
+	ThreadPool& pool;
+	size_t budget;
+	std::vector<std::unique_ptr<Accelerator>> pageTrees;
+	std::unique_ptr<Bvh> topLevel;
+	std::string layoutName;
+
+	// Residency flags and last use, in fetch counts, per page. Updated without the lock on access.
+	std::unique_ptr<std::atomic<uint8_t>[]> resident;
+	std::unique_ptr<std::atomic<uint64_t>[]> lastUse;
+	mutable std::atomic<uint64_t> clock{1};
+	mutable std::mutex cacheMutex;
+	mutable std::vector<uint32_t> residentPages;
+	mutable PageStats statistics;
+	// Per thread (page << 32 | ray) pairs of the current batch.
+	mutable std::vector<std::vector<uint64_t>> threadDeferrals;
+	mutable std::vector<uint64_t> deferrals;
+};
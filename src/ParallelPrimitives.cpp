@@ -0,0 +1,82 @@
+#include "ParallelPrimitives.h"
+
+#include <utility>
+
+namespace
+{
+	constexpr uint32_t RadixBits = 8;
+	constexpr uint32_t RadixSize = 1u << RadixBits;
+	constexpr uint32_t SortChunkSize = 16384;
+}
+
+void radixSort(ThreadPool& pool, uint32_t* keys, uint32_t* values, uint32_t count, uint32_t keyBits, RadixSortScratch& scratch)
+{
+	uint32_t chunks = (count + SortChunkSize - 1) / SortChunkSize;
+	scratch.keys.resize(count);
+	scratch.values.resize(count);
+	scratch.offsets.resize(static_cast<size_t>(chunks) * RadixSize);
+
+	uint32_t* sourceKeys = keys;
+	uint32_t* sourceValues = values;
+	uint32_t* targetKeys = scratch.keys.data();
+	uint32_t* targetValues = scratch.values.data();
+	uint32_t* offsets = scratch.offsets.data();
+	for (uint32_t shift = 0; shift < keyBits; shift += RadixBits)
+	{
+		pool.parallelFor(chunks, [&](uint32_t chunk, uint32_t)
+		{
+			uint32_t* chunkCounts = offsets + static_cast<size_t>(chunk) * RadixSize;
+			std::fill(chunkCounts, chunkCounts + RadixSize, 0u);
+			uint32_t end = std::min(count, (chunk + 1) * SortChunkSize);
+			for (uint32_t i = chunk * SortChunkSize; i < end; ++i)
+			{
+				chunkCounts[(sourceKeys[i] >> shift) & (RadixSize - 1)]++;
+			}
+		});
+
+		// Exclusive prefix over digits, then over chunks within a digit.
+		uint32_t total = 0;
+		bool single = false;
+		for (uint32_t digit = 0; digit < RadixSize; ++digit)
+		{
+			uint32_t digitStart = total;
+			for (uint32_t chunk = 0; chunk < chunks; ++chunk)
+			{
+				uint32_t& slot = offsets[static_cast<size_t>(chunk) * RadixSize + digit];
+				uint32_t chunkCount = slot;
+				slot = total;
+				total += chunkCount;
+			}
+			single = single || total - digitStart == count;
+		}
+		if (single)
+		{
+			continue;
+		}
+
+		pool.parallelFor(chunks, [&](uint32_t chunk, uint32_t)
+		{
+			uint32_t* cursor = offsets + static_cast<size_t>(chunk) * RadixSize;
+			uint32_t end = std::min(count, (chunk + 1) * SortChunkSize);
+			for (uint32_t i = chunk * SortChunkSize; i < end; ++i)
+			{
+				uint32_t target = cursor[(sourceKeys[i] >> shift) & (RadixSize - 1)]++;
+				targetKeys[target] = sourceKeys[i];
+				targetValues[target] = sourceValues[i];
+			}
+		});
+		std::swap(sourceKeys, targetKeys);
+		std::swap(sourceValues, targetValues);
+	}
+
+	if (sourceKeys != keys)
+	{
+		pool.parallelFor(chunks, [&](uint32_t chunk, uint32_t)
+		{
+			uint32_t begin = chunk * SortChunkSize;
+			uint32_t end = std::min(count, begin + SortChunkSize);
+			std::copy(sourceKeys + begin, sourceKeys + end, keys + begin);
+			std::copy(sourceValues + begin, sourceValues + end, values + begin);
+		});
+	}
+}
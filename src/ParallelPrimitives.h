@@ -0,0 +1,75 @@
+#pragma once
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Stable parallel split of items into bucketCount output lists. key(item) returns the bucket of an
+// item; keys at or above bucketCount drop the item. Output order within a bucket follows the input
+// order, independent of the number of threads.
+template <typename KeyFunction>
+void partitionByKey(ThreadPool& pool, const uint32_t* items, uint32_t count, uint32_t bucketCount, KeyFunction key, std::vector<uint32_t>* buckets, std::vector<uint8_t>& keys)
+{
+	constexpr uint32_t ChunkSize = 4096;
+	uint32_t chunks = (count + ChunkSize - 1) / ChunkSize;
+	std::vector<uint32_t> offsets(static_cast<size_t>(chunks) * bucketCount, 0);
+	keys.resize(count);
+
+	pool.parallelFor(chunks, [&](uint32_t chunk, uint32_t)
+	{
+		uint32_t* chunkCounts = &offsets[static_cast<size_t>(chunk) * bucketCount];
+		uint32_t end = std::min(count, (chunk + 1) * ChunkSize);
+		for (uint32_t i = chunk * ChunkSize; i < end; ++i)
+		{
+			uint32_t k = key(items[i]);
+			keys[i] = static_cast<uint8_t>(std::min(k, bucketCount));
+			if (k < bucketCount)
+			{
+				chunkCounts[k]++;
+			}
+		}
+	});
+
+	// Exclusive prefix over chunks, per bucket.
+	for (uint32_t b = 0; b < bucketCount; ++b)
+	{
+		uint32_t total = 0;
+		for (uint32_t chunk = 0; chunk < chunks; ++chunk)
+		{
+			uint32_t& slot = offsets[static_cast<size_t>(chunk) * bucketCount + b];
+			uint32_t chunkCount = slot;
+			slot = total;
+			total += chunkCount;
+		}
+		buckets[b].resize(total);
+	}
+
+	pool.parallelFor(chunks, [&](uint32_t chunk, uint32_t)
+	{
+		uint32_t* cursor = &offsets[static_cast<size_t>(chunk) * bucketCount];
+		uint32_t end = std::min(count, (chunk + 1) * ChunkSize);
+		for (uint32_t i = chunk * ChunkSize; i < end; ++i)
+		{
+			uint32_t k = keys[i];
+			if (k < bucketCount)
+			{
+				buckets[k][cursor[k]++] = items[i];
+			}
+		}
+	});
+}
+
+// Buffers for radixSort, kept by the caller so that repeated sorts reuse their memory.
+struct RadixSortScratch
+{
+	std::vector<uint32_t> keys;
+	std::vector<uint32_t> values;
+	std::vector<uint32_t> offsets;
+};
+
+// Stable parallel LSD radix sort of count key/value pairs by the low keyBits bits of the keys, 8 bits
+// per pass. Sorts keys and values in place; passes in which all keys share a digit are skipped. The
+// result does not depend on the number of threads.
+void radixSort(ThreadPool& pool, uint32_t* keys, uint32_t* values, uint32_t count, uint32_t keyBits, RadixSortScratch& scratch);
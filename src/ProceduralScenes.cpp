@@ -0,0 +1,342 @@
+#include "ProceduralScenes.h"
+
+#include "Random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+	void addBox(Scene& scene, const Vec3& center, const Vec3& halfSize, float rotationY, uint32_t material)
+	{
+		float c = std::cos(rotationY);
+		float s = std::sin(rotationY);
+		auto corner = [&](float sx, float sy, float sz)
+		{
+			Vec3 local(sx * halfSize.x, sy * halfSize.y, sz * halfSize.z);
+			return center + Vec3(c * local.x + s * local.z, local.y, -s * local.x + c * local.z);
+		};
+
+		Vec3 p[8] = {
+			corner(-1, -1, -1), corner(1, -1, -1), corner(1, 1, -1), corner(-1, 1, -1),
+			corner(-1, -1, 1), corner(1, -1, 1), corner(1, 1, 1), corner(-1, 1, 1),
+		};
+		scene.addQuad(p[0], p[3], p[2], p[1], material);
+		scene.addQuad(p[4], p[5], p[6], p[7], material);
+		scene.addQuad(p[0], p[4], p[7], p[3], material);
+		scene.addQuad(p[1], p[2], p[6], p[5], material);
+		scene.addQuad(p[3], p[7], p[6], p[2], material);
+		scene.addQuad(p[0], p[1], p[5], p[4], material);
+	}
+
+	// Deterministic uniform float in [0, 1) for procedural placement.
+	float hashFloat(uint32_t a, uint32_t b = 0)
+	{
+		return (pcgHash(a ^ pcgHash(b + 0x68bc21ebu)) >> 8) * (1.0f / 16777216.0f);
+	}
+
+	void addSphere(Scene& scene, const Vec3& center, float radius, uint32_t segments, uint32_t material)
+	{
+		uint32_t rings = std::max(2u, segments / 2);
+		uint32_t north = scene.addVertex(center + Vec3(0.0f, radius, 0.0f));
+		for (uint32_t r = 1; r < rings; ++r)
+		{
+			float theta = Pi * r / rings;
+			for (uint32_t s = 0; s < segments; ++s)
+			{
+				float phi = 2.0f * Pi * s / segments;
+				scene.addVertex(center + Vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)) * radius);
+			}
+		}
+		uint32_t south = scene.addVertex(center - Vec3(0.0f, radius, 0.0f));
+		auto ring = [&](uint32_t r, uint32_t s) { return north + 1 + (r - 1) * segments + s % segments; };
+		for (uint32_t s = 0; s < segments; ++s)
+		{
+			scene.addTriangle(north, ring(1, s + 1), ring(1, s), material);
+			for (uint32_t r = 1; r + 1 < rings; ++r)
+			{
+				scene.addTriangle(ring(r, s), ring(r, s + 1), ring(r + 1, s + 1), material);
+				scene.addTriangle(ring(r, s), ring(r + 1, s + 1), ring(r + 1, s), material);
+			}
+			scene.addTriangle(south, ring(rings - 1, s), ring(rings - 1, s + 1), material);
+		}
+	}
+
+	void addSphereFlake(Scene& scene, const Vec3& center, float radius, const Vec3& axis, uint32_t depth, uint32_t segments, uint32_t material)
+	{
+		addSphere(scene, center, radius, segments, material);
+		if (depth == 0)
+		{
+			return;
+		}
+		// Six children around the equator of the growth axis and three above them.
+		Vec3 tangent, bitangent;
+		makeBasis(axis, tangent, bitangent);
+		for (uint32_t i = 0; i < 9; ++i)
+		{
+			float elevation = i < 6 ? 0.0f : Pi / 3.0f;
+			float azimuth = i < 6 ? i * Pi / 3.0f : Pi / 6.0f + (i - 6) * 2.0f * Pi / 3.0f;
+			Vec3 direction = normalize(tangent * (std::cos(elevation) * std::cos(azimuth)) + bitangent * (std::cos(elevation) * std::sin(azimuth))
+				+ axis * std::sin(elevation));
+			float childRadius = radius / 3.0f;
+			addSphereFlake(scene, center + direction * (radius + childRadius), childRadius, direction, depth - 1, segments, material);
+		}
+	}
+
+	// Appends a cone of the given base radius along +y, with its base closed.
+	void addCone(Scene& scene, const Vec3& base, float radius, float height, uint32_t sides, uint32_t material)
+	{
+		uint32_t apex = scene.addVertex(base + Vec3(0.0f, height, 0.0f));
+		uint32_t center = scene.addVertex(base);
+		uint32_t first = static_cast<uint32_t>(scene.positions.size());
+		for (uint32_t s = 0; s < sides; ++s)
+		{
+			float phi = 2.0f * Pi * s / sides;
+			scene.addVertex(base + Vec3(std::cos(phi) * radius, 0.0f, std::sin(phi) * radius));
+		}
+		for (uint32_t s = 0; s < sides; ++s)
+		{
+			uint32_t a = first + s;
+			uint32_t b = first + (s + 1) % sides;
+			scene.addTriangle(apex, b, a, material);
+			scene.addTriangle(center, a, b, material);
+		}
+	}
+
+	// Smoothly interpolated lattice noise in [0, 1).
+	float valueNoise(float x, float z, uint32_t seed)
+	{
+		float fx = std::floor(x);
+		float fz = std::floor(z);
+		int32_t ix = static_cast<int32_t>(fx);
+		int32_t iz = static_cast<int32_t>(fz);
+		float tx = x - fx;
+		float tz = z - fz;
+		tx = tx * tx * (3.0f - 2.0f * tx);
+		tz = tz * tz * (3.0f - 2.0f * tz);
+		auto lattice = [&](int32_t i, int32_t j) { return hashFloat(static_cast<uint32_t>(i) * 73856093u ^ seed, static_cast<uint32_t>(j)); };
+		float a = lattice(ix, iz) + (lattice(ix + 1, iz) - lattice(ix, iz)) * tx;
+		float b = lattice(ix, iz + 1) + (lattice(ix + 1, iz + 1) - lattice(ix, iz + 1)) * tx;
+		return a + (b - a) * tz;
+	}
+
+	// Ridged multifractal: sharp crests where the noise crosses its midpoint.
+	float terrainHeight(float x, float z)
+	{
+		float height = 0.0f;
+		float amplitude = 0.5f;
+		float frequency = 3.0f;
+		for (uint32_t octave = 0; octave < 7; ++octave)
+		{
+			float ridge = 1.0f - std::abs(2.0f * valueNoise(x * frequency, z * frequency, octave) - 1.0f);
+			height += amplitude * ridge * ridge;
+			amplitude *= 0.5f;
+			frequency *= 2.0f;
+		}
+		return 0.4f * height;
+	}
+
+	const Vec3 SkyColor(0.75f, 0.85f, 1.0f);
+}
+
+Scene makeCornellBox()
+{
+	Scene scene;
+
+	uint32_t white = scene.addMaterial({Vec3(0.73f, 0.73f, 0.73f)});
+	uint32_t red = scene.addMaterial({Vec3(0.65f, 0.05f, 0.05f)});
+	uint32_t green = scene.addMaterial({Vec3(0.12f, 0.45f, 0.15f)});
+	uint32_t mirror = scene.addMaterial({Vec3(0.95f), MaterialType::Mirror});
+	uint32_t glass = scene.addMaterial({Vec3(1.0f), MaterialType::Glass, Vec3(0.0f), 1.5f});
+	uint32_t light = scene.addMaterial({Vec3(0.0f), MaterialType::Diffuse, Vec3(17.0f, 12.0f, 4.0f)});
+
+	// Floor, ceiling, back wall, left and right walls of a unit box centered at the origin.
+	scene.addQuad({-1, -1, -1}, {-1, -1, 1}, {1, -1, 1}, {1, -1, -1}, white);
+	scene.addQuad({-1, 1, -1}, {1, 1, -1}, {1, 1, 1}, {-1, 1, 1}, white);
+	scene.addQuad({-1, -1, -1}, {1, -1, -1}, {1, 1, -1}, {-1, 1, -1}, white);
+	scene.addQuad({-1, -1, -1}, {-1, 1, -1}, {-1, 1, 1}, {-1, -1, 1}, red);
+	scene.addQuad({1, -1, -1}, {1, -1, 1}, {1, 1, 1}, {1, 1, -1}, green);
+
+	scene.addQuad({-0.25f, 0.999f, -0.25f}, {0.25f, 0.999f, -0.25f}, {0.25f, 0.999f, 0.25f}, {-0.25f, 0.999f, 0.25f}, light);
+
+	// The boxes float just above the floor, so that their bottoms are not coplanar with it and hits do
+	// not depend on how the accelerator breaks ties.
+	const float lift = 1e-3f;
+	addBox(scene, {-0.35f, -0.4f + lift, -0.35f}, {0.3f, 0.6f, 0.3f}, 0.3f, mirror);
+	addBox(scene, {0.4f, -0.7f + lift, 0.3f}, {0.3f, 0.3f, 0.3f}, -0.3f, glass);
+
+	scene.camera.lookAt({0.0f, 0.0f, 3.4f}, {0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, 40.0f);
+	return scene;
+}
+
+Scene makeSphereFlake(uint32_t depth, uint32_t segments)
+{
+	Scene scene;
+	uint32_t ground = scene.addMaterial({Vec3(0.5f)});
+	uint32_t flake = scene.addMaterial({Vec3(0.8f, 0.6f, 0.3f)});
+	scene.addQuad({-20, -1, -20}, {-20, -1, 20}, {20, -1, 20}, {20, -1, -20}, ground);
+	addSphereFlake(scene, Vec3(0.0f), 1.0f, Vec3(0.0f, 1.0f, 0.0f), depth, segments, flake);
+	scene.background = SkyColor;
+	scene.camera.lookAt({3.2f, 1.6f, 3.2f}, {0.0f, 0.2f, 0.0f}, {0.0f, 1.0f, 0.0f}, 40.0f);
+	return scene;
+}
+
+Scene makeForest(uint32_t treeCount)
+{
+	Scene scene;
+	uint32_t ground = scene.addMaterial({Vec3(0.3f, 0.25f, 0.15f)});
+	uint32_t bark = scene.addMaterial({Vec3(0.35f, 0.2f, 0.1f)});
+	uint32_t leaves = scene.addMaterial({Vec3(0.1f, 0.4f, 0.12f)});
+
+	uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(treeCount))));
+	float spacing = 1.5f;
+	float extent = 0.5f * side * spacing;
+	uint32_t first = scene.triangleCount();
+	scene.addQuad({-extent, 0, -extent}, {-extent, 0, extent}, {extent, 0, extent}, {extent, 0, -extent}, ground);
+	scene.addInstance(scene.addMesh(first), Transform());
+
+	// The tree is built once at the origin and instanced with a random scale, rotation and offset.
+	first = scene.triangleCount();
+	addCone(scene, Vec3(0.0f), 0.08f, 1.2f, 6, bark);
+	for (uint32_t layer = 0; layer < 3; ++layer)
+	{
+		addCone(scene, Vec3(0.0f, 0.5f + 0.35f * layer, 0.0f), 0.6f - 0.15f * layer, 0.8f, 12, leaves);
+	}
+	uint32_t tree = scene.addMesh(first);
+	scene.instances.reserve(static_cast<size_t>(treeCount) + 1);
+	for (uint32_t i = 0; i < treeCount; ++i)
+	{
+		float x = -extent + spacing * (i % side + 0.2f + 0.6f * hashFloat(i, 1));
+		float z = -extent + spacing * (i / side + 0.2f + 0.6f * hashFloat(i, 2));
+		float scale = 0.7f + 0.6f * hashFloat(i, 3);
+		float angle = 2.0f * Pi * hashFloat(i, 4);
+		scene.addInstance(tree, Transform::translate(Vec3(x, 0.0f, z)) * Transform::rotate(Vec3(0.0f, 1.0f, 0.0f), angle) * Transform::scale(Vec3(scale)));
+	}
+
+	scene.background = SkyColor;
+	scene.camera.lookAt({-extent * 0.9f, 4.0f, -extent * 0.9f}, {0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, 50.0f);
+	return scene;
+}
+
+Scene makeTerrain(uint32_t resolution)
+{
+	Scene scene;
+	uint32_t rock = scene.addMaterial({Vec3(0.45f, 0.4f, 0.35f)});
+	uint32_t stride = resolution + 1;
+	scene.positions.reserve(static_cast<size_t>(stride) * stride);
+	for (uint32_t j = 0; j <= resolution; ++j)
+	{
+		for (uint32_t i = 0; i <= resolution; ++i)
+		{
+			float x = 2.0f * i / resolution - 1.0f;
+			float z = 2.0f * j / resolution - 1.0f;
+			scene.addVertex(Vec3(x, terrainHeight(x, z), z));
+		}
+	}
+	scene.indices.reserve(static_cast<size_t>(resolution) * resolution * 6);
+	scene.materialIds.reserve(static_cast<size_t>(resolution) * resolution * 2);
+	for (uint32_t j = 0; j < resolution; ++j)
+	{
+		for (uint32_t i = 0; i < resolution; ++i)
+		{
+			uint32_t v = j * stride + i;
+			scene.addTriangle(v, v + stride, v + stride + 1, rock);
+			scene.addTriangle(v, v + stride + 1, v + 1, rock);
+		}
+	}
+	scene.background = SkyColor;
+	scene.camera.lookAt({0.0f, 0.7f, 1.6f}, {0.0f, 0.1f, 0.0f}, {0.0f, 1.0f, 0.0f}, 45.0f);
+	return scene;
+}
+
+Scene makeCity(uint32_t blocks)
+{
+	Scene scene;
+	uint32_t street = scene.addMaterial({Vec3(0.2f)});
+	uint32_t facade = scene.addMaterial({Vec3(0.35f, 0.33f, 0.3f)});
+	const Vec3 windowColors[] = {Vec3(4.0f, 2.6f, 1.2f), Vec3(3.2f, 2.8f, 2.2f), Vec3(1.6f, 2.4f, 3.6f), Vec3(4.0f, 1.8f, 0.8f)};
+	uint32_t windows[4];
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		windows[i] = scene.addMaterial({Vec3(0.0f), MaterialType::Diffuse, windowColors[i]});
+	}
+
+	// Towers one unit wide on a grid of 1.6 units; a floor is 0.25 units, with four windows per side.
+	const float spacing = 1.6f;
+	const float floorHeight = 0.25f;
+	const uint32_t columns = 4;
+	float extent = 0.5f * blocks * spacing;
+	scene.addQuad({-extent, 0, -extent}, {-extent, 0, extent}, {extent, 0, extent}, {extent, 0, -extent}, street);
+	const Vec3 up(0.0f, 1.0f, 0.0f);
+	const Vec3 sides[4] = {Vec3(1.0f, 0.0f, 0.0f), Vec3(-1.0f, 0.0f, 0.0f), Vec3(0.0f, 0.0f, 1.0f), Vec3(0.0f, 0.0f, -1.0f)};
+	for (uint32_t block = 0; block < blocks * blocks; ++block)
+	{
+		Vec3 center(-extent + spacing * (block % blocks + 0.5f), 0.0f, -extent + spacing * (block / blocks + 0.5f));
+		uint32_t floors = 6 + static_cast<uint32_t>(hashFloat(block, 1) * hashFloat(block, 2) * 40.0f);
+		float height = floors * floorHeight;
+		addBox(scene, center + Vec3(0.0f, 0.5f * height, 0.0f), Vec3(0.5f, 0.5f * height, 0.5f), 0.0f, facade);
+
+		// Windows sit just off each facade, facing out, their corners counter-clockwise seen from outside.
+		for (uint32_t side = 0; side < 4; ++side)
+		{
+			Vec3 normal = sides[side];
+			Vec3 right = cross(up, normal);
+			Vec3 origin = center + normal * 0.501f;
+			for (uint32_t floor = 0; floor < floors; ++floor)
+			{
+				for (uint32_t column = 0; column < columns; ++column)
+				{
+					uint32_t window = (block * 4 + side) * 256 + floor * columns + column;
+					if (hashFloat(window, 3) >= 0.35f)
+					{
+						continue;
+					}
+					float x0 = -0.5f + (column + 0.25f) / columns;
+					float x1 = -0.5f + (column + 0.75f) / columns;
+					float y0 = (floor + 0.3f) * floorHeight;
+					float y1 = (floor + 0.8f) * floorHeight;
+					uint32_t material = windows[std::min(3u, static_cast<uint32_t>(hashFloat(window, 4) * 4.0f))];
+					scene.addQuad(origin + right * x0 + up * y0, origin + right * x1 + up * y0, origin + right * x1 + up * y1,
+						origin + right * x0 + up * y1, material);
+				}
+			}
+		}
+	}
+
+	scene.background = Vec3(0.0f);
+	// Down the middle street from just outside the grid, at head height.
+	float avenue = -extent + spacing * (blocks / 2);
+	scene.camera.lookAt({avenue, 0.6f, -extent - 1.0f}, {avenue, 1.2f, 0.0f}, {0.0f, 1.0f, 0.0f}, 60.0f);
+	return scene;
+}
+
+bool isProceduralScene(const std::string& name)
+{
+	return name == "cornell" || name == "sphereflake" || name == "forest" || name == "terrain" || name == "city";
+}
+
+Scene makeProceduralScene(const std::string& name)
+{
+	if (name == "cornell")
+	{
+		return makeCornellBox();
+	}
+	if (name == "sphereflake")
+	{
+		return makeSphereFlake();
+	}
+	if (name == "forest")
+	{
+		return makeForest();
+	}
+	if (name == "terrain")
+	{
+		return makeTerrain();
+	}
+	if (name == "city")
+	{
+		return makeCity();
+	}
+	throw std::runtime_error("Unknown procedural scene " + name);
+}
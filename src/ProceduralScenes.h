@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Scene.h"
+
+#include <cstdint>
+#include <string>
+
+// Classic Cornell box with a ceiling light, a mirror block and a glass block.
+Scene makeCornellBox();
+
+// Sphere flake: a sphere with nine children at a third of its radius, recursively, on a ground
+// plane under a sky. Each sphere has about segments^2 triangles.
+Scene makeSphereFlake(uint32_t depth = 4, uint32_t segments = 12);
+
+// Randomly placed, scaled and rotated instances of one tree mesh (trunk and layered canopy, 84
+// triangles) on a ground plane.
+Scene makeForest(uint32_t treeCount = 10000);
+
+// Heightfield of resolution x resolution quads displaced by ridged fractal noise, seen from above
+// its edge under a sky.
+Scene makeTerrain(uint32_t resolution = 1024);
+
+// Night-time city: a blocks x blocks grid of towers of random height on a street plane, lit only by
+// their windows, about a third of which glow in one of a few warm and cool tints. Each lit window is
+// two emissive triangles, some 180 per tower.
+Scene makeCity(uint32_t blocks = 32);
+
+// True when name is one of the scenes makeProceduralScene builds.
+bool isProceduralScene(const std::string& name);
+// Builds one of the scenes above by name: cornell, sphereflake, forest, terrain or city, at default size.
+// Throws std::runtime_error for other names.
+Scene makeProceduralScene(const std::string& name);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "sampling.h"
+
+#include <cstdint>
+
+enum class SamplerType : uint32_t
+{
+	// Philox counter-based random numbers.
+	Random = 0,
+	// Owen-scrambled Sobol points.
+	Sobol = 1,
+};
+
+// Sampler of one path. The n-th call returns dimension n of the pixel's sample, computed from the
+// counters alone, so results do not depend on which thread traced the path. Shares kernels/sampling.h
+// with the OpenCL kernels.
+class Sampler
+{
+public:
+	Sampler(uint32_t pixel, uint32_t sampleIndex, SamplerType type) : state(makeSampler(pixel, sampleIndex, type == SamplerType::Sobol)) {}
+
+	float nextFloat() { return ::nextFloat(&state); }
+	// Call before drawing the two coordinates of a 2D sample.
+	void startPair() { ::startPair(&state); }
+
+private:
+	SamplerState state;
+};
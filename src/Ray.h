@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Math.h"
+
+#include <cstdint>
+
+constexpr uint32_t InvalidIndex = 0xffffffffu;
+
+struct Ray
+{
+	Vec3 origin;
+	float tMin = 0.0f;
+	Vec3 direction;
+	float tMax = Infinity;
+
+	Vec3 at(float t) const { return origin + direction * t; }
+};
+
+struct Hit
+{
+	float t = Infinity;
+	float u = 0.0f;
+	float v = 0.0f;
+	uint32_t primitive = InvalidIndex;
+	// Scene instance the primitive was hit through, InvalidIndex for scenes without instances.
+	uint32_t instance = InvalidIndex;
+
+	bool valid() const { return primitive != InvalidIndex; }
+};
+
+// Maps a ray into another space without renormalizing the direction, so distances along it stay
+// comparable with the original ray.
+inline Ray transformRay(const Transform& transform, const Ray& ray)
+{
+	Ray result;
+	result.origin = transform.point(ray.origin);
+	result.direction = transform.vector(ray.direction);
+	result.tMin = ray.tMin;
+	result.tMax = ray.tMax;
+	return result;
+}
+
+// Reciprocal of a direction with zero components nudged away from zero so slab tests never see NaNs.
+inline Vec3 safeInverse(const Vec3& d)
+{
+	auto inverse = [](float v) { return 1.0f / (std::fabs(v) > 1e-20f ? v : std::copysign(1e-20f, v)); };
+	return {inverse(d.x), inverse(d.y), inverse(d.z)};
+}
+
+// Moeller-Trumbore; only reports hits inside (ray.tMin, ray.tMax).
+inline bool intersectTriangle(const Ray& ray, const Vec3& v0, const Vec3& v1, const Vec3& v2, float& t, float& u, float& v)
+{
+	Vec3 e1 = v1 - v0;
+	Vec3 e2 = v2 - v0;
+	Vec3 p = cross(ray.direction, e2);
+	float det = dot(e1, p);
+	if (std::fabs(det) < 1e-12f)
+	{
+		return false;
+	}
+	float invDet = 1.0f / det;
+	Vec3 s = ray.origin - v0;
+	u = dot(s, p) * invDet;
+	if (u < 0.0f || u > 1.0f)
+	{
+		return false;
+	}
+	Vec3 q = cross(s, e1);
+	v = dot(ray.direction, q) * invDet;
+	if (v < 0.0f || u + v > 1.0f)
+	{
+		return false;
+	}
+	t = dot(e2, q) * invDet;
+	return t > ray.tMin && t < ray.tMax;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "Framebuffer.h"
+#include "Random.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+struct RenderSettings
+{
+	uint32_t width = 1280;
+	uint32_t height = 720;
+	uint32_t tileSize = 32;
+	uint32_t maxDepth = 8;
+	SamplerType sampler = SamplerType::Sobol;
+	// Adaptive sampling: a tile stops receiving samples once every pixel's relative error
+	// (Framebuffer::relativeError) is below this threshold. 0 samples every pixel in every pass.
+	float adaptiveThreshold = 0.0f;
+	// Samples every pixel gets before its error estimate is trusted.
+	uint32_t adaptiveMinSamples = 16;
+	// Traces camera rays and the shadow rays of their first hits in packets of neighbouring pixels.
+	bool packetTraversal = true;
+	// Wavefront pipeline: sorts secondary rays by direction octant and origin cell before traversal.
+	bool sortRays = false;
+	// Picks lights for next event estimation with a light tree; off picks them by area. Renderers
+	// given a LightSet use it as it is.
+	bool lightTree = true;
+	// First hit channels recorded next to the radiance, see Aov. The denoiser needs DenoiseAovs.
+	AovMask aovs = 0;
+};
+
+struct RenderStats
+{
+	uint32_t passes = 0;
+	uint64_t pathSamples = 0;
+	uint64_t rays = 0;
+	double seconds = 0.0;
+	double lastPassSeconds = 0.0;
+
+	double samplesPerSecond() const { return seconds > 0.0 ? pathSamples / seconds : 0.0; }
+	double raysPerSecond() const { return seconds > 0.0 ? rays / seconds : 0.0; }
+};
+
+// Everything the remaining passes of a progressive render depend on, so that a render resumed from it
+// continues as if it had never stopped. Checkpoint.h reads and writes it.
+struct RenderCheckpoint
+{
+	// The scene and settings the render was started with, as the caller describes them; resuming
+	// needs the same.
+	std::string description;
+	RenderStats stats;
+	// Renderer specific state, such as the tiles adaptive sampling has finished.
+	std::vector<uint8_t> state;
+	// Framebuffer::save data.
+	std::vector<uint8_t> samples;
+};
+
+// Pixel rectangle [x0, x1) x [y0, y1) of the tileSize grid that partitions the image.
+struct Tile
+{
+	uint32_t x0, y0, x1, y1;
+};
+
+// Tiles in row-major order, clipped to the image.
+inline std::vector<Tile> makeTiles(const RenderSettings& settings)
+{
+	std::vector<Tile> tiles;
+	for (uint32_t y = 0; y < settings.height; y += settings.tileSize)
+	{
+		for (uint32_t x = 0; x < settings.width; x += settings.tileSize)
+		{
+			tiles.push_back({x, y, std::min(x + settings.tileSize, settings.width), std::min(y + settings.tileSize, settings.height)});
+		}
+	}
+	return tiles;
+}
+
+// Progressive renderer: every pass adds one sample per pixel to the accumulation buffer.
+class Renderer
+{
+public:
+	virtual ~Renderer() = default;
+
+	virtual void renderPass() = 0;
+	virtual void reset() = 0;
+
+	// Writes the averaged linear radiance as RGBA32F rows, top row first.
+	virtual void resolve(float* rgba) const = 0;
+
+	virtual const RenderStats& stats() const = 0;
+	virtual const RenderSettings& settings() const = 0;
+	virtual const char* name() const = 0;
+
+	// Resolves only the listed tiles of makeTiles(settings()); pixels outside them are left untouched.
+	virtual void resolveTiles(float* rgba, const std::vector<uint32_t>&) const { resolve(rgba); }
+
+	// Appends the tiles whose pixels changed since the previous call. Renderers that do not track
+	// this report every tile.
+	virtual void takeDirtyTiles(std::vector<uint32_t>& tiles)
+	{
+		uint32_t tilesX = (settings().width + settings().tileSize - 1) / settings().tileSize;
+		uint32_t tilesY = (settings().height + settings().tileSize - 1) / settings().tileSize;
+		for (uint32_t i = 0; i < tilesX * tilesY; ++i)
+		{
+			tiles.push_back(i);
+		}
+	}
+
+	// Writes the first hit guides of the accumulated samples for denoising. Returns false for renderers
+	// that do not record them.
+	virtual bool resolveFeatures(PixelFeatures&) const { return false; }
+
+	// Appends the recorded channels of aovs to image as Framebuffer::resolveAovs does and returns them.
+	// Renderers without a host framebuffer write none.
+	virtual AovMask resolveAovs(AovMask, bool, LayeredImage&) const { return 0; }
+
+	// Copies the accumulated samples and the rest of the state that later passes depend on into
+	// checkpoint, leaving its description to the caller. Returns false for renderers that cannot resume.
+	virtual bool saveCheckpoint(RenderCheckpoint&) const { return false; }
+	// Continues from a checkpoint saved by a renderer of the same kind, scene and settings: the passes
+	// that follow give the same image, bit for bit, as if the render had not stopped. Returns false,
+	// leaving the renderer as it was, when the checkpoint does not fit it.
+	virtual bool restoreCheckpoint(const RenderCheckpoint&) { return false; }
+
+	// True once adaptive sampling has stopped sampling every pixel.
+	virtual bool converged() const { return false; }
+
+	// Writes the adaptive sampling state as RGBA32F: red is the relative error over the threshold,
+	// green marks converged tiles and blue the sample count over the largest one. Returns false for
+	// renderers without adaptive sampling.
+	virtual bool convergenceMask(float*) const { return false; }
+
+	// Backend specific statistics beyond RenderStats.
+	virtual void printStats(std::ostream&) const {}
+};
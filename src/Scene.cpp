@@ -0,0 +1,261 @@
+#include "Scene.h"
+
+void Camera::lookAt(const Vec3& eye, const Vec3& target, const Vec3& worldUp, float fovYDegrees)
+{
+	position = eye;
+	forward = normalize(target - eye);
+	right = normalize(cross(forward, worldUp));
+	up = cross(right, forward);
+	tanHalfFov = std::tan(0.5f * fovYDegrees * Pi / 180.0f);
+}
+
+Ray Camera::generateRay(float u, float v, float aspect) const
+{
+	float sx = (2.0f * u - 1.0f) * tanHalfFov * aspect;
+	float sy = (1.0f - 2.0f * v) * tanHalfFov;
+
+	Ray ray;
+	ray.origin = position;
+	ray.direction = normalize(forward + right * sx + up * sy);
+	return ray;
+}
+
+uint32_t Scene::addMaterial(const Material& material)
+{
+	materials.push_back(material);
+	return static_cast<uint32_t>(materials.size() - 1);
+}
+
+uint32_t Scene::addVertex(const Vec3& position)
+{
+	positions.push_back(position);
+	return static_cast<uint32_t>(positions.size() - 1);
+}
+
+void Scene::addTriangle(uint32_t i0, uint32_t i1, uint32_t i2, uint32_t material)
+{
+	indices.push_back(i0);
+	indices.push_back(i1);
+	indices.push_back(i2);
+	materialIds.push_back(material);
+}
+
+void Scene::addTriangle(const Vec3& a, const Vec3& b, const Vec3& c, uint32_t material)
+{
+	uint32_t base = static_cast<uint32_t>(positions.size());
+	positions.push_back(a);
+	positions.push_back(b);
+	positions.push_back(c);
+	addTriangle(base, base + 1, base + 2, material);
+}
+
+void Scene::addQuad(const Vec3& a, const Vec3& b, const Vec3& c, const Vec3& d, uint32_t material)
+{
+	uint32_t base = static_cast<uint32_t>(positions.size());
+	positions.push_back(a);
+	positions.push_back(b);
+	positions.push_back(c);
+	positions.push_back(d);
+	addTriangle(base, base + 1, base + 2, material);
+	addTriangle(base, base + 2, base + 3, material);
+}
+
+uint32_t Scene::addMesh(uint32_t firstTriangle)
+{
+	meshes.push_back({firstTriangle, triangleCount() - firstTriangle});
+	return static_cast<uint32_t>(meshes.size() - 1);
+}
+
+uint32_t Scene::addInstance(uint32_t mesh, const Transform& transform)
+{
+	instances.push_back({transform, mesh});
+	return static_cast<uint32_t>(instances.size() - 1);
+}
+
+Aabb Scene::triangleBounds(uint32_t triangle) const
+{
+	Aabb box;
+	box.extend(vertex(triangle, 0));
+	box.extend(vertex(triangle, 1));
+	box.extend(vertex(triangle, 2));
+	return box;
+}
+
+Vec3 Scene::geometricNormal(uint32_t triangle) const
+{
+	const Vec3& v0 = vertex(triangle, 0);
+	return normalize(cross(vertex(triangle, 1) - v0, vertex(triangle, 2) - v0));
+}
+
+float Scene::triangleArea(uint32_t triangle) const
+{
+	const Vec3& v0 = vertex(triangle, 0);
+	return 0.5f * length(cross(vertex(triangle, 1) - v0, vertex(triangle, 2) - v0));
+}
+
+TexCoord Scene::texcoord(uint32_t triangle, float u, float v) const
+{
+	const TexCoord* corners = &texcoords[3 * triangle];
+	float w = 1.0f - u - v;
+	return {w * corners[0].u + u * corners[1].u + v * corners[2].u, w * corners[0].v + u * corners[1].v + v * corners[2].v};
+}
+
+Aabb Scene::meshBounds(uint32_t mesh) const
+{
+	Aabb box;
+	const Mesh& range = meshes[mesh];
+	for (uint32_t i = range.firstTriangle; i < range.firstTriangle + range.triangleCount; ++i)
+	{
+		box.extend(triangleBounds(i));
+	}
+	return box;
+}
+
+Aabb Scene::bounds() const
+{
+	Aabb box;
+	if (instanced())
+	{
+		std::vector<Aabb> boxes(meshes.size());
+		for (uint32_t mesh = 0; mesh < meshes.size(); ++mesh)
+		{
+			boxes[mesh] = meshBounds(mesh);
+		}
+		for (const Instance& instance : instances)
+		{
+			box.extend(instance.transform.bounds(boxes[instance.mesh]));
+		}
+		return box;
+	}
+	for (const Vec3& p : positions)
+	{
+		box.extend(p);
+	}
+	return box;
+}
+
+Vec3 Scene::vertex(uint32_t instance, uint32_t triangle, int corner) const
+{
+	const Vec3& p = vertex(triangle, corner);
+	return instance == InvalidIndex ? p : instances[instance].transform.point(p);
+}
+
+Vec3 Scene::geometricNormal(uint32_t instance, uint32_t triangle) const
+{
+	if (instance == InvalidIndex)
+	{
+		return geometricNormal(triangle);
+	}
+	Vec3 v0 = vertex(instance, triangle, 0);
+	return normalize(cross(vertex(instance, triangle, 1) - v0, vertex(instance, triangle, 2) - v0));
+}
+
+float Scene::triangleArea(uint32_t instance, uint32_t triangle) const
+{
+	if (instance == InvalidIndex)
+	{
+		return triangleArea(triangle);
+	}
+	Vec3 v0 = vertex(instance, triangle, 0);
+	return 0.5f * length(cross(vertex(instance, triangle, 1) - v0, vertex(instance, triangle, 2) - v0));
+}
+
+bool Scene::intersect(Ray& ray, Hit& hit) const
+{
+	auto intersectRange = [&](Ray& local, uint32_t first, uint32_t count, uint32_t instance)
+	{
+		bool found = false;
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			float t, u, v;
+			if (intersectTriangle(local, vertex(i, 0), vertex(i, 1), vertex(i, 2), t, u, v))
+			{
+				local.tMax = t;
+				hit.t = t;
+				hit.u = u;
+				hit.v = v;
+				hit.primitive = i;
+				hit.instance = instance;
+				found = true;
+			}
+		}
+		return found;
+	};
+
+	if (!instanced())
+	{
+		return intersectRange(ray, 0, triangleCount(), InvalidIndex);
+	}
+	bool found = false;
+	for (uint32_t i = 0; i < instances.size(); ++i)
+	{
+		const Mesh& mesh = meshes[instances[i].mesh];
+		Ray local = transformRay(instances[i].transform.inverse(), ray);
+		if (intersectRange(local, mesh.firstTriangle, mesh.triangleCount, i))
+		{
+			ray.tMax = local.tMax;
+			found = true;
+		}
+	}
+	return found;
+}
+
+bool Scene::occluded(const Ray& ray) const
+{
+	auto occludedRange = [&](const Ray& local, uint32_t first, uint32_t count)
+	{
+		for (uint32_t i = first; i < first + count; ++i)
+		{
+			float t, u, v;
+			if (intersectTriangle(local, vertex(i, 0), vertex(i, 1), vertex(i, 2), t, u, v))
+			{
+				return true;
+			}
+		}
+		return false;
+	};
+
+	if (!instanced())
+	{
+		return occludedRange(ray, 0, triangleCount());
+	}
+	for (const Instance& instance : instances)
+	{
+		const Mesh& mesh = meshes[instance.mesh];
+		if (occludedRange(transformRay(instance.transform.inverse(), ray), mesh.firstTriangle, mesh.triangleCount))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+Scene flattenInstances(const Scene& scene)
+{
+	Scene flat;
+	flat.materials = scene.materials;
+	flat.textures = scene.textures;
+	flat.background = scene.background;
+	flat.camera = scene.camera;
+	if (!scene.instanced())
+	{
+		flat.positions = scene.positions;
+		flat.indices = scene.indices;
+		flat.materialIds = scene.materialIds;
+		flat.texcoords = scene.texcoords;
+		return flat;
+	}
+	for (uint32_t i = 0; i < scene.instances.size(); ++i)
+	{
+		const Mesh& mesh = scene.meshes[scene.instances[i].mesh];
+		for (uint32_t triangle = mesh.firstTriangle; triangle < mesh.firstTriangle + mesh.triangleCount; ++triangle)
+		{
+			flat.addTriangle(scene.vertex(i, triangle, 0), scene.vertex(i, triangle, 1), scene.vertex(i, triangle, 2), scene.materialIds[triangle]);
+			for (int corner = 0; corner < 3 && !scene.texcoords.empty(); ++corner)
+			{
+				flat.texcoords.push_back(scene.texcoords[3 * triangle + corner]);
+			}
+		}
+	}
+	return flat;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "Array.h"
+#include "Math.h"
+#include "Ray.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class MaterialType : uint32_t
+{
+	Diffuse = 0,
+	Mirror = 1,
+	Glass = 2,
+};
+
+struct Material
+{
+	Vec3 albedo = Vec3(0.8f);
+	MaterialType type = MaterialType::Diffuse;
+	Vec3 emission = Vec3(0.0f);
+	float ior = 1.5f;
+	// Index into Scene::textures of a map multiplied with albedo, or InvalidIndex.
+	uint32_t texture = InvalidIndex;
+
+	bool emissive() const { return !isBlack(emission); }
+};
+
+struct Camera
+{
+	Vec3 position = Vec3(0.0f, 0.0f, 1.0f);
+	Vec3 forward = Vec3(0.0f, 0.0f, -1.0f);
+	Vec3 right = Vec3(1.0f, 0.0f, 0.0f);
+	Vec3 up = Vec3(0.0f, 1.0f, 0.0f);
+	float tanHalfFov = 0.41421356f;
+
+	void lookAt(const Vec3& eye, const Vec3& target, const Vec3& worldUp, float fovYDegrees);
+
+	// u and v are in [0, 1] with v = 0 at the top of the image.
+	Ray generateRay(float u, float v, float aspect) const;
+	// Angle between the rays of neighbouring pixels at the image centre.
+	float pixelSpread(uint32_t height) const { return 2.0f * tanHalfFov / height; }
+};
+
+// Texture coordinate of a triangle corner, see Scene::texcoords.
+struct TexCoord
+{
+	float u = 0.0f;
+	float v = 0.0f;
+};
+
+// Contiguous range of triangles that instances place into the scene.
+struct Mesh
+{
+	uint32_t firstTriangle;
+	uint32_t triangleCount;
+};
+
+struct Instance
+{
+	Transform transform;
+	uint32_t mesh;
+};
+
+// Triangle soup with one material per triangle. Vertex data is shared through the index buffer,
+// texture coordinates are stored per triangle corner as OBJ indexes them separately.
+// Scenes with instances render only their instances, each placing a mesh of the soup with an
+// affine transform; without instances the soup is rendered as is. The arrays may view a mapped
+// scene cache instead of owning their data.
+struct Scene
+{
+	Array<Vec3> positions;
+	Array<uint32_t> indices;
+	Array<uint32_t> materialIds;
+	Array<Material> materials;
+	Array<Mesh> meshes;
+	Array<Instance> instances;
+	// Three per triangle with v = 0 at the top of the texture, or empty without texture coordinates.
+	Array<TexCoord> texcoords;
+	// Tiled texture files, or images to convert to them, that materials refer to.
+	std::vector<std::string> textures;
+	Vec3 background = Vec3(0.0f);
+	Camera camera;
+
+	uint32_t addMaterial(const Material& material);
+	uint32_t addVertex(const Vec3& position);
+	void addTriangle(uint32_t i0, uint32_t i1, uint32_t i2, uint32_t material);
+	void addTriangle(const Vec3& a, const Vec3& b, const Vec3& c, uint32_t material);
+	void addQuad(const Vec3& a, const Vec3& b, const Vec3& c, const Vec3& d, uint32_t material);
+	// Turns the triangles added since firstTriangle into a mesh.
+	uint32_t addMesh(uint32_t firstTriangle);
+	uint32_t addInstance(uint32_t mesh, const Transform& transform);
+
+	bool instanced() const { return !instances.empty(); }
+
+	uint32_t triangleCount() const { return static_cast<uint32_t>(materialIds.size()); }
+	const Vec3& vertex(uint32_t triangle, int corner) const { return positions[indices[3 * triangle + corner]]; }
+	const Material& material(uint32_t triangle) const { return materials[materialIds[triangle]]; }
+	// Object of a hit for the object ID pass: its instance, or its material without instances.
+	uint32_t object(const Hit& hit) const { return instanced() ? hit.instance : materialIds[hit.primitive]; }
+	// Texture coordinates at barycentrics (u, v) of a triangle; the scene must have texcoords.
+	TexCoord texcoord(uint32_t triangle, float u, float v) const;
+
+	Aabb triangleBounds(uint32_t triangle) const;
+	Vec3 geometricNormal(uint32_t triangle) const;
+	float triangleArea(uint32_t triangle) const;
+	Aabb meshBounds(uint32_t mesh) const;
+	// World space bounds, of the instances when there are any.
+	Aabb bounds() const;
+
+	// World space queries for a triangle seen through an instance, or InvalidIndex for none.
+	Vec3 vertex(uint32_t instance, uint32_t triangle, int corner) const;
+	Vec3 geometricNormal(uint32_t instance, uint32_t triangle) const;
+	float triangleArea(uint32_t instance, uint32_t triangle) const;
+
+	// Brute force reference queries, O(triangles) per ray.
+	bool intersect(Ray& ray, Hit& hit) const;
+	bool occluded(const Ray& ray) const;
+};
+
+// Copies every instance's mesh into a plain triangle soup, for consumers without instancing support.
+Scene flattenInstances(const Scene& scene);
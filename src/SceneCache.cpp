@@ -0,0 +1,368 @@
+#include "SceneCache.h"
+
+#include "CpuFeatures.h"
+#include "WideBvh.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+namespace
+{
+	enum Section : uint32_t
+	{
+		Positions,
+		Indices,
+		MaterialIds,
+		Materials,
+		Nodes,
+		Primitives,
+		WideNodes,
+		WidePackets,
+		Pages,
+		PageData,
+		Texcoords,
+		// Texture paths, each terminated by a NUL.
+		TexturePaths,
+		SectionCount,
+	};
+
+	constexpr char Magic[8] = {'P', 'T', 'G', 'P', 'U', 'S', 'C', '\0'};
+	constexpr uint32_t EndianMarker = 0x01020304;
+	// Sections start on cache line boundaries so that node and vertex loads never straddle lines.
+	constexpr uint64_t SectionAlignment = 64;
+
+	struct SectionEntry
+	{
+		uint64_t offset;
+		uint64_t count;
+		uint64_t elementBytes;
+	};
+
+	// Host layout throughout; headerBytes, the endian marker and the element sizes reject caches
+	// written by an incompatible build.
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t endianMarker;
+		uint64_t headerBytes;
+		uint64_t sourceKey;
+		// Lane count of the stored wide BVH and of the geometry pages, 0 when there are none.
+		uint64_t wideWidth;
+		uint64_t pageWidth;
+		SectionEntry sections[SectionCount];
+		Vec3 background;
+		Camera camera;
+		BvhBuildStats bvhStats;
+	};
+
+	static_assert(std::is_trivially_copyable<Header>::value, "The cache header is written as raw bytes");
+
+	void elementBytes(uint64_t wideWidth, size_t* bytes)
+	{
+		const size_t fixed[] = {sizeof(Vec3), sizeof(uint32_t), sizeof(uint32_t), sizeof(Material), sizeof(BvhNode), sizeof(uint32_t)};
+		std::copy(fixed, fixed + WideNodes, bytes);
+		bytes[WideNodes] = wideWidth == 8 ? sizeof(WideBvhNode<8>) : sizeof(WideBvhNode<4>);
+		bytes[WidePackets] = wideWidth == 8 ? sizeof(TrianglePacket<8>) : sizeof(TrianglePacket<4>);
+		bytes[Pages] = sizeof(GeometryPage);
+		bytes[PageData] = 1;
+		bytes[Texcoords] = sizeof(TexCoord);
+		bytes[TexturePaths] = 1;
+	}
+
+	template <typename T>
+	Array<T> viewSection(const uint8_t* base, const SectionEntry& entry)
+	{
+		return Array<T>::view(reinterpret_cast<const T*>(base + entry.offset), static_cast<size_t>(entry.count));
+	}
+
+	uint64_t alignUp(uint64_t value, uint64_t alignment = SectionAlignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// FNV-1a, stable across runs and platforms of the same endianness.
+	class Hasher
+	{
+	public:
+		void add(const void* data, size_t bytes)
+		{
+			const uint8_t* p = static_cast<const uint8_t*>(data);
+			for (size_t i = 0; i < bytes; ++i)
+			{
+				state = (state ^ p[i]) * 0x100000001b3ull;
+			}
+		}
+
+		template <typename T>
+		void add(const T& value)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "Only raw values can be hashed");
+			add(&value, sizeof(T));
+		}
+
+		uint64_t value() const { return state; }
+
+	private:
+		uint64_t state = 0xcbf29ce484222325ull;
+	};
+
+	void addSettings(Hasher& hasher, const BvhBuildSettings& settings)
+	{
+		uint32_t version = SceneCache::Version;
+		hasher.add(version);
+		hasher.add(settings.binCount);
+		hasher.add(settings.maxLeafSize);
+		hasher.add(settings.traversalCost);
+		hasher.add(settings.intersectionCost);
+	}
+}
+
+std::unique_ptr<SceneCache> SceneCache::open(const std::string& path, uint64_t sourceKey)
+{
+	std::unique_ptr<SceneCache> cache(new SceneCache());
+	if (!cache->file.open(path) || cache->file.size() < sizeof(Header))
+	{
+		return nullptr;
+	}
+
+	Header header;
+	std::memcpy(&header, cache->file.data(), sizeof(Header));
+	if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version || header.endianMarker != EndianMarker
+		|| header.headerBytes != sizeof(Header) || header.sourceKey != sourceKey)
+	{
+		return nullptr;
+	}
+
+	// Bounds are checked per section; the contents are trusted so that opening touches no data pages.
+	const uint8_t* base = cache->file.data();
+	size_t bytes[SectionCount];
+	elementBytes(header.wideWidth, bytes);
+	if ((header.wideWidth != 0 && header.wideWidth != 4 && header.wideWidth != 8) || (header.pageWidth != 0 && header.pageWidth != 4 && header.pageWidth != 8))
+	{
+		return nullptr;
+	}
+	for (uint32_t i = 0; i < SectionCount; ++i)
+	{
+		const SectionEntry& section = header.sections[i];
+		if (section.elementBytes != bytes[i] || section.offset % SectionAlignment != 0 || section.offset > cache->file.size()
+			|| section.count > (cache->file.size() - section.offset) / section.elementBytes)
+		{
+			return nullptr;
+		}
+	}
+
+	Scene& scene = cache->sceneData;
+	scene.positions = viewSection<Vec3>(base, header.sections[Positions]);
+	scene.indices = viewSection<uint32_t>(base, header.sections[Indices]);
+	scene.materialIds = viewSection<uint32_t>(base, header.sections[MaterialIds]);
+	scene.materials = viewSection<Material>(base, header.sections[Materials]);
+	scene.texcoords = viewSection<TexCoord>(base, header.sections[Texcoords]);
+	scene.background = header.background;
+	scene.camera = header.camera;
+	if (scene.indices.size() != 3 * scene.materialIds.size() || (!scene.texcoords.empty() && scene.texcoords.size() != scene.indices.size())
+		|| header.sections[Nodes].count == 0)
+	{
+		return nullptr;
+	}
+	const char* paths = reinterpret_cast<const char*>(base + header.sections[TexturePaths].offset);
+	const char* pathsEnd = paths + header.sections[TexturePaths].count;
+	while (paths < pathsEnd)
+	{
+		const char* terminator = std::find(paths, pathsEnd, '\0');
+		scene.textures.emplace_back(paths, terminator);
+		paths = terminator + 1;
+	}
+	cache->tree = std::make_unique<Bvh>(scene, viewSection<BvhNode>(base, header.sections[Nodes]),
+		viewSection<uint32_t>(base, header.sections[Primitives]), header.bvhStats);
+	if (header.wideWidth != 0 && header.sections[WideNodes].count > 0)
+	{
+		cache->wideWidth = static_cast<uint32_t>(header.wideWidth);
+		cache->wideNodes = base + header.sections[WideNodes].offset;
+		cache->widePackets = base + header.sections[WidePackets].offset;
+		cache->wideNodeCount = static_cast<size_t>(header.sections[WideNodes].count);
+		cache->widePacketCount = static_cast<size_t>(header.sections[WidePackets].count);
+	}
+	if (header.pageWidth != 0 && header.sections[Pages].count > 0)
+	{
+		cache->pageWidth = static_cast<uint32_t>(header.pageWidth);
+		cache->pageData = static_cast<size_t>(header.sections[PageData].offset);
+		cache->pageTable = viewSection<GeometryPage>(base, header.sections[Pages]);
+	}
+	return cache;
+}
+
+std::unique_ptr<Accelerator> SceneCache::createAccelerator(AcceleratorKind kind) const
+{
+	kind = resolveAcceleratorKind(kind);
+	if (kind == AcceleratorKind::Wide8 && wideWidth == 8)
+	{
+		return std::make_unique<WideBvh<8>>(Array<WideBvhNode<8>>::view(reinterpret_cast<const WideBvhNode<8>*>(wideNodes), wideNodeCount),
+			Array<TrianglePacket<8>>::view(reinterpret_cast<const TrianglePacket<8>*>(widePackets), widePacketCount));
+	}
+	if (kind == AcceleratorKind::Wide4 && wideWidth == 4)
+	{
+		return std::make_unique<WideBvh<4>>(Array<WideBvhNode<4>>::view(reinterpret_cast<const WideBvhNode<4>*>(wideNodes), wideNodeCount),
+			Array<TrianglePacket<4>>::view(reinterpret_cast<const TrianglePacket<4>*>(widePackets), widePacketCount));
+	}
+	return ::createAccelerator(*tree, kind);
+}
+
+std::unique_ptr<PagedBvh> SceneCache::createPagedAccelerator(ThreadPool& pool, size_t budgetBytes) const
+{
+	if (pageTable.empty() || (pageWidth == 8 && !cpuSupportsAvx2()))
+	{
+		return nullptr;
+	}
+	size_t dataBytes = file.size() - pageData;
+	for (const GeometryPage& page : pageTable)
+	{
+		if (page.offset % GeometryPageAlignment != 0 || page.offset > dataBytes || page.size > dataBytes - page.offset)
+		{
+			return nullptr;
+		}
+	}
+	return std::make_unique<PagedBvh>(file, pageData, pageTable, pageWidth, pool, budgetBytes);
+}
+
+void SceneCache::write(const std::string& path, uint64_t sourceKey, const Scene& scene, const Bvh& bvh, const Accelerator* accelerator,
+	const PagedGeometry* pages)
+{
+	const void* wideNodes = nullptr;
+	const void* widePackets = nullptr;
+	size_t wideNodeCount = 0;
+	size_t widePacketCount = 0;
+	uint64_t wideWidth = 0;
+	if (auto wide8 = dynamic_cast<const WideBvh<8>*>(accelerator))
+	{
+		wideWidth = 8;
+		wideNodes = wide8->nodes().data();
+		widePackets = wide8->packets().data();
+		wideNodeCount = wide8->nodes().size();
+		widePacketCount = wide8->packets().size();
+	}
+	else if (auto wide4 = dynamic_cast<const WideBvh<4>*>(accelerator))
+	{
+		wideWidth = 4;
+		wideNodes = wide4->nodes().data();
+		widePackets = wide4->packets().data();
+		wideNodeCount = wide4->nodes().size();
+		widePacketCount = wide4->packets().size();
+	}
+
+	Header header = {};
+	std::memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.endianMarker = EndianMarker;
+	header.headerBytes = sizeof(Header);
+	header.sourceKey = sourceKey;
+	header.wideWidth = wideWidth;
+	header.pageWidth = pages ? pages->width : 0;
+	header.background = scene.background;
+	header.camera = scene.camera;
+	header.bvhStats = bvh.stats();
+
+	std::string texturePaths;
+	for (const std::string& texture : scene.textures)
+	{
+		texturePaths += texture;
+		texturePaths += '\0';
+	}
+
+	const void* data[SectionCount] = {scene.positions.data(), scene.indices.data(), scene.materialIds.data(), scene.materials.data(),
+		bvh.nodes().data(), bvh.primitiveIndices().data(), wideNodes, widePackets, pages ? pages->pages.data() : nullptr,
+		pages ? pages->data.data() : nullptr, scene.texcoords.data(), texturePaths.data()};
+	const size_t counts[SectionCount] = {scene.positions.size(), scene.indices.size(), scene.materialIds.size(), scene.materials.size(),
+		bvh.nodes().size(), bvh.primitiveIndices().size(), wideNodeCount, widePacketCount, pages ? pages->pages.size() : 0,
+		pages ? pages->data.size() : 0, scene.texcoords.size(), texturePaths.size()};
+	size_t bytes[SectionCount];
+	elementBytes(wideWidth, bytes);
+	uint64_t offset = alignUp(sizeof(Header));
+	for (uint32_t i = 0; i < SectionCount; ++i)
+	{
+		// Geometry pages are dropped from memory one at a time, so they start on a page boundary.
+		if (i == PageData)
+		{
+			offset = alignUp(offset, GeometryPageAlignment);
+		}
+		header.sections[i] = {offset, counts[i], bytes[i]};
+		offset = alignUp(offset + counts[i] * bytes[i]);
+	}
+
+	std::string temporary = path + ".tmp";
+	{
+		std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+		if (!out)
+		{
+			throw std::runtime_error("Cannot open " + temporary + " for writing");
+		}
+		const char padding[GeometryPageAlignment] = {};
+		uint64_t written = 0;
+		auto pad = [&](uint64_t target)
+		{
+			out.write(padding, static_cast<std::streamsize>(target - written));
+			written = target;
+		};
+		out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		written = sizeof(Header);
+		for (uint32_t i = 0; i < SectionCount; ++i)
+		{
+			pad(header.sections[i].offset);
+			uint64_t sectionBytes = counts[i] * bytes[i];
+			if (sectionBytes > 0)
+			{
+				out.write(static_cast<const char*>(data[i]), static_cast<std::streamsize>(sectionBytes));
+			}
+			written += sectionBytes;
+		}
+		pad(alignUp(written));
+		if (!out.flush())
+		{
+			throw std::runtime_error("Failed to write " + temporary);
+		}
+	}
+	std::error_code error;
+	std::filesystem::rename(temporary, path, error);
+	if (error)
+	{
+		std::remove(temporary.c_str());
+		throw std::runtime_error("Cannot move " + temporary + " to " + path + ": " + error.message());
+	}
+}
+
+uint64_t fileSourceKey(const std::string& path, const BvhBuildSettings& settings)
+{
+	Hasher hasher;
+	std::string absolute = std::filesystem::absolute(path).string();
+	hasher.add(absolute.data(), absolute.size());
+	std::error_code error;
+	uint64_t size = std::filesystem::file_size(path, error);
+	int64_t modified = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+	hasher.add(size);
+	hasher.add(modified);
+	addSettings(hasher, settings);
+	return hasher.value();
+}
+
+uint64_t sceneSourceKey(const Scene& scene, const BvhBuildSettings& settings)
+{
+	Hasher hasher;
+	hasher.add(scene.positions.data(), scene.positions.size() * sizeof(Vec3));
+	hasher.add(scene.indices.data(), scene.indices.size() * sizeof(uint32_t));
+	hasher.add(scene.materialIds.data(), scene.materialIds.size() * sizeof(uint32_t));
+	hasher.add(scene.materials.data(), scene.materials.size() * sizeof(Material));
+	hasher.add(scene.texcoords.data(), scene.texcoords.size() * sizeof(TexCoord));
+	for (const std::string& texture : scene.textures)
+	{
+		hasher.add(texture.data(), texture.size() + 1);
+	}
+	hasher.add(scene.background);
+	hasher.add(scene.camera);
+	addSettings(hasher, settings);
+	return hasher.value();
+}
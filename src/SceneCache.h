@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Accelerator.h"
+#include "Bvh.h"
+#include "MappedFile.h"
+#include "PagedBvh.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Versioned, pointer-free binary image of a scene, its prebuilt BVH and optionally the collapsed
+// wide BVH. Opening maps the file and points the scene and BVH arrays straight at it, so nothing is
+// parsed or copied and pages are only read when traversal first touches them. Every cache records a key of the asset and build
+// settings it was made from; a cache with a different key is treated as missing. Optionally the
+// cache also holds the geometry cut into pages for out-of-core traversal with PagedBvh.
+class SceneCache
+{
+public:
+	static constexpr uint32_t Version = 3;
+
+	// Returns null when the file is missing, truncated, from another format version or ABI, or
+	// was built from a different source key.
+	static std::unique_ptr<SceneCache> open(const std::string& path, uint64_t sourceKey);
+
+	// Writes through a temporary file and renames it, so concurrent readers never see a partial
+	// cache. A 4 or 8 wide accelerator and geometry pages are stored as well when given. Throws
+	// std::runtime_error on failure.
+	static void write(const std::string& path, uint64_t sourceKey, const Scene& scene, const Bvh& bvh, const Accelerator* accelerator = nullptr,
+		const PagedGeometry* pages = nullptr);
+
+	const Scene& scene() const { return sceneData; }
+	const Bvh& bvh() const { return *tree; }
+
+	// Views the stored wide BVH when it has the resolved layout, otherwise builds from bvh().
+	std::unique_ptr<Accelerator> createAccelerator(AcceleratorKind kind = AcceleratorKind::Auto) const;
+	// Out-of-core traversal of the stored pages with at most budgetBytes of them resident. Null when
+	// the cache has no pages, or 8 wide pages and the CPU lacks AVX2.
+	std::unique_ptr<PagedBvh> createPagedAccelerator(ThreadPool& pool, size_t budgetBytes) const;
+	bool hasPages() const { return !pageTable.empty(); }
+	size_t fileBytes() const { return file.size(); }
+
+private:
+	SceneCache() = default;
+
+	MappedFile file;
+	Scene sceneData;
+	std::unique_ptr<Bvh> tree;
+	uint32_t wideWidth = 0;
+	const uint8_t* wideNodes = nullptr;
+	const uint8_t* widePackets = nullptr;
+	size_t wideNodeCount = 0;
+	size_t widePacketCount = 0;
+	uint32_t pageWidth = 0;
+	size_t pageData = 0;
+	Array<GeometryPage> pageTable;
+};
+
+// Key of an asset on disk: its path, size and modification time, plus the BVH build settings.
+// Touching or replacing the asset changes the key and so invalidates its cache.
+uint64_t fileSourceKey(const std::string& path, const BvhBuildSettings& settings);
+
+// Key of a scene generated in memory, hashed from its contents and the BVH build settings.
+uint64_t sceneSourceKey(const Scene& scene, const BvhBuildSettings& settings);
@@ -0,0 +1,1354 @@
+#include "SceneLoader.h"
+
+#include "ImageIO.h"
+#include "MappedFile.h"
+#include "Timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+	// Text scanning over the mapped file, which is not NUL terminated.
+
+	bool isBlank(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	const char* skipBlanks(const char* p, const char* end)
+	{
+		while (p < end && isBlank(*p))
+		{
+			++p;
+		}
+		return p;
+	}
+
+	const char* skipToken(const char* p, const char* end)
+	{
+		while (p < end && !isBlank(*p) && *p != '\n')
+		{
+			++p;
+		}
+		return p;
+	}
+
+	const char* nextLine(const char* p, const char* end)
+	{
+		const void* newline = std::memchr(p, '\n', static_cast<size_t>(end - p));
+		return newline ? static_cast<const char*>(newline) + 1 : end;
+	}
+
+	bool atLineEnd(const char* p, const char* end)
+	{
+		return p >= end || *p == '\n' || *p == '#';
+	}
+
+	// True when the line at p starts with keyword followed by a blank.
+	bool hasKeyword(const char* p, const char* end, const char* keyword)
+	{
+		size_t length = std::strlen(keyword);
+		return static_cast<size_t>(end - p) > length && std::memcmp(p, keyword, length) == 0 && isBlank(p[length]);
+	}
+
+	// Rest of the line with surrounding blanks removed.
+	std::string restOfLine(const char* p, const char* end)
+	{
+		p = skipBlanks(p, end);
+		const char* last = p;
+		while (last < end && *last != '\n')
+		{
+			++last;
+		}
+		while (last > p && isBlank(last[-1]))
+		{
+			--last;
+		}
+		return std::string(p, last);
+	}
+
+	const double PowersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16,
+		1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+	// Decimal to float without locale or NUL termination. Takes Clinger's fast path, which is exact
+	// while the mantissa fits in 53 bits and the exponent is within +-22; anything else, including
+	// inf and nan, goes through strtod.
+	bool parseFloat(const char*& p, const char* end, float& value)
+	{
+		const char* start = p;
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			++p;
+		}
+
+		uint64_t mantissa = 0;
+		int digits = 0;
+		int exponent = 0;
+		bool anyDigits = false;
+		bool exact = true;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p)
+		{
+			anyDigits = true;
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+				digits += mantissa > 0;
+			}
+			else
+			{
+				exponent++;
+				exact = false;
+			}
+		}
+		if (p < end && *p == '.')
+		{
+			for (++p; p < end && *p >= '0' && *p <= '9'; ++p)
+			{
+				anyDigits = true;
+				if (digits < 19)
+				{
+					mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+					digits += mantissa > 0;
+					exponent--;
+				}
+				else
+				{
+					exact = false;
+				}
+			}
+		}
+		if (anyDigits && p < end && (*p == 'e' || *p == 'E'))
+		{
+			const char* e = p + 1;
+			bool negativeExponent = false;
+			if (e < end && (*e == '-' || *e == '+'))
+			{
+				negativeExponent = *e == '-';
+				++e;
+			}
+			if (e < end && *e >= '0' && *e <= '9')
+			{
+				int explicitExponent = 0;
+				for (; e < end && *e >= '0' && *e <= '9'; ++e)
+				{
+					explicitExponent = std::min(explicitExponent * 10 + (*e - '0'), 100000);
+				}
+				exponent += negativeExponent ? -explicitExponent : explicitExponent;
+				p = e;
+			}
+		}
+
+		if (anyDigits && exact && mantissa < (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+		{
+			double result = static_cast<double>(mantissa);
+			result = exponent < 0 ? result / PowersOfTen[-exponent] : result * PowersOfTen[exponent];
+			value = static_cast<float>(negative ? -result : result);
+			return true;
+		}
+
+		// Slow path on a NUL terminated copy of the token.
+		const char* tokenEnd = skipToken(start, end);
+		char buffer[128];
+		size_t length = std::min(static_cast<size_t>(tokenEnd - start), sizeof(buffer) - 1);
+		std::memcpy(buffer, start, length);
+		buffer[length] = '\0';
+		char* parsedEnd = nullptr;
+		double result = std::strtod(buffer, &parsedEnd);
+		if (parsedEnd == buffer)
+		{
+			p = start;
+			return false;
+		}
+		p = start + (parsedEnd - buffer);
+		value = static_cast<float>(result);
+		return true;
+	}
+
+	bool parseInt(const char*& p, const char* end, int64_t& value)
+	{
+		bool negative = false;
+		const char* start = p;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			++p;
+		}
+		int64_t result = 0;
+		const char* digitsBegin = p;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p)
+		{
+			result = result * 10 + (*p - '0');
+		}
+		if (p == digitsBegin)
+		{
+			p = start;
+			return false;
+		}
+		value = negative ? -result : result;
+		return true;
+	}
+
+	// Contiguous byte range of the file parsed by one task, with the element counts of the first
+	// pass and the output offsets derived from them.
+	struct Chunk
+	{
+		const char* begin = nullptr;
+		const char* end = nullptr;
+		uint64_t vertexCount = 0;
+		uint64_t triangleCount = 0;
+		uint64_t firstVertex = 0;
+		uint64_t firstTriangle = 0;
+		// OBJ only: vt lines and their output offset, usemtl names in order of appearance, and the
+		// material active at the chunk start.
+		uint64_t texcoordCount = 0;
+		uint64_t firstTexcoord = 0;
+		std::vector<std::string> materialNames;
+		std::vector<std::string> libraries;
+		uint32_t material = 0;
+		std::string error;
+	};
+
+	// Splits [begin, end) into chunks of about chunkBytes that end on line boundaries.
+	std::vector<Chunk> splitLines(const char* begin, const char* end, size_t chunkBytes)
+	{
+		std::vector<Chunk> chunks;
+		const char* p = begin;
+		while (p < end)
+		{
+			const char* target = p + std::min(chunkBytes, static_cast<size_t>(end - p));
+			const char* chunkEnd = target < end ? nextLine(target, end) : end;
+			Chunk chunk;
+			chunk.begin = p;
+			chunk.end = chunkEnd;
+			chunks.push_back(std::move(chunk));
+			p = chunkEnd;
+		}
+		return chunks;
+	}
+
+	// Assigns output offsets from the per-chunk counts and checks the 32 bit index limits.
+	void assignOffsets(std::vector<Chunk>& chunks, uint64_t& vertexCount, uint64_t& triangleCount)
+	{
+		for (Chunk& chunk : chunks)
+		{
+			chunk.firstVertex = vertexCount;
+			chunk.firstTriangle = triangleCount;
+			vertexCount += chunk.vertexCount;
+			triangleCount += chunk.triangleCount;
+		}
+		if (vertexCount >= InvalidIndex || triangleCount >= InvalidIndex / 3)
+		{
+			throw std::runtime_error("Scene exceeds the 32 bit vertex and index limits");
+		}
+	}
+
+	void throwChunkErrors(const std::vector<Chunk>& chunks, const std::string& path)
+	{
+		for (const Chunk& chunk : chunks)
+		{
+			if (!chunk.error.empty())
+			{
+				throw std::runtime_error(path + ": " + chunk.error);
+			}
+		}
+	}
+
+	class ChunkReleaser
+	{
+	public:
+		explicit ChunkReleaser(const MappedFile& file) : file(file) {}
+
+		void operator()(const Chunk& chunk) const
+		{
+			const char* base = reinterpret_cast<const char*>(file.data());
+			file.release(static_cast<size_t>(chunk.begin - base), static_cast<size_t>(chunk.end - chunk.begin));
+		}
+
+	private:
+		const MappedFile& file;
+	};
+
+	// Wavefront OBJ
+
+	void countObjChunk(Chunk& chunk)
+	{
+		const char* end = chunk.end;
+		for (const char* line = chunk.begin; line < end; line = nextLine(line, end))
+		{
+			const char* p = skipBlanks(line, end);
+			if (hasKeyword(p, end, "v"))
+			{
+				chunk.vertexCount++;
+			}
+			else if (hasKeyword(p, end, "vt"))
+			{
+				chunk.texcoordCount++;
+			}
+			else if (hasKeyword(p, end, "f"))
+			{
+				uint32_t corners = 0;
+				for (p = skipBlanks(p + 1, end); !atLineEnd(p, end); p = skipBlanks(skipToken(p, end), end))
+				{
+					corners++;
+				}
+				chunk.triangleCount += corners >= 3 ? corners - 2 : 0;
+			}
+			else if (hasKeyword(p, end, "usemtl"))
+			{
+				std::string name = restOfLine(p + 6, end);
+				if (chunk.materialNames.empty() || chunk.materialNames.back() != name)
+				{
+					chunk.materialNames.push_back(std::move(name));
+				}
+			}
+			else if (hasKeyword(p, end, "mtllib"))
+			{
+				chunk.libraries.push_back(restOfLine(p + 6, end));
+			}
+		}
+	}
+
+	// Texture coordinates of an OBJ file: the vt values, and per triangle corner the vt it references or
+	// InvalidIndex. Both are null when the file has no vt lines.
+	struct ObjTexcoords
+	{
+		TexCoord* values = nullptr;
+		uint32_t* corners = nullptr;
+		uint64_t count = 0;
+	};
+
+	void parseObjChunk(Chunk& chunk, const std::unordered_map<std::string, uint32_t>& materialIds, uint64_t totalVertices, const ObjTexcoords& texcoords,
+		Scene& scene)
+	{
+		Vec3* positions = scene.positions.data();
+		uint32_t* indices = scene.indices.data();
+		uint32_t* triangleMaterials = scene.materialIds.data();
+		uint64_t vertex = chunk.firstVertex;
+		uint64_t texcoord = chunk.firstTexcoord;
+		uint64_t triangle = chunk.firstTriangle;
+		uint32_t material = chunk.material;
+		const char* end = chunk.end;
+		for (const char* line = chunk.begin; line < end; line = nextLine(line, end))
+		{
+			const char* p = skipBlanks(line, end);
+			if (hasKeyword(p, end, "v"))
+			{
+				Vec3 position;
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					p = skipBlanks(p + (axis == 0), end);
+					if (!parseFloat(p, end, position[axis]))
+					{
+						chunk.error = "malformed vertex";
+						return;
+					}
+				}
+				positions[vertex++] = position;
+			}
+			else if (hasKeyword(p, end, "vt"))
+			{
+				// OBJ puts v = 0 at the bottom of the image, the renderer at the top; w is ignored.
+				TexCoord value;
+				p = skipBlanks(p + 2, end);
+				if (!parseFloat(p, end, value.u))
+				{
+					chunk.error = "malformed texture coordinate";
+					return;
+				}
+				p = skipBlanks(p, end);
+				float v = 0.0f;
+				if (!atLineEnd(p, end) && !parseFloat(p, end, v))
+				{
+					chunk.error = "malformed texture coordinate";
+					return;
+				}
+				value.v = 1.0f - v;
+				texcoords.values[texcoord++] = value;
+			}
+			else if (hasKeyword(p, end, "f"))
+			{
+				uint32_t first = 0;
+				uint32_t previous = 0;
+				uint32_t firstTexcoord = InvalidIndex;
+				uint32_t previousTexcoord = InvalidIndex;
+				uint32_t corner = 0;
+				for (p = skipBlanks(p + 1, end); !atLineEnd(p, end); p = skipBlanks(skipToken(p, end), end))
+				{
+					// The position and, when the file has any vt, texture coordinate indices of v, v/vt, v//vn
+					// and v/vt/vn are used.
+					int64_t index = 0;
+					if (!parseInt(p, end, index) || index == 0)
+					{
+						chunk.error = "malformed face";
+						return;
+					}
+					int64_t resolved = index > 0 ? index - 1 : static_cast<int64_t>(vertex) + index;
+					if (resolved < 0 || static_cast<uint64_t>(resolved) >= totalVertices)
+					{
+						chunk.error = "face references a missing vertex";
+						return;
+					}
+					uint32_t current = static_cast<uint32_t>(resolved);
+					uint32_t currentTexcoord = InvalidIndex;
+					if (texcoords.corners && p + 1 < end && *p == '/' && p[1] != '/' && !isBlank(p[1]))
+					{
+						++p;
+						int64_t texcoordIndex = 0;
+						if (!parseInt(p, end, texcoordIndex) || texcoordIndex == 0)
+						{
+							chunk.error = "malformed face";
+							return;
+						}
+						int64_t resolvedTexcoord = texcoordIndex > 0 ? texcoordIndex - 1 : static_cast<int64_t>(texcoord) + texcoordIndex;
+						if (resolvedTexcoord < 0 || static_cast<uint64_t>(resolvedTexcoord) >= texcoords.count)
+						{
+							chunk.error = "face references a missing texture coordinate";
+							return;
+						}
+						currentTexcoord = static_cast<uint32_t>(resolvedTexcoord);
+					}
+					if (corner == 0)
+					{
+						first = current;
+						firstTexcoord = currentTexcoord;
+					}
+					else if (corner >= 2)
+					{
+						indices[3 * triangle + 0] = first;
+						indices[3 * triangle + 1] = previous;
+						indices[3 * triangle + 2] = current;
+						triangleMaterials[triangle] = material;
+						if (texcoords.corners)
+						{
+							texcoords.corners[3 * triangle + 0] = firstTexcoord;
+							texcoords.corners[3 * triangle + 1] = previousTexcoord;
+							texcoords.corners[3 * triangle + 2] = currentTexcoord;
+						}
+						triangle++;
+					}
+					previous = current;
+					previousTexcoord = currentTexcoord;
+					corner++;
+				}
+			}
+			else if (hasKeyword(p, end, "usemtl"))
+			{
+				material = materialIds.at(restOfLine(p + 6, end));
+			}
+		}
+	}
+
+	// Reads the subset of MTL that maps onto the renderer's materials: Kd, map_Kd and Ke everywhere, Ks
+	// for mirrors (illum 3) and Ni plus Tf for glass (illum 4, 6, 7 or dissolve below 1). Texture paths,
+	// relative to the library, are added to textures.
+	void loadMaterialLibrary(const std::filesystem::path& path, std::unordered_map<std::string, Material>& library, std::vector<std::string>& textures)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			return;
+		}
+		struct Pending
+		{
+			Material material;
+			Vec3 specular = Vec3(0.0f);
+			Vec3 transmission = Vec3(1.0f);
+			int illum = 2;
+			float dissolve = 1.0f;
+			std::string diffuseMap;
+		};
+		std::string name;
+		Pending current;
+		auto commit = [&]()
+		{
+			if (name.empty())
+			{
+				return;
+			}
+			Material material = current.material;
+			if (current.illum == 4 || current.illum == 6 || current.illum == 7 || current.dissolve < 1.0f)
+			{
+				material.type = MaterialType::Glass;
+				material.albedo = current.transmission;
+			}
+			else if (current.illum == 3)
+			{
+				material.type = MaterialType::Mirror;
+				material.albedo = isBlack(current.specular) ? material.albedo : current.specular;
+			}
+			if (!current.diffuseMap.empty())
+			{
+				auto known = std::find(textures.begin(), textures.end(), current.diffuseMap);
+				material.texture = static_cast<uint32_t>(known - textures.begin());
+				if (known == textures.end())
+				{
+					textures.push_back(current.diffuseMap);
+				}
+			}
+			library[name] = material;
+		};
+
+		std::string line;
+		while (std::getline(file, line))
+		{
+			std::istringstream in(line);
+			std::string keyword;
+			in >> keyword;
+			Vec3 color;
+			if (keyword == "newmtl")
+			{
+				commit();
+				name = restOfLine(line.data() + line.find("newmtl") + 6, line.data() + line.size());
+				current = Pending();
+			}
+			else if (keyword == "Kd" && in >> color.x >> color.y >> color.z)
+			{
+				current.material.albedo = color;
+			}
+			else if (keyword == "Ke" && in >> color.x >> color.y >> color.z)
+			{
+				current.material.emission = color;
+			}
+			else if (keyword == "Ks" && in >> color.x >> color.y >> color.z)
+			{
+				current.specular = color;
+			}
+			else if (keyword == "Tf" && in >> color.x >> color.y >> color.z)
+			{
+				current.transmission = color;
+			}
+			else if (keyword == "map_Kd")
+			{
+				// Options such as -s or -o precede the file name, which is taken to be the last token.
+				std::string token;
+				std::string file;
+				while (in >> token)
+				{
+					file = token;
+				}
+				current.diffuseMap = file.empty() ? std::string() : (path.parent_path() / file).string();
+			}
+			else if (keyword == "Ni")
+			{
+				in >> current.material.ior;
+			}
+			else if (keyword == "illum")
+			{
+				in >> current.illum;
+			}
+			else if (keyword == "d")
+			{
+				in >> current.dissolve;
+			}
+			else if (keyword == "Tr")
+			{
+				float transparency = 0.0f;
+				in >> transparency;
+				current.dissolve = 1.0f - transparency;
+			}
+		}
+		commit();
+	}
+
+	void loadObj(const MappedFile& file, const std::string& path, ThreadPool& pool, const SceneLoadSettings& settings, Scene& scene, SceneLoadStats& stats)
+	{
+		const char* begin = reinterpret_cast<const char*>(file.data());
+		std::vector<Chunk> chunks = splitLines(begin, begin + file.size(), settings.chunkBytes);
+		ChunkReleaser release(file);
+		pool.parallelFor(static_cast<uint32_t>(chunks.size()), [&](uint32_t i, uint32_t)
+		{
+			countObjChunk(chunks[i]);
+			release(chunks[i]);
+		});
+
+		uint64_t vertexCount = 0;
+		uint64_t triangleCount = 0;
+		assignOffsets(chunks, vertexCount, triangleCount);
+
+		// Material 0 covers faces before the first usemtl; named materials follow in order of first use.
+		std::unordered_map<std::string, Material> library;
+		for (const Chunk& chunk : chunks)
+		{
+			for (const std::string& name : chunk.libraries)
+			{
+				loadMaterialLibrary(std::filesystem::path(path).parent_path() / name, library, scene.textures);
+			}
+		}
+		std::unordered_map<std::string, uint32_t> materialIds;
+		scene.materials.push_back(Material());
+		uint32_t current = 0;
+		for (Chunk& chunk : chunks)
+		{
+			chunk.material = current;
+			for (const std::string& name : chunk.materialNames)
+			{
+				auto found = materialIds.find(name);
+				if (found == materialIds.end())
+				{
+					auto known = library.find(name);
+					found = materialIds.emplace(name, static_cast<uint32_t>(scene.materials.size())).first;
+					scene.materials.push_back(known != library.end() ? known->second : Material());
+				}
+				current = found->second;
+			}
+		}
+
+		ObjTexcoords texcoords;
+		for (Chunk& chunk : chunks)
+		{
+			chunk.firstTexcoord = texcoords.count;
+			texcoords.count += chunk.texcoordCount;
+		}
+		std::vector<TexCoord> texcoordValues(texcoords.count);
+		std::vector<uint32_t> cornerTexcoords(texcoords.count > 0 ? 3 * triangleCount : 0);
+		texcoords.values = texcoordValues.data();
+		texcoords.corners = texcoords.count > 0 ? cornerTexcoords.data() : nullptr;
+
+		scene.positions.resize(vertexCount);
+		scene.indices.resize(3 * triangleCount);
+		scene.materialIds.resize(triangleCount);
+		pool.parallelFor(static_cast<uint32_t>(chunks.size()), [&](uint32_t i, uint32_t)
+		{
+			parseObjChunk(chunks[i], materialIds, vertexCount, texcoords, scene);
+			release(chunks[i]);
+		});
+		throwChunkErrors(chunks, path);
+
+		// Corners without a vt get (0, 0), as do all corners of a file without any.
+		if (texcoords.count > 0)
+		{
+			scene.texcoords.resize(3 * triangleCount);
+			TexCoord* resolved = scene.texcoords.data();
+			pool.parallelFor(static_cast<uint32_t>(cornerTexcoords.size()), [&](uint32_t i, uint32_t)
+			{
+				uint32_t index = cornerTexcoords[i];
+				resolved[i] = index != InvalidIndex ? texcoordValues[index] : TexCoord();
+			}, 4096);
+		}
+		stats.chunkCount = static_cast<uint32_t>(chunks.size());
+	}
+
+	// PLY
+
+	enum class PlyType
+	{
+		Int8,
+		UInt8,
+		Int16,
+		UInt16,
+		Int32,
+		UInt32,
+		Float32,
+		Float64,
+	};
+
+	enum class PlyFormat
+	{
+		Ascii,
+		BinaryLittleEndian,
+		BinaryBigEndian,
+	};
+
+	struct PlyProperty
+	{
+		std::string name;
+		PlyType type = PlyType::Float32;
+		bool list = false;
+		PlyType countType = PlyType::UInt8;
+	};
+
+	struct PlyElement
+	{
+		std::string name;
+		uint64_t count = 0;
+		std::vector<PlyProperty> properties;
+	};
+
+	struct PlyHeader
+	{
+		PlyFormat format = PlyFormat::Ascii;
+		std::vector<PlyElement> elements;
+		size_t dataOffset = 0;
+	};
+
+	PlyType parsePlyType(const std::string& name)
+	{
+		static const std::pair<const char*, PlyType> names[] = {{"char", PlyType::Int8}, {"int8", PlyType::Int8}, {"uchar", PlyType::UInt8},
+			{"uint8", PlyType::UInt8}, {"short", PlyType::Int16}, {"int16", PlyType::Int16}, {"ushort", PlyType::UInt16},
+			{"uint16", PlyType::UInt16}, {"int", PlyType::Int32}, {"int32", PlyType::Int32}, {"uint", PlyType::UInt32},
+			{"uint32", PlyType::UInt32}, {"float", PlyType::Float32}, {"float32", PlyType::Float32}, {"double", PlyType::Float64},
+			{"float64", PlyType::Float64}};
+		for (const auto& entry : names)
+		{
+			if (name == entry.first)
+			{
+				return entry.second;
+			}
+		}
+		throw std::runtime_error("Unknown PLY property type " + name);
+	}
+
+	size_t plyTypeSize(PlyType type)
+	{
+		static const size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+		return sizes[static_cast<int>(type)];
+	}
+
+	PlyHeader parsePlyHeader(const MappedFile& file)
+	{
+		const char* begin = reinterpret_cast<const char*>(file.data());
+		const char* end = begin + file.size();
+		PlyHeader header;
+		const char* line = begin;
+		bool first = true;
+		while (line < end)
+		{
+			const char* next = nextLine(line, end);
+			std::istringstream in(std::string(line, next));
+			line = next;
+			std::string keyword;
+			in >> keyword;
+			if (first)
+			{
+				if (keyword != "ply")
+				{
+					throw std::runtime_error("Missing PLY magic");
+				}
+				first = false;
+			}
+			else if (keyword == "format")
+			{
+				std::string format;
+				in >> format;
+				header.format = format == "ascii" ? PlyFormat::Ascii : format == "binary_little_endian" ? PlyFormat::BinaryLittleEndian
+					: format == "binary_big_endian" ? PlyFormat::BinaryBigEndian : throw std::runtime_error("Unknown PLY format " + format);
+			}
+			else if (keyword == "element")
+			{
+				PlyElement element;
+				in >> element.name >> element.count;
+				header.elements.push_back(element);
+			}
+			else if (keyword == "property")
+			{
+				if (header.elements.empty())
+				{
+					throw std::runtime_error("PLY property outside of an element");
+				}
+				PlyProperty property;
+				std::string type;
+				in >> type;
+				if (type == "list")
+				{
+					std::string countType;
+					in >> countType >> type;
+					property.list = true;
+					property.countType = parsePlyType(countType);
+				}
+				property.type = parsePlyType(type);
+				in >> property.name;
+				header.elements.back().properties.push_back(property);
+			}
+			else if (keyword == "end_header")
+			{
+				header.dataOffset = static_cast<size_t>(line - begin);
+				return header;
+			}
+		}
+		throw std::runtime_error("Truncated PLY header");
+	}
+
+	double readBinary(const uint8_t* p, PlyType type, bool swap)
+	{
+		uint8_t bytes[8];
+		size_t size = plyTypeSize(type);
+		for (size_t i = 0; i < size; ++i)
+		{
+			bytes[i] = swap ? p[size - 1 - i] : p[i];
+		}
+		switch (type)
+		{
+		case PlyType::Int8: { int8_t v; std::memcpy(&v, bytes, 1); return v; }
+		case PlyType::UInt8: return bytes[0];
+		case PlyType::Int16: { int16_t v; std::memcpy(&v, bytes, 2); return v; }
+		case PlyType::UInt16: { uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+		case PlyType::Int32: { int32_t v; std::memcpy(&v, bytes, 4); return v; }
+		case PlyType::UInt32: { uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+		case PlyType::Float32: { float v; std::memcpy(&v, bytes, 4); return v; }
+		default: { double v; std::memcpy(&v, bytes, 8); return v; }
+		}
+	}
+
+	bool hostIsLittleEndian()
+	{
+		const uint16_t probe = 1;
+		uint8_t first;
+		std::memcpy(&first, &probe, 1);
+		return first == 1;
+	}
+
+	int findProperty(const PlyElement& element, std::initializer_list<const char*> names)
+	{
+		for (size_t i = 0; i < element.properties.size(); ++i)
+		{
+			for (const char* name : names)
+			{
+				if (element.properties[i].name == name)
+				{
+					return static_cast<int>(i);
+				}
+			}
+		}
+		return -1;
+	}
+
+	// Byte size of one binary record, 0 if it contains lists.
+	size_t fixedRecordSize(const PlyElement& element)
+	{
+		size_t size = 0;
+		for (const PlyProperty& property : element.properties)
+		{
+			if (property.list)
+			{
+				return 0;
+			}
+			size += plyTypeSize(property.type);
+		}
+		return size;
+	}
+
+	// Walks one binary record, calling onList(property, count, items) for list properties.
+	template <typename OnList>
+	const uint8_t* walkBinaryRecord(const uint8_t* p, const PlyElement& element, bool swap, OnList&& onList)
+	{
+		for (size_t i = 0; i < element.properties.size(); ++i)
+		{
+			const PlyProperty& property = element.properties[i];
+			if (!property.list)
+			{
+				p += plyTypeSize(property.type);
+				continue;
+			}
+			uint64_t count = static_cast<uint64_t>(readBinary(p, property.countType, swap));
+			p += plyTypeSize(property.countType);
+			onList(i, count, p);
+			p += count * plyTypeSize(property.type);
+		}
+		return p;
+	}
+
+	// Walks one ASCII record, calling onScalar(property, text) and onList(property, count, text)
+	// where text points at the value or the first list item.
+	template <typename OnScalar, typename OnList>
+	bool walkAsciiRecord(const char*& p, const char* end, const PlyElement& element, OnScalar&& onScalar, OnList&& onList)
+	{
+		for (size_t i = 0; i < element.properties.size(); ++i)
+		{
+			const PlyProperty& property = element.properties[i];
+			p = skipBlanks(p, end);
+			if (atLineEnd(p, end))
+			{
+				return false;
+			}
+			if (!property.list)
+			{
+				if (!onScalar(i, p))
+				{
+					return false;
+				}
+				p = skipToken(p, end);
+				continue;
+			}
+			int64_t count = 0;
+			if (!parseInt(p, end, count) || count < 0)
+			{
+				return false;
+			}
+			if (!onList(i, static_cast<uint64_t>(count), p))
+			{
+				return false;
+			}
+			for (int64_t item = 0; item < count; ++item)
+			{
+				p = skipToken(skipBlanks(p, end), end);
+			}
+		}
+		return true;
+	}
+
+	// Binary face records have no line breaks to split at, so one sequential pass over the list
+	// counts cuts them into chunks of a fixed number of records.
+	std::vector<Chunk> splitBinaryFaces(const uint8_t* begin, const PlyElement& faces, int indexProperty, bool swap, size_t chunkBytes,
+		const uint8_t*& end)
+	{
+		std::vector<Chunk> chunks;
+		const uint8_t* p = begin;
+		for (uint64_t face = 0; face < faces.count;)
+		{
+			Chunk chunk;
+			chunk.begin = reinterpret_cast<const char*>(p);
+			const uint8_t* target = p + chunkBytes;
+			for (; face < faces.count && p < target; ++face)
+			{
+				p = walkBinaryRecord(p, faces, swap, [&](size_t property, uint64_t count, const uint8_t*)
+				{
+					if (static_cast<int>(property) == indexProperty && count >= 3)
+					{
+						chunk.triangleCount += count - 2;
+					}
+				});
+				chunk.vertexCount++;
+			}
+			chunk.end = reinterpret_cast<const char*>(p);
+			chunks.push_back(std::move(chunk));
+		}
+		end = p;
+		return chunks;
+	}
+
+	void loadPly(const MappedFile& file, const std::string& path, ThreadPool& pool, const SceneLoadSettings& settings, Scene& scene, SceneLoadStats& stats)
+	{
+		PlyHeader header = parsePlyHeader(file);
+		bool binary = header.format != PlyFormat::Ascii;
+		bool swap = binary && (header.format == PlyFormat::BinaryLittleEndian) != hostIsLittleEndian();
+		ChunkReleaser release(file);
+		const char* fileEnd = reinterpret_cast<const char*>(file.data()) + file.size();
+		const char* cursor = reinterpret_cast<const char*>(file.data()) + header.dataOffset;
+
+		const PlyElement* vertices = nullptr;
+		const PlyElement* faces = nullptr;
+		const char* vertexData = nullptr;
+		std::vector<Chunk> vertexChunks;
+		std::vector<Chunk> faceChunks;
+		int indexProperty = -1;
+		int axes[3] = {-1, -1, -1};
+
+		for (const PlyElement& element : header.elements)
+		{
+			if (element.name == "vertex")
+			{
+				vertices = &element;
+				axes[0] = findProperty(element, {"x"});
+				axes[1] = findProperty(element, {"y"});
+				axes[2] = findProperty(element, {"z"});
+				if (axes[0] < 0 || axes[1] < 0 || axes[2] < 0)
+				{
+					throw std::runtime_error(path + ": PLY vertices need x, y and z");
+				}
+			}
+			else if (element.name == "face")
+			{
+				faces = &element;
+				indexProperty = findProperty(element, {"vertex_indices", "vertex_index"});
+				if (indexProperty < 0 || !element.properties[indexProperty].list)
+				{
+					throw std::runtime_error(path + ": PLY faces need a vertex_indices list");
+				}
+			}
+
+			if (binary)
+			{
+				size_t recordSize = fixedRecordSize(element);
+				if (&element == faces)
+				{
+					const uint8_t* facesEnd = nullptr;
+					faceChunks = splitBinaryFaces(reinterpret_cast<const uint8_t*>(cursor), element, indexProperty, swap, settings.chunkBytes, facesEnd);
+					cursor = reinterpret_cast<const char*>(facesEnd);
+				}
+				else if (recordSize == 0)
+				{
+					const uint8_t* p = reinterpret_cast<const uint8_t*>(cursor);
+					for (uint64_t i = 0; i < element.count; ++i)
+					{
+						p = walkBinaryRecord(p, element, swap, [](size_t, uint64_t, const uint8_t*) {});
+					}
+					cursor = reinterpret_cast<const char*>(p);
+				}
+				else
+				{
+					if (&element == vertices)
+					{
+						vertexData = cursor;
+					}
+					cursor += recordSize * element.count;
+				}
+			}
+			else
+			{
+				// ASCII records are one per line; the section ends after count lines.
+				const char* sectionBegin = cursor;
+				for (uint64_t i = 0; i < element.count && cursor < fileEnd; ++i)
+				{
+					cursor = nextLine(cursor, fileEnd);
+				}
+				if (&element == vertices || &element == faces)
+				{
+					(&element == vertices ? vertexChunks : faceChunks) = splitLines(sectionBegin, cursor, settings.chunkBytes);
+				}
+			}
+			if (cursor > fileEnd)
+			{
+				throw std::runtime_error(path + ": truncated PLY data");
+			}
+		}
+		if (!vertices || !faces)
+		{
+			throw std::runtime_error(path + ": PLY file without vertex and face elements");
+		}
+
+		const PlyElement& vertexElement = *vertices;
+		const PlyElement& faceElement = *faces;
+		const PlyProperty& indexList = faceElement.properties[indexProperty];
+		uint64_t vertexCount = vertexElement.count;
+		uint64_t triangleCount = 0;
+		if (!binary)
+		{
+			pool.parallelFor(static_cast<uint32_t>(vertexChunks.size()), [&](uint32_t i, uint32_t)
+			{
+				Chunk& chunk = vertexChunks[i];
+				for (const char* line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end))
+				{
+					chunk.vertexCount++;
+				}
+			});
+			pool.parallelFor(static_cast<uint32_t>(faceChunks.size()), [&](uint32_t i, uint32_t)
+			{
+				Chunk& chunk = faceChunks[i];
+				for (const char* line = chunk.begin; line < chunk.end; line = nextLine(line, chunk.end))
+				{
+					const char* p = line;
+					bool valid = walkAsciiRecord(p, chunk.end, faceElement, [](size_t, const char*) { return true; },
+						[&](size_t property, uint64_t count, const char*)
+					{
+						if (static_cast<int>(property) == indexProperty && count >= 3)
+						{
+							chunk.triangleCount += count - 2;
+						}
+						return true;
+					});
+					if (!valid)
+					{
+						chunk.error = "malformed PLY face";
+						break;
+					}
+				}
+				release(chunk);
+			});
+			throwChunkErrors(faceChunks, path);
+			uint64_t unusedTriangles = 0;
+			vertexCount = 0;
+			assignOffsets(vertexChunks, vertexCount, unusedTriangles);
+		}
+		uint64_t faceVertexCount = 0;
+		assignOffsets(faceChunks, faceVertexCount, triangleCount);
+		if (vertexCount != vertexElement.count)
+		{
+			throw std::runtime_error(path + ": truncated PLY vertex data");
+		}
+
+		scene.materials.push_back(Material());
+		scene.positions.resize(vertexCount);
+		scene.indices.resize(3 * triangleCount);
+		scene.materialIds.resize(triangleCount);
+		Vec3* positions = scene.positions.data();
+		uint32_t* indices = scene.indices.data();
+
+		if (binary)
+		{
+			size_t stride = fixedRecordSize(vertexElement);
+			if (stride == 0)
+			{
+				throw std::runtime_error(path + ": PLY vertices with list properties are not supported");
+			}
+			size_t offsets[3];
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				offsets[axis] = 0;
+				for (int i = 0; i < axes[axis]; ++i)
+				{
+					offsets[axis] += plyTypeSize(vertexElement.properties[i].type);
+				}
+			}
+			uint32_t grain = static_cast<uint32_t>(std::max<size_t>(1, settings.chunkBytes / stride));
+			const uint8_t* base = reinterpret_cast<const uint8_t*>(vertexData);
+			uint32_t blocks = static_cast<uint32_t>((vertexCount + grain - 1) / grain);
+			pool.parallelFor(blocks, [&](uint32_t block, uint32_t)
+			{
+				uint64_t first = static_cast<uint64_t>(block) * grain;
+				uint64_t last = std::min<uint64_t>(vertexCount, first + grain);
+				for (uint64_t v = first; v < last; ++v)
+				{
+					const uint8_t* record = base + v * stride;
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						positions[v][axis] = static_cast<float>(readBinary(record + offsets[axis], vertexElement.properties[axes[axis]].type, swap));
+					}
+				}
+				file.release(static_cast<size_t>(base + first * stride - file.data()), static_cast<size_t>((last - first) * stride));
+			});
+
+			size_t itemSize = plyTypeSize(indexList.type);
+			pool.parallelFor(static_cast<uint32_t>(faceChunks.size()), [&](uint32_t i, uint32_t)
+			{
+				Chunk& chunk = faceChunks[i];
+				uint64_t triangle = chunk.firstTriangle;
+				const uint8_t* p = reinterpret_cast<const uint8_t*>(chunk.begin);
+				for (uint64_t face = 0; face < chunk.vertexCount && chunk.error.empty(); ++face)
+				{
+					p = walkBinaryRecord(p, faceElement, swap, [&](size_t property, uint64_t count, const uint8_t* items)
+					{
+						if (static_cast<int>(property) != indexProperty)
+						{
+							return;
+						}
+						uint32_t corners[3];
+						for (uint64_t corner = 0; corner < count; ++corner)
+						{
+							double index = readBinary(items + corner * itemSize, indexList.type, swap);
+							if (index < 0.0 || index >= static_cast<double>(vertexCount))
+							{
+								chunk.error = "face references a missing vertex";
+								return;
+							}
+							uint32_t current = static_cast<uint32_t>(index);
+							if (corner < 2)
+							{
+								corners[corner] = current;
+								continue;
+							}
+							indices[3 * triangle + 0] = corners[0];
+							indices[3 * triangle + 1] = corners[1];
+							indices[3 * triangle + 2] = current;
+							corners[1] = current;
+							triangle++;
+						}
+					});
+				}
+				release(chunk);
+			});
+		}
+		else
+		{
+			pool.parallelFor(static_cast<uint32_t>(vertexChunks.size()), [&](uint32_t i, uint32_t)
+			{
+				Chunk& chunk = vertexChunks[i];
+				uint64_t vertex = chunk.firstVertex;
+				for (const char* line = chunk.begin; line < chunk.end && chunk.error.empty(); line = nextLine(line, chunk.end))
+				{
+					const char* p = line;
+					Vec3& position = positions[vertex++];
+					bool valid = walkAsciiRecord(p, chunk.end, vertexElement, [&](size_t property, const char* text)
+					{
+						for (int axis = 0; axis < 3; ++axis)
+						{
+							if (static_cast<int>(property) == axes[axis])
+							{
+								return parseFloat(text, chunk.end, position[axis]);
+							}
+						}
+						return true;
+					}, [](size_t, uint64_t, const char*) { return true; });
+					if (!valid)
+					{
+						chunk.error = "malformed PLY vertex";
+					}
+				}
+				release(chunk);
+			});
+			pool.parallelFor(static_cast<uint32_t>(faceChunks.size()), [&](uint32_t i, uint32_t)
+			{
+				Chunk& chunk = faceChunks[i];
+				uint64_t triangle = chunk.firstTriangle;
+				for (const char* line = chunk.begin; line < chunk.end && chunk.error.empty(); line = nextLine(line, chunk.end))
+				{
+					const char* p = line;
+					walkAsciiRecord(p, chunk.end, faceElement, [](size_t, const char*) { return true; },
+						[&](size_t property, uint64_t count, const char* items)
+					{
+						if (static_cast<int>(property) != indexProperty)
+						{
+							return true;
+						}
+						uint32_t corners[3];
+						for (uint64_t corner = 0; corner < count; ++corner)
+						{
+							items = skipBlanks(items, chunk.end);
+							int64_t index = 0;
+							if (!parseInt(items, chunk.end, index) || index < 0 || static_cast<uint64_t>(index) >= vertexCount)
+							{
+								chunk.error = "face references a missing vertex";
+								return false;
+							}
+							uint32_t current = static_cast<uint32_t>(index);
+							if (corner < 2)
+							{
+								corners[corner] = current;
+								continue;
+							}
+							indices[3 * triangle + 0] = corners[0];
+							indices[3 * triangle + 1] = corners[1];
+							indices[3 * triangle + 2] = current;
+							corners[1] = current;
+							triangle++;
+						}
+						return true;
+					});
+				}
+				release(chunk);
+			});
+			throwChunkErrors(vertexChunks, path);
+		}
+		throwChunkErrors(faceChunks, path);
+		stats.chunkCount = static_cast<uint32_t>(vertexChunks.size() + faceChunks.size());
+	}
+
+	// Merges bit-identical positions through an open addressing table, keeping the first occurrence
+	// of each so the result is deterministic. The table and the remap list are freed before returning.
+	void weldVertices(Scene& scene, ThreadPool& pool)
+	{
+		size_t count = scene.positions.size();
+		if (count == 0)
+		{
+			return;
+		}
+		size_t capacity = 1;
+		while (capacity < 2 * count)
+		{
+			capacity <<= 1;
+		}
+		std::vector<uint32_t> remap(count);
+		Vec3* positions = scene.positions.data();
+		uint32_t unique = 0;
+		{
+			std::vector<uint32_t> table(capacity, InvalidIndex);
+			size_t mask = capacity - 1;
+			for (size_t i = 0; i < count; ++i)
+			{
+				uint32_t bits[3];
+				std::memcpy(bits, &positions[i], sizeof(bits));
+				uint64_t hash = (bits[0] * 0x9e3779b97f4a7c15ull) ^ (bits[1] * 0xc2b2ae3d27d4eb4full) ^ (bits[2] * 0x165667b19e3779f9ull);
+				size_t slot = static_cast<size_t>(hash ^ (hash >> 29)) & mask;
+				while (true)
+				{
+					uint32_t entry = table[slot];
+					if (entry == InvalidIndex)
+					{
+						table[slot] = unique;
+						positions[unique] = positions[i];
+						remap[i] = unique++;
+						break;
+					}
+					if (std::memcmp(&positions[entry], &positions[i], sizeof(Vec3)) == 0)
+					{
+						remap[i] = entry;
+						break;
+					}
+					slot = (slot + 1) & mask;
+				}
+			}
+		}
+
+		uint32_t* indices = scene.indices.data();
+		pool.parallelFor(static_cast<uint32_t>(scene.indices.size()), [&](uint32_t i, uint32_t)
+		{
+			indices[i] = remap[indices[i]];
+		}, 1 << 16);
+		if (unique < count)
+		{
+			scene.positions.resize(unique);
+			scene.positions.shrink_to_fit();
+		}
+	}
+
+	void frameCamera(Scene& scene)
+	{
+		Aabb bounds;
+		for (const Vec3& position : scene.positions)
+		{
+			bounds.extend(position);
+		}
+		if (bounds.empty())
+		{
+			return;
+		}
+		Vec3 center = bounds.centroid();
+		float radius = std::max(0.5f * length(bounds.diagonal()), 1e-6f);
+		const float fov = 40.0f;
+		float distance = radius / std::sin(0.5f * fov * Pi / 180.0f);
+		scene.camera.lookAt(center + Vec3(0.0f, 0.0f, distance), center, Vec3(0.0f, 1.0f, 0.0f), fov);
+	}
+}
+
+bool isSceneFile(const std::string& path)
+{
+	return hasExtension(path, ".obj") || hasExtension(path, ".ply");
+}
+
+Scene loadSceneFile(const std::string& path, ThreadPool& pool, const SceneLoadSettings& settings, SceneLoadStats* stats)
+{
+	Timer timer;
+	MappedFile file;
+	if (!file.open(path))
+	{
+		throw std::runtime_error("Cannot open scene " + path);
+	}
+
+	Scene scene;
+	SceneLoadStats loadStats;
+	loadStats.fileBytes = file.size();
+	if (hasExtension(path, ".obj"))
+	{
+		loadObj(file, path, pool, settings, scene, loadStats);
+	}
+	else if (hasExtension(path, ".ply"))
+	{
+		loadPly(file, path, pool, settings, scene, loadStats);
+	}
+	else
+	{
+		throw std::runtime_error("Unsupported scene format: " + path + " (expected .obj or .ply)");
+	}
+	file.close();
+	if (scene.triangleCount() == 0)
+	{
+		throw std::runtime_error(path + ": no triangles");
+	}
+
+	loadStats.vertexCount = static_cast<uint32_t>(scene.positions.size());
+	if (settings.weldVertices)
+	{
+		weldVertices(scene, pool);
+	}
+	loadStats.uniqueVertexCount = static_cast<uint32_t>(scene.positions.size());
+	loadStats.triangleCount = scene.triangleCount();
+
+	frameCamera(scene);
+	bool emissive = std::any_of(scene.materials.begin(), scene.materials.end(), [](const Material& m) { return m.emissive(); });
+	scene.background = emissive ? Vec3(0.0f) : Vec3(1.0f);
+
+	loadStats.seconds = timer.seconds();
+	if (stats)
+	{
+		*stats = loadStats;
+	}
+	return scene;
+}
+
+void SceneLoadStats::print(std::ostream& out) const
+{
+	out << "Scene: " << triangleCount << " triangles, " << uniqueVertexCount << " vertices (" << vertexCount << " before welding), "
+		<< fileBytes / (1024.0 * 1024.0) << " MiB in " << chunkCount << " chunks, loaded in " << seconds * 1000.0 << " ms" << std::endl;
+}
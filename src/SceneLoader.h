@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Scene.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+struct SceneLoadSettings
+{
+	// Merges vertices with bit-identical positions, which PLY scans and per-face OBJ exports repeat.
+	bool weldVertices = true;
+	// Files are split into chunks of roughly this size that are parsed in parallel.
+	size_t chunkBytes = size_t(8) << 20;
+};
+
+struct SceneLoadStats
+{
+	double seconds = 0.0;
+	uint64_t fileBytes = 0;
+	uint32_t vertexCount = 0;
+	// Vertices left after welding.
+	uint32_t uniqueVertexCount = 0;
+	uint32_t triangleCount = 0;
+	uint32_t chunkCount = 0;
+
+	void print(std::ostream& out) const;
+};
+
+// Loads a Wavefront OBJ (with its MTL materials) or a PLY mesh (ASCII or binary) into a scene.
+// The file is mapped and parsed in two passes over parallel chunks: the first counts elements per
+// chunk, the second parses straight into the final scene arrays at the offsets the counts imply.
+// No token or per-chunk intermediate buffers are kept, and consumed pages of the mapping are
+// released, so the resident set stays close to the size of the resulting scene.
+// Polygons are triangulated as fans. The camera frames the mesh bounds; scenes without emissive
+// materials get a white background so that they are lit. Throws std::runtime_error on malformed input
+// and on files without triangles.
+Scene loadSceneFile(const std::string& path, ThreadPool& pool, const SceneLoadSettings& settings = {}, SceneLoadStats* stats = nullptr);
+
+// True for the file extensions loadSceneFile understands.
+bool isSceneFile(const std::string& path);
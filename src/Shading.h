@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Math.h"
+
+constexpr float RayEpsilon = 1e-4f;
+// Spread of a ray cone after a diffuse bounce, in radians per unit of distance.
+constexpr float DiffuseConeSpread = 0.2f;
+
+// Footprint of a ray as a cone: its width at the ray origin, growing by spread per unit of distance.
+// The isotropic form of ray differentials, which fits the path state in two floats (Akenine-Moller
+// et al., "Texture Level of Detail Strategies for Real-Time Ray Tracing", 2019).
+struct RayCone
+{
+	float width = 0.0f;
+	float spread = 0.0f;
+
+	float widthAt(float t) const { return width + spread * t; }
+	// Continues the cone from a hit at distance t. Specular bounces off flat triangles keep the spread,
+	// diffuse ones widen it so that later lookups read coarse MIP levels.
+	void bounce(float t, bool specular)
+	{
+		width = widthAt(t);
+		spread = specular ? spread : std::max(spread, DiffuseConeSpread);
+	}
+};
+
+inline Vec3 cosineSampleHemisphere(const Vec3& normal, float u1, float u2)
+{
+	float r = std::sqrt(u1);
+	float phi = 2.0f * Pi * u2;
+	Vec3 tangent, bitangent;
+	makeBasis(normal, tangent, bitangent);
+	return normalize(tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + normal * std::sqrt(std::max(0.0f, 1.0f - u1)));
+}
+
+inline float fresnelDielectric(float cosThetaI, float eta)
+{
+	float sinThetaT2 = eta * eta * std::max(0.0f, 1.0f - cosThetaI * cosThetaI);
+	if (sinThetaT2 >= 1.0f)
+	{
+		return 1.0f;
+	}
+	float cosThetaT = std::sqrt(1.0f - sinThetaT2);
+	float rs = (eta * cosThetaI - cosThetaT) / (eta * cosThetaI + cosThetaT);
+	float rp = (cosThetaI - eta * cosThetaT) / (cosThetaI + eta * cosThetaT);
+	return 0.5f * (rs * rs + rp * rp);
+}
+
+// Picks reflection or refraction at a dielectric boundary with the Fresnel probability. n faces the
+// incoming ray, eta is the ratio of indices on the incoming and outgoing side. Returns true on refraction.
+inline bool sampleDielectric(const Vec3& direction, const Vec3& n, float eta, float u, Vec3& sampled)
+{
+	float cosThetaI = -dot(direction, n);
+	if (u < fresnelDielectric(cosThetaI, eta))
+	{
+		sampled = reflect(direction, n);
+		return false;
+	}
+	float cosThetaT = std::sqrt(1.0f - eta * eta * (1.0f - cosThetaI * cosThetaI));
+	sampled = normalize(direction * eta + n * (eta * cosThetaI - cosThetaT));
+	return true;
+}
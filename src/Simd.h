@@ -0,0 +1,151 @@
+#pragma once
+
+// Minimal SIMD wrappers for the traversal and denoising kernels. Each instruction set lives in its own
+// namespace and is only available when the including translation unit is compiled for it. All of them
+// have internal linkage: the per instruction set translation units get their own copies, so a wrapper
+// compiled for AVX2 never stands in for one used on CPUs without it, even when it is not inlined.
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PTGPU_SIMD_SSE 1
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PTGPU_SIMD_AVX2 1
+#endif
+
+namespace
+{
+namespace generic
+{
+	// Portable fallback, relies on the compiler to vectorize the lane loops.
+	template <int Lanes>
+	struct Float
+	{
+		static constexpr int Width = Lanes;
+		float v[Lanes];
+
+		static Float load(const float* p) { Float r; for (int i = 0; i < Lanes; ++i) r.v[i] = p[i]; return r; }
+		static Float loadUnaligned(const float* p) { return load(p); }
+		static Float broadcast(float s) { Float r; for (int i = 0; i < Lanes; ++i) r.v[i] = s; return r; }
+		// Converts Lanes unsigned bytes.
+		static Float loadBytes(const uint8_t* p) { Float r; for (int i = 0; i < Lanes; ++i) r.v[i] = p[i]; return r; }
+		void store(float* p) const { for (int i = 0; i < Lanes; ++i) p[i] = v[i]; }
+	};
+
+	template <int Lanes>
+	struct Mask
+	{
+		bool v[Lanes];
+
+		uint32_t bits() const { uint32_t r = 0; for (int i = 0; i < Lanes; ++i) r |= uint32_t(v[i]) << i; return r; }
+	};
+
+#define PTGPU_GENERIC_BINARY(op, result)                                                            \
+	template <int N> inline result<N> operator op(const Float<N>& a, const Float<N>& b)             \
+	{ result<N> r; for (int i = 0; i < N; ++i) r.v[i] = a.v[i] op b.v[i]; return r; }
+
+	PTGPU_GENERIC_BINARY(+, Float)
+	PTGPU_GENERIC_BINARY(-, Float)
+	PTGPU_GENERIC_BINARY(*, Float)
+	PTGPU_GENERIC_BINARY(/, Float)
+	PTGPU_GENERIC_BINARY(<, Mask)
+	PTGPU_GENERIC_BINARY(<=, Mask)
+	PTGPU_GENERIC_BINARY(>, Mask)
+	PTGPU_GENERIC_BINARY(>=, Mask)
+#undef PTGPU_GENERIC_BINARY
+
+	template <int N> inline Mask<N> operator&(const Mask<N>& a, const Mask<N>& b) { Mask<N> r; for (int i = 0; i < N; ++i) r.v[i] = a.v[i] && b.v[i]; return r; }
+	template <int N> inline Float<N> min(const Float<N>& a, const Float<N>& b) { Float<N> r; for (int i = 0; i < N; ++i) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r; }
+	template <int N> inline Float<N> max(const Float<N>& a, const Float<N>& b) { Float<N> r; for (int i = 0; i < N; ++i) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r; }
+	template <int N> inline Float<N> abs(const Float<N>& a) { Float<N> r; for (int i = 0; i < N; ++i) r.v[i] = a.v[i] < 0.0f ? -a.v[i] : a.v[i]; return r; }
+	// Approximate 1 / a where the instruction set has one; exact here.
+	template <int N> inline Float<N> reciprocal(const Float<N>& a) { Float<N> r; for (int i = 0; i < N; ++i) r.v[i] = 1.0f / a.v[i]; return r; }
+}
+
+#if PTGPU_SIMD_SSE
+namespace sse
+{
+	struct Mask
+	{
+		__m128 m;
+		uint32_t bits() const { return static_cast<uint32_t>(_mm_movemask_ps(m)); }
+	};
+
+	struct Float
+	{
+		static constexpr int Width = 4;
+		__m128 m;
+
+		static Float load(const float* p) { return {_mm_load_ps(p)}; }
+		static Float loadUnaligned(const float* p) { return {_mm_loadu_ps(p)}; }
+		static Float broadcast(float s) { return {_mm_set1_ps(s)}; }
+		static Float loadBytes(const uint8_t* p)
+		{
+			int32_t word;
+			std::memcpy(&word, p, sizeof(word));
+			__m128i zero = _mm_setzero_si128();
+			__m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(word), zero);
+			return {_mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero))};
+		}
+		void store(float* p) const { _mm_store_ps(p, m); }
+	};
+
+	inline Float operator+(Float a, Float b) { return {_mm_add_ps(a.m, b.m)}; }
+	inline Float operator-(Float a, Float b) { return {_mm_sub_ps(a.m, b.m)}; }
+	inline Float operator*(Float a, Float b) { return {_mm_mul_ps(a.m, b.m)}; }
+	inline Float operator/(Float a, Float b) { return {_mm_div_ps(a.m, b.m)}; }
+	inline Mask operator<(Float a, Float b) { return {_mm_cmplt_ps(a.m, b.m)}; }
+	inline Mask operator<=(Float a, Float b) { return {_mm_cmple_ps(a.m, b.m)}; }
+	inline Mask operator>(Float a, Float b) { return {_mm_cmpgt_ps(a.m, b.m)}; }
+	inline Mask operator>=(Float a, Float b) { return {_mm_cmpge_ps(a.m, b.m)}; }
+	inline Mask operator&(Mask a, Mask b) { return {_mm_and_ps(a.m, b.m)}; }
+	inline Float min(Float a, Float b) { return {_mm_min_ps(a.m, b.m)}; }
+	inline Float max(Float a, Float b) { return {_mm_max_ps(a.m, b.m)}; }
+	inline Float abs(Float a) { return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.m)}; }
+	// About 12 bits of 1 / a.
+	inline Float reciprocal(Float a) { return {_mm_rcp_ps(a.m)}; }
+}
+#endif
+
+#if PTGPU_SIMD_AVX2
+namespace avx2
+{
+	struct Mask
+	{
+		__m256 m;
+		uint32_t bits() const { return static_cast<uint32_t>(_mm256_movemask_ps(m)); }
+	};
+
+	struct Float
+	{
+		static constexpr int Width = 8;
+		__m256 m;
+
+		static Float load(const float* p) { return {_mm256_load_ps(p)}; }
+		static Float loadUnaligned(const float* p) { return {_mm256_loadu_ps(p)}; }
+		static Float broadcast(float s) { return {_mm256_set1_ps(s)}; }
+		static Float loadBytes(const uint8_t* p) { return {_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))))}; }
+		void store(float* p) const { _mm256_store_ps(p, m); }
+	};
+
+	inline Float operator+(Float a, Float b) { return {_mm256_add_ps(a.m, b.m)}; }
+	inline Float operator-(Float a, Float b) { return {_mm256_sub_ps(a.m, b.m)}; }
+	inline Float operator*(Float a, Float b) { return {_mm256_mul_ps(a.m, b.m)}; }
+	inline Float operator/(Float a, Float b) { return {_mm256_div_ps(a.m, b.m)}; }
+	inline Mask operator<(Float a, Float b) { return {_mm256_cmp_ps(a.m, b.m, _CMP_LT_OQ)}; }
+	inline Mask operator<=(Float a, Float b) { return {_mm256_cmp_ps(a.m, b.m, _CMP_LE_OQ)}; }
+	inline Mask operator>(Float a, Float b) { return {_mm256_cmp_ps(a.m, b.m, _CMP_GT_OQ)}; }
+	inline Mask operator>=(Float a, Float b) { return {_mm256_cmp_ps(a.m, b.m, _CMP_GE_OQ)}; }
+	inline Mask operator&(Mask a, Mask b) { return {_mm256_and_ps(a.m, b.m)}; }
+	inline Float min(Float a, Float b) { return {_mm256_min_ps(a.m, b.m)}; }
+	inline Float max(Float a, Float b) { return {_mm256_max_ps(a.m, b.m)}; }
+	inline Float abs(Float a) { return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.m)}; }
+	inline Float reciprocal(Float a) { return {_mm256_rcp_ps(a.m)}; }
+}
+#endif
+}
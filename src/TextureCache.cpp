@@ -0,0 +1,484 @@
+#include "TextureCache.h"
+
+#include "ImageIO.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+
+namespace
+{
+	constexpr char Magic[8] = {'P', 'T', 'G', 'P', 'U', 'T', 'X', '\0'};
+	constexpr uint32_t Version = 1;
+	// Tiles start after the header on this boundary and are a multiple of it, so each tile can be
+	// dropped from memory on its own once copied into the cache.
+	constexpr uint64_t TileAlignment = 4096;
+	constexpr uint32_t ShardCount = 64;
+	// Key of a slot that is free or being filled, and so not in any shard.
+	constexpr uint64_t UnusedKey = ~0ull;
+	// Enough slots that a thread claiming one always finds a filled slot to evict.
+	constexpr uint32_t MinSlots = 256;
+	constexpr uint32_t MaxLevels = 32;
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t tileSize;
+		uint32_t width;
+		uint32_t height;
+		uint32_t levelCount;
+		uint32_t tileCount;
+	};
+
+	static_assert(sizeof(Header) <= TileAlignment && TextureTileBytes % TileAlignment == 0, "Tiles have to stay page aligned");
+
+	uint32_t nextLevelSize(uint32_t size)
+	{
+		return std::max(1u, (size + 1) / 2);
+	}
+
+	uint32_t tilesFor(uint32_t size)
+	{
+		return (size + TextureTileSize - 1) / TextureTileSize;
+	}
+
+	uint32_t shardOf(uint64_t key)
+	{
+		return static_cast<uint32_t>((key * 0x9e3779b97f4a7c15ull) >> 58) % ShardCount;
+	}
+
+	uint32_t wrap(int32_t coordinate, uint32_t size)
+	{
+		int32_t wrapped = coordinate % static_cast<int32_t>(size);
+		return static_cast<uint32_t>(wrapped < 0 ? wrapped + static_cast<int32_t>(size) : wrapped);
+	}
+
+	Vec3 decodeTexel(uint32_t texel)
+	{
+		uint8_t bytes[4];
+		std::memcpy(bytes, &texel, sizeof(bytes));
+		return {decodeSrgb(bytes[0]), decodeSrgb(bytes[1]), decodeSrgb(bytes[2])};
+	}
+}
+
+void writeTiledTexture(const std::string& path, uint32_t width, uint32_t height, const float* rgba)
+{
+	// Box filtered MIP chain in linear RGBA, clamping at odd edges.
+	std::vector<std::vector<float>> levels;
+	std::vector<std::pair<uint32_t, uint32_t>> sizes = {{width, height}};
+	levels.emplace_back(rgba, rgba + 4 * static_cast<size_t>(width) * height);
+	while ((sizes.back().first > 1 || sizes.back().second > 1) && sizes.size() < MaxLevels)
+	{
+		auto [w, h] = sizes.back();
+		uint32_t nw = nextLevelSize(w);
+		uint32_t nh = nextLevelSize(h);
+		const std::vector<float>& source = levels.back();
+		std::vector<float> level(4 * static_cast<size_t>(nw) * nh);
+		for (uint32_t y = 0; y < nh; ++y)
+		{
+			for (uint32_t x = 0; x < nw; ++x)
+			{
+				uint32_t x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+				uint32_t y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+				for (uint32_t c = 0; c < 4; ++c)
+				{
+					level[4 * (static_cast<size_t>(y) * nw + x) + c] = 0.25f * (source[4 * (static_cast<size_t>(y0) * w + x0) + c]
+						+ source[4 * (static_cast<size_t>(y0) * w + x1) + c] + source[4 * (static_cast<size_t>(y1) * w + x0) + c]
+						+ source[4 * (static_cast<size_t>(y1) * w + x1) + c]);
+				}
+			}
+		}
+		levels.push_back(std::move(level));
+		sizes.emplace_back(nw, nh);
+	}
+
+	Header header = {};
+	std::memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.tileSize = TextureTileSize;
+	header.width = width;
+	header.height = height;
+	header.levelCount = static_cast<uint32_t>(levels.size());
+	for (const auto& size : sizes)
+	{
+		header.tileCount += tilesFor(size.first) * tilesFor(size.second);
+	}
+
+	std::string temporary = path + ".tmp";
+	{
+		std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+		if (!out)
+		{
+			throw std::runtime_error("Cannot open " + temporary + " for writing");
+		}
+		std::vector<char> padding(TileAlignment - sizeof(Header), 0);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		out.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+		std::vector<uint8_t> tile(TextureTileBytes);
+		for (size_t l = 0; l < levels.size(); ++l)
+		{
+			auto [w, h] = sizes[l];
+			for (uint32_t ty = 0; ty < tilesFor(h); ++ty)
+			{
+				for (uint32_t tx = 0; tx < tilesFor(w); ++tx)
+				{
+					for (uint32_t y = 0; y < TextureTileSize; ++y)
+					{
+						for (uint32_t x = 0; x < TextureTileSize; ++x)
+						{
+							uint32_t sx = std::min(tx * TextureTileSize + x, w - 1);
+							uint32_t sy = std::min(ty * TextureTileSize + y, h - 1);
+							const float* texel = &levels[l][4 * (static_cast<size_t>(sy) * w + sx)];
+							uint8_t* target = &tile[4 * (y * TextureTileSize + x)];
+							target[0] = encodeSrgb(texel[0]);
+							target[1] = encodeSrgb(texel[1]);
+							target[2] = encodeSrgb(texel[2]);
+							target[3] = static_cast<uint8_t>(std::min(std::max(texel[3], 0.0f), 1.0f) * 255.0f + 0.5f);
+						}
+					}
+					out.write(reinterpret_cast<const char*>(tile.data()), static_cast<std::streamsize>(tile.size()));
+				}
+			}
+		}
+		if (!out.flush())
+		{
+			throw std::runtime_error("Failed to write " + temporary);
+		}
+	}
+	std::error_code error;
+	std::filesystem::rename(temporary, path, error);
+	if (error)
+	{
+		std::remove(temporary.c_str());
+		throw std::runtime_error("Cannot move " + temporary + " to " + path + ": " + error.message());
+	}
+}
+
+std::vector<std::string> prepareTiledTextures(const std::vector<std::string>& sources, ThreadPool& pool)
+{
+	std::vector<std::string> tiled(sources.size());
+	std::vector<uint32_t> pending;
+	for (uint32_t i = 0; i < sources.size(); ++i)
+	{
+		const std::string& source = sources[i];
+		tiled[i] = source;
+		if (hasExtension(source, ".tiled"))
+		{
+			continue;
+		}
+		std::string target = source + ".tiled";
+		std::error_code error;
+		bool sourceExists = std::filesystem::exists(source, error);
+		if (std::filesystem::exists(target, error)
+			&& (!sourceExists || std::filesystem::last_write_time(target, error) >= std::filesystem::last_write_time(source, error)))
+		{
+			tiled[i] = target;
+		}
+		else if (sourceExists)
+		{
+			tiled[i] = target;
+			pending.push_back(i);
+		}
+	}
+
+	std::vector<std::string> errors(pending.size());
+	pool.parallelFor(static_cast<uint32_t>(pending.size()), [&](uint32_t i, uint32_t)
+	{
+		try
+		{
+			uint32_t width = 0, height = 0;
+			std::vector<float> rgba = readImage(sources[pending[i]], width, height);
+			writeTiledTexture(tiled[pending[i]], width, height, rgba.data());
+		}
+		catch (const std::exception& e)
+		{
+			errors[i] = e.what();
+		}
+	});
+	for (const std::string& error : errors)
+	{
+		if (!error.empty())
+		{
+			throw std::runtime_error(error);
+		}
+	}
+	return tiled;
+}
+
+void TextureStats::print(std::ostream& out) const
+{
+	double hitRate = tileRequests > 0 ? 100.0 * (tileRequests - std::min(tileLoads, tileRequests)) / tileRequests : 100.0;
+	out << "Textures: " << texturesOpened << " opened";
+	if (texturesFailed > 0)
+	{
+		out << " (" << texturesFailed << " failed)";
+	}
+	out << ", " << tileRequests << " tile lookups, " << hitRate << "% hits, " << tileLoads << " tiles loaded, " << evictions << " evicted, "
+		<< residentBytes / (1024.0 * 1024.0) << " MiB resident" << std::endl;
+}
+
+TextureCache::TextureCache(std::vector<std::string> paths, size_t budgetBytes)
+	: textures(std::make_unique<Texture[]>(paths.size())), textureCount(static_cast<uint32_t>(paths.size())),
+	slotCount(static_cast<uint32_t>(std::max<size_t>(MinSlots, budgetBytes / TextureTileBytes))), shards(std::make_unique<Shard[]>(ShardCount)),
+	slots(std::make_unique<Slot[]>(slotCount))
+{
+	for (uint32_t i = 0; i < textureCount; ++i)
+	{
+		textures[i].path = std::move(paths[i]);
+	}
+	for (uint32_t i = 0; i < slotCount; ++i)
+	{
+		slots[i].key.store(UnusedKey, std::memory_order_relaxed);
+	}
+}
+
+TextureCache::~TextureCache() = default;
+
+const TextureCache::Texture* TextureCache::open(uint32_t texture) const
+{
+	Texture& entry = textures[texture];
+	std::call_once(entry.opened, [&]()
+	{
+		Header header;
+		if (!entry.file.open(entry.path) || entry.file.size() < TileAlignment)
+		{
+			failed++;
+			return;
+		}
+		std::memcpy(&header, entry.file.data(), sizeof(Header));
+		uint32_t width = header.width;
+		uint32_t height = header.height;
+		uint32_t tiles = 0;
+		for (uint32_t l = 0; l < header.levelCount && l < MaxLevels && width > 0 && height > 0; ++l)
+		{
+			entry.levels.push_back({width, height, tilesFor(width), tiles});
+			tiles += tilesFor(width) * tilesFor(height);
+			width = nextLevelSize(width);
+			height = nextLevelSize(height);
+		}
+		if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version || header.tileSize != TextureTileSize
+			|| entry.levels.empty() || entry.levels.size() != header.levelCount || tiles != header.tileCount
+			|| (entry.file.size() - TileAlignment) / TextureTileBytes < tiles)
+		{
+			entry.levels.clear();
+			entry.file.close();
+			failed++;
+			return;
+		}
+		entry.valid = true;
+		opened++;
+	});
+	return entry.valid ? &entry : nullptr;
+}
+
+uint32_t TextureCache::claimSlot() const
+{
+	std::lock_guard<std::mutex> lock(clockMutex);
+	if (!freeSlots.empty())
+	{
+		uint32_t index = freeSlots.back();
+		freeSlots.pop_back();
+		return index;
+	}
+	if (allocated < slotCount)
+	{
+		slots[allocated].texels = std::make_unique<uint32_t[]>(TextureTileSize * TextureTileSize);
+		return allocated++;
+	}
+	for (;;)
+	{
+		uint32_t index = hand;
+		hand = hand + 1 < slotCount ? hand + 1 : 0;
+		Slot& slot = slots[index];
+		uint64_t key = slot.key.load(std::memory_order_acquire);
+		if (key == UnusedKey || slot.referenced.exchange(0, std::memory_order_relaxed))
+		{
+			continue;
+		}
+		// Lookups copy texels under their shard lock, so none reads the slot once it is unmapped.
+		Shard& shard = shards[shardOf(key)];
+		std::lock_guard<std::mutex> victim(shard.mutex);
+		shard.tiles.erase(key);
+		slot.key.store(UnusedKey, std::memory_order_relaxed);
+		evictions.fetch_add(1, std::memory_order_relaxed);
+		return index;
+	}
+}
+
+void TextureCache::fetch(const Texture& file, uint32_t texture, uint32_t tile, const uint32_t* x, const uint32_t* y, uint32_t lanes,
+	uint32_t* texels) const
+{
+	auto copy = [&](const Slot& slot)
+	{
+		for (uint32_t lane = 0; lane < 4; ++lane)
+		{
+			if (lanes >> lane & 1)
+			{
+				texels[lane] = slot.texels[(y[lane] % TextureTileSize) * TextureTileSize + x[lane] % TextureTileSize];
+			}
+		}
+	};
+
+	uint64_t key = static_cast<uint64_t>(texture) << 32 | tile;
+	Shard& shard = shards[shardOf(key)];
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.requests++;
+		auto found = shard.tiles.find(key);
+		if (found != shard.tiles.end())
+		{
+			Slot& slot = slots[found->second];
+			slot.referenced.store(1, std::memory_order_relaxed);
+			copy(slot);
+			return;
+		}
+	}
+
+	// Miss: read the tile into a slot of its own without holding a lock, then publish it. A thread
+	// that lost the race to load the same tile returns its slot.
+	uint32_t index = claimSlot();
+	Slot& slot = slots[index];
+	size_t offset = TileAlignment + static_cast<size_t>(tile) * TextureTileBytes;
+	std::memcpy(slot.texels.get(), file.file.data() + offset, TextureTileBytes);
+	file.file.release(offset, TextureTileBytes);
+	loads.fetch_add(1, std::memory_order_relaxed);
+	bool lost;
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto inserted = shard.tiles.emplace(key, index);
+		lost = !inserted.second;
+		copy(slots[inserted.first->second]);
+		if (!lost)
+		{
+			slot.referenced.store(1, std::memory_order_relaxed);
+			slot.key.store(key, std::memory_order_release);
+		}
+	}
+	if (lost)
+	{
+		std::lock_guard<std::mutex> lock(clockMutex);
+		freeSlots.push_back(index);
+	}
+}
+
+Vec3 TextureCache::bilinear(const Texture& file, uint32_t texture, uint32_t level, float u, float v) const
+{
+	const Level& size = file.levels[level];
+	float x = u * size.width - 0.5f;
+	float y = v * size.height - 0.5f;
+	float fx = std::floor(x);
+	float fy = std::floor(y);
+	float tx = x - fx;
+	float ty = y - fy;
+	int32_t ix = static_cast<int32_t>(fx);
+	int32_t iy = static_cast<int32_t>(fy);
+	uint32_t x0 = wrap(ix, size.width), x1 = wrap(ix + 1, size.width);
+	uint32_t y0 = wrap(iy, size.height), y1 = wrap(iy + 1, size.height);
+	const uint32_t xs[4] = {x0, x1, x0, x1};
+	const uint32_t ys[4] = {y0, y0, y1, y1};
+	auto tileOf = [&](uint32_t lane)
+	{
+		return size.firstTile + (ys[lane] / TextureTileSize) * size.tilesX + xs[lane] / TextureTileSize;
+	};
+
+	// The four texels mostly share a tile; each distinct tile is looked up once.
+	uint32_t texels[4];
+	uint32_t remaining = 0xf;
+	for (uint32_t first = 0; first < 4; ++first)
+	{
+		if (!(remaining >> first & 1))
+		{
+			continue;
+		}
+		uint32_t tile = tileOf(first);
+		uint32_t lanes = 0;
+		for (uint32_t lane = first; lane < 4; ++lane)
+		{
+			lanes |= (remaining >> lane & 1) && tileOf(lane) == tile ? 1u << lane : 0u;
+		}
+		fetch(file, texture, tile, xs, ys, lanes, texels);
+		remaining &= ~lanes;
+	}
+	Vec3 top = decodeTexel(texels[0]) * (1.0f - tx) + decodeTexel(texels[1]) * tx;
+	Vec3 bottom = decodeTexel(texels[2]) * (1.0f - tx) + decodeTexel(texels[3]) * tx;
+	return top * (1.0f - ty) + bottom * ty;
+}
+
+Vec3 TextureCache::sample(uint32_t texture, float u, float v, float footprint) const
+{
+	const Texture* file = texture < textureCount ? open(texture) : nullptr;
+	if (!file || !std::isfinite(u) || !std::isfinite(v))
+	{
+		return Vec3(1.0f);
+	}
+	u -= std::floor(u);
+	v -= std::floor(v);
+	// Level 0 has one texel per footprint, each level above twice the width.
+	const Level& base = file->levels[0];
+	float lod = std::log2(footprint * std::sqrt(static_cast<float>(base.width) * base.height));
+	float maxLevel = static_cast<float>(file->levels.size() - 1);
+	lod = lod > 0.0f ? std::min(lod, maxLevel) : 0.0f;
+	uint32_t level = static_cast<uint32_t>(lod);
+	float blend = lod - level;
+	Vec3 color = bilinear(*file, texture, level, u, v);
+	if (blend > 0.0f)
+	{
+		color = color * (1.0f - blend) + bilinear(*file, texture, level + 1, u, v) * blend;
+	}
+	return color;
+}
+
+size_t TextureCache::memoryBytes() const
+{
+	std::lock_guard<std::mutex> lock(clockMutex);
+	return static_cast<size_t>(allocated) * TextureTileBytes + slotCount * sizeof(Slot);
+}
+
+TextureStats TextureCache::stats() const
+{
+	TextureStats result;
+	for (uint32_t i = 0; i < ShardCount; ++i)
+	{
+		std::lock_guard<std::mutex> lock(shards[i].mutex);
+		result.tileRequests += shards[i].requests;
+	}
+	result.tileLoads = loads.load(std::memory_order_relaxed);
+	result.evictions = evictions.load(std::memory_order_relaxed);
+	result.texturesOpened = opened.load(std::memory_order_relaxed);
+	result.texturesFailed = failed.load(std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(clockMutex);
+		result.residentBytes = static_cast<size_t>(allocated - freeSlots.size()) * TextureTileBytes;
+	}
+	return result;
+}
+
+void TextureCache::printStats(std::ostream& out) const
+{
+	stats().print(out);
+}
+
+Vec3 surfaceAlbedo(const Scene& scene, const TextureCache* textures, const Material& material, const Hit& hit, const Vec3& direction,
+	float footprintWidth)
+{
+	if (!textures || material.texture == InvalidIndex || scene.texcoords.empty())
+	{
+		return material.albedo;
+	}
+	// The ray footprint on the surface, stretched by the cosine to it, scaled from world to texture
+	// space by the ratio of the triangle's texcoord and surface areas.
+	const TexCoord* corners = &scene.texcoords[3 * hit.primitive];
+	float texcoordArea = 0.5f * std::fabs((corners[1].u - corners[0].u) * (corners[2].v - corners[0].v)
+		- (corners[2].u - corners[0].u) * (corners[1].v - corners[0].v));
+	float area = scene.triangleArea(hit.instance, hit.primitive);
+	float cosTheta = std::max(std::fabs(dot(scene.geometricNormal(hit.instance, hit.primitive), direction)), 0.01f);
+	float footprint = area > 0.0f ? footprintWidth / cosTheta * std::sqrt(texcoordArea / area) : 0.0f;
+	TexCoord uv = scene.texcoord(hit.primitive, hit.u, hit.v);
+	return material.albedo * textures->sample(material.texture, uv.u, uv.v, footprint);
+}
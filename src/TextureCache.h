@@ -0,0 +1,125 @@
+#pragma once
+
+#include "MappedFile.h"
+#include "Ray.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Texels per side of a texture tile, the unit of loading and eviction.
+constexpr uint32_t TextureTileSize = 64;
+constexpr size_t TextureTileBytes = TextureTileSize * TextureTileSize * 4;
+
+// Writes rgba, top row first, as a tiled texture: a header, then the tiles of every
+// MIP level down to 1x1, each TextureTileSize squared sRGB encoded RGBA8 texels on a page boundary.
+// Edge tiles repeat the last texel. Throws std::runtime_error when the file cannot be written.
+void writeTiledTexture(const std::string& path, uint32_t width, uint32_t height, const float* rgba);
+
+// Maps each texture of a scene to a tiled texture file. Tiled files are used as they are, images are
+// converted once, in parallel, to path + ".tiled" next to them and reconverted when the image is newer.
+// Missing sources keep their path and render with the untextured albedo.
+std::vector<std::string> prepareTiledTextures(const std::vector<std::string>& sources, ThreadPool& pool);
+
+struct TextureStats
+{
+	// Tiles requested by lookups and those read from their file, some of them twice by racing threads.
+	uint64_t tileRequests = 0;
+	uint64_t tileLoads = 0;
+	uint64_t evictions = 0;
+	uint32_t texturesOpened = 0;
+	uint32_t texturesFailed = 0;
+	size_t residentBytes = 0;
+
+	void print(std::ostream& out) const;
+};
+
+// Thread-safe, lazily filled cache of texture tiles. Files are mapped on their first lookup and
+// tiles copied in on demand, so neither startup nor memory depends on the textures a scene lists,
+// only on those its rays reach. At most budgetBytes of tiles are resident; beyond that the clock
+// algorithm evicts tiles no lookup has touched since the hand last passed them. Tiles are read
+// without any lock held, lookups of different tiles only contend on one of many shard locks.
+class TextureCache
+{
+public:
+	TextureCache(std::vector<std::string> paths, size_t budgetBytes);
+	~TextureCache();
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// Trilinear lookup with repeat wrapping. footprint is the filter width in texture space, where 1
+	// spans the whole texture; it picks the MIP levels. Textures that fail to open return white.
+	Vec3 sample(uint32_t texture, float u, float v, float footprint) const;
+
+	size_t memoryBytes() const;
+	TextureStats stats() const;
+	void printStats(std::ostream& out) const;
+
+private:
+	struct Level
+	{
+		uint32_t width;
+		uint32_t height;
+		uint32_t tilesX;
+		uint32_t firstTile;
+	};
+
+	struct Texture
+	{
+		std::string path;
+		std::once_flag opened;
+		bool valid = false;
+		MappedFile file;
+		std::vector<Level> levels;
+	};
+
+	struct alignas(64) Shard
+	{
+		std::mutex mutex;
+		std::unordered_map<uint64_t, uint32_t> tiles;
+		uint64_t requests = 0;
+	};
+
+	struct Slot
+	{
+		std::atomic<uint64_t> key;
+		std::atomic<uint8_t> referenced{0};
+		std::unique_ptr<uint32_t[]> texels;
+	};
+
+	const Texture* open(uint32_t texture) const;
+	// Copies the texels at (x[lane], y[lane]) of the lanes set in the mask, which all lie in tile.
+	void fetch(const Texture& file, uint32_t texture, uint32_t tile, const uint32_t* x, const uint32_t* y, uint32_t lanes, uint32_t* texels) const;
+	uint32_t claimSlot() const;
+	Vec3 bilinear(const Texture& file, uint32_t texture, uint32_t level, float u, float v) const;
+
+	std::unique_ptr<Texture[]> textures;
+	uint32_t textureCount;
+	uint32_t slotCount;
+	std::unique_ptr<Shard[]> shards;
+	std::unique_ptr<Slot[]> slots;
+
+	// Clock state: slots are handed out in order until the budget is reached, then recycled.
+	mutable std::mutex clockMutex;
+	mutable uint32_t hand = 0;
+	mutable uint32_t allocated = 0;
+	mutable std::vector<uint32_t> freeSlots;
+	mutable std::atomic<uint64_t> loads{0};
+	mutable std::atomic<uint64_t> evictions{0};
+	mutable std::atomic<uint32_t> failed{0};
+	mutable std::atomic<uint32_t> opened{0};
+};
+
+// Albedo of the material hit by a ray along direction, where the ray's footprint has the given width:
+// the material albedo times its texture, filtered over the footprint projected into texture space.
+Vec3 surfaceAlbedo(const Scene& scene, const TextureCache* textures, const Material& material, const Hit& hit, const Vec3& direction,
+	float footprintWidth);
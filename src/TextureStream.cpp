@@ -0,0 +1,220 @@
+#include "TextureStream.h"
+
+#include "Timer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+	bool hasBufferStorage()
+	{
+#ifdef GL_MAP_PERSISTENT_BIT
+		GLint major = 0;
+		GLint minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		if (major > 4 || (major == 4 && minor >= 4))
+		{
+			return true;
+		}
+		GLint extensionCount = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+		for (GLint i = 0; i < extensionCount; ++i)
+		{
+			if (std::strcmp(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)), "GL_ARB_buffer_storage") == 0)
+			{
+				return true;
+			}
+		}
+#endif
+		return false;
+	}
+}
+
+TextureStream::TextureStream(const RenderSettings& settings, uint32_t slotCount)
+	: width(settings.width), height(settings.height), tilesX((settings.width + settings.tileSize - 1) / settings.tileSize),
+	tiles(makeTiles(settings)), slotBytes(sizeof(float) * 4 * static_cast<size_t>(settings.width) * settings.height), fences(slotCount, nullptr)
+{
+	glGenTextures(1, &textureName);
+	glBindTexture(GL_TEXTURE_2D, textureName);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	GLsizeiptr ringBytes = static_cast<GLsizeiptr>(slotBytes * slotCount);
+	persistentMapping = hasBufferStorage();
+#ifdef GL_MAP_PERSISTENT_BIT
+	if (persistentMapping)
+	{
+		// Coherent so that writes through the mapping are visible without explicit flushes.
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, ringBytes, nullptr, flags);
+		mapped = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, ringBytes, flags));
+	}
+#endif
+	if (!persistentMapping)
+	{
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, ringBytes, nullptr, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (glGetError() != GL_NO_ERROR || (persistentMapping && !mapped))
+	{
+		throw std::runtime_error("Cannot allocate the texture upload ring");
+	}
+}
+
+TextureStream::~TextureStream()
+{
+	for (GLsync fence : fences)
+	{
+		if (fence)
+		{
+			glDeleteSync(fence);
+		}
+	}
+	if (mapped)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	glDeleteBuffers(1, &buffer);
+	glDeleteTextures(1, &textureName);
+}
+
+uint32_t TextureStream::update(Renderer& renderer)
+{
+	Timer timer;
+	dirty.clear();
+	renderer.takeDirtyTiles(dirty);
+	if (dirty.empty())
+	{
+		return 0;
+	}
+
+	uint32_t slot = acquireSlot();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	renderer.resolveTiles(mapSlot(slot), dirty);
+	unmapSlot();
+
+	mergeTiles(dirty);
+	size_t uploaded = uploadRects(slot);
+	totalSeconds += timer.seconds();
+	totalBytes += uploaded;
+	frameCount++;
+	return static_cast<uint32_t>(dirty.size());
+}
+
+void TextureStream::updateFrame(const std::function<void(float*)>& write)
+{
+	Timer timer;
+	uint32_t slot = acquireSlot();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	write(mapSlot(slot));
+	unmapSlot();
+
+	rects.assign(1, {0, 0, width, height});
+	size_t uploaded = uploadRects(slot);
+	totalSeconds += timer.seconds();
+	totalBytes += uploaded;
+	frameCount++;
+}
+
+uint32_t TextureStream::acquireSlot()
+{
+	uint32_t slot = nextSlot;
+	nextSlot = (nextSlot + 1) % static_cast<uint32_t>(fences.size());
+	if (fences[slot])
+	{
+		// Only blocks when the GPU is still consuming the upload issued slotCount frames ago.
+		glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(fences[slot]);
+		fences[slot] = nullptr;
+	}
+	return slot;
+}
+
+float* TextureStream::mapSlot(uint32_t slot)
+{
+	if (persistentMapping)
+	{
+		return reinterpret_cast<float*>(mapped + slot * slotBytes);
+	}
+	// The fence wait above already guarantees the slot is idle, so the driver need not synchronize.
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+	void* pointer = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, static_cast<GLintptr>(slot * slotBytes), static_cast<GLsizeiptr>(slotBytes), flags);
+	if (!pointer)
+	{
+		throw std::runtime_error("glMapBufferRange failed");
+	}
+	return static_cast<float*>(pointer);
+}
+
+void TextureStream::unmapSlot()
+{
+	if (!persistentMapping)
+	{
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+}
+
+void TextureStream::mergeTiles(std::vector<uint32_t>& tileIndices)
+{
+	// Runs of dirty tiles within a tile row become one rectangle; full-width runs in consecutive
+	// rows are merged again, so a fully dirty image is a single upload.
+	std::sort(tileIndices.begin(), tileIndices.end());
+	rects.clear();
+	for (size_t i = 0; i < tileIndices.size();)
+	{
+		size_t end = i + 1;
+		while (end < tileIndices.size() && tileIndices[end] == tileIndices[end - 1] + 1 && tileIndices[end] % tilesX != 0)
+		{
+			++end;
+		}
+		const Tile& first = tiles[tileIndices[i]];
+		const Tile& last = tiles[tileIndices[end - 1]];
+		Rect rect = {first.x0, first.y0, last.x1, last.y1};
+		bool fullWidth = rect.x0 == 0 && rect.x1 == width;
+		if (fullWidth && !rects.empty() && rects.back().x0 == 0 && rects.back().x1 == width && rects.back().y1 == rect.y0)
+		{
+			rects.back().y1 = rect.y1;
+		}
+		else
+		{
+			rects.push_back(rect);
+		}
+		i = end;
+	}
+}
+
+size_t TextureStream::uploadRects(uint32_t slot)
+{
+	glBindTexture(GL_TEXTURE_2D, textureName);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+	size_t uploaded = 0;
+	for (const Rect& rect : rects)
+	{
+		size_t offset = slot * slotBytes + sizeof(float) * 4 * (static_cast<size_t>(rect.y0) * width + rect.x0);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0, GL_RGBA, GL_FLOAT,
+			reinterpret_cast<const void*>(offset));
+		uploaded += sizeof(float) * 4 * static_cast<size_t>(rect.x1 - rect.x0) * (rect.y1 - rect.y0);
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	return uploaded;
+}
+
+void TextureStream::readBack(std::vector<float>& rgba) const
+{
+	rgba.resize(4 * static_cast<size_t>(width) * height);
+	glBindTexture(GL_TEXTURE_2D, textureName);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, rgba.data());
+}
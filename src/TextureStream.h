@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Gl.h"
+#include "Renderer.h"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Streams the progressive image into an RGBA32F texture through a ring of pixel buffer slots.
+// The texture is allocated once; each frame the renderer resolves its dirty tiles straight into
+// the mapped slot and only those tiles are uploaded, merged into as few rectangles as possible.
+// With GL 4.4 or ARB_buffer_storage the ring is mapped persistently for the lifetime of the
+// stream; older contexts map the slot unsynchronized each frame instead. Fences keep the host
+// from overwriting a slot the GPU is still reading from.
+class TextureStream
+{
+public:
+	TextureStream(const RenderSettings& settings, uint32_t slotCount = 3);
+	~TextureStream();
+
+	TextureStream(const TextureStream&) = delete;
+	TextureStream& operator=(const TextureStream&) = delete;
+
+	// Resolves renderer's dirty tiles into the next slot and uploads them. Returns the number of
+	// tiles uploaded.
+	uint32_t update(Renderer& renderer);
+	// Uploads a whole frame that write fills in as RGBA32F rows, for images that are processed as a
+	// whole before display, such as the denoised preview.
+	void updateFrame(const std::function<void(float*)>& write);
+
+	GLuint texture() const { return textureName; }
+	bool persistent() const { return persistentMapping; }
+
+	// Reads the texture back, for checking the upload path against Renderer::resolve.
+	void readBack(std::vector<float>& rgba) const;
+
+	double uploadSeconds() const { return totalSeconds; }
+	uint64_t uploadedBytes() const { return totalBytes; }
+	uint32_t frames() const { return frameCount; }
+
+private:
+	struct Rect
+	{
+		uint32_t x0, y0, x1, y1;
+	};
+
+	// Returns the next slot once the GPU is done with it.
+	uint32_t acquireSlot();
+	float* mapSlot(uint32_t slot);
+	void unmapSlot();
+	void mergeTiles(std::vector<uint32_t>& tileIndices);
+	// Uploads rects from slot and fences it. Returns the bytes uploaded.
+	size_t uploadRects(uint32_t slot);
+
+	uint32_t width;
+	uint32_t height;
+	uint32_t tilesX;
+	std::vector<Tile> tiles;
+	size_t slotBytes;
+
+	GLuint textureName = 0;
+	GLuint buffer = 0;
+	bool persistentMapping = false;
+	uint8_t* mapped = nullptr;
+	std::vector<GLsync> fences;
+	uint32_t nextSlot = 0;
+
+	std::vector<uint32_t> dirty;
+	std::vector<Rect> rects;
+
+	double totalSeconds = 0.0;
+	uint64_t totalBytes = 0;
+	uint32_t frameCount = 0;
+};
@@ -0,0 +1,158 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	thread_local uint32_t threadIndex = 0;
+
+	// Best effort: where the priority cannot be changed the thread keeps running at its own.
+	void lowerCurrentThreadPriority()
+	{
+#ifdef _WIN32
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+		// Linux schedules threads as tasks of their own, each with its own nice value.
+		setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+#endif
+	}
+}
+
+ThreadPool::ThreadPool(uint32_t threadCount, ThreadPriority priority)
+	: threadCount(threadCount ? threadCount : std::max(1u, std::thread::hardware_concurrency()))
+{
+	for (uint32_t i = 1; i < this->threadCount; ++i)
+	{
+		workers.emplace_back([this, i, priority] { workerLoop(i, priority); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeup.notify_all();
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+uint32_t ThreadPool::currentThreadIndex()
+{
+	return threadIndex;
+}
+
+void ThreadPool::run(TaskGroup& group, std::function<void()> task)
+{
+	group.pending.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back({std::move(task), &group});
+	}
+	wakeup.notify_one();
+}
+
+void ThreadPool::wait(TaskGroup& group)
+{
+	while (!group.done())
+	{
+		if (!runOne())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void ThreadPool::parallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)>& body, uint32_t grainSize)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	grainSize = std::max(1u, grainSize);
+	std::atomic<uint32_t> next{0};
+	auto drain = [&]
+	{
+		uint32_t self = currentThreadIndex();
+		for (;;)
+		{
+			uint32_t begin = next.fetch_add(grainSize, std::memory_order_relaxed);
+			if (begin >= count)
+			{
+				break;
+			}
+			uint32_t end = std::min(count, begin + grainSize);
+			for (uint32_t i = begin; i < end; ++i)
+			{
+				body(i, self);
+			}
+		}
+	};
+
+	uint32_t batches = (count + grainSize - 1) / grainSize;
+	uint32_t helpers = std::min(threadCount, batches) - 1;
+	TaskGroup group;
+	for (uint32_t i = 0; i < helpers; ++i)
+	{
+		run(group, drain);
+	}
+	drain();
+	wait(group);
+}
+
+bool ThreadPool::runOne()
+{
+	Task task;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (queue.empty())
+		{
+			return false;
+		}
+		task = std::move(queue.front());
+		queue.pop_front();
+	}
+	task.function();
+	task.group->pending.fetch_sub(1, std::memory_order_acq_rel);
+	return true;
+}
+
+void ThreadPool::workerLoop(uint32_t index, ThreadPriority priority)
+{
+	threadIndex = index;
+	if (priority == ThreadPriority::Background)
+	{
+		lowerCurrentThreadPriority();
+	}
+	for (;;)
+	{
+		Task task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeup.wait(lock, [this] { return stopping || !queue.empty(); });
+			if (stopping && queue.empty())
+			{
+				return;
+			}
+			task = std::move(queue.front());
+			queue.pop_front();
+		}
+		task.function();
+		task.group->pending.fetch_sub(1, std::memory_order_acq_rel);
+	}
+}
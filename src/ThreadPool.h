@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts outstanding tasks submitted through ThreadPool::run.
+class TaskGroup
+{
+public:
+	bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class ThreadPool;
+	std::atomic<uint32_t> pending{0};
+};
+
+enum class ThreadPriority
+{
+	Normal,
+	// Lowest OS scheduling priority, so that the workers mostly run on cycles other threads leave idle.
+	Background
+};
+
+// Fixed set of worker threads fed from a shared task queue. The thread calling wait() or
+// parallelFor() takes part in the work, so nested parallelism does not deadlock.
+class ThreadPool
+{
+public:
+	// threadCount includes the calling thread; 0 selects std::thread::hardware_concurrency(). The
+	// priority applies to the workers only.
+	explicit ThreadPool(uint32_t threadCount = 0, ThreadPriority priority = ThreadPriority::Normal);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	uint32_t size() const { return threadCount; }
+
+	// Index of the calling thread within this pool: 0 for the owner thread, 1..size()-1 for workers.
+	static uint32_t currentThreadIndex();
+
+	void run(TaskGroup& group, std::function<void()> task);
+	void wait(TaskGroup& group);
+
+	// Calls body(index, threadIndex) for every index in [0, count), handing out indices in batches of grainSize.
+	void parallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)>& body, uint32_t grainSize = 1);
+
+private:
+	struct Task
+	{
+		std::function<void()> function;
+		TaskGroup* group;
+	};
+
+	void workerLoop(uint32_t index, ThreadPriority priority);
+	bool runOne();
+
+	uint32_t threadCount;
+	std::vector<std::thread> workers;
+	std::deque<Task> queue;
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	bool stopping = false;
+};
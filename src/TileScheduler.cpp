@@ -0,0 +1,253 @@
+#include "TileScheduler.h"
+
+#include "Timer.h"
+
+#include <algorithm>
+#include <numeric>
+#include <ostream>
+
+namespace
+{
+	// Position of (x, y) along the Hilbert curve filling a size x size grid, size a power of two.
+	uint32_t hilbertIndex(uint32_t size, uint32_t x, uint32_t y)
+	{
+		uint32_t index = 0;
+		for (uint32_t s = size / 2; s > 0; s /= 2)
+		{
+			uint32_t rx = (x & s) > 0;
+			uint32_t ry = (y & s) > 0;
+			index += s * s * ((3 * rx) ^ ry);
+			if (ry == 0)
+			{
+				if (rx == 1)
+				{
+					x = s - 1 - x;
+					y = s - 1 - y;
+				}
+				std::swap(x, y);
+			}
+		}
+		return index;
+	}
+
+	// Split pieces stay at least this many pixels wide and high.
+	constexpr uint32_t MinSplitSize = 8;
+}
+
+TileScheduler::TileScheduler(ThreadPool& pool, const RenderSettings& settings, const std::vector<Tile>& tiles)
+	: pool(pool), tiles(tiles), curveIndex(tiles.size()), workers(pool.size()), tileCost(tiles.size(), 0.0),
+	splitLevel(tiles.size(), 0)
+{
+	uint32_t tilesX = (settings.width + settings.tileSize - 1) / settings.tileSize;
+	uint32_t tilesY = (settings.height + settings.tileSize - 1) / settings.tileSize;
+	uint32_t size = 1;
+	while (size < std::max(tilesX, tilesY))
+	{
+		size *= 2;
+	}
+	for (uint32_t i = 0; i < tiles.size(); ++i)
+	{
+		curveIndex[i] = hilbertIndex(size, tiles[i].x0 / settings.tileSize, tiles[i].y0 / settings.tileSize);
+	}
+}
+
+void TileScheduler::reset()
+{
+	std::fill(tileCost.begin(), tileCost.end(), 0.0);
+	std::fill(splitLevel.begin(), splitLevel.end(), 0);
+	for (Worker& worker : workers)
+	{
+		worker.busySeconds = 0.0;
+		worker.rendered = 0;
+		worker.stolen = 0;
+	}
+	wallSeconds = 0.0;
+	passes = 0;
+}
+
+void TileScheduler::run(const std::vector<uint32_t>& tileIndices, const Body& body)
+{
+	Timer timer;
+	distribute(tileIndices);
+
+	TaskGroup group;
+	for (uint32_t i = 1; i < pool.size(); ++i)
+	{
+		pool.run(group, [this, &body] { work(ThreadPool::currentThreadIndex(), body); });
+	}
+	work(ThreadPool::currentThreadIndex(), body);
+	pool.wait(group);
+
+	wallSeconds += timer.seconds();
+	passes++;
+	updateSplitLevels(tileIndices);
+}
+
+void TileScheduler::distribute(const std::vector<uint32_t>& tileIndices)
+{
+	std::vector<uint32_t> order = tileIndices;
+	std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return curveIndex[a] < curveIndex[b]; });
+
+	// Tiles not rendered before are estimated from the mean cost per pixel of those that were.
+	double knownSeconds = 0.0;
+	double knownPixels = 0.0;
+	for (uint32_t tile : order)
+	{
+		if (tileCost[tile] > 0.0)
+		{
+			const Tile& t = tiles[tile];
+			knownSeconds += tileCost[tile];
+			knownPixels += static_cast<double>(t.x1 - t.x0) * (t.y1 - t.y0);
+		}
+	}
+	double secondsPerPixel = knownPixels > 0.0 ? knownSeconds / knownPixels : 1.0;
+
+	std::vector<WorkItem> items;
+	std::vector<double> costs;
+	itemTiles.clear();
+	for (uint32_t tile : order)
+	{
+		const Tile& t = tiles[tile];
+		uint32_t width = t.x1 - t.x0;
+		uint32_t height = t.y1 - t.y0;
+		double cost = tileCost[tile] > 0.0 ? tileCost[tile] : secondsPerPixel * width * height;
+		uint32_t pieces = 1u << splitLevel[tile];
+		uint32_t stepX = std::max(MinSplitSize, (width + pieces - 1) / pieces);
+		uint32_t stepY = std::max(MinSplitSize, (height + pieces - 1) / pieces);
+		for (uint32_t y = t.y0; y < t.y1; y += stepY)
+		{
+			for (uint32_t x = t.x0; x < t.x1; x += stepX)
+			{
+				Tile rect{x, y, std::min(x + stepX, t.x1), std::min(y + stepY, t.y1)};
+				items.push_back({rect, tile, static_cast<uint32_t>(items.size())});
+				costs.push_back(cost * (rect.x1 - rect.x0) * (rect.y1 - rect.y0) / (static_cast<double>(width) * height));
+				itemTiles.push_back(tile);
+			}
+		}
+	}
+	itemSeconds.assign(items.size(), 0.0);
+
+	// Contiguous runs of the curve with equal estimated cost, one per thread.
+	double total = std::accumulate(costs.begin(), costs.end(), 0.0);
+	double perWorker = total / workers.size();
+	double prefix = 0.0;
+	for (size_t i = 0; i < items.size(); ++i)
+	{
+		size_t owner = std::min(workers.size() - 1, static_cast<size_t>((prefix + 0.5 * costs[i]) / perWorker));
+		prefix += costs[i];
+		workers[owner].items.push_back(items[i]);
+	}
+}
+
+void TileScheduler::work(uint32_t self, const Body& body)
+{
+	Worker& worker = workers[self];
+	WorkItem item;
+	while (pop(self, item) || steal(self, item))
+	{
+		Timer timer;
+		body(item.rect, item.tile, self);
+		double seconds = timer.seconds();
+		itemSeconds[item.item] = seconds;
+		worker.busySeconds += seconds;
+		worker.rendered++;
+	}
+}
+
+bool TileScheduler::pop(uint32_t self, WorkItem& item)
+{
+	Worker& worker = workers[self];
+	std::lock_guard<std::mutex> lock(worker.mutex);
+	if (worker.items.empty())
+	{
+		return false;
+	}
+	item = worker.items.front();
+	worker.items.pop_front();
+	return true;
+}
+
+bool TileScheduler::steal(uint32_t self, WorkItem& item)
+{
+	for (size_t offset = 1; offset < workers.size(); ++offset)
+	{
+		Worker& victim = workers[(self + offset) % workers.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.items.empty())
+		{
+			item = victim.items.back();
+			victim.items.pop_back();
+			workers[self].stolen++;
+			return true;
+		}
+	}
+	return false;
+}
+
+void TileScheduler::updateSplitLevels(const std::vector<uint32_t>& tileIndices)
+{
+	for (uint32_t tile : tileIndices)
+	{
+		tileCost[tile] = 0.0;
+	}
+	for (size_t i = 0; i < itemSeconds.size(); ++i)
+	{
+		tileCost[itemTiles[i]] += itemSeconds[i];
+	}
+
+	double mean = 0.0;
+	for (uint32_t tile : tileIndices)
+	{
+		mean += tileCost[tile];
+	}
+	mean /= std::max<size_t>(1, tileIndices.size());
+	for (uint32_t tile : tileIndices)
+	{
+		if (tileCost[tile] > SplitThreshold * mean && splitLevel[tile] < MaxSplitLevel)
+		{
+			splitLevel[tile]++;
+		}
+		else if (tileCost[tile] < mean && splitLevel[tile] > 0)
+		{
+			splitLevel[tile]--;
+		}
+	}
+}
+
+std::vector<double> TileScheduler::utilization() const
+{
+	std::vector<double> result;
+	for (const Worker& worker : workers)
+	{
+		result.push_back(wallSeconds > 0.0 ? worker.busySeconds / wallSeconds : 0.0);
+	}
+	return result;
+}
+
+void TileScheduler::printStats(std::ostream& out) const
+{
+	std::vector<double> busy = utilization();
+	if (busy.empty() || passes == 0)
+	{
+		return;
+	}
+	uint64_t rendered = 0;
+	uint64_t stolen = 0;
+	for (const Worker& worker : workers)
+	{
+		rendered += worker.rendered;
+		stolen += worker.stolen;
+	}
+	size_t split = static_cast<size_t>(std::count_if(splitLevel.begin(), splitLevel.end(), [](uint8_t level) { return level > 0; }));
+	double mean = std::accumulate(busy.begin(), busy.end(), 0.0) / busy.size();
+	out << "Tile scheduler: " << rendered / passes << " work items per pass, " << 100.0 * stolen / std::max<uint64_t>(1, rendered)
+		<< "% stolen, " << split << " tiles split" << std::endl;
+	out << "Thread utilization: mean " << 100.0 * mean << "%, min " << 100.0 * *std::min_element(busy.begin(), busy.end()) << "%, max "
+		<< 100.0 * *std::max_element(busy.begin(), busy.end()) << "%" << std::endl;
+	out << "Per thread:";
+	for (size_t i = 0; i < busy.size(); ++i)
+	{
+		out << (i % 16 == 0 ? "\n " : "") << " " << static_cast<int>(100.0 * busy[i] + 0.5) << "%";
+	}
+	out << std::endl;
+}
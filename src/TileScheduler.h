@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Renderer.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iosfwd>
+#include <mutex>
+#include <vector>
+
+// Work-stealing scheduler for the tiles of a progressive pass. Tiles are visited in Hilbert curve
+// order and dealt out to per-thread deques in contiguous runs of similar estimated cost; a thread
+// takes work from the front of its own deque and, once it runs dry, steals from the back of the
+// others, so both ends stay spatially coherent. Tiles that were expensive in the previous pass are
+// split into up to 4^MaxSplitLevel pieces, which gives stealing something to balance with.
+class TileScheduler
+{
+public:
+	// body(rect, tileIndex, threadIndex) renders rect, which lies within tile tileIndex.
+	using Body = std::function<void(const Tile& rect, uint32_t tileIndex, uint32_t threadIndex)>;
+
+	TileScheduler(ThreadPool& pool, const RenderSettings& settings, const std::vector<Tile>& tiles);
+
+	// Renders the listed tiles once, returning after all are done.
+	void run(const std::vector<uint32_t>& tileIndices, const Body& body);
+
+	// Forgets the per-tile costs and statistics, as after a scene or camera change.
+	void reset();
+
+	// Fraction of the pass wall time each thread spent rendering, accumulated over all passes.
+	std::vector<double> utilization() const;
+	void printStats(std::ostream& out) const;
+
+	static constexpr uint32_t MaxSplitLevel = 2;
+	// A tile splits one level further once it costs this many times the mean tile.
+	static constexpr float SplitThreshold = 4.0f;
+
+private:
+	struct WorkItem
+	{
+		Tile rect;
+		uint32_t tile;
+		uint32_t item;
+	};
+
+	struct alignas(64) Worker
+	{
+		std::mutex mutex;
+		std::deque<WorkItem> items;
+		double busySeconds = 0.0;
+		uint64_t rendered = 0;
+		uint64_t stolen = 0;
+	};
+
+	void work(uint32_t self, const Body& body);
+	bool pop(uint32_t self, WorkItem& item);
+	bool steal(uint32_t self, WorkItem& item);
+	void distribute(const std::vector<uint32_t>& tileIndices);
+	void updateSplitLevels(const std::vector<uint32_t>& tileIndices);
+
+	ThreadPool& pool;
+	const std::vector<Tile>& tiles;
+	// Hilbert curve position of every tile.
+	std::vector<uint32_t> curveIndex;
+	std::vector<Worker> workers;
+	// Seconds the tile took in the last pass that rendered it, 0 if unknown.
+	std::vector<double> tileCost;
+	std::vector<uint8_t> splitLevel;
+	// Seconds of every work item of the current pass, each written by the thread that rendered it.
+	std::vector<double> itemSeconds;
+	std::vector<uint32_t> itemTiles;
+	double wallSeconds = 0.0;
+	uint32_t passes = 0;
+};
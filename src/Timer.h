@@ -0,0 +1,22 @@
+#pragma once
+
+#include <chrono>
+
+class Timer
+{
+public:
+	Timer() : start(Clock::now()) {}
+
+	void reset() { start = Clock::now(); }
+
+	double seconds() const
+	{
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	double milliseconds() const { return seconds() * 1000.0; }
+
+private:
+	using Clock = std::chrono::steady_clock;
+	Clock::time_point start;
+};
@@ -0,0 +1,91 @@
+#include "Wavefront.h"
+
+#include <iomanip>
+#include <ostream>
+
+const char* wavefrontStageName(WavefrontStage stage)
+{
+	switch (stage)
+	{
+	case WavefrontStage::Generate:
+		return "generate";
+	case WavefrontStage::Sort:
+		return "sort";
+	case WavefrontStage::Extend:
+		return "extend";
+	case WavefrontStage::Shade:
+		return "shade";
+	case WavefrontStage::Connect:
+		return "connect";
+	case WavefrontStage::Compact:
+		return "compact";
+	case WavefrontStage::Accumulate:
+		return "accumulate";
+	default:
+		return "unknown";
+	}
+}
+
+void WavefrontTimings::ensureBounce(uint32_t bounce)
+{
+	if (bounce >= stageSeconds.size())
+	{
+		stageSeconds.resize(bounce + 1, {});
+		paths.resize(bounce + 1, 0);
+	}
+}
+
+void WavefrontTimings::add(uint32_t bounce, WavefrontStage stage, double seconds)
+{
+	ensureBounce(bounce);
+	stageSeconds[bounce][static_cast<uint32_t>(stage)] += seconds;
+}
+
+void WavefrontTimings::addPaths(uint32_t bounce, uint64_t count)
+{
+	ensureBounce(bounce);
+	paths[bounce] += count;
+}
+
+void WavefrontTimings::clear()
+{
+	stageSeconds.clear();
+	paths.clear();
+}
+
+double WavefrontTimings::seconds(uint32_t bounce, WavefrontStage stage) const
+{
+	return bounce < stageSeconds.size() ? stageSeconds[bounce][static_cast<uint32_t>(stage)] : 0.0;
+}
+
+void WavefrontTimings::print(std::ostream& out) const
+{
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out << std::setw(8) << "bounce" << std::setw(12) << "paths";
+	for (uint32_t s = 0; s < WavefrontStageCount; ++s)
+	{
+		out << std::setw(12) << wavefrontStageName(static_cast<WavefrontStage>(s));
+	}
+	out << "   (ms)\n" << std::fixed << std::setprecision(2);
+
+	std::array<double, WavefrontStageCount> total = {};
+	for (uint32_t b = 0; b < stageSeconds.size(); ++b)
+	{
+		out << std::setw(8) << b << std::setw(12) << paths[b];
+		for (uint32_t s = 0; s < WavefrontStageCount; ++s)
+		{
+			out << std::setw(12) << stageSeconds[b][s] * 1000.0;
+			total[s] += stageSeconds[b][s];
+		}
+		out << "\n";
+	}
+	out << std::setw(8) << "total" << std::setw(12) << "";
+	for (uint32_t s = 0; s < WavefrontStageCount; ++s)
+	{
+		out << std::setw(12) << total[s] * 1000.0;
+	}
+	out << std::endl;
+	out.flags(flags);
+	out.precision(precision);
+}
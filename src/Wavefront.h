@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+// Stages of the wavefront pipeline, shared by the CPU and OpenCL implementations. Every bounce runs
+// Extend, Shade, Connect and Compact, secondary bounces optionally Sort first; Generate and
+// Accumulate run once per pass.
+enum class WavefrontStage : uint32_t
+{
+	Generate,
+	Sort,
+	Extend,
+	Shade,
+	Connect,
+	Compact,
+	Accumulate,
+	Count,
+};
+
+constexpr uint32_t WavefrontStageCount = static_cast<uint32_t>(WavefrontStage::Count);
+
+const char* wavefrontStageName(WavefrontStage stage);
+
+// Accumulated stage times per bounce, plus the number of paths that entered each bounce.
+class WavefrontTimings
+{
+public:
+	void add(uint32_t bounce, WavefrontStage stage, double seconds);
+	void addPaths(uint32_t bounce, uint64_t count);
+	void clear();
+
+	double seconds(uint32_t bounce, WavefrontStage stage) const;
+	uint32_t bounces() const { return static_cast<uint32_t>(stageSeconds.size()); }
+
+	void print(std::ostream& out) const;
+
+private:
+	void ensureBounce(uint32_t bounce);
+
+	std::vector<std::array<double, WavefrontStageCount>> stageSeconds;
+	std::vector<uint64_t> paths;
+};
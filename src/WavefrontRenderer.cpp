@@ -0,0 +1,526 @@
+#include "WavefrontRenderer.h"
+
+#include "Timer.h"
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+namespace
+{
+	constexpr uint32_t MaxWaveSize = 1u << 20;
+	constexpr uint32_t Grain = 256;
+	// Origin cells per axis of the ray sort key, 9 bits each.
+	constexpr uint32_t SortGridBits = 9;
+
+	// Spreads the low 10 bits of v to every third bit.
+	uint32_t expandBits(uint32_t v)
+	{
+		v = (v * 0x00010001u) & 0xff0000ffu;
+		v = (v * 0x00000101u) & 0x0f00f00fu;
+		v = (v * 0x00000011u) & 0xc30c30c3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+
+	// Moves values[from[i]] to values[to[i]] for every i, staged through scratch.
+	template <typename T>
+	void permute(ThreadPool& pool, T* values, const uint32_t* from, const uint32_t* to, uint32_t count, std::vector<uint8_t>& scratch)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Path state is moved as raw bytes");
+		scratch.resize(static_cast<size_t>(count) * sizeof(T));
+		uint8_t* staging = scratch.data();
+		pool.parallelFor(count, [&](uint32_t i, uint32_t)
+		{
+			std::memcpy(staging + static_cast<size_t>(i) * sizeof(T), &values[from[i]], sizeof(T));
+		}, Grain);
+		pool.parallelFor(count, [&](uint32_t i, uint32_t)
+		{
+			std::memcpy(&values[to[i]], staging + static_cast<size_t>(i) * sizeof(T), sizeof(T));
+		}, Grain);
+	}
+}
+
+WavefrontRenderer::WavefrontRenderer(const Scene& scene, const Accelerator& accelerator, ThreadPool& pool, const RenderSettings& settings,
+	const TextureCache* textures, const LightSet* sharedLights)
+	: scene(scene), accelerator(accelerator), textures(textures), pool(pool), config(settings),
+	ownedLights(sharedLights ? nullptr : settings.lightTree ? std::make_unique<LightSet>(scene, pool) : std::make_unique<LightSet>(scene)),
+	lights(sharedLights ? *sharedLights : *ownedLights), accumulation(settings.width, settings.height, settings.aovs),
+	waveCapacity(std::min(settings.width * settings.height, MaxWaveSize)), sceneBounds(settings.sortRays ? scene.bounds() : Aabb()),
+	paged(dynamic_cast<const PagedBvh*>(&accelerator))
+{
+	origins.resize(waveCapacity);
+	directions.resize(waveCapacity);
+	throughputs.resize(waveCapacity);
+	radiances.resize(waveCapacity);
+	cones.resize(waveCapacity);
+	pixels.resize(waveCapacity);
+	rngs.assign(waveCapacity, Sampler(0, 0, settings.sampler));
+	specularBounces.resize(waveCapacity);
+	lastPositions.resize(waveCapacity);
+	lastNormals.resize(waveCapacity);
+	alive.resize(waveCapacity);
+	hits.resize(waveCapacity);
+	activeQueue.reserve(waveCapacity);
+	nextQueue.reserve(waveCapacity);
+}
+
+void WavefrontRenderer::reset()
+{
+	accumulation.clear();
+	statistics = RenderStats();
+	stageTimings.clear();
+}
+
+bool WavefrontRenderer::saveCheckpoint(RenderCheckpoint& checkpoint) const
+{
+	// Paths do not outlive a pass and their samplers are seeded by pixel and sample index.
+	checkpoint.stats = statistics;
+	checkpoint.state.clear();
+	accumulation.save(checkpoint.samples);
+	return true;
+}
+
+bool WavefrontRenderer::restoreCheckpoint(const RenderCheckpoint& checkpoint)
+{
+	if (!checkpoint.state.empty() || !accumulation.load(checkpoint.samples))
+	{
+		return false;
+	}
+	statistics = checkpoint.stats;
+	stageTimings.clear();
+	return true;
+}
+
+void WavefrontRenderer::renderPass()
+{
+	Timer timer;
+	uint32_t pixelCount = accumulation.pixelCount();
+	for (uint32_t first = 0; first < pixelCount; first += waveCapacity)
+	{
+		renderWave(first, std::min(waveCapacity, pixelCount - first));
+	}
+
+	statistics.passes++;
+	statistics.pathSamples += pixelCount;
+	statistics.lastPassSeconds = timer.seconds();
+	statistics.seconds += statistics.lastPassSeconds;
+}
+
+void WavefrontRenderer::renderWave(uint32_t firstPixel, uint32_t pathCount)
+{
+	Timer timer;
+	generate(firstPixel, pathCount);
+	stageTimings.add(0, WavefrontStage::Generate, timer.seconds());
+
+	for (uint32_t depth = 0; depth < config.maxDepth && !activeQueue.empty(); ++depth)
+	{
+		stageTimings.addPaths(depth, activeQueue.size());
+		statistics.rays += activeQueue.size();
+
+		if (config.sortRays && depth > 0)
+		{
+			timer.reset();
+			sortRays();
+			stageTimings.add(depth, WavefrontStage::Sort, timer.seconds());
+		}
+
+		timer.reset();
+		extend(depth);
+		stageTimings.add(depth, WavefrontStage::Extend, timer.seconds());
+
+		timer.reset();
+		shade(depth);
+		stageTimings.add(depth, WavefrontStage::Shade, timer.seconds());
+
+		timer.reset();
+		connect();
+		stageTimings.add(depth, WavefrontStage::Connect, timer.seconds());
+
+		timer.reset();
+		compact();
+		stageTimings.add(depth, WavefrontStage::Compact, timer.seconds());
+	}
+
+	timer.reset();
+	accumulate(pathCount);
+	stageTimings.add(0, WavefrontStage::Accumulate, timer.seconds());
+}
+
+void WavefrontRenderer::generate(uint32_t firstPixel, uint32_t pathCount)
+{
+	float aspect = static_cast<float>(config.width) / config.height;
+	float spread = scene.camera.pixelSpread(config.height);
+	activeQueue.resize(pathCount);
+	pool.parallelFor(pathCount, [&](uint32_t path, uint32_t)
+	{
+		uint32_t pixel = firstPixel + path;
+		uint32_t x = pixel % config.width;
+		uint32_t y = pixel / config.width;
+		Sampler rng(pixel, accumulation.sampleCount(pixel), config.sampler);
+		float u = (x + rng.nextFloat()) / config.width;
+		float v = (y + rng.nextFloat()) / config.height;
+		Ray ray = scene.camera.generateRay(u, v, aspect);
+
+		origins[path] = ray.origin;
+		directions[path] = ray.direction;
+		throughputs[path] = Vec3(1.0f);
+		radiances[path] = Vec3(0.0f);
+		cones[path] = RayCone();
+		cones[path].spread = spread;
+		pixels[path] = pixel;
+		rngs[path] = rng;
+		specularBounces[path] = 1;
+		activeQueue[path] = path;
+	}, Grain);
+}
+
+void WavefrontRenderer::sortRays()
+{
+	// Key: direction octant in the top 3 bits, then the Morton code of the origin cell on a grid over
+	// the scene bounds. Paths are independent, so the order changes nothing but memory locality.
+	constexpr float MaxCell = static_cast<float>((1u << SortGridBits) - 1);
+	uint32_t count = static_cast<uint32_t>(activeQueue.size());
+	sortKeys.resize(count);
+	Vec3 extent = sceneBounds.diagonal();
+	Vec3 scale(MaxCell / std::max(extent.x, 1e-20f), MaxCell / std::max(extent.y, 1e-20f), MaxCell / std::max(extent.z, 1e-20f));
+	pool.parallelFor(count, [&](uint32_t i, uint32_t)
+	{
+		uint32_t path = activeQueue[i];
+		const Vec3& origin = origins[path];
+		const Vec3& direction = directions[path];
+		uint32_t cells[3];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float cell = (origin[axis] - sceneBounds.min[axis]) * scale[axis];
+			cells[axis] = cell >= 0.0f ? static_cast<uint32_t>(std::min(cell, MaxCell)) : 0;
+		}
+		uint32_t octant = (direction.x < 0.0f ? 1u : 0u) | (direction.y < 0.0f ? 2u : 0u) | (direction.z < 0.0f ? 4u : 0u);
+		sortKeys[i] = octant << (3 * SortGridBits) | expandBits(cells[0]) << 2 | expandBits(cells[1]) << 1 | expandBits(cells[2]);
+	}, Grain);
+	sortSlots.assign(activeQueue.begin(), activeQueue.end());
+	radixSort(pool, sortKeys.data(), activeQueue.data(), count, 3 * SortGridBits + 3, sortScratch);
+
+	// Move the paths into the slots the active paths held, in key order, so that the following stages
+	// stream through the path state instead of gathering from it. Hits and shadow rays are rewritten
+	// before they are read again.
+	const uint32_t* from = activeQueue.data();
+	const uint32_t* to = sortSlots.data();
+	permute(pool, origins.data(), from, to, count, permuteScratch);
+	permute(pool, directions.data(), from, to, count, permuteScratch);
+	permute(pool, throughputs.data(), from, to, count, permuteScratch);
+	permute(pool, radiances.data(), from, to, count, permuteScratch);
+	permute(pool, cones.data(), from, to, count, permuteScratch);
+	permute(pool, pixels.data(), from, to, count, permuteScratch);
+	permute(pool, rngs.data(), from, to, count, permuteScratch);
+	permute(pool, specularBounces.data(), from, to, count, permuteScratch);
+	permute(pool, lastPositions.data(), from, to, count, permuteScratch);
+	permute(pool, lastNormals.data(), from, to, count, permuteScratch);
+	activeQueue.swap(sortSlots);
+}
+
+void WavefrontRenderer::extend(uint32_t depth)
+{
+	uint32_t count = static_cast<uint32_t>(activeQueue.size());
+	if (paged)
+	{
+		batchRays.resize(count);
+		batchHits.assign(count, Hit());
+		pool.parallelFor(count, [&](uint32_t i, uint32_t)
+		{
+			uint32_t path = activeQueue[i];
+			batchRays[i] = Ray();
+			batchRays[i].origin = origins[path];
+			batchRays[i].direction = directions[path];
+		}, Grain);
+		paged->intersectBatch(batchRays.data(), batchHits.data(), count);
+		pool.parallelFor(count, [&](uint32_t i, uint32_t)
+		{
+			hits[activeQueue[i]] = batchHits[i];
+		}, Grain);
+		return;
+	}
+
+	// Camera rays are coherent in queue order, secondary rays only once sorted.
+	if (config.packetTraversal && (depth == 0 || config.sortRays))
+	{
+		pool.parallelFor((count + RayPacketSize - 1) / RayPacketSize, [&](uint32_t packet, uint32_t)
+		{
+			uint32_t first = packet * RayPacketSize;
+			uint32_t size = std::min(RayPacketSize, count - first);
+			Ray rays[RayPacketSize];
+			Hit packetHits[RayPacketSize];
+			for (uint32_t i = 0; i < size; ++i)
+			{
+				uint32_t path = activeQueue[first + i];
+				rays[i].origin = origins[path];
+				rays[i].direction = directions[path];
+			}
+			accelerator.intersectRays(rays, packetHits, size);
+			for (uint32_t i = 0; i < size; ++i)
+			{
+				hits[activeQueue[first + i]] = packetHits[i];
+			}
+		}, Grain / RayPacketSize);
+		return;
+	}
+
+	pool.parallelFor(count, [&](uint32_t i, uint32_t)
+	{
+		uint32_t path = activeQueue[i];
+		Ray ray;
+		ray.origin = origins[path];
+		ray.direction = directions[path];
+		Hit hit;
+		accelerator.intersect(ray, hit);
+		hits[path] = hit;
+	}, Grain);
+}
+
+void WavefrontRenderer::shade(uint32_t depth)
+{
+	// Misses are resolved during classification, hits are queued by material type.
+	uint32_t activeCount = static_cast<uint32_t>(activeQueue.size());
+	partitionByKey(pool, activeQueue.data(), activeCount, MaterialQueueCount, [&](uint32_t path) -> uint32_t
+	{
+		const Hit& hit = hits[path];
+		if (!hit.valid())
+		{
+			float weight = specularBounces[path] ? 1.0f : lights.backgroundWeight(lastNormals[path], directions[path]);
+			radiances[path] += throughputs[path] * lights.background(directions[path]) * weight;
+			if (depth == 0)
+			{
+				FirstHit first;
+				first.emission = radiances[path];
+				accumulation.addFirstHit(pixels[path], first);
+			}
+			alive[path] = 0;
+			return MaterialQueueCount;
+		}
+		return static_cast<uint32_t>(scene.material(hit.primitive).type);
+	}, materialQueues, keyScratch);
+
+	// Also returns the albedo, textured over the footprint of the path's cone, and moves the cone on.
+	auto surface = [&](uint32_t path, Vec3& position, Vec3& n, bool& frontFace, Vec3& albedo) -> const Material&
+	{
+		const Hit& hit = hits[path];
+		const Material& material = scene.material(hit.primitive);
+		position = origins[path] + directions[path] * hit.t;
+		Vec3 normal = scene.geometricNormal(hit.instance, hit.primitive);
+		frontFace = dot(normal, directions[path]) < 0.0f;
+		n = frontFace ? normal : -normal;
+		if (frontFace && material.emissive())
+		{
+			float weight = specularBounces[path] ? 1.0f : lights.emissionWeight(lastPositions[path], lastNormals[path], directions[path], hit);
+			radiances[path] += throughputs[path] * material.emission * weight;
+		}
+		albedo = surfaceAlbedo(scene, textures, material, hit, directions[path], cones[path].widthAt(hit.t));
+		if (depth == 0)
+		{
+			// Each pixel has one path per wave, so the first hits of a wave never share a pixel.
+			accumulation.addFirstHit(pixels[path], {radiances[path], albedo, n, hit.t, scene.object(hit)});
+		}
+		cones[path].bounce(hit.t, material.type != MaterialType::Diffuse);
+		return material;
+	};
+
+	auto russianRoulette = [&](uint32_t path)
+	{
+		alive[path] = 1;
+		if (depth >= 3)
+		{
+			float survival = std::min(0.95f, maxComponent(throughputs[path]));
+			if (rngs[path].nextFloat() >= survival)
+			{
+				alive[path] = 0;
+				return;
+			}
+			throughputs[path] *= 1.0f / survival;
+		}
+	};
+
+	const std::vector<uint32_t>& diffuse = materialQueues[static_cast<uint32_t>(MaterialType::Diffuse)];
+	uint32_t diffuseCount = static_cast<uint32_t>(diffuse.size());
+	shadowOrigins.resize(diffuseCount);
+	shadowDirections.resize(diffuseCount);
+	shadowDistances.resize(diffuseCount);
+	shadowContributions.resize(diffuseCount);
+	pool.parallelFor(diffuseCount, [&](uint32_t i, uint32_t)
+	{
+		uint32_t path = diffuse[i];
+		Vec3 position, n, albedo;
+		bool frontFace;
+		surface(path, position, n, frontFace, albedo);
+		Sampler& rng = rngs[path];
+
+		shadowDistances[i] = 0.0f;
+		if (!lights.empty())
+		{
+			Ray shadow;
+			Vec3 radiance;
+			float u0 = rng.nextFloat();
+			rng.startPair();
+			float u1 = rng.nextFloat();
+			float u2 = rng.nextFloat();
+			if (lights.sampleDirect(position, n, u0, u1, u2, shadow, radiance))
+			{
+				shadowOrigins[i] = shadow.origin;
+				shadowDirections[i] = shadow.direction;
+				shadowDistances[i] = shadow.tMax;
+				shadowContributions[i] = throughputs[path] * albedo * InvPi * radiance;
+			}
+		}
+
+		origins[path] = position + n * RayEpsilon;
+		rng.startPair();
+		float u1 = rng.nextFloat();
+		float u2 = rng.nextFloat();
+		directions[path] = cosineSampleHemisphere(n, u1, u2);
+		throughputs[path] *= albedo;
+		specularBounces[path] = 0;
+		lastPositions[path] = position;
+		lastNormals[path] = n;
+		russianRoulette(path);
+	}, Grain);
+
+	const std::vector<uint32_t>& mirror = materialQueues[static_cast<uint32_t>(MaterialType::Mirror)];
+	pool.parallelFor(static_cast<uint32_t>(mirror.size()), [&](uint32_t i, uint32_t)
+	{
+		uint32_t path = mirror[i];
+		Vec3 position, n, albedo;
+		bool frontFace;
+		surface(path, position, n, frontFace, albedo);
+
+		origins[path] = position + n * RayEpsilon;
+		directions[path] = reflect(directions[path], n);
+		throughputs[path] *= albedo;
+		specularBounces[path] = 1;
+		russianRoulette(path);
+	}, Grain);
+
+	const std::vector<uint32_t>& glass = materialQueues[static_cast<uint32_t>(MaterialType::Glass)];
+	pool.parallelFor(static_cast<uint32_t>(glass.size()), [&](uint32_t i, uint32_t)
+	{
+		uint32_t path = glass[i];
+		Vec3 position, n, albedo;
+		bool frontFace;
+		const Material& material = surface(path, position, n, frontFace, albedo);
+
+		float eta = frontFace ? 1.0f / material.ior : material.ior;
+		Vec3 direction;
+		bool refracted = sampleDielectric(directions[path], n, eta, rngs[path].nextFloat(), direction);
+		origins[path] = position + (refracted ? -n : n) * RayEpsilon;
+		directions[path] = direction;
+		throughputs[path] *= albedo;
+		specularBounces[path] = 1;
+		russianRoulette(path);
+	}, Grain);
+}
+
+void WavefrontRenderer::connect()
+{
+	const std::vector<uint32_t>& diffuse = materialQueues[static_cast<uint32_t>(MaterialType::Diffuse)];
+	uint32_t count = static_cast<uint32_t>(diffuse.size());
+	if (paged)
+	{
+		batchEntries.clear();
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (shadowDistances[i] > 0.0f)
+			{
+				batchEntries.push_back(i);
+			}
+		}
+		uint32_t shadowCount = static_cast<uint32_t>(batchEntries.size());
+		batchRays.resize(shadowCount);
+		batchOccluded.resize(shadowCount);
+		pool.parallelFor(shadowCount, [&](uint32_t s, uint32_t)
+		{
+			uint32_t i = batchEntries[s];
+			batchRays[s] = Ray();
+			batchRays[s].origin = shadowOrigins[i];
+			batchRays[s].direction = shadowDirections[i];
+			batchRays[s].tMax = shadowDistances[i];
+		}, Grain);
+		paged->occludedBatch(batchRays.data(), batchOccluded.data(), shadowCount);
+		pool.parallelFor(shadowCount, [&](uint32_t s, uint32_t)
+		{
+			if (!batchOccluded[s])
+			{
+				radiances[diffuse[batchEntries[s]]] += shadowContributions[batchEntries[s]];
+			}
+		}, Grain);
+		statistics.rays += shadowCount;
+		return;
+	}
+
+	std::atomic<uint64_t> traced{0};
+	pool.parallelFor((count + Grain - 1) / Grain, [&](uint32_t chunk, uint32_t)
+	{
+		uint64_t rays = 0;
+		uint32_t end = std::min(count, (chunk + 1) * Grain);
+		Ray shadows[RayPacketSize];
+		uint32_t entries[RayPacketSize];
+		uint32_t pending = 0;
+		auto flush = [&]()
+		{
+			uint32_t occluded = 0;
+			if (config.packetTraversal)
+			{
+				occluded = accelerator.occludedRays(shadows, pending);
+			}
+			else
+			{
+				for (uint32_t s = 0; s < pending; ++s)
+				{
+					occluded |= accelerator.occluded(shadows[s]) ? 1u << s : 0u;
+				}
+			}
+			for (uint32_t s = 0; s < pending; ++s)
+			{
+				if (!(occluded >> s & 1))
+				{
+					radiances[diffuse[entries[s]]] += shadowContributions[entries[s]];
+				}
+			}
+			rays += pending;
+			pending = 0;
+		};
+		for (uint32_t i = chunk * Grain; i < end; ++i)
+		{
+			if (shadowDistances[i] <= 0.0f)
+			{
+				continue;
+			}
+			Ray& shadow = shadows[pending];
+			shadow.origin = shadowOrigins[i];
+			shadow.direction = shadowDirections[i];
+			shadow.tMax = shadowDistances[i];
+			entries[pending++] = i;
+			if (pending == RayPacketSize)
+			{
+				flush();
+			}
+		}
+		flush();
+		traced.fetch_add(rays, std::memory_order_relaxed);
+	});
+	statistics.rays += traced.load();
+}
+
+void WavefrontRenderer::compact()
+{
+	partitionByKey(pool, activeQueue.data(), static_cast<uint32_t>(activeQueue.size()), 1, [&](uint32_t path) -> uint32_t
+	{
+		return alive[path] ? 0 : 1;
+	}, &nextQueue, keyScratch);
+	std::swap(activeQueue, nextQueue);
+}
+
+void WavefrontRenderer::accumulate(uint32_t pathCount)
+{
+	pool.parallelFor(pathCount, [&](uint32_t path, uint32_t)
+	{
+		accumulation.addSample(pixels[path], radiances[path]);
+	}, Grain);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Accelerator.h"
+#include "Framebuffer.h"
+#include "Lights.h"
+#include "PagedBvh.h"
+#include "ParallelPrimitives.h"
+#include "Random.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "Shading.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include "Wavefront.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Path tracer that advances a whole wave of paths one stage at a time instead of tracing each path
+// to completion. Paths live in SoA arrays and are routed through index queues: one queue of
+// active paths, one per material type and one of pending shadow rays. Optionally the active paths
+// are sorted by a Morton key of their rays before each secondary bounce, so that rays which traverse
+// the same part of the scene are traced together. With paged geometry, each stage traces its rays
+// as one batch, so that rays wait in page queues rather than on the file. Textures, when given, are
+// filtered over the ray cone of each path. Direct light is weighted against BSDF sampling as in
+// CpuRenderer.
+class WavefrontRenderer : public Renderer
+{
+public:
+	WavefrontRenderer(const Scene& scene, const Accelerator& accelerator, ThreadPool& pool, const RenderSettings& settings,
+		const TextureCache* textures = nullptr, const LightSet* sharedLights = nullptr);
+
+	void renderPass() override;
+	void reset() override;
+	void resolve(float* rgba) const override { accumulation.resolve(rgba); }
+	bool resolveFeatures(PixelFeatures& features) const override { return accumulation.resolveFeatures(features); }
+	AovMask resolveAovs(AovMask aovs, bool half, LayeredImage& image) const override { return accumulation.resolveAovs(aovs, half, image); }
+
+	const RenderStats& stats() const override { return statistics; }
+	const RenderSettings& settings() const override { return config; }
+	const char* name() const override { return "CPU wavefront"; }
+	void printStats(std::ostream& out) const override { stageTimings.print(out); }
+	bool saveCheckpoint(RenderCheckpoint& checkpoint) const override;
+	bool restoreCheckpoint(const RenderCheckpoint& checkpoint) override;
+
+	const Framebuffer& framebuffer() const { return accumulation; }
+	const WavefrontTimings& timings() const { return stageTimings; }
+
+private:
+	static constexpr uint32_t MaterialQueueCount = 3;
+
+	void renderWave(uint32_t firstPixel, uint32_t pathCount);
+	void generate(uint32_t firstPixel, uint32_t pathCount);
+	void sortRays();
+	void extend(uint32_t depth);
+	void shade(uint32_t depth);
+	void connect();
+	void compact();
+	void accumulate(uint32_t pathCount);
+
+	const Scene& scene;
+	const Accelerator& accelerator;
+	const TextureCache* textures;
+	ThreadPool& pool;
+	RenderSettings config;
+	std::unique_ptr<LightSet> ownedLights;
+	const LightSet& lights;
+	Framebuffer accumulation;
+	RenderStats statistics;
+	WavefrontTimings stageTimings;
+	uint32_t waveCapacity;
+	Aabb sceneBounds;
+	// Set when the accelerator pages geometry in from a scene cache.
+	const PagedBvh* paged;
+
+	// Per path state, indexed by path.
+	std::vector<Vec3> origins;
+	std::vector<Vec3> directions;
+	std::vector<Vec3> throughputs;
+	std::vector<Vec3> radiances;
+	std::vector<RayCone> cones;
+	std::vector<uint32_t> pixels;
+	std::vector<Sampler> rngs;
+	std::vector<uint8_t> specularBounces;
+	// Last diffuse vertex of each path, for weighting the emission its bounce finds.
+	std::vector<Vec3> lastPositions;
+	std::vector<Vec3> lastNormals;
+	std::vector<uint8_t> alive;
+	std::vector<Hit> hits;
+
+	// Shadow rays, one slot per entry of the diffuse queue.
+	std::vector<Vec3> shadowOrigins;
+	std::vector<Vec3> shadowDirections;
+	std::vector<float> shadowDistances;
+	std::vector<Vec3> shadowContributions;
+
+	std::vector<uint32_t> activeQueue;
+	std::vector<uint32_t> nextQueue;
+	std::vector<uint32_t> materialQueues[MaterialQueueCount];
+	std::vector<uint8_t> keyScratch;
+	std::vector<uint32_t> sortKeys;
+	std::vector<uint32_t> sortSlots;
+	RadixSortScratch sortScratch;
+	std::vector<uint8_t> permuteScratch;
+
+	// Rays of a paged batch and their results, with the queue entries they came from.
+	std::vector<Ray> batchRays;
+	std::vector<Hit> batchHits;
+	std::vector<uint8_t> batchOccluded;
+	std::vector<uint32_t> batchEntries;
+};
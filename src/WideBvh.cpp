@@ -0,0 +1,551 @@
+#include "WideBvh.h"
+
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+	// Exposes the binary BVH through the accelerator interface without copying it.
+	class BinaryBvhAccelerator : public Accelerator
+	{
+	public:
+		explicit BinaryBvhAccelerator(const Bvh& bvh) : bvh(bvh) {}
+
+		bool intersect(Ray& ray, Hit& hit) const override { return bvh.intersect(ray, hit); }
+		bool occluded(const Ray& ray) const override { return bvh.occluded(ray); }
+		const char* name() const override { return "BVH2"; }
+		size_t memoryBytes() const override { return bvh.stats().nodeBytes + bvh.stats().indexBytes; }
+
+	private:
+		const Bvh& bvh;
+	};
+
+	// Collects up to Width children of an interior binary node, opening the interior child with the
+	// largest surface area until all slots are used. Returns the number of slots.
+	template <int Width>
+	int openSlots(const Array<BvhNode>& binary, uint32_t binaryNode, uint32_t* slots)
+	{
+		int slotCount = 2;
+		slots[0] = binary[binaryNode].offset;
+		slots[1] = binary[binaryNode].offset + 1;
+		while (slotCount < Width)
+		{
+			int best = -1;
+			float bestArea = -1.0f;
+			for (int i = 0; i < slotCount; ++i)
+			{
+				const BvhNode& candidate = binary[slots[i]];
+				float area = candidate.bounds().surfaceArea();
+				if (!candidate.leaf() && area > bestArea)
+				{
+					best = i;
+					bestArea = area;
+				}
+			}
+			if (best < 0)
+			{
+				break;
+			}
+			uint32_t opened = slots[best];
+			slots[best] = binary[opened].offset;
+			slots[slotCount++] = binary[opened].offset + 1;
+		}
+		return slotCount;
+	}
+
+	// Appends the triangles of a binary leaf as packets and returns the number of packets.
+	template <int Width>
+	uint32_t appendPackets(const Bvh& bvh, const BvhNode& leaf, Array<TrianglePacket<Width>>& packets)
+	{
+		const Scene& scene = bvh.scene();
+		const Array<uint32_t>& primitives = bvh.primitiveIndices();
+
+		uint32_t count = (leaf.count + Width - 1) / Width;
+		for (uint32_t p = 0; p < count; ++p)
+		{
+			TrianglePacket<Width>& packet = packets.emplace_back();
+			for (int lane = 0; lane < Width; ++lane)
+			{
+				uint32_t i = p * Width + lane;
+				Vec3 v0, e1, e2;
+				uint32_t primitive = InvalidIndex;
+				if (i < leaf.count)
+				{
+					primitive = primitives[leaf.offset + i];
+					v0 = scene.vertex(primitive, 0);
+					e1 = scene.vertex(primitive, 1) - v0;
+					e2 = scene.vertex(primitive, 2) - v0;
+				}
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					packet.v0[axis][lane] = v0[axis];
+					packet.edge1[axis][lane] = e1[axis];
+					packet.edge2[axis][lane] = e2[axis];
+				}
+				packet.primitives[lane] = primitive;
+			}
+		}
+		return count;
+	}
+
+	// Quantizes the child boxes of a compressed node against their union. Empty boxes become empty
+	// slots. The rounding is checked against the decoded planes so that no child ever shrinks.
+	template <int Width>
+	void quantizeBounds(CompressedWideBvhNode<Width>& node, const Aabb* boxes)
+	{
+		Aabb bounds;
+		for (int i = 0; i < Width; ++i)
+		{
+			if (!boxes[i].empty())
+			{
+				bounds.extend(boxes[i]);
+			}
+		}
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float origin = bounds.empty() ? 0.0f : bounds.min[axis];
+			float top = bounds.empty() ? 0.0f : bounds.max[axis];
+			float extent = top - origin;
+			int exponent = extent > 0.0f ? static_cast<int>(std::ceil(std::log2(extent / 255.0f))) : -126;
+			exponent = std::min(std::max(exponent, -126), 127);
+			while (exponent < 127 && origin + 255.0f * std::ldexp(1.0f, exponent) < top)
+			{
+				++exponent;
+			}
+			float scale = std::ldexp(1.0f, exponent);
+			node.origin[axis] = origin;
+			node.exponents[axis] = static_cast<int8_t>(exponent);
+
+			for (int i = 0; i < Width; ++i)
+			{
+				if (boxes[i].empty())
+				{
+					node.bounds[2 * axis][i] = 255;
+					node.bounds[2 * axis + 1][i] = 0;
+					continue;
+				}
+				float lo = boxes[i].min[axis];
+				float hi = boxes[i].max[axis];
+				int qlo = std::min(std::max(static_cast<int>(std::floor((lo - origin) / scale)), 0), 255);
+				int qhi = std::min(std::max(static_cast<int>(std::ceil((hi - origin) / scale)), 0), 255);
+				while (qlo > 0 && origin + qlo * scale > lo)
+				{
+					--qlo;
+				}
+				while (qhi < 255 && origin + qhi * scale < hi)
+				{
+					++qhi;
+				}
+				node.bounds[2 * axis][i] = static_cast<uint8_t>(qlo);
+				node.bounds[2 * axis + 1][i] = static_cast<uint8_t>(qhi);
+			}
+		}
+	}
+}
+
+template <int Width>
+WideBvh<Width>::WideBvh(const Bvh& bvh)
+{
+	const Array<BvhNode>& binary = bvh.nodes();
+	nodeList.reserve(binary.size() / (Width - 1) + 1);
+
+	if (binary[0].leaf() || bvh.empty())
+	{
+		// A single leaf still gets a root so that traversal always starts at an interior node, and a tree
+		// without primitives one with empty slots only.
+		nodeList.emplace_back();
+		WideBvhNode<Width>& root = nodeList[0];
+		for (int i = 0; i < Width; ++i)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				root.bounds[2 * axis][i] = Infinity;
+				root.bounds[2 * axis + 1][i] = -Infinity;
+			}
+			root.children[i] = InvalidIndex;
+			root.packetCounts[i] = 0;
+		}
+		if (bvh.empty())
+		{
+			return;
+		}
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			root.bounds[2 * axis][0] = binary[0].boundsMin[axis];
+			root.bounds[2 * axis + 1][0] = binary[0].boundsMax[axis];
+		}
+		emitLeaf(bvh, binary[0], root.children[0], root.packetCounts[0]);
+		return;
+	}
+
+	collapse(bvh, 0);
+}
+
+template <int Width>
+WideBvh<Width>::WideBvh(Array<WideBvhNode<Width>> nodes, Array<TrianglePacket<Width>> packets)
+	: nodeList(std::move(nodes)), packetList(std::move(packets))
+{
+}
+
+template <int Width>
+void WideBvh<Width>::refit(const Scene& scene, ThreadPool& pool)
+{
+	auto setBounds = [](WideBvhNode<Width>& node, int slot, const Aabb& bounds)
+	{
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			node.bounds[2 * axis][slot] = bounds.min[axis];
+			node.bounds[2 * axis + 1][slot] = bounds.max[axis];
+		}
+	};
+
+	// Every packet belongs to one leaf slot, so leaf slots reload their packets independently. Interior
+	// slots follow in reverse order, as children come after their parent.
+	TrianglePacket<Width>* packets = packetList.data();
+	WideBvhNode<Width>* nodes = nodeList.data();
+	uint32_t nodeCount = static_cast<uint32_t>(nodeList.size());
+	pool.parallelFor(nodeCount, [&](uint32_t n, uint32_t)
+	{
+		WideBvhNode<Width>& node = nodes[n];
+		for (int i = 0; i < Width; ++i)
+		{
+			if (node.packetCounts[i] == 0)
+			{
+				continue;
+			}
+			Aabb bounds;
+			for (uint32_t p = node.children[i]; p < node.children[i] + node.packetCounts[i]; ++p)
+			{
+				TrianglePacket<Width>& packet = packets[p];
+				for (int lane = 0; lane < Width; ++lane)
+				{
+					uint32_t primitive = packet.primitives[lane];
+					if (primitive == InvalidIndex)
+					{
+						continue;
+					}
+					Vec3 v0 = scene.vertex(primitive, 0);
+					Vec3 v1 = scene.vertex(primitive, 1);
+					Vec3 v2 = scene.vertex(primitive, 2);
+					bounds.extend(v0);
+					bounds.extend(v1);
+					bounds.extend(v2);
+					Vec3 e1 = v1 - v0;
+					Vec3 e2 = v2 - v0;
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						packet.v0[axis][lane] = v0[axis];
+						packet.edge1[axis][lane] = e1[axis];
+						packet.edge2[axis][lane] = e2[axis];
+					}
+				}
+			}
+			setBounds(node, i, bounds);
+		}
+	}, 16);
+	for (uint32_t n = nodeCount; n-- > 0;)
+	{
+		WideBvhNode<Width>& node = nodes[n];
+		for (int i = 0; i < Width; ++i)
+		{
+			if (node.packetCounts[i] != 0 || node.children[i] == InvalidIndex)
+			{
+				continue;
+			}
+			const WideBvhNode<Width>& child = nodes[node.children[i]];
+			Aabb bounds;
+			for (int j = 0; j < Width; ++j)
+			{
+				bounds.min = min(bounds.min, Vec3(child.bounds[0][j], child.bounds[2][j], child.bounds[4][j]));
+				bounds.max = max(bounds.max, Vec3(child.bounds[1][j], child.bounds[3][j], child.bounds[5][j]));
+			}
+			setBounds(node, i, bounds);
+		}
+	}
+}
+
+template <int Width>
+uint32_t WideBvh<Width>::collapse(const Bvh& bvh, uint32_t binaryNode)
+{
+	const Array<BvhNode>& binary = bvh.nodes();
+
+	uint32_t slots[Width];
+	int slotCount = openSlots<Width>(binary, binaryNode, slots);
+
+	uint32_t index = static_cast<uint32_t>(nodeList.size());
+	nodeList.emplace_back();
+	for (int i = 0; i < Width; ++i)
+	{
+		uint32_t child = InvalidIndex;
+		uint32_t packetCount = 0;
+		Aabb bounds;
+		if (i < slotCount)
+		{
+			const BvhNode& node = binary[slots[i]];
+			bounds = node.bounds();
+			if (node.leaf())
+			{
+				emitLeaf(bvh, node, child, packetCount);
+			}
+			else
+			{
+				child = collapse(bvh, slots[i]);
+			}
+		}
+
+		WideBvhNode<Width>& wide = nodeList[index];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			wide.bounds[2 * axis][i] = bounds.min[axis];
+			wide.bounds[2 * axis + 1][i] = bounds.max[axis];
+		}
+		wide.children[i] = child;
+		wide.packetCounts[i] = packetCount;
+	}
+	return index;
+}
+
+template <int Width>
+void WideBvh<Width>::emitLeaf(const Bvh& bvh, const BvhNode& leaf, uint32_t& first, uint32_t& count)
+{
+	first = static_cast<uint32_t>(packetList.size());
+	count = appendPackets<Width>(bvh, leaf, packetList);
+}
+
+template <int Width>
+const char* WideBvh<Width>::name() const
+{
+	return Width == 4 ? "BVH4" : "BVH8";
+}
+
+template <int Width>
+size_t WideBvh<Width>::memoryBytes() const
+{
+	return nodeList.size() * sizeof(WideBvhNode<Width>) + packetList.size() * sizeof(TrianglePacket<Width>);
+}
+
+template <>
+bool WideBvh<4>::intersect(Ray& ray, Hit& hit) const
+{
+	return intersectSse(nodeList.data(), packetList.data(), ray, hit);
+}
+
+template <>
+bool WideBvh<4>::occluded(const Ray& ray) const
+{
+	return occludedSse(nodeList.data(), packetList.data(), ray);
+}
+
+// Eight packet lanes split over SSE registers lose to single rays through the 4 wide nodes, so the
+// 4 wide layout traces packets ray by ray.
+template <>
+void WideBvh<4>::intersectRays(Ray* rays, Hit* hits, uint32_t count) const
+{
+	Accelerator::intersectRays(rays, hits, count);
+}
+
+template <>
+uint32_t WideBvh<4>::occludedRays(const Ray* rays, uint32_t count) const
+{
+	return Accelerator::occludedRays(rays, count);
+}
+
+template <>
+bool WideBvh<8>::intersect(Ray& ray, Hit& hit) const
+{
+	return intersectAvx2(nodeList.data(), packetList.data(), ray, hit);
+}
+
+template <>
+bool WideBvh<8>::occluded(const Ray& ray) const
+{
+	return occludedAvx2(nodeList.data(), packetList.data(), ray);
+}
+
+template <>
+void WideBvh<8>::intersectRays(Ray* rays, Hit* hits, uint32_t count) const
+{
+	intersectRaysAvx2(nodeList.data(), packetList.data(), rays, hits, count);
+}
+
+template <>
+uint32_t WideBvh<8>::occludedRays(const Ray* rays, uint32_t count) const
+{
+	return occludedRaysAvx2(nodeList.data(), packetList.data(), rays, count);
+}
+
+template class WideBvh<4>;
+template class WideBvh<8>;
+
+template <int Width>
+CompressedWideBvh<Width>::CompressedWideBvh(const Bvh& bvh)
+{
+	nodeList.reserve(bvh.nodes().size() / (Width - 1) + 1);
+	nodeList.emplace_back();
+	collapse(bvh, 0, 0);
+}
+
+template <int Width>
+void CompressedWideBvh<Width>::collapse(const Bvh& bvh, uint32_t binaryNode, uint32_t index)
+{
+	const Array<BvhNode>& binary = bvh.nodes();
+
+	// A single leaf still gets a root so that traversal always starts at an interior node, and a tree
+	// without primitives one with empty slots only.
+	uint32_t slots[Width];
+	int slotCount = bvh.empty() ? 0 : 1;
+	slots[0] = binaryNode;
+	if (slotCount > 0 && !binary[binaryNode].leaf())
+	{
+		slotCount = openSlots<Width>(binary, binaryNode, slots);
+	}
+
+	CompressedWideBvhNode<Width> node = {};
+	node.packetBase = static_cast<uint32_t>(packetList.size());
+	Aabb boxes[Width];
+	uint32_t interior[Width];
+	uint32_t interiorCount = 0;
+	for (int i = 0; i < slotCount; ++i)
+	{
+		const BvhNode& child = binary[slots[i]];
+		if (child.leaf())
+		{
+			if (child.count == 0)
+			{
+				continue;
+			}
+			uint32_t offset = static_cast<uint32_t>(packetList.size()) - node.packetBase;
+			uint32_t count = appendPackets<Width>(bvh, child, packetList);
+			if (offset > 31 || count > 8)
+			{
+				throw std::runtime_error("BVH leaves are too large for the compressed layout, build with maxLeafSize <= 32");
+			}
+			node.meta[i] = static_cast<uint8_t>(offset | (count - 1) << 5);
+		}
+		else
+		{
+			node.interiorMask |= static_cast<uint8_t>(1u << i);
+			node.meta[i] = static_cast<uint8_t>(interiorCount);
+			interior[interiorCount++] = slots[i];
+		}
+		boxes[i] = child.bounds();
+	}
+	quantizeBounds<Width>(node, boxes);
+
+	// Interior children are allocated as one block before any of them is filled.
+	node.childBase = static_cast<uint32_t>(nodeList.size());
+	nodeList[index] = node;
+	nodeList.resize(nodeList.size() + interiorCount);
+	for (uint32_t k = 0; k < interiorCount; ++k)
+	{
+		collapse(bvh, interior[k], node.childBase + k);
+	}
+}
+
+template <int Width>
+const char* CompressedWideBvh<Width>::name() const
+{
+	return Width == 4 ? "CBVH4" : "CBVH8";
+}
+
+template <int Width>
+size_t CompressedWideBvh<Width>::memoryBytes() const
+{
+	return nodeList.size() * sizeof(CompressedWideBvhNode<Width>) + packetList.size() * sizeof(TrianglePacket<Width>);
+}
+
+template <>
+bool CompressedWideBvh<4>::intersect(Ray& ray, Hit& hit) const
+{
+	return intersectSse(nodeList.data(), packetList.data(), ray, hit);
+}
+
+template <>
+bool CompressedWideBvh<4>::occluded(const Ray& ray) const
+{
+	return occludedSse(nodeList.data(), packetList.data(), ray);
+}
+
+template <>
+bool CompressedWideBvh<8>::intersect(Ray& ray, Hit& hit) const
+{
+	return intersectAvx2(nodeList.data(), packetList.data(), ray, hit);
+}
+
+template <>
+bool CompressedWideBvh<8>::occluded(const Ray& ray) const
+{
+	return occludedAvx2(nodeList.data(), packetList.data(), ray);
+}
+
+template class CompressedWideBvh<4>;
+template class CompressedWideBvh<8>;
+
+AcceleratorKind resolveAcceleratorKind(AcceleratorKind kind)
+{
+	if (kind == AcceleratorKind::Auto)
+	{
+		return cpuSupportsAvx2() ? AcceleratorKind::Wide8 : AcceleratorKind::Wide4;
+	}
+	if (kind == AcceleratorKind::Compressed)
+	{
+		return cpuSupportsAvx2() ? AcceleratorKind::Compressed8 : AcceleratorKind::Compressed4;
+	}
+	return kind;
+}
+
+std::unique_ptr<Accelerator> createAccelerator(const Bvh& bvh, AcceleratorKind kind)
+{
+	switch (resolveAcceleratorKind(kind))
+	{
+	case AcceleratorKind::Binary:
+		return std::make_unique<BinaryBvhAccelerator>(bvh);
+	case AcceleratorKind::Wide8:
+		return std::make_unique<WideBvh<8>>(bvh);
+	case AcceleratorKind::Compressed4:
+		return std::make_unique<CompressedWideBvh<4>>(bvh);
+	case AcceleratorKind::Compressed8:
+		return std::make_unique<CompressedWideBvh<8>>(bvh);
+	default:
+		return std::make_unique<WideBvh<4>>(bvh);
+	}
+}
+
+void updateAccelerator(std::unique_ptr<Accelerator>& accelerator, const Bvh& bvh, const BvhUpdateStats& update, ThreadPool& pool)
+{
+	// The binary layout views bvh, which is current already.
+	if (auto* wide = dynamic_cast<WideBvh<8>*>(accelerator.get()))
+	{
+		if (update.topologyChanged())
+		{
+			accelerator = std::make_unique<WideBvh<8>>(bvh);
+		}
+		else
+		{
+			wide->refit(bvh.scene(), pool);
+		}
+	}
+	else if (auto* wide = dynamic_cast<WideBvh<4>*>(accelerator.get()))
+	{
+		if (update.topologyChanged())
+		{
+			accelerator = std::make_unique<WideBvh<4>>(bvh);
+		}
+		else
+		{
+			wide->refit(bvh.scene(), pool);
+		}
+	}
+	else if (dynamic_cast<CompressedWideBvh<8>*>(accelerator.get()))
+	{
+		accelerator = std::make_unique<CompressedWideBvh<8>>(bvh);
+	}
+	else if (dynamic_cast<CompressedWideBvh<4>*>(accelerator.get()))
+	{
+		accelerator = std::make_unique<CompressedWideBvh<4>>(bvh);
+	}
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "Accelerator.h"
+#include "Array.h"
+#include "Bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+// Child bounds of a wide node in SoA form: rows are minX, maxX, minY, maxY, minZ, maxZ so that the
+// near and far planes of an axis can be picked with the sign of the ray direction. Empty slots
+// carry inverted bounds and never pass the slab test.
+template <int Width>
+struct alignas(64) WideBvhNode
+{
+	float bounds[6][Width];
+	// Interior children hold a node index, leaves the first triangle packet.
+	uint32_t children[Width];
+	// Number of triangle packets for leaves, 0 for interior children.
+	uint32_t packetCounts[Width];
+};
+
+// Width triangles in SoA layout for vectorized intersection, unused lanes are degenerate.
+template <int Width>
+struct alignas(64) TrianglePacket
+{
+	float v0[3][Width];
+	float edge1[3][Width];
+	float edge2[3][Width];
+	uint32_t primitives[Width];
+};
+
+// Wide node with child bounds quantized to 8 bits inside the node's own box: 80 bytes for 8 children
+// against 256 for WideBvhNode. Per axis a child plane decodes as origin + q * 2^exponent, with minima
+// rounded down and maxima up so that decoded boxes contain the exact ones. Interior children are
+// stored next to each other from childBase and the packets of the leaf children from packetBase,
+// which leaves one byte per child to find it.
+template <int Width>
+struct CompressedWideBvhNode
+{
+	float origin[3];
+	int8_t exponents[3];
+	// Bit i is set when child i is an interior node.
+	uint8_t interiorMask;
+	uint32_t childBase;
+	uint32_t packetBase;
+	// Interior children: node offset from childBase. Leaves: packet offset from packetBase in the low
+	// 5 bits and the packet count minus one in the high 3.
+	uint8_t meta[Width];
+	// Rows as in WideBvhNode. Empty slots have minima of 255 and maxima of 0.
+	uint8_t bounds[6][Width];
+};
+
+static_assert(sizeof(CompressedWideBvhNode<8>) == 80, "Compressed 8 wide nodes should be 80 bytes");
+
+// BVH with Width children per node, collapsed from a binary BVH. Traversal kernels are compiled
+// per instruction set: SSE for 4 lanes and AVX2 for 8 lanes, with a portable fallback elsewhere.
+template <int Width>
+class WideBvh : public Accelerator
+{
+public:
+	explicit WideBvh(const Bvh& bvh);
+	// Adopts previously collapsed data, e.g. views into a mapped scene cache.
+	WideBvh(Array<WideBvhNode<Width>> nodes, Array<TrianglePacket<Width>> packets);
+
+	bool intersect(Ray& ray, Hit& hit) const override;
+	bool occluded(const Ray& ray) const override;
+	// Packet traversal for the 8 wide layout: nodes are culled against the packet's frustum before the
+	// rays are tested one lane each, and subtrees that only a few rays reach are finished with single
+	// ray traversal. The 4 wide layout traces packets ray by ray.
+	void intersectRays(Ray* rays, Hit* hits, uint32_t count) const override;
+	uint32_t occludedRays(const Ray* rays, uint32_t count) const override;
+
+	const char* name() const override;
+	size_t memoryBytes() const override;
+
+	// Follows moved vertices while the binary BVH topology is unchanged, e.g. after a Bvh::update
+	// without rebuilds: reloads the triangle packets and refits the node bounds.
+	void refit(const Scene& scene, ThreadPool& pool);
+
+	const Array<WideBvhNode<Width>>& nodes() const { return nodeList; }
+	const Array<TrianglePacket<Width>>& packets() const { return packetList; }
+
+private:
+	uint32_t collapse(const Bvh& bvh, uint32_t binaryNode);
+	void emitLeaf(const Bvh& bvh, const BvhNode& leaf, uint32_t& first, uint32_t& count);
+
+	Array<WideBvhNode<Width>> nodeList;
+	Array<TrianglePacket<Width>> packetList;
+};
+
+// Wide BVH over CompressedWideBvhNode, traded for a little decoding work per node. Triangle packets
+// are the same as for WideBvh. Leaves are limited to 8 packets and a node's leaves to 32 packets
+// together, which binary BVHs built with maxLeafSize up to 32 always meet.
+template <int Width>
+class CompressedWideBvh : public Accelerator
+{
+public:
+	// Throws std::runtime_error when the leaves of bvh are too large to encode.
+	explicit CompressedWideBvh(const Bvh& bvh);
+
+	bool intersect(Ray& ray, Hit& hit) const override;
+	bool occluded(const Ray& ray) const override;
+
+	const char* name() const override;
+	size_t memoryBytes() const override;
+
+	const Array<CompressedWideBvhNode<Width>>& nodes() const { return nodeList; }
+	const Array<TrianglePacket<Width>>& packets() const { return packetList; }
+
+private:
+	void collapse(const Bvh& bvh, uint32_t binaryNode, uint32_t index);
+
+	Array<CompressedWideBvhNode<Width>> nodeList;
+	Array<TrianglePacket<Width>> packetList;
+};
+
+// Traversal kernels, compiled per instruction set in WideBvhSse.cpp and WideBvhAvx2.cpp. They take the
+// raw node and packet arrays so that those translation units need no inline member of Array.
+bool intersectSse(const WideBvhNode<4>* nodes, const TrianglePacket<4>* packets, Ray& ray, Hit& hit);
+bool occludedSse(const WideBvhNode<4>* nodes, const TrianglePacket<4>* packets, const Ray& ray);
+bool intersectSse(const CompressedWideBvhNode<4>* nodes, const TrianglePacket<4>* packets, Ray& ray, Hit& hit);
+bool occludedSse(const CompressedWideBvhNode<4>* nodes, const TrianglePacket<4>* packets, const Ray& ray);
+bool intersectAvx2(const WideBvhNode<8>* nodes, const TrianglePacket<8>* packets, Ray& ray, Hit& hit);
+bool occludedAvx2(const WideBvhNode<8>* nodes, const TrianglePacket<8>* packets, const Ray& ray);
+void intersectRaysAvx2(const WideBvhNode<8>* nodes, const TrianglePacket<8>* packets, Ray* rays, Hit* hits,
+	uint32_t count);
+uint32_t occludedRaysAvx2(const WideBvhNode<8>* nodes, const TrianglePacket<8>* packets, const Ray* rays,
+	uint32_t count);
+bool intersectAvx2(const CompressedWideBvhNode<8>* nodes, const TrianglePacket<8>* packets, Ray& ray, Hit& hit);
+bool occludedAvx2(const CompressedWideBvhNode<8>* nodes, const TrianglePacket<8>* packets, const Ray& ray);
+
+template <> bool WideBvh<4>::intersect(Ray& ray, Hit& hit) const;
+template <> bool WideBvh<4>::occluded(const Ray& ray) const;
+template <> void WideBvh<4>::intersectRays(Ray* rays, Hit* hits, uint32_t count) const;
+template <> uint32_t WideBvh<4>::occludedRays(const Ray* rays, uint32_t count) const;
+template <> bool WideBvh<8>::intersect(Ray& ray, Hit& hit) const;
+template <> bool WideBvh<8>::occluded(const Ray& ray) const;
+template <> void WideBvh<8>::intersectRays(Ray* rays, Hit* hits, uint32_t count) const;
+template <> uint32_t WideBvh<8>::occludedRays(const Ray* rays, uint32_t count) const;
+template <> bool CompressedWideBvh<4>::intersect(Ray& ray, Hit& hit) const;
+template <> bool CompressedWideBvh<4>::occluded(const Ray& ray) const;
+template <> bool CompressedWideBvh<8>::intersect(Ray& ray, Hit& hit) const;
+template <> bool CompressedWideBvh<8>::occluded(const Ray& ray) const;
+
+extern template class WideBvh<4>;
+extern template class WideBvh<8>;
+extern template class CompressedWideBvh<4>;
+extern template class CompressedWideBvh<8>;
@@ -0,0 +1,42 @@
+#include "WideBvhKernels.h"
+
+#include "Simd.h"
+
+// Built with AVX2 and FMA enabled on x86; createAccelerator only selects it when the CPU supports both.
+#if PTGPU_SIMD_AVX2
+using Float8 = avx2::Float;
+#else
+using Float8 = generic::Float<8>;
+#endif
+
+bool intersectAvx2(const WideBvhNode<8>* nodes, const TrianglePacket<8>* packets, Ray& ray, Hit& hit)
+{
+	return intersectWide<Float8, 8>(nodes, packets, ray, hit);
+}
+
+bool occludedAvx2(const WideBvhNode<8>* nodes, const TrianglePacket<8>* packets, const Ray& ray)
+{
+	return occludedWide<Float8, 8>(nodes, packets, ray);
+}
+
+void intersectRaysAvx2(const WideBvhNode<8>* nodes, const TrianglePacket<8>* packets, Ray* rays, Hit* hits,
+	uint32_t count)
+{
+	intersectWideRays<Float8, Float8, 8>(nodes, packets, rays, hits, count);
+}
+
+uint32_t occludedRaysAvx2(const WideBvhNode<8>* nodes, const TrianglePacket<8>* packets, const Ray* rays,
+	uint32_t count)
+{
+	return occludedWideRays<Float8, Float8, 8>(nodes, packets, rays, count);
+}
+
+bool intersectAvx2(const CompressedWideBvhNode<8>* nodes, const TrianglePacket<8>* packets, Ray& ray, Hit& hit)
+{
+	return intersectWide<Float8, 8>(nodes, packets, ray, hit);
+}
+
+bool occludedAvx2(const CompressedWideBvhNode<8>* nodes, const TrianglePacket<8>* packets, const Ray& ray)
+{
+	return occludedWide<Float8, 8>(nodes, packets, ray);
+}
@@ -0,0 +1,641 @@
+#pragma once
+
+// Traversal kernels shared by the per instruction set translation units. Only include this from
+// WideBvhSse.cpp and WideBvhAvx2.cpp. Everything here has internal linkage, and the kernels work on
+// raw arrays and plain fields instead of calling the inline members of Math.h and Array.h: those
+// would be emitted as weak definitions compiled for the wider instruction set when inlining is off,
+// and the linker could pick them for the whole program.
+
+#include "WideBvh.h"
+
+#include <cstring>
+
+namespace
+{
+	inline uint32_t lowestBit(uint32_t mask)
+	{
+#if defined(_MSC_VER) && !defined(__clang__)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+#else
+		return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+	}
+
+	inline uint32_t bitCount(uint32_t mask)
+	{
+#if defined(_MSC_VER) && !defined(__clang__)
+		return __popcnt(mask);
+#else
+		return static_cast<uint32_t>(__builtin_popcount(mask));
+#endif
+	}
+
+	template <typename F>
+	struct RayLanes
+	{
+		F origin[3];
+		F direction[3];
+		F inverseDirection[3];
+		uint32_t nearRow[3];
+		uint32_t farRow[3];
+		// Scalar copies for setting up the decoding of compressed nodes.
+		float scalarOrigin[3];
+		float scalarInverse[3];
+
+		explicit RayLanes(const Ray& ray)
+		{
+			const float rayOrigin[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+			const float rayDirection[3] = {ray.direction.x, ray.direction.y, ray.direction.z};
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				float d = rayDirection[axis];
+				float inverse = 1.0f / (d > 1e-20f || d < -1e-20f ? d : (d < 0.0f ? -1e-20f : 1e-20f));
+				origin[axis] = F::broadcast(rayOrigin[axis]);
+				direction[axis] = F::broadcast(d);
+				inverseDirection[axis] = F::broadcast(inverse);
+				scalarOrigin[axis] = rayOrigin[axis];
+				scalarInverse[axis] = inverse;
+				nearRow[axis] = 2 * axis + (inverse < 0.0f ? 1 : 0);
+				farRow[axis] = 2 * axis + (inverse < 0.0f ? 0 : 1);
+			}
+		}
+	};
+
+	// Returns a bit mask of children whose boxes overlap [tMin, tMax] and stores their entry distances.
+	template <typename F, int Width>
+	uint32_t intersectChildren(const WideBvhNode<Width>& node, const RayLanes<F>& lanes, float tMin, float tMax, float* distances)
+	{
+		F tNear = F::broadcast(tMin);
+		F tFar = F::broadcast(tMax);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			F nearPlane = F::load(node.bounds[lanes.nearRow[axis]]);
+			F farPlane = F::load(node.bounds[lanes.farRow[axis]]);
+			tNear = max(tNear, (nearPlane - lanes.origin[axis]) * lanes.inverseDirection[axis]);
+			tFar = min(tFar, (farPlane - lanes.origin[axis]) * lanes.inverseDirection[axis]);
+		}
+		tNear.store(distances);
+		return (tNear <= tFar).bits();
+	}
+
+	inline float exponentScale(int8_t exponent)
+	{
+		uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+		float scale;
+		std::memcpy(&scale, &bits, sizeof(scale));
+		return scale;
+	}
+
+	// As above for quantized bounds. A plane at origin + q * scale is entered at
+	// q * (scale / d) + (origin - o) / d, so decoding folds into the slab test at one multiply-add.
+	template <typename F, int Width>
+	uint32_t intersectChildren(const CompressedWideBvhNode<Width>& node, const RayLanes<F>& lanes, float tMin, float tMax, float* distances)
+	{
+		F tNear = F::broadcast(tMin);
+		F tFar = F::broadcast(tMax);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float inverse = lanes.scalarInverse[axis];
+			F step = F::broadcast(exponentScale(node.exponents[axis]) * inverse);
+			F offset = F::broadcast((node.origin[axis] - lanes.scalarOrigin[axis]) * inverse);
+			tNear = max(tNear, F::loadBytes(node.bounds[lanes.nearRow[axis]]) * step + offset);
+			tFar = min(tFar, F::loadBytes(node.bounds[lanes.farRow[axis]]) * step + offset);
+		}
+		tNear.store(distances);
+		return (tNear <= tFar).bits();
+	}
+
+	template <int Width>
+	void childEntry(const WideBvhNode<Width>& node, uint32_t i, uint32_t& child, uint32_t& packetCount)
+	{
+		child = node.children[i];
+		packetCount = node.packetCounts[i];
+	}
+
+	template <int Width>
+	void childEntry(const CompressedWideBvhNode<Width>& node, uint32_t i, uint32_t& child, uint32_t& packetCount)
+	{
+		uint32_t meta = node.meta[i];
+		if (node.interiorMask >> i & 1)
+		{
+			child = node.childBase + meta;
+			packetCount = 0;
+		}
+		else
+		{
+			child = node.packetBase + (meta & 31);
+			packetCount = (meta >> 5) + 1;
+		}
+	}
+
+	// Vectorized Moeller-Trumbore over all lanes of a packet. Returns the lanes that hit inside
+	// (tMin, tMax) and stores their distances and barycentrics.
+	template <typename F, int Width>
+	uint32_t intersectPacket(const TrianglePacket<Width>& packet, const RayLanes<F>& lanes, float tMin, float tMax, float* t, float* u, float* v)
+	{
+		const F* d = lanes.direction;
+		F e1[3] = {F::load(packet.edge1[0]), F::load(packet.edge1[1]), F::load(packet.edge1[2])};
+		F e2[3] = {F::load(packet.edge2[0]), F::load(packet.edge2[1]), F::load(packet.edge2[2])};
+
+		F p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+		F det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		F invDet = F::broadcast(1.0f) / det;
+
+		F s[3] = {
+			lanes.origin[0] - F::load(packet.v0[0]),
+			lanes.origin[1] - F::load(packet.v0[1]),
+			lanes.origin[2] - F::load(packet.v0[2]),
+		};
+		F uu = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+
+		F q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+		F vv = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * invDet;
+		F tt = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+
+		F zero = F::broadcast(0.0f);
+		auto mask = (abs(det) > F::broadcast(1e-12f)) & (uu >= zero) & (vv >= zero) & (uu + vv <= F::broadcast(1.0f))
+			& (tt > F::broadcast(tMin)) & (tt < F::broadcast(tMax));
+		uint32_t bits = mask.bits();
+		if (bits)
+		{
+			tt.store(t);
+			uu.store(u);
+			vv.store(v);
+		}
+		return bits;
+	}
+
+	template <int Width>
+	struct TraversalEntry
+	{
+		uint32_t child;
+		uint32_t packetCount;
+		float t;
+	};
+
+	template <int Width>
+	constexpr int traversalStackSize() { return BvhMaxDepth * (Width - 1) + 1; }
+
+	// Traverses from the root, or from the subtree given by rootChild and rootPacketCount.
+	template <typename F, int Width, typename Node>
+	bool intersectWide(const Node* nodes, const TrianglePacket<Width>* packets, Ray& ray, Hit& hit, uint32_t rootChild = 0,
+		uint32_t rootPacketCount = 0)
+	{
+		RayLanes<F> lanes(ray);
+		TraversalEntry<Width> stack[traversalStackSize<Width>()];
+		int stackSize = 0;
+		stack[stackSize++] = {rootChild, rootPacketCount, ray.tMin};
+		alignas(64) float distances[Width];
+		alignas(64) float t[Width];
+		alignas(64) float u[Width];
+		alignas(64) float v[Width];
+		bool found = false;
+
+		while (stackSize > 0)
+		{
+			TraversalEntry<Width> entry = stack[--stackSize];
+			if (entry.t > ray.tMax)
+			{
+				continue;
+			}
+
+			if (entry.packetCount > 0)
+			{
+				for (uint32_t p = entry.child; p < entry.child + entry.packetCount; ++p)
+				{
+					uint32_t bits = intersectPacket<F, Width>(packets[p], lanes, ray.tMin, ray.tMax, t, u, v);
+					while (bits)
+					{
+						uint32_t lane = lowestBit(bits);
+						bits &= bits - 1;
+						if (t[lane] < ray.tMax)
+						{
+							ray.tMax = t[lane];
+							hit.t = t[lane];
+							hit.u = u[lane];
+							hit.v = v[lane];
+							hit.primitive = packets[p].primitives[lane];
+							found = true;
+						}
+					}
+				}
+				continue;
+			}
+
+			const Node& node = nodes[entry.child];
+			uint32_t bits = intersectChildren<F, Width>(node, lanes, ray.tMin, ray.tMax, distances);
+
+			// Keep the pushed children sorted so that the nearest one is popped first.
+			int first = stackSize;
+			while (bits)
+			{
+				uint32_t i = lowestBit(bits);
+				bits &= bits - 1;
+				TraversalEntry<Width> child = {0, 0, distances[i]};
+				childEntry(node, i, child.child, child.packetCount);
+				int j = stackSize++;
+				while (j > first && stack[j - 1].t < child.t)
+				{
+					stack[j] = stack[j - 1];
+					--j;
+				}
+				stack[j] = child;
+			}
+		}
+		return found;
+	}
+
+	template <typename F, int Width, typename Node>
+	bool occludedWide(const Node* nodes, const TrianglePacket<Width>* packets, const Ray& ray, uint32_t rootChild = 0,
+		uint32_t rootPacketCount = 0)
+	{
+		RayLanes<F> lanes(ray);
+		uint32_t stack[traversalStackSize<Width>()];
+		uint32_t packetCounts[traversalStackSize<Width>()];
+		stack[0] = rootChild;
+		packetCounts[0] = rootPacketCount;
+		int stackSize = 1;
+		alignas(64) float distances[Width];
+		alignas(64) float t[Width];
+		alignas(64) float u[Width];
+		alignas(64) float v[Width];
+
+		while (stackSize > 0)
+		{
+			--stackSize;
+			uint32_t child = stack[stackSize];
+			uint32_t packetCount = packetCounts[stackSize];
+
+			if (packetCount > 0)
+			{
+				for (uint32_t p = child; p < child + packetCount; ++p)
+				{
+					if (intersectPacket<F, Width>(packets[p], lanes, ray.tMin, ray.tMax, t, u, v))
+					{
+						return true;
+					}
+				}
+				continue;
+			}
+
+			const Node& node = nodes[child];
+			uint32_t bits = intersectChildren<F, Width>(node, lanes, ray.tMin, ray.tMax, distances);
+			while (bits)
+			{
+				uint32_t i = lowestBit(bits);
+				bits &= bits - 1;
+				childEntry(node, i, stack[stackSize], packetCounts[stackSize]);
+				++stackSize;
+			}
+		}
+		return false;
+	}
+
+	// Packets with fewer active rays than this continue with single ray traversal.
+	constexpr uint32_t MinPacketRays = 3;
+
+	// The rays of a packet, one per lane of R, plus their bounds for frustum culling. Inactive lanes
+	// repeat the first ray.
+	template <typename R>
+	struct PacketLanes
+	{
+		static_assert(R::Width == RayPacketSize, "One lane per packet ray");
+
+		R origin[3];
+		R direction[3];
+		R inverseDirection[3];
+		R tMin;
+		alignas(64) float tMax[RayPacketSize];
+		uint32_t activeMask;
+		// Frustum of the active rays, only used when they all agree on the direction signs.
+		bool coherent;
+		float originMin[3];
+		float originMax[3];
+		float inverseMin[3];
+		float inverseMax[3];
+		uint32_t nearRow[3];
+		uint32_t farRow[3];
+		float tMinLow;
+		float tMaxHigh;
+
+		PacketLanes(const Ray* rays, uint32_t count)
+		{
+			alignas(64) float values[10][RayPacketSize];
+			for (uint32_t lane = 0; lane < RayPacketSize; ++lane)
+			{
+				const Ray& ray = rays[lane < count ? lane : 0];
+				const float rayOrigin[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+				const float rayDirection[3] = {ray.direction.x, ray.direction.y, ray.direction.z};
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					float d = rayDirection[axis];
+					values[axis][lane] = rayOrigin[axis];
+					values[3 + axis][lane] = d;
+					values[6 + axis][lane] = 1.0f / (d > 1e-20f || d < -1e-20f ? d : (d < 0.0f ? -1e-20f : 1e-20f));
+				}
+				values[9][lane] = ray.tMin;
+				tMax[lane] = ray.tMax;
+			}
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				origin[axis] = R::load(values[axis]);
+				direction[axis] = R::load(values[3 + axis]);
+				inverseDirection[axis] = R::load(values[6 + axis]);
+			}
+			tMin = R::load(values[9]);
+			activeMask = count >= 32 ? ~0u : (1u << count) - 1;
+
+			coherent = count > 0;
+			tMinLow = Infinity;
+			tMaxHigh = -Infinity;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				originMin[axis] = inverseMin[axis] = Infinity;
+				originMax[axis] = inverseMax[axis] = -Infinity;
+				bool negative = values[6 + axis][0] < 0.0f;
+				for (uint32_t lane = 0; lane < count; ++lane)
+				{
+					originMin[axis] = originMin[axis] < values[axis][lane] ? originMin[axis] : values[axis][lane];
+					originMax[axis] = originMax[axis] > values[axis][lane] ? originMax[axis] : values[axis][lane];
+					inverseMin[axis] = inverseMin[axis] < values[6 + axis][lane] ? inverseMin[axis] : values[6 + axis][lane];
+					inverseMax[axis] = inverseMax[axis] > values[6 + axis][lane] ? inverseMax[axis] : values[6 + axis][lane];
+					coherent = coherent && (values[6 + axis][lane] < 0.0f) == negative;
+				}
+				nearRow[axis] = 2 * axis + (negative ? 1 : 0);
+				farRow[axis] = 2 * axis + (negative ? 0 : 1);
+			}
+			for (uint32_t lane = 0; lane < count; ++lane)
+			{
+				tMinLow = tMinLow < values[9][lane] ? tMinLow : values[9][lane];
+				tMaxHigh = tMaxHigh > tMax[lane] ? tMaxHigh : tMax[lane];
+			}
+		}
+	};
+
+	// Interval arithmetic over the packet frustum, vectorized over the children: a child is culled
+	// when even the earliest possible entry is behind the latest possible exit of any ray.
+	template <typename F, typename R, int Width>
+	uint32_t frustumChildren(const WideBvhNode<Width>& node, const PacketLanes<R>& lanes)
+	{
+		F low = F::broadcast(lanes.tMinLow);
+		F high = F::broadcast(lanes.tMaxHigh);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			F originLow = F::broadcast(lanes.originMin[axis]);
+			F originHigh = F::broadcast(lanes.originMax[axis]);
+			F inverseLow = F::broadcast(lanes.inverseMin[axis]);
+			F inverseHigh = F::broadcast(lanes.inverseMax[axis]);
+			F nearPlane = F::load(node.bounds[lanes.nearRow[axis]]);
+			F farPlane = F::load(node.bounds[lanes.farRow[axis]]);
+			F n0 = nearPlane - originHigh;
+			F n1 = nearPlane - originLow;
+			F f0 = farPlane - originHigh;
+			F f1 = farPlane - originLow;
+			low = max(low, min(min(n0 * inverseLow, n0 * inverseHigh), min(n1 * inverseLow, n1 * inverseHigh)));
+			high = min(high, max(max(f0 * inverseLow, f0 * inverseHigh), max(f1 * inverseLow, f1 * inverseHigh)));
+		}
+		return (low <= high).bits();
+	}
+
+	// Slab test of all packet rays against one child box. Returns the lanes that overlap it and stores
+	// their entry distances.
+	template <typename R, int Width>
+	uint32_t intersectChildRays(const WideBvhNode<Width>& node, int child, const PacketLanes<R>& lanes, float* distances)
+	{
+		R tNear = lanes.tMin;
+		R tFar = R::load(lanes.tMax);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			R t0 = (R::broadcast(node.bounds[2 * axis][child]) - lanes.origin[axis]) * lanes.inverseDirection[axis];
+			R t1 = (R::broadcast(node.bounds[2 * axis + 1][child]) - lanes.origin[axis]) * lanes.inverseDirection[axis];
+			tNear = max(tNear, min(t0, t1));
+			tFar = min(tFar, max(t0, t1));
+		}
+		tNear.store(distances);
+		return (tNear <= tFar).bits();
+	}
+
+	// Moeller-Trumbore of one packet triangle against all packet rays, in the same operation order as
+	// intersectPacket so that both report identical distances.
+	template <typename R, int Width>
+	uint32_t intersectTriangleRays(const TrianglePacket<Width>& packet, int triangle, const PacketLanes<R>& lanes, float* t, float* u, float* v)
+	{
+		const R* d = lanes.direction;
+		R e1[3] = {R::broadcast(packet.edge1[0][triangle]), R::broadcast(packet.edge1[1][triangle]), R::broadcast(packet.edge1[2][triangle])};
+		R e2[3] = {R::broadcast(packet.edge2[0][triangle]), R::broadcast(packet.edge2[1][triangle]), R::broadcast(packet.edge2[2][triangle])};
+
+		R p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+		R det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		R invDet = R::broadcast(1.0f) / det;
+
+		R s[3] = {
+			lanes.origin[0] - R::broadcast(packet.v0[0][triangle]),
+			lanes.origin[1] - R::broadcast(packet.v0[1][triangle]),
+			lanes.origin[2] - R::broadcast(packet.v0[2][triangle]),
+		};
+		R uu = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+
+		R q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+		R vv = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * invDet;
+		R tt = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+
+		R zero = R::broadcast(0.0f);
+		auto mask = (abs(det) > R::broadcast(1e-12f)) & (uu >= zero) & (vv >= zero) & (uu + vv <= R::broadcast(1.0f)) & (tt > lanes.tMin)
+			& (tt < R::load(lanes.tMax));
+		uint32_t bits = mask.bits();
+		if (bits)
+		{
+			tt.store(t);
+			uu.store(u);
+			vv.store(v);
+		}
+		return bits;
+	}
+
+	template <int Width>
+	struct PacketEntry
+	{
+		uint32_t child;
+		uint32_t packetCount;
+		uint32_t mask;
+		float t;
+	};
+
+	// Children of a node that rays in mask may reach, before the per ray tests.
+	template <typename F, typename R, int Width>
+	uint32_t candidateChildren(const WideBvhNode<Width>& node, const PacketLanes<R>& lanes)
+	{
+		if (lanes.coherent)
+		{
+			return frustumChildren<F, R, Width>(node, lanes);
+		}
+		uint32_t candidates = 0;
+		for (int i = 0; i < Width; ++i)
+		{
+			candidates |= node.children[i] != InvalidIndex ? 1u << i : 0u;
+		}
+		return candidates;
+	}
+
+	template <typename F, typename R, int Width>
+	void intersectWideRays(const WideBvhNode<Width>* nodes, const TrianglePacket<Width>* packets, Ray* rays, Hit* hits, uint32_t count)
+	{
+		PacketLanes<R> lanes(rays, count);
+		PacketEntry<Width> stack[traversalStackSize<Width>()];
+		int stackSize = 0;
+		stack[stackSize++] = {0, 0, lanes.activeMask, lanes.tMinLow};
+		alignas(64) float distances[RayPacketSize];
+		alignas(64) float t[RayPacketSize];
+		alignas(64) float u[RayPacketSize];
+		alignas(64) float v[RayPacketSize];
+
+		while (stackSize > 0)
+		{
+			PacketEntry<Width> entry = stack[--stackSize];
+			float farthest = -Infinity;
+			for (uint32_t bits = entry.mask; bits; bits &= bits - 1)
+			{
+				uint32_t lane = lowestBit(bits);
+				farthest = farthest > lanes.tMax[lane] ? farthest : lanes.tMax[lane];
+			}
+			if (entry.t > farthest)
+			{
+				continue;
+			}
+
+			if (bitCount(entry.mask) < MinPacketRays)
+			{
+				for (uint32_t bits = entry.mask; bits; bits &= bits - 1)
+				{
+					uint32_t lane = lowestBit(bits);
+					Ray ray = rays[lane];
+					ray.tMax = lanes.tMax[lane];
+					if (intersectWide<F, Width>(nodes, packets, ray, hits[lane], entry.child, entry.packetCount))
+					{
+						lanes.tMax[lane] = ray.tMax;
+					}
+				}
+				continue;
+			}
+
+			if (entry.packetCount > 0)
+			{
+				for (uint32_t p = entry.child; p < entry.child + entry.packetCount; ++p)
+				{
+					const TrianglePacket<Width>& packet = packets[p];
+					for (int triangle = 0; triangle < Width && packet.primitives[triangle] != InvalidIndex; ++triangle)
+					{
+						uint32_t bits = intersectTriangleRays<R, Width>(packet, triangle, lanes, t, u, v) & entry.mask;
+						for (; bits; bits &= bits - 1)
+						{
+							uint32_t lane = lowestBit(bits);
+							lanes.tMax[lane] = t[lane];
+							hits[lane].t = t[lane];
+							hits[lane].u = u[lane];
+							hits[lane].v = v[lane];
+							hits[lane].primitive = packet.primitives[triangle];
+						}
+					}
+				}
+				continue;
+			}
+
+			const WideBvhNode<Width>& node = nodes[entry.child];
+			int first = stackSize;
+			for (uint32_t candidates = candidateChildren<F, R, Width>(node, lanes); candidates; candidates &= candidates - 1)
+			{
+				uint32_t i = lowestBit(candidates);
+				uint32_t mask = intersectChildRays<R, Width>(node, i, lanes, distances) & entry.mask;
+				if (!mask)
+				{
+					continue;
+				}
+				PacketEntry<Width> child = {node.children[i], node.packetCounts[i], mask, Infinity};
+				for (uint32_t bits = mask; bits; bits &= bits - 1)
+				{
+					uint32_t lane = lowestBit(bits);
+					child.t = child.t < distances[lane] ? child.t : distances[lane];
+				}
+				// Keep the pushed children sorted so that the nearest one is popped first.
+				int j = stackSize++;
+				while (j > first && stack[j - 1].t < child.t)
+				{
+					stack[j] = stack[j - 1];
+					--j;
+				}
+				stack[j] = child;
+			}
+		}
+
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			rays[i].tMax = lanes.tMax[i];
+		}
+	}
+
+	template <typename F, typename R, int Width>
+	uint32_t occludedWideRays(const WideBvhNode<Width>* nodes, const TrianglePacket<Width>* packets, const Ray* rays, uint32_t count)
+	{
+		PacketLanes<R> lanes(rays, count);
+		PacketEntry<Width> stack[traversalStackSize<Width>()];
+		int stackSize = 0;
+		stack[stackSize++] = {0, 0, lanes.activeMask, 0.0f};
+		alignas(64) float distances[RayPacketSize];
+		alignas(64) float t[RayPacketSize];
+		alignas(64) float u[RayPacketSize];
+		alignas(64) float v[RayPacketSize];
+		uint32_t occluded = 0;
+
+		while (stackSize > 0 && occluded != lanes.activeMask)
+		{
+			PacketEntry<Width> entry = stack[--stackSize];
+			entry.mask &= ~occluded;
+			if (!entry.mask)
+			{
+				continue;
+			}
+
+			if (bitCount(entry.mask) < MinPacketRays)
+			{
+				for (uint32_t bits = entry.mask; bits; bits &= bits - 1)
+				{
+					uint32_t lane = lowestBit(bits);
+					if (occludedWide<F, Width>(nodes, packets, rays[lane], entry.child, entry.packetCount))
+					{
+						occluded |= 1u << lane;
+					}
+				}
+				continue;
+			}
+
+			if (entry.packetCount > 0)
+			{
+				for (uint32_t p = entry.child; p < entry.child + entry.packetCount && entry.mask; ++p)
+				{
+					const TrianglePacket<Width>& packet = packets[p];
+					for (int triangle = 0; triangle < Width && packet.primitives[triangle] != InvalidIndex && entry.mask; ++triangle)
+					{
+						uint32_t bits = intersectTriangleRays<R, Width>(packet, triangle, lanes, t, u, v) & entry.mask;
+						occluded |= bits;
+						entry.mask &= ~bits;
+					}
+				}
+				continue;
+			}
+
+			const WideBvhNode<Width>& node = nodes[entry.child];
+			for (uint32_t candidates = candidateChildren<F, R, Width>(node, lanes); candidates; candidates &= candidates - 1)
+			{
+				uint32_t i = lowestBit(candidates);
+				uint32_t mask = intersectChildRays<R, Width>(node, i, lanes, distances) & entry.mask;
+				if (mask)
+				{
+					stack[stackSize++] = {node.children[i], node.packetCounts[i], mask, 0.0f};
+				}
+			}
+		}
+		return occluded;
+	}
+}
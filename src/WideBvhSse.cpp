@@ -0,0 +1,29 @@
+#include "WideBvhKernels.h"
+
+#include "Simd.h"
+
+#if PTGPU_SIMD_SSE
+using Float4 = sse::Float;
+#else
+using Float4 = generic::Float<4>;
+#endif
+
+bool intersectSse(const WideBvhNode<4>* nodes, const TrianglePacket<4>* packets, Ray& ray, Hit& hit)
+{
+	return intersectWide<Float4, 4>(nodes, packets, ray, hit);
+}
+
+bool occludedSse(const WideBvhNode<4>* nodes, const TrianglePacket<4>* packets, const Ray& ray)
+{
+	return occludedWide<Float4, 4>(nodes, packets, ray);
+}
+
+bool intersectSse(const CompressedWideBvhNode<4>* nodes, const TrianglePacket<4>* packets, Ray& ray, Hit& hit)
+{
+	return intersectWide<Float4, 4>(nodes, packets, ray, hit);
+}
+
+bool occludedSse(const CompressedWideBvhNode<4>* nodes, const TrianglePacket<4>* packets, const Ray& ray)
+{
+	return occludedWide<Float4, 4>(nodes, packets, ray);
+}